@@ -19,6 +19,11 @@
 // See https://github.com/openssl/openssl/blob/master/LICENSE for conditions.
 //-----------------------------------------------------------------------------
 
+#include "dtlscontext.h"
+#include "dtlsloadtest.h"
+#include "dtlsserver.h"
+#include "udpsocket.h"
+
 #include <openssl/bio.h>
 #include <openssl/dtls1.h>
 #include <openssl/err.h>
@@ -26,19 +31,22 @@
 #include <winsock2.h>
 #include <ws2tcpip.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <thread>
+#include <vector>
 
 #pragma comment(lib, "Ws2_32.lib")
 
 #define SERVER_PORT 9000
 #define CLIENT_PORT 9001
-#define CERTIFICATE_PATH "localhost.pem"
-#define CERTIFICATE_KEY_PATH "localhost_key.pem"
 #define ERROR_BUFFER_SIZE 2048
 #define HANDSHAKE_TIMEOUT_SECONDS 15
-#define DTLS_COOKIE "dummy"
-#define SRTP_ALGORITHM "SRTP_AES128_CM_SHA1_80"
 
 #define SSL_WHERE_INFO(ssl, w, flag, msg) {                \
     if(w & flag) {                                         \
@@ -49,15 +57,12 @@
 	    }                                                    \
     } 
 
-enum class AddressFamily
-{
-  IPv4,
-  IPv6
-};
+using sipsorcery::AddressFamily;
 
 // Forward function definitions.
 void RunServer(AddressFamily addrFamily);
 void RunClient(AddressFamily addrFamily);
+void RunMultiClientServer(AddressFamily addrFamily, int port);
 
 void info_callback(const SSL* ssl, int where, int ret)
 {
@@ -71,21 +76,21 @@ void info_callback(const SSL* ssl, int where, int ret)
   SSL_WHERE_INFO(ssl, where, SSL_CB_HANDSHAKE_DONE, "HANDSHAKE DONE");
 }
 
-int verify_cookie(SSL* ssl, const unsigned char* cookie, unsigned int cookie_len)
-{
-  // Accept any cookie.
-  return 1;
-}
-
-int generate_cookie(SSL* ssl, unsigned char* cookie, unsigned int* cookie_len)
-{
-  int cookieLength = sizeof(DTLS_COOKIE);
-  *cookie_len = cookieLength;
-  memcpy(cookie, (unsigned char*)DTLS_COOKIE, cookieLength);
-  return 1;
-}
-
-int main()
+/**
+* Usage:
+*  DtlsHandshakeTest                                    one handshake between a client and server thread.
+*  DtlsHandshakeTest server [port] [ipv6]               multi client server on one UDP socket, echoes
+*                                                       application data, until a key is pressed.
+*  DtlsHandshakeTest load [peers] [in flight] [ipv6]    loopback load test, peers held connected at once
+*                                                       against the multi client server.
+*  DtlsHandshakeTest flood [peers] [datagrams/s]        handshakes against the multi client server during
+*                                                       a spoofed ClientHello flood.
+*  DtlsHandshakeTest bench [handshakes] [at once]       handshake rate, latency and CPU for each certificate
+*                                                       key type, cipher list and SRTP profile.
+*  DtlsHandshakeTest resume [handshakes] [at once]      handshake rate, latency and CPU for full handshakes
+*                                                       and ones resumed by session ticket and session ID.
+*/
+int main(int argc, char* argv[])
 {
   std::cout << "DTLS Test Console:" << std::endl;
 
@@ -104,6 +109,40 @@ int main()
   ERR_load_BIO_strings();
   OpenSSL_add_all_algorithms();
 
+  std::string mode = (argc > 1) ? argv[1] : "";
+
+  if (mode == "server") {
+    int port = (argc > 2) ? std::atoi(argv[2]) : SERVER_PORT;
+    bool ipv6 = (argc > 3) && std::string(argv[3]) == "ipv6";
+    RunMultiClientServer(ipv6 ? AddressFamily::IPv6 : AddressFamily::IPv4, port);
+    return 0;
+  }
+  else if (mode == "load") {
+    int peerCount = (argc > 2) ? std::atoi(argv[2]) : DTLS_LOAD_TEST_DEFAULT_PEERS;
+    int inFlight = (argc > 3) ? std::atoi(argv[3]) : DTLS_LOAD_TEST_DEFAULT_IN_FLIGHT;
+    bool ipv6 = (argc > 4) && std::string(argv[4]) == "ipv6";
+    sipsorcery::RunDtlsLoadTest(peerCount, inFlight, ipv6 ? AddressFamily::IPv6 : AddressFamily::IPv4);
+    return 0;
+  }
+  else if (mode == "flood") {
+    int peerCount = (argc > 2) ? std::atoi(argv[2]) : DTLS_FLOOD_TEST_DEFAULT_PEERS;
+    int rate = (argc > 3) ? std::atoi(argv[3]) : DTLS_FLOOD_TEST_DEFAULT_RATE;
+    sipsorcery::RunDtlsFloodTest(peerCount, rate);
+    return 0;
+  }
+  else if (mode == "bench") {
+    int handshakes = (argc > 2) ? std::atoi(argv[2]) : DTLS_BENCHMARK_DEFAULT_HANDSHAKES;
+    int concurrency = (argc > 3) ? std::atoi(argv[3]) : DTLS_BENCHMARK_DEFAULT_CONCURRENCY;
+    sipsorcery::RunDtlsHandshakeBenchmark(handshakes, concurrency);
+    return 0;
+  }
+  else if (mode == "resume") {
+    int handshakes = (argc > 2) ? std::atoi(argv[2]) : DTLS_BENCHMARK_DEFAULT_HANDSHAKES;
+    int concurrency = (argc > 3) ? std::atoi(argv[3]) : DTLS_BENCHMARK_DEFAULT_CONCURRENCY;
+    sipsorcery::RunDtlsResumptionBenchmark(handshakes, concurrency);
+    return 0;
+  }
+
   //AddressFamily addrFamily = AddressFamily::IPv6;
   AddressFamily addrFamily = AddressFamily::IPv4;
 
@@ -122,24 +161,50 @@ int main()
   svrThd.join();
 }
 
+/**
+ * Waits for the socket to become readable or OpenSSL's retransmission timer,
+ * from DTLSv1_get_timeout, to expire, and retransmits if it has. Replaces
+ * blocking reads with a receive timeout, so a handshake waiting on its peer
+ * doesn't use any CPU.
+ * @@Returns false if the handshake deadline has passed or OpenSSL has given
+ *  up retransmitting.
+ */
+static bool WaitForDtls(SSL* ssl, sipsorcery::SocketPoller& poller, std::chrono::steady_clock::time_point deadline)
+{
+  auto now = std::chrono::steady_clock::now();
+  if (now >= deadline) {
+    return false;
+  }
+
+  int waitMs = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+  struct timeval timeout;
+  if (DTLSv1_get_timeout(ssl, &timeout) == 1) {
+    waitMs = std::min(waitMs, (int)(timeout.tv_sec * 1000 + timeout.tv_usec / 1000));
+  }
+
+  std::vector<size_t> readyIds;
+  if (poller.Wait(waitMs, readyIds) == 0 && DTLSv1_handle_timeout(ssl) < 0) {
+    return false;
+  }
+
+  return true;
+}
+
 /**
  * Attempts to bind a UDP server socket and hand it off to OpenSSL to
  * complete the server end of a DTLS handshake.
  */
 void RunServer(AddressFamily addrFamily)
 {
-  SOCKET svrSock = 0;
-  sockaddr* svrAddr = nullptr;
-  int svrAddrSize = 0;
-  sockaddr_in svrAddr4 = { 0 };
-  sockaddr_in6 svrAddr6 = { 0 };
+  std::unique_ptr<sipsorcery::UdpSocket> svrSock;
+  std::unique_ptr<sipsorcery::SocketPoller> poller;
   SSL_CTX* ctx = nullptr;
   SSL* ssl = nullptr;
   BIO* bio = nullptr;
   int res = 0;
   char buf[ERROR_BUFFER_SIZE];
   BIO_ADDR* clientAddr = BIO_ADDR_new();
-  struct timeval timeout;
+  std::chrono::steady_clock::time_point deadline;
   OSSL_HANDSHAKE_STATE handshakeState = OSSL_HANDSHAKE_STATE::TLS_ST_BEFORE;
 
   std::cout << "RunServer..." << std::endl;
@@ -147,83 +212,19 @@ void RunServer(AddressFamily addrFamily)
   // Dump any openssl errors.
   ERR_print_errors_fp(stderr);
 
-  // Bind to a UDP socket that will listen for client handshakes.
-  svrSock = socket((addrFamily == AddressFamily::IPv6) ? AF_INET6 : AF_INET, 
-    SOCK_DGRAM, IPPROTO_UDP);
-  if (svrSock == INVALID_SOCKET || svrSock < 0) {
-    std::cerr << "Server socket initialisation failed." << std::endl;
-    goto cleanup;
-  }
-
-  if (addrFamily == AddressFamily::IPv6) {
-    svrAddr6.sin6_family = AF_INET6;
-    svrAddr6.sin6_addr = in6addr_loopback;
-    svrAddr6.sin6_port = htons(SERVER_PORT);
-
-    svrAddr = (sockaddr*)&svrAddr6;
-    svrAddrSize = sizeof(svrAddr6);
+  // Bind to a non-blocking UDP socket that will listen for client handshakes.
+  // Create a new DTLS context with the certificate, key and cookie callbacks.
+  try {
+    svrSock.reset(new sipsorcery::UdpSocket(sipsorcery::PeerAddress::Loopback(addrFamily, SERVER_PORT)));
+    poller.reset(new sipsorcery::SocketPoller());
+    poller->Add(*svrSock, 0);
+    ctx = sipsorcery::CreateDtlsServerContext();
   }
-  else {
-    svrAddr4.sin_family = AF_INET;
-    svrAddr4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    svrAddr4.sin_port = htons(SERVER_PORT);
-
-    svrAddr = (sockaddr*)&svrAddr4;
-    svrAddrSize = sizeof(svrAddr4);
-  }
-
-  res = bind(svrSock, svrAddr, svrAddrSize);
-  if (res == SOCKET_ERROR) {
-    wprintf(L"Server socket bind failed with error: %ld\n", WSAGetLastError());
-    goto cleanup;
-  }
-
-  // Create a new DTLS context.
-  ctx = SSL_CTX_new(DTLS_server_method());
-  if (!ctx) {
-    printf("Error: cannot create SSL_CTX.\n");
-    ERR_print_errors_fp(stderr);
-    goto cleanup;
-  }
-
-  // Set our supported ciphers.
-  res = SSL_CTX_set_cipher_list(ctx, "ALL:!ADH:!LOW:!EXP:!MD5:@STRENGTH");
-  //res = SSL_CTX_set_cipher_list(ctx, "ALL:NULL:eNULL:aNULL");
-  if (res != 1) {
-    printf("Error: cannot set the cipher list.\n");
-    ERR_print_errors_fp(stderr);
-    goto cleanup;
-  }
-
-  // Load certificate.
-  res = SSL_CTX_use_certificate_file(ctx, CERTIFICATE_PATH, SSL_FILETYPE_PEM);
-  if (res != 1) {
-    printf("Error: cannot load certificate file.\n");
-    ERR_print_errors_fp(stderr);
-    goto cleanup;
-  }
-
-  /* load private key */
-  res = SSL_CTX_use_PrivateKey_file(ctx, CERTIFICATE_KEY_PATH, SSL_FILETYPE_PEM);
-  if (res != 1) {
-    printf("Error: cannot load private key file.\n");
-    ERR_print_errors_fp(stderr);
-    goto cleanup;
-  }
-
-  // Check if the private key is valid.
-  res = SSL_CTX_check_private_key(ctx);
-  if (res != 1) {
-    printf("Error: checking the private key failed. \n");
-    ERR_print_errors_fp(stderr);
+  catch (const std::exception& excp) {
+    printf("Error: %s\n", excp.what());
     goto cleanup;
   }
 
-  // The client doesn't have to send it's certificate.
-  SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
-  SSL_CTX_set_cookie_generate_cb(ctx, generate_cookie);
-  SSL_CTX_set_cookie_verify_cb(ctx, verify_cookie);
-
   // Create SSL.
   ssl = SSL_new(ctx);
   if (!ssl) {
@@ -232,17 +233,12 @@ void RunServer(AddressFamily addrFamily)
   }
 
   // Create Basic I/O.
-  bio = BIO_new_dgram((int)svrSock, BIO_NOCLOSE);
+  bio = BIO_new_dgram((int)svrSock->GetHandle(), BIO_NOCLOSE);
   if (!bio) {
     printf("Error: cannot create new BIO.\n");
     goto cleanup;
   }
 
-  /* Set and activate timeouts */
-  timeout.tv_sec = HANDSHAKE_TIMEOUT_SECONDS;
-  timeout.tv_usec = 0;
-  BIO_ctrl(bio, BIO_CTRL_DGRAM_SET_RECV_TIMEOUT, 0, &timeout);
-
   SSL_set_bio(ssl, bio, bio);
   SSL_set_info_callback(ssl, info_callback);
   SSL_set_options(ssl, SSL_OP_COOKIE_EXCHANGE);
@@ -250,17 +246,28 @@ void RunServer(AddressFamily addrFamily)
   // Act as the server end of the DTLS connection.
   SSL_set_accept_state(ssl);
 
-  // Checks that the cookie has been set in client hello.
-  while (DTLSv1_listen(ssl, clientAddr) <= 0);
+  deadline = std::chrono::steady_clock::now() + std::chrono::seconds(HANDSHAKE_TIMEOUT_SECONDS);
+
+  // Checks that the cookie has been set in client hello. Returns 0 when
+  // there's nothing to read yet, or the ClientHello was answered with a
+  // HelloVerifyRequest.
+  while ((res = DTLSv1_listen(ssl, clientAddr)) <= 0) {
+    if (res < 0 || !WaitForDtls(ssl, *poller, deadline)) {
+      printf("Error: no ClientHello with a valid cookie.\n");
+      goto cleanup;
+    }
+  }
 
   printf("New DTLS client connection.\n");
 
   // Finish handshake.
-  do { res = SSL_accept(ssl); } while (res == 0);
-  if (res < 0) {
-    perror("SSL_accept");
-    printf("%s\n", ERR_error_string(ERR_get_error(), buf));
-    goto cleanup;
+  while ((res = SSL_accept(ssl)) != 1) {
+    int err = SSL_get_error(ssl, res);
+    if ((err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) || !WaitForDtls(ssl, *poller, deadline)) {
+      perror("SSL_accept");
+      printf("%s\n", ERR_error_string(ERR_get_error(), buf));
+      goto cleanup;
+    }
   }
 
   handshakeState = SSL_get_state(ssl);
@@ -284,8 +291,6 @@ cleanup:
     SSL_CTX_free(ctx);
   }
 
-  closesocket(svrSock);
-
   std::cout << "RunServer finished." << std::endl;
 }
 
@@ -295,21 +300,15 @@ cleanup:
  */
 void RunClient(AddressFamily addrFamily)
 {
-  SOCKET cliSock = 0;
-  sockaddr* cliAddr = nullptr;
-  int cliAddrSize = 0;
-  sockaddr_in cliAddr4 = { 0 };
-  sockaddr_in6 cliAddr6 = { 0 };
-  sockaddr* svrAddr = nullptr;
-  int svrAddrSize = 0;
-  sockaddr_in svrAddr4 = { 0 };
-  sockaddr_in6 svrAddr6 = { 0 };
+  std::unique_ptr<sipsorcery::UdpSocket> cliSock;
+  std::unique_ptr<sipsorcery::SocketPoller> poller;
+  sipsorcery::PeerAddress svrAddr = sipsorcery::PeerAddress::Loopback(addrFamily, SERVER_PORT);
   int res = 0;
   SSL_CTX* ctx = nullptr;
   SSL* ssl = nullptr;
   BIO* bio = nullptr;
   char buf[ERROR_BUFFER_SIZE];
-  struct timeval timeout;
+  std::chrono::steady_clock::time_point deadline;
   OSSL_HANDSHAKE_STATE handshakeState = OSSL_HANDSHAKE_STATE::TLS_ST_BEFORE;
 
   std::cout << "RunClient..." << std::endl;
@@ -317,87 +316,25 @@ void RunClient(AddressFamily addrFamily)
   // Dump any openssl errors.
   ERR_print_errors_fp(stderr);
 
-  cliSock = socket((addrFamily == AddressFamily::IPv6) ? AF_INET6 : AF_INET, 
-    SOCK_DGRAM, IPPROTO_UDP);
-  if (cliSock == INVALID_SOCKET || cliSock < 0) {
-    std::cerr << "Client socket initialisation failed." << std::endl;
-    goto cleanup;
-  }
-
-  if (addrFamily == AddressFamily::IPv6) {
-    cliAddr6.sin6_family = AF_INET6;
-    cliAddr6.sin6_addr = in6addr_loopback;
-    cliAddr6.sin6_port = htons(CLIENT_PORT);
-
-    cliAddr = (sockaddr*)&cliAddr6;
-    cliAddrSize = sizeof(cliAddr6);
-
-    svrAddr6.sin6_family = AF_INET6;
-    svrAddr6.sin6_addr = in6addr_loopback;
-    svrAddr6.sin6_port = htons(SERVER_PORT);
-
-    svrAddr = (sockaddr*)&svrAddr6;
-    svrAddrSize = sizeof(svrAddr6);
+  // Create a new DTLS context with the SRTP profiles.
+  try {
+    cliSock.reset(new sipsorcery::UdpSocket(sipsorcery::PeerAddress::Loopback(addrFamily, CLIENT_PORT)));
+    poller.reset(new sipsorcery::SocketPoller());
+    poller->Add(*cliSock, 0);
+    ctx = sipsorcery::CreateDtlsClientContext();
   }
-  else {
-    cliAddr4.sin_family = AF_INET;
-    cliAddr4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    cliAddr4.sin_port = htons(CLIENT_PORT);
-
-    cliAddr = (sockaddr*)&cliAddr4;
-    cliAddrSize = sizeof(cliAddr4);
-
-    svrAddr4.sin_family = AF_INET;
-    svrAddr4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-    svrAddr4.sin_port = htons(SERVER_PORT);
-
-    svrAddr = (sockaddr*)&svrAddr4;
-    svrAddrSize = sizeof(svrAddr4);
-  }
-
-  res = bind(cliSock, cliAddr, cliAddrSize);
-  if (res == SOCKET_ERROR) {
-    wprintf(L"Client socket bind failed with error: %ld\n", WSAGetLastError());
-    closesocket(cliSock);
+  catch (const std::exception& excp) {
+    printf("Error: %s\n", excp.what());
     goto cleanup;
   }
 
   // Even though it's UDP we call connect to set the destination socket.
-  res = connect(cliSock, svrAddr, svrAddrSize);
-  if (res == SOCKET_ERROR) {
-    wprintf(L"Client socket connect failed with error: %ld\n", WSAGetLastError());
-    closesocket(cliSock);
-    goto cleanup;
-  }
-
-  // Create a new DTLS context.
-  ctx = SSL_CTX_new(DTLS_client_method());
-  if (!ctx) {
-    printf("Error: cannot create SSL_CTX.\n");
-    ERR_print_errors_fp(stderr);
-    goto cleanup;
-  }
-
-  // Set our supported ciphers.
-  res = SSL_CTX_set_cipher_list(ctx, "ALL:!ADH:!LOW:!EXP:!MD5:@STRENGTH");
-  //res = SSL_CTX_set_cipher_list(ctx, "ALL:NULL:eNULL:aNULL");
-  if (res != 1) {
-    printf("Error: cannot set the cipher list.\n");
-    ERR_print_errors_fp(stderr);
-    goto cleanup;
-  }
-
-  /* enable srtp */
-  res = SSL_CTX_set_tlsext_use_srtp(ctx, SRTP_ALGORITHM);
+  res = connect(cliSock->GetHandle(), (const sockaddr*)&svrAddr.Addr, svrAddr.Length);
   if (res != 0) {
-    printf("Error: cannot setup srtp.\n");
-    ERR_print_errors_fp(stderr);
+    printf("Error: client socket connect failed.\n");
     goto cleanup;
   }
 
-  SSL_CTX_set_ecdh_auto(ctx, 1);                        // Needed for FireFox DTLS negotiation.
-  SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);    // The client doesn't have to send it's certificate.
-
   // Create SSL.
   ssl = SSL_new(ctx);
   if (!ssl) {
@@ -406,7 +343,7 @@ void RunClient(AddressFamily addrFamily)
   }
 
   // Create Basic I/O.
-  bio = BIO_new_dgram((int)cliSock, BIO_NOCLOSE);
+  bio = BIO_new_dgram((int)cliSock->GetHandle(), BIO_NOCLOSE);
   if (!bio) {
     printf("Error: cannot create new BIO.\n");
     goto cleanup;
@@ -417,21 +354,20 @@ void RunClient(AddressFamily addrFamily)
 
   SSL_set_connect_state(ssl);
 
-  /* Set and activate timeouts */
-  timeout.tv_sec = HANDSHAKE_TIMEOUT_SECONDS;
-  timeout.tv_usec = 0;
-  BIO_ctrl(bio, BIO_CTRL_DGRAM_SET_SEND_TIMEOUT, 0, &timeout);
-
-  if (BIO_ctrl(bio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &svrAddr) <= 0) {
+  if (BIO_ctrl(bio, BIO_CTRL_DGRAM_SET_CONNECTED, 0, &svrAddr.Addr) <= 0) {
     printf("Error: BIO_CTL to set BIO_CTRL_DGRAM_SET_CONNECTED failed.\n");
   }
 
-  // Exits on error (<0) or success (==1).
-  do { res = SSL_connect(ssl); } while (res == 0);
-  if (res < 0) {
-    perror("SSL_connect");
-    printf("%s\n", ERR_error_string(ERR_get_error(), buf));
-    goto cleanup;
+  deadline = std::chrono::steady_clock::now() + std::chrono::seconds(HANDSHAKE_TIMEOUT_SECONDS);
+
+  // Exits on error or success (==1), waiting for the server in between.
+  while ((res = SSL_connect(ssl)) != 1) {
+    int err = SSL_get_error(ssl, res);
+    if ((err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) || !WaitForDtls(ssl, *poller, deadline)) {
+      perror("SSL_connect");
+      printf("%s\n", ERR_error_string(ERR_get_error(), buf));
+      goto cleanup;
+    }
   }
 
   handshakeState = SSL_get_state(ssl);
@@ -451,7 +387,44 @@ cleanup:
     SSL_CTX_free(ctx);
   }
 
-  closesocket(cliSock);
-
   std::cout << "RunClient finished." << std::endl;
+}
+
+/**
+ * Runs the multi client DTLS server on one socket until a key is pressed,
+ * echoing any application data back to the peer that sent it.
+ */
+void RunMultiClientServer(AddressFamily addrFamily, int port)
+{
+  SSL_CTX* ctx = nullptr;
+  std::unique_ptr<sipsorcery::DtlsServer> server;
+
+  try {
+    ctx = sipsorcery::CreateDtlsServerContext();
+    server.reset(new sipsorcery::DtlsServer(ctx, sipsorcery::PeerAddress::Loopback(addrFamily, (uint16_t)port)));
+  }
+  catch (const std::exception& excp) {
+    std::cerr << excp.what() << std::endl;
+    SSL_CTX_free(ctx);
+    return;
+  }
+
+  SSL_CTX_free(ctx);
+
+  server->SetDataHandler([](sipsorcery::DtlsServer& svr, const sipsorcery::PeerAddress& peer, const uint8_t* data, size_t length) {
+    svr.Send(peer, data, length);
+  });
+
+  std::atomic<bool> exit{ false };
+  std::thread svrThd([&]() { server->Run(exit); });
+
+  std::cout << "DTLS server listening on " << server->GetLocalAddress().ToString() << ", press any key to exit..." << std::endl;
+  auto o = getchar();
+
+  exit = true;
+  svrThd.join();
+
+  sipsorcery::DtlsServerStats stats = server->GetStats();
+  std::cout << "Handshakes completed " << stats.HandshakesCompleted << ", failed " << stats.HandshakesFailed
+    << ", timed out " << stats.HandshakesTimedOut << ", peak peers " << stats.PeakPeers << "." << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,236 @@
+#include "dtlsconnection.h"
+#include "dtlscontext.h"
+
+#include <openssl/err.h>
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/time.h>
+#endif
+
+namespace sipsorcery
+{
+  DtlsConnection::DtlsConnection(SSL_CTX* ctx, bool isServer) :
+    _ssl(nullptr),
+    _rbio(nullptr),
+    _wbio(nullptr),
+    _clientAddr(nullptr),
+    _state(DtlsState::Handshaking),
+    _pendingOffset(0)
+  {
+    _ssl = SSL_new(ctx);
+    if (!_ssl) {
+      throw std::runtime_error("Cannot create new SSL. " + GetOpenSslErrors());
+    }
+
+    _rbio = BIO_new(BIO_s_mem());
+    _wbio = BIO_new(BIO_s_mem());
+    if (!_rbio || !_wbio) {
+      BIO_free(_rbio);
+      BIO_free(_wbio);
+      SSL_free(_ssl);
+      throw std::runtime_error("Cannot create memory BIOs. " + GetOpenSslErrors());
+    }
+
+    // An empty memory BIO otherwise reads as end of file, which OpenSSL
+    // takes as the peer having gone.
+    BIO_set_mem_eof_return(_rbio, -1);
+    BIO_set_mem_eof_return(_wbio, -1);
+    SSL_set_bio(_ssl, _rbio, _wbio);
+
+    // There's no socket to ask for the path MTU.
+    SSL_set_options(_ssl, SSL_OP_NO_QUERY_MTU);
+    SSL_set_mtu(_ssl, DTLS_MTU);
+
+    if (isServer) {
+      _clientAddr = BIO_ADDR_new();
+      SSL_set_accept_state(_ssl);
+    }
+    else {
+      SSL_set_connect_state(_ssl);
+    }
+  }
+
+  DtlsConnection::~DtlsConnection()
+  {
+    // Frees the BIOs as well.
+    SSL_free(_ssl);
+
+    if (_clientAddr != nullptr) {
+      BIO_ADDR_free(_clientAddr);
+    }
+  }
+
+  bool DtlsConnection::Listen(const uint8_t* datagram, size_t length)
+  {
+    // Whatever a previous rejected datagram left behind mustn't be read as
+    // part of this one.
+    (void)BIO_reset(_rbio);
+    BIO_write(_rbio, datagram, (int)length);
+
+    int res = DTLSv1_listen(_ssl, _clientAddr);
+    if (res < 0) {
+      ERR_clear_error();
+    }
+
+    return res > 0;
+  }
+
+  void DtlsConnection::Feed(const uint8_t* datagram, size_t length)
+  {
+    BIO_write(_rbio, datagram, (int)length);
+  }
+
+  DtlsState DtlsConnection::Handshake()
+  {
+    if (_state != DtlsState::Handshaking) {
+      return _state;
+    }
+
+    int res = SSL_do_handshake(_ssl);
+    if (res == 1) {
+      _state = DtlsState::Connected;
+      return _state;
+    }
+
+    return CheckResult(res);
+  }
+
+  int DtlsConnection::Read(uint8_t* buf, size_t length)
+  {
+    if (_state == DtlsState::Closed || _state == DtlsState::Failed) {
+      return -1;
+    }
+
+    int res = SSL_read(_ssl, buf, (int)length);
+    if (res > 0) {
+      return res;
+    }
+
+    DtlsState state = CheckResult(res);
+    return (state == DtlsState::Closed || state == DtlsState::Failed) ? -1 : 0;
+  }
+
+  int DtlsConnection::Write(const uint8_t* buf, size_t length)
+  {
+    if (_state != DtlsState::Connected) {
+      return -1;
+    }
+
+    int res = SSL_write(_ssl, buf, (int)length);
+    if (res > 0) {
+      return res;
+    }
+
+    CheckResult(res);
+    return -1;
+  }
+
+  void DtlsConnection::Shutdown()
+  {
+    if (_state == DtlsState::Connected) {
+      SSL_shutdown(_ssl);
+      ERR_clear_error();
+      _state = DtlsState::Closed;
+    }
+  }
+
+  bool DtlsConnection::GetTimeout(std::chrono::milliseconds& remaining) const
+  {
+    if (_state != DtlsState::Handshaking) {
+      return false;
+    }
+
+    struct timeval timeout;
+    if (DTLSv1_get_timeout(_ssl, &timeout) != 1) {
+      return false;
+    }
+
+    remaining = std::chrono::seconds(timeout.tv_sec) + std::chrono::milliseconds(timeout.tv_usec / 1000);
+    return true;
+  }
+
+  bool DtlsConnection::HandleTimeout()
+  {
+    if (_state != DtlsState::Handshaking) {
+      return false;
+    }
+
+    // Fails once OpenSSL has given up retransmitting.
+    int res = DTLSv1_handle_timeout(_ssl);
+    if (res < 0) {
+      ERR_clear_error();
+      _state = DtlsState::Failed;
+    }
+
+    return res > 0;
+  }
+
+  const uint8_t* DtlsConnection::NextDatagram(size_t& length)
+  {
+    if (_pendingOffset >= _pending.size()) {
+      _pending.clear();
+      _pendingOffset = 0;
+    }
+
+    size_t available = BIO_ctrl_pending(_wbio);
+    if (available > 0) {
+      size_t end = _pending.size();
+      _pending.resize(end + available);
+      int read = BIO_read(_wbio, _pending.data() + end, (int)available);
+      _pending.resize(end + (read > 0 ? read : 0));
+    }
+
+    if (_pendingOffset >= _pending.size()) {
+      length = 0;
+      return nullptr;
+    }
+
+    // Pack whole records up to the MTU. A record that doesn't parse takes
+    // everything that's left rather than being split somewhere arbitrary.
+    size_t start = _pendingOffset;
+    size_t posn = start;
+    while (posn + DTLS_RECORD_HEADER_LENGTH <= _pending.size()) {
+      size_t recordLength = DTLS_RECORD_HEADER_LENGTH + (_pending[posn + 11] << 8 | _pending[posn + 12]);
+      if (posn + recordLength > _pending.size()) {
+        posn = _pending.size();
+        break;
+      }
+      if (posn > start && posn - start + recordLength > DTLS_MTU) {
+        break;
+      }
+      posn += recordLength;
+    }
+
+    if (posn == start) {
+      posn = _pending.size();
+    }
+
+    _pendingOffset = posn;
+    length = posn - start;
+    return _pending.data() + start;
+  }
+
+  DtlsState DtlsConnection::CheckResult(int res)
+  {
+    int err = SSL_get_error(_ssl, res);
+
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+      return _state;
+    }
+
+    _state = (err == SSL_ERROR_ZERO_RETURN) ? DtlsState::Closed : DtlsState::Failed;
+
+    // Answer the peer's close_notify. OpenSSL treats a connection freed
+    // without sending one as broken and drops its session from the cache.
+    if (_state == DtlsState::Closed) {
+      SSL_shutdown(_ssl);
+    }
+
+    ERR_clear_error();
+    return _state;
+  }
+}
@@ -0,0 +1,147 @@
+//-----------------------------------------------------------------------------
+// Filename: dtlsconnection.h
+//
+// Description: One end of a DTLS association run over memory BIOs, so the
+// SSL never touches a socket. Received datagrams are fed in and whatever
+// OpenSSL wants to send is taken out as datagrams, which lets one socket
+// serve any number of peers and keeps all I/O non-blocking.
+//
+// A memory BIO doesn't keep datagram boundaries, everything OpenSSL writes
+// is one stream of DTLS records. The records are split back into datagrams
+// at record boundaries, packing as many as fit in the MTU, so a flight goes
+// out in about as many datagrams as a datagram BIO would have used.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 18 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//
+// OpenSSL License:
+// This application includes software developed by the OpenSSL Project and
+// cryptographic software written by Eric Young (eay@cryptsoft.com)
+// See https://github.com/openssl/openssl/blob/master/LICENSE for conditions.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_DTLSCONNECTION_H
+#define SIPSORCERY_DTLSCONNECTION_H
+
+#include <openssl/ssl.h>
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define DTLS_MTU 1200                   // Leaves room for TURN and IPv6 headers on a 1500 byte link.
+#define DTLS_RECORD_HEADER_LENGTH 13
+#define DTLS_MAX_DATAGRAM_LENGTH 2048   // Receive buffer, anything bigger isn't from a peer using DTLS_MTU.
+
+namespace sipsorcery
+{
+  enum class DtlsState
+  {
+    Handshaking,
+    Connected,
+    Closed,       // The peer sent a close_notify.
+    Failed
+  };
+
+  class DtlsConnection
+  {
+  public:
+    /**
+    * @param[in] ctx: the context to create the SSL from, it can be shared
+    *  with other connections.
+    * @param[in] isServer: true for the accepting end.
+    * Throws std::runtime_error if the SSL or BIOs cannot be created.
+    */
+    DtlsConnection(SSL_CTX* ctx, bool isServer);
+    ~DtlsConnection();
+
+    DtlsConnection(const DtlsConnection&) = delete;
+    DtlsConnection& operator=(const DtlsConnection&) = delete;
+
+    /**
+    * Runs the stateless part of a server handshake, DTLSv1_listen, on one
+    * datagram from a peer that has no connection yet. A ClientHello without
+    * a valid cookie is answered with a HelloVerifyRequest, taken out with
+    * NextDatagram like any other output.
+    * @@Returns true if the datagram was a ClientHello with a valid cookie,
+    *  the connection then belongs to that peer and Handshake carries on from
+    *  it. False otherwise, the connection can be used for the next datagram.
+    */
+    bool Listen(const uint8_t* datagram, size_t length);
+
+    /**
+    * Queues a received datagram for the SSL to read on the next Handshake
+    * or Read.
+    */
+    void Feed(const uint8_t* datagram, size_t length);
+
+    /**
+    * Advances the handshake as far as the datagrams fed so far allow. The
+    * first call on a client sends the ClientHello.
+    * @@Returns the state after, Connected once the handshake is complete.
+    */
+    DtlsState Handshake();
+
+    /**
+    * Reads decrypted application data.
+    * @@Returns the number of bytes read, 0 if there is nothing more to read
+    *  and -1 if the connection has been closed or failed.
+    */
+    int Read(uint8_t* buf, size_t length);
+
+    /**
+    * Encrypts application data as one record.
+    * @@Returns the number of bytes written or -1 on failure.
+    */
+    int Write(const uint8_t* buf, size_t length);
+
+    /**
+    * Queues a close_notify for the peer.
+    */
+    void Shutdown();
+
+    /**
+    * Asks OpenSSL when its handshake retransmission timer expires.
+    * @param[out] remaining: the time left, zero if it's already expired.
+    * @@Returns false if the timer isn't running.
+    */
+    bool GetTimeout(std::chrono::milliseconds& remaining) const;
+
+    /**
+    * Retransmits the last flight if OpenSSL's handshake timer has expired.
+    * @@Returns true if a flight was queued for retransmission.
+    */
+    bool HandleTimeout();
+
+    /**
+    * Takes the next datagram to send. The pointer stays valid until the
+    * next call to any other method.
+    * @param[out] length: the length of the datagram.
+    * @@Returns nullptr once there is nothing left to send.
+    */
+    const uint8_t* NextDatagram(size_t& length);
+
+    DtlsState GetState() const { return _state; }
+    SSL* GetSsl() const { return _ssl; }
+
+  private:
+    SSL* _ssl;
+    BIO* _rbio;
+    BIO* _wbio;
+    BIO_ADDR* _clientAddr;
+    DtlsState _state;
+    std::vector<uint8_t> _pending;      // Records written by OpenSSL and not yet sent.
+    size_t _pendingOffset;
+
+    DtlsState CheckResult(int res);
+  };
+}
+
+#endif // SIPSORCERY_DTLSCONNECTION_H
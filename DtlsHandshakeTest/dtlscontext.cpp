@@ -0,0 +1,164 @@
+#include "dtlscontext.h"
+#include "dtlscookie.h"
+#include "dtlssession.h"
+
+#include <openssl/err.h>
+#include <openssl/rand.h>
+
+#include <stdexcept>
+
+namespace sipsorcery
+{
+  static void ThrowOnFailure(SSL_CTX* ctx, bool failed, const std::string& step)
+  {
+    if (failed) {
+      std::string errors = GetOpenSslErrors();
+      SSL_CTX_free(ctx);
+      throw std::runtime_error("DTLS context " + step + " failed. " + errors);
+    }
+  }
+
+  static SSL_CTX* NewDtlsContext(const SSL_METHOD* method, const char* cipherList, const char* srtpProfiles)
+  {
+    SSL_CTX* ctx = SSL_CTX_new(method);
+    if (!ctx) {
+      throw std::runtime_error("Cannot create SSL_CTX. " + GetOpenSslErrors());
+    }
+
+    ThrowOnFailure(ctx, SSL_CTX_set_cipher_list(ctx, cipherList) != 1, std::string("set cipher list ") + cipherList);
+    ThrowOnFailure(ctx, SSL_CTX_set_tlsext_use_srtp(ctx, srtpProfiles) != 0, std::string("set SRTP profiles ") + srtpProfiles);
+
+    return ctx;
+  }
+
+  /**
+  * The server settings that come after the certificate and key.
+  */
+  static SSL_CTX* FinishDtlsServerContext(SSL_CTX* ctx)
+  {
+    ThrowOnFailure(ctx, SSL_CTX_check_private_key(ctx) != 1, "check private key");
+
+    // The client doesn't have to send it's certificate.
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+
+    try {
+      AttachDtlsCookieGenerator(ctx);
+      AttachDtlsSessionResumption(ctx);
+    }
+    catch (...) {
+      SSL_CTX_free(ctx);
+      throw;
+    }
+
+    return ctx;
+  }
+
+  SSL_CTX* CreateDtlsServerContext(const char* certificatePath, const char* keyPath)
+  {
+    SSL_CTX* ctx = NewDtlsContext(DTLS_server_method(), DTLS_CIPHER_LIST, DTLS_SRTP_PROFILES);
+
+    ThrowOnFailure(ctx, SSL_CTX_use_certificate_file(ctx, certificatePath, SSL_FILETYPE_PEM) != 1,
+      std::string("load certificate ") + certificatePath);
+    ThrowOnFailure(ctx, SSL_CTX_use_PrivateKey_file(ctx, keyPath, SSL_FILETYPE_PEM) != 1,
+      std::string("load private key ") + keyPath);
+
+    return FinishDtlsServerContext(ctx);
+  }
+
+  SSL_CTX* CreateDtlsServerContext(X509* certificate, EVP_PKEY* key, const char* cipherList, const char* srtpProfiles)
+  {
+    SSL_CTX* ctx = NewDtlsContext(DTLS_server_method(), cipherList, srtpProfiles);
+
+    ThrowOnFailure(ctx, SSL_CTX_use_certificate(ctx, certificate) != 1, "use certificate");
+    ThrowOnFailure(ctx, SSL_CTX_use_PrivateKey(ctx, key) != 1, "use private key");
+
+    return FinishDtlsServerContext(ctx);
+  }
+
+  SSL_CTX* CreateDtlsClientContext(const char* cipherList, const char* srtpProfiles)
+  {
+    SSL_CTX* ctx = NewDtlsContext(DTLS_client_method(), cipherList, srtpProfiles);
+
+    SSL_CTX_set_ecdh_auto(ctx, 1);                        // Needed for FireFox DTLS negotiation.
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);    // The client doesn't have to send it's certificate.
+
+    return ctx;
+  }
+
+  const char* GetDtlsKeyTypeName(DtlsKeyType keyType)
+  {
+    switch (keyType) {
+    case DtlsKeyType::Rsa2048:
+      return "RSA-2048";
+    case DtlsKeyType::EcdsaP256:
+      return "ECDSA P-256";
+    case DtlsKeyType::Ed25519:
+      return "Ed25519";
+    default:
+      return "unknown";
+    }
+  }
+
+  void GenerateDtlsCertificate(DtlsKeyType keyType, X509*& certificate, EVP_PKEY*& key)
+  {
+    int keyId = (keyType == DtlsKeyType::Rsa2048) ? EVP_PKEY_RSA :
+      (keyType == DtlsKeyType::EcdsaP256) ? EVP_PKEY_EC : EVP_PKEY_ED25519;
+
+    certificate = nullptr;
+    key = nullptr;
+
+    EVP_PKEY_CTX* keyCtx = EVP_PKEY_CTX_new_id(keyId, nullptr);
+    bool ok = keyCtx != nullptr && EVP_PKEY_keygen_init(keyCtx) == 1;
+    if (ok && keyType == DtlsKeyType::Rsa2048) {
+      ok = EVP_PKEY_CTX_set_rsa_keygen_bits(keyCtx, 2048) > 0;
+    }
+    else if (ok && keyType == DtlsKeyType::EcdsaP256) {
+      ok = EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyCtx, NID_X9_62_prime256v1) > 0;
+    }
+    ok = ok && EVP_PKEY_keygen(keyCtx, &key) == 1;
+    EVP_PKEY_CTX_free(keyCtx);
+
+    uint32_t serial = 0;
+    X509_NAME* name = nullptr;
+    certificate = ok ? X509_new() : nullptr;
+
+    // Ed25519 signs the whole certificate itself, it doesn't take a digest.
+    ok = certificate != nullptr &&
+      RAND_bytes((unsigned char*)&serial, sizeof(serial)) == 1 &&
+      X509_set_version(certificate, 2) == 1 &&
+      ASN1_INTEGER_set(X509_get_serialNumber(certificate), (long)(serial & 0x7fffffff)) == 1 &&
+      X509_gmtime_adj(X509_getm_notBefore(certificate), -60 * 60) != nullptr &&
+      X509_gmtime_adj(X509_getm_notAfter(certificate), DTLS_CERTIFICATE_LIFETIME_DAYS * 24L * 60 * 60) != nullptr &&
+      X509_set_pubkey(certificate, key) == 1 &&
+      (name = X509_get_subject_name(certificate)) != nullptr &&
+      X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)DTLS_CERTIFICATE_COMMON_NAME, -1, -1, 0) == 1 &&
+      X509_set_issuer_name(certificate, name) == 1 &&
+      X509_sign(certificate, key, (keyType == DtlsKeyType::Ed25519) ? nullptr : EVP_sha256()) > 0;
+
+    if (!ok) {
+      std::string errors = GetOpenSslErrors();
+      X509_free(certificate);
+      EVP_PKEY_free(key);
+      certificate = nullptr;
+      key = nullptr;
+      throw std::runtime_error(std::string("Generating a ") + GetDtlsKeyTypeName(keyType) + " certificate failed. " + errors);
+    }
+  }
+
+  std::string GetOpenSslErrors()
+  {
+    std::string errors;
+    char buf[256];
+    unsigned long err = 0;
+
+    while ((err = ERR_get_error()) != 0) {
+      ERR_error_string_n(err, buf, sizeof(buf));
+      if (!errors.empty()) {
+        errors += "\n";
+      }
+      errors += buf;
+    }
+
+    return errors;
+  }
+}
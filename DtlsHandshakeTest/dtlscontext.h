@@ -0,0 +1,97 @@
+//-----------------------------------------------------------------------------
+// Filename: dtlscontext.h
+//
+// Description: Creates the client and server SSL_CTX's for DTLS. A context
+// holds the certificate, key, cipher list and SRTP profiles and is shared by
+// every SSL created from it, the server has one for all its peers.
+//
+// The server's certificate and key come from PEM files, or can be made in
+// memory with GenerateDtlsCertificate for any of the key types WebRTC
+// endpoints use.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 18 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//
+// OpenSSL License:
+// This application includes software developed by the OpenSSL Project and
+// cryptographic software written by Eric Young (eay@cryptsoft.com)
+// See https://github.com/openssl/openssl/blob/master/LICENSE for conditions.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_DTLSCONTEXT_H
+#define SIPSORCERY_DTLSCONTEXT_H
+
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <string>
+
+#define DTLS_CERTIFICATE_PATH "localhost.pem"
+#define DTLS_CERTIFICATE_KEY_PATH "localhost_key.pem"
+#define DTLS_CIPHER_LIST "ALL:!ADH:!LOW:!EXP:!MD5:@STRENGTH"
+#define DTLS_SRTP_PROFILES "SRTP_AES128_CM_SHA1_80"
+#define DTLS_CERTIFICATE_COMMON_NAME "localhost"
+#define DTLS_CERTIFICATE_LIFETIME_DAYS 30
+
+namespace sipsorcery
+{
+  enum class DtlsKeyType
+  {
+    Rsa2048,
+    EcdsaP256,
+    Ed25519
+  };
+
+  const char* GetDtlsKeyTypeName(DtlsKeyType keyType);
+
+  /**
+  * Creates a DTLS server context with a certificate and key loaded from PEM
+  * files and a DtlsCookieGenerator attached for stateless cookies.
+  * Throws std::runtime_error with OpenSSL's error queue if any step fails.
+  */
+  SSL_CTX* CreateDtlsServerContext(const char* certificatePath = DTLS_CERTIFICATE_PATH,
+    const char* keyPath = DTLS_CERTIFICATE_KEY_PATH);
+
+  /**
+  * Creates a DTLS server context the same way from a certificate and key
+  * in memory. The context takes its own references to them.
+  * @param[in] cipherList: an OpenSSL cipher list string.
+  * @param[in] srtpProfiles: colon separated SRTP protection profile names.
+  */
+  SSL_CTX* CreateDtlsServerContext(X509* certificate, EVP_PKEY* key,
+    const char* cipherList = DTLS_CIPHER_LIST, const char* srtpProfiles = DTLS_SRTP_PROFILES);
+
+  /**
+  * Creates a DTLS client context that offers SRTP and doesn't send a
+  * certificate.
+  * Throws std::runtime_error with OpenSSL's error queue if any step fails.
+  */
+  SSL_CTX* CreateDtlsClientContext(const char* cipherList = DTLS_CIPHER_LIST,
+    const char* srtpProfiles = DTLS_SRTP_PROFILES);
+
+  /**
+  * Generates a key and a self signed certificate for it, with the common
+  * name DTLS_CERTIFICATE_COMMON_NAME. WebRTC peers check the certificate's
+  * fingerprint from the SDP rather than a chain, self signed is what they
+  * use.
+  * @param[out] certificate: the new certificate, free with X509_free.
+  * @param[out] key: the new key, free with EVP_PKEY_free.
+  * Throws std::runtime_error with OpenSSL's error queue if any step fails.
+  */
+  void GenerateDtlsCertificate(DtlsKeyType keyType, X509*& certificate, EVP_PKEY*& key);
+
+  /**
+  * Empties the calling thread's OpenSSL error queue.
+  * @@Returns the errors, one per line.
+  */
+  std::string GetOpenSslErrors();
+}
+
+#endif // SIPSORCERY_DTLSCONTEXT_H
@@ -0,0 +1,397 @@
+#include "dtlscookie.h"
+#include "dtlsconnection.h"
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
+
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#define DTLS_CONTENT_TYPE_HANDSHAKE 22
+#define DTLS_HANDSHAKE_CLIENT_HELLO 1
+#define DTLS_HANDSHAKE_HELLO_VERIFY_REQUEST 3
+#define DTLS_HANDSHAKE_HEADER_LENGTH 12
+#define DTLS_RANDOM_LENGTH 32
+#define DTLS_MAX_SESSION_ID_LENGTH 32
+
+namespace sipsorcery
+{
+  static int _ctxGeneratorIndex = -1;
+  static int _sslPeerIndex = -1;
+  static std::once_flag _exDataIndexOnce;
+
+  static void FreeCookieGenerator(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+  {
+    delete (DtlsCookieGenerator*)ptr;
+  }
+
+  static void InitExDataIndexes()
+  {
+    std::call_once(_exDataIndexOnce, []() {
+      _ctxGeneratorIndex = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, FreeCookieGenerator);
+      _sslPeerIndex = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+    });
+  }
+
+  /**
+  * Finds the address of the peer an SSL is talking to, from SetDtlsCookiePeer
+  * or failing that from a datagram BIO.
+  */
+  static bool GetCookiePeer(SSL* ssl, PeerAddress& peer)
+  {
+    const PeerAddress* listeningTo = (const PeerAddress*)SSL_get_ex_data(ssl, _sslPeerIndex);
+    if (listeningTo != nullptr) {
+      peer = *listeningTo;
+      return true;
+    }
+
+    bool found = false;
+    BIO_ADDR* addr = BIO_ADDR_new();
+
+    if (addr != nullptr && BIO_dgram_get_peer(SSL_get_rbio(ssl), addr) > 0) {
+      size_t rawLength = 0;
+      if (BIO_ADDR_family(addr) == AF_INET6) {
+        sockaddr_in6* addr6 = (sockaddr_in6*)&peer.Addr;
+        addr6->sin6_family = AF_INET6;
+        addr6->sin6_port = BIO_ADDR_rawport(addr);
+        found = BIO_ADDR_rawaddress(addr, &addr6->sin6_addr, &rawLength) == 1;
+        peer.Length = sizeof(sockaddr_in6);
+      }
+      else if (BIO_ADDR_family(addr) == AF_INET) {
+        sockaddr_in* addr4 = (sockaddr_in*)&peer.Addr;
+        addr4->sin_family = AF_INET;
+        addr4->sin_port = BIO_ADDR_rawport(addr);
+        found = BIO_ADDR_rawaddress(addr, &addr4->sin_addr, &rawLength) == 1;
+        peer.Length = sizeof(sockaddr_in);
+      }
+    }
+
+    BIO_ADDR_free(addr);
+    return found;
+  }
+
+  static int generate_cookie(SSL* ssl, unsigned char* cookie, unsigned int* cookie_len)
+  {
+    DtlsCookieGenerator* generator = GetDtlsCookieGenerator(SSL_get_SSL_CTX(ssl));
+    PeerAddress peer;
+
+    if (generator == nullptr || !GetCookiePeer(ssl, peer)) {
+      return 0;
+    }
+
+    *cookie_len = (unsigned int)generator->Generate(peer, cookie);
+    return *cookie_len > 0 ? 1 : 0;
+  }
+
+  static int verify_cookie(SSL* ssl, const unsigned char* cookie, unsigned int cookie_len)
+  {
+    DtlsCookieGenerator* generator = GetDtlsCookieGenerator(SSL_get_SSL_CTX(ssl));
+    PeerAddress peer;
+
+    if (generator == nullptr || !GetCookiePeer(ssl, peer)) {
+      return 0;
+    }
+
+    return generator->Verify(peer, cookie, cookie_len) ? 1 : 0;
+  }
+
+  DtlsCookieGenerator::DtlsCookieGenerator() :
+    _current(),
+    _previous(),
+    _hasPrevious(false),
+    _epoch(std::chrono::steady_clock::now()),
+    _nextRotation(_epoch + std::chrono::seconds(DTLS_COOKIE_SECRET_ROTATION_SECONDS))
+  {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    _hmac = EVP_MAC_fetch(nullptr, "HMAC", nullptr);
+    _current.Mac = _hmac ? EVP_MAC_CTX_new(_hmac) : nullptr;
+    _previous.Mac = _hmac ? EVP_MAC_CTX_new(_hmac) : nullptr;
+#else
+    _current.Mac = HMAC_CTX_new();
+    _previous.Mac = HMAC_CTX_new();
+#endif
+
+    _current.Id = 0;
+    _previous.Id = 0;
+
+    if (_current.Mac == nullptr || _previous.Mac == nullptr || !Rekey(_current)) {
+      Free();
+      throw std::runtime_error("DTLS cookie HMAC initialisation failed.");
+    }
+  }
+
+  DtlsCookieGenerator::~DtlsCookieGenerator()
+  {
+    Free();
+  }
+
+  void DtlsCookieGenerator::Free()
+  {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    EVP_MAC_CTX_free(_current.Mac);
+    EVP_MAC_CTX_free(_previous.Mac);
+    EVP_MAC_free(_hmac);
+    _hmac = nullptr;
+#else
+    HMAC_CTX_free(_current.Mac);
+    HMAC_CTX_free(_previous.Mac);
+#endif
+    _current.Mac = nullptr;
+    _previous.Mac = nullptr;
+  }
+
+  size_t DtlsCookieGenerator::Generate(const PeerAddress& peer, uint8_t* cookie)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto now = std::chrono::steady_clock::now();
+    RotateIfDue(now);
+
+    uint32_t timestamp = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(now - _epoch).count();
+
+    cookie[0] = _current.Id;
+    cookie[1] = timestamp >> 24 & 0xff;
+    cookie[2] = timestamp >> 16 & 0xff;
+    cookie[3] = timestamp >> 8 & 0xff;
+    cookie[4] = timestamp & 0xff;
+
+    return ComputeMac(_current, timestamp, peer, cookie + 5) ? DTLS_COOKIE_LENGTH : 0;
+  }
+
+  bool DtlsCookieGenerator::Verify(const PeerAddress& peer, const uint8_t* cookie, size_t length)
+  {
+    if (length != DTLS_COOKIE_LENGTH) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto now = std::chrono::steady_clock::now();
+    RotateIfDue(now);
+
+    Secret* secret = nullptr;
+    if (cookie[0] == _current.Id) {
+      secret = &_current;
+    }
+    else if (_hasPrevious && cookie[0] == _previous.Id) {
+      secret = &_previous;
+    }
+    else {
+      return false;
+    }
+
+    uint32_t timestamp = (uint32_t)cookie[1] << 24 | cookie[2] << 16 | cookie[3] << 8 | cookie[4];
+    uint32_t nowSeconds = (uint32_t)std::chrono::duration_cast<std::chrono::seconds>(now - _epoch).count();
+    if (timestamp > nowSeconds) {
+      return false;
+    }
+
+    uint8_t mac[DTLS_COOKIE_MAC_LENGTH];
+    return ComputeMac(*secret, timestamp, peer, mac) && CRYPTO_memcmp(mac, cookie + 5, DTLS_COOKIE_MAC_LENGTH) == 0;
+  }
+
+  void DtlsCookieGenerator::RotateIfDue(std::chrono::steady_clock::time_point now)
+  {
+    if (now < _nextRotation) {
+      return;
+    }
+
+    // The old previous secret's context is re-keyed as the new current one.
+    uint8_t nextId = (uint8_t)(_current.Id + 1);
+    std::swap(_current, _previous);
+    _current.Id = nextId;
+
+    if (Rekey(_current)) {
+      _hasPrevious = true;
+    }
+    else {
+      // Keep the secret there is rather than use a stale one.
+      std::swap(_current, _previous);
+      _current.Id = (uint8_t)(nextId - 1);
+    }
+
+    _nextRotation = now + std::chrono::seconds(DTLS_COOKIE_SECRET_ROTATION_SECONDS);
+  }
+
+  bool DtlsCookieGenerator::Rekey(Secret& secret)
+  {
+    uint8_t key[DTLS_COOKIE_SECRET_LENGTH];
+    if (RAND_bytes(key, sizeof(key)) != 1) {
+      return false;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"SHA256", 0),
+      OSSL_PARAM_construct_end()
+    };
+    bool keyed = EVP_MAC_init(secret.Mac, key, sizeof(key), params) == 1;
+#else
+    bool keyed = HMAC_Init_ex(secret.Mac, key, sizeof(key), EVP_sha256(), nullptr) == 1;
+#endif
+
+    OPENSSL_cleanse(key, sizeof(key));
+    return keyed;
+  }
+
+  bool DtlsCookieGenerator::ComputeMac(Secret& secret, uint32_t timestamp, const PeerAddress& peer, uint8_t* mac)
+  {
+    // Timestamp, address family, address and port.
+    uint8_t input[4 + 1 + 16 + 2];
+    size_t inputLength = 0;
+
+    input[inputLength++] = timestamp >> 24 & 0xff;
+    input[inputLength++] = timestamp >> 16 & 0xff;
+    input[inputLength++] = timestamp >> 8 & 0xff;
+    input[inputLength++] = timestamp & 0xff;
+
+    if (peer.Addr.ss_family == AF_INET6) {
+      const sockaddr_in6* addr6 = (const sockaddr_in6*)&peer.Addr;
+      input[inputLength++] = 6;
+      std::memcpy(input + inputLength, &addr6->sin6_addr, 16);
+      inputLength += 16;
+      std::memcpy(input + inputLength, &addr6->sin6_port, 2);
+    }
+    else {
+      const sockaddr_in* addr4 = (const sockaddr_in*)&peer.Addr;
+      input[inputLength++] = 4;
+      std::memcpy(input + inputLength, &addr4->sin_addr, 4);
+      inputLength += 4;
+      std::memcpy(input + inputLength, &addr4->sin_port, 2);
+    }
+    inputLength += 2;
+
+    uint8_t full[EVP_MAX_MD_SIZE];
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    size_t fullLength = 0;
+    bool ok = EVP_MAC_init(secret.Mac, nullptr, 0, nullptr) == 1 &&
+      EVP_MAC_update(secret.Mac, input, inputLength) == 1 &&
+      EVP_MAC_final(secret.Mac, full, &fullLength, sizeof(full)) == 1;
+#else
+    unsigned int fullLength = 0;
+    bool ok = HMAC_Init_ex(secret.Mac, nullptr, 0, nullptr, nullptr) == 1 &&
+      HMAC_Update(secret.Mac, input, inputLength) == 1 &&
+      HMAC_Final(secret.Mac, full, &fullLength) == 1;
+#endif
+
+    if (!ok || fullLength < DTLS_COOKIE_MAC_LENGTH) {
+      return false;
+    }
+
+    std::memcpy(mac, full, DTLS_COOKIE_MAC_LENGTH);
+    return true;
+  }
+
+  bool ParseDtlsClientHello(const uint8_t* buf, size_t length, DtlsClientHelloInfo& hello)
+  {
+    if (length < DTLS_RECORD_HEADER_LENGTH + DTLS_HANDSHAKE_HEADER_LENGTH ||
+      buf[0] != DTLS_CONTENT_TYPE_HANDSHAKE || buf[1] != 0xfe ||
+      buf[3] != 0 || buf[4] != 0) {     // Epoch 0.
+      return false;
+    }
+
+    size_t recordLength = buf[11] << 8 | buf[12];
+    if (DTLS_RECORD_HEADER_LENGTH + recordLength > length || recordLength < DTLS_HANDSHAKE_HEADER_LENGTH) {
+      return false;
+    }
+
+    const uint8_t* msg = buf + DTLS_RECORD_HEADER_LENGTH;
+    size_t msgLength = (size_t)msg[1] << 16 | msg[2] << 8 | msg[3];
+    size_t fragmentOffset = (size_t)msg[6] << 16 | msg[7] << 8 | msg[8];
+    size_t fragmentLength = (size_t)msg[9] << 16 | msg[10] << 8 | msg[11];
+
+    if (msg[0] != DTLS_HANDSHAKE_CLIENT_HELLO || fragmentOffset != 0 || fragmentLength != msgLength ||
+      DTLS_HANDSHAKE_HEADER_LENGTH + msgLength > recordLength) {
+      return false;
+    }
+
+    // client_version, random, session_id and cookie.
+    const uint8_t* body = msg + DTLS_HANDSHAKE_HEADER_LENGTH;
+    size_t posn = 2 + DTLS_RANDOM_LENGTH;
+    if (posn + 1 > msgLength || body[posn] > DTLS_MAX_SESSION_ID_LENGTH) {
+      return false;
+    }
+
+    posn += 1 + body[posn];
+    if (posn + 1 > msgLength || posn + 1 + body[posn] > msgLength) {
+      return false;
+    }
+
+    std::memcpy(hello.RecordSequence, buf + 5, sizeof(hello.RecordSequence));
+    hello.CookieLength = body[posn];
+    hello.Cookie = body + posn + 1;
+    return true;
+  }
+
+  size_t WriteDtlsHelloVerifyRequest(uint8_t* buf, const DtlsClientHelloInfo& hello, const uint8_t* cookie, size_t cookieLength)
+  {
+    size_t bodyLength = 2 + 1 + cookieLength;
+    size_t recordLength = DTLS_HANDSHAKE_HEADER_LENGTH + bodyLength;
+
+    // The record reuses the ClientHello's sequence number, as DTLSv1_listen
+    // does, and is DTLS 1.0 whatever version is negotiated later.
+    buf[0] = DTLS_CONTENT_TYPE_HANDSHAKE;
+    buf[1] = 0xfe;
+    buf[2] = 0xff;
+    buf[3] = 0;
+    buf[4] = 0;
+    std::memcpy(buf + 5, hello.RecordSequence, sizeof(hello.RecordSequence));
+    buf[11] = recordLength >> 8 & 0xff;
+    buf[12] = recordLength & 0xff;
+
+    // Message sequence 0 and a single fragment.
+    uint8_t* msg = buf + DTLS_RECORD_HEADER_LENGTH;
+    msg[0] = DTLS_HANDSHAKE_HELLO_VERIFY_REQUEST;
+    msg[1] = bodyLength >> 16 & 0xff;
+    msg[2] = bodyLength >> 8 & 0xff;
+    msg[3] = bodyLength & 0xff;
+    msg[4] = 0;
+    msg[5] = 0;
+    msg[6] = 0;
+    msg[7] = 0;
+    msg[8] = 0;
+    msg[9] = msg[1];
+    msg[10] = msg[2];
+    msg[11] = msg[3];
+
+    uint8_t* body = msg + DTLS_HANDSHAKE_HEADER_LENGTH;
+    body[0] = 0xfe;
+    body[1] = 0xff;
+    body[2] = (uint8_t)cookieLength;
+    std::memcpy(body + 3, cookie, cookieLength);
+
+    return DTLS_RECORD_HEADER_LENGTH + recordLength;
+  }
+
+  void AttachDtlsCookieGenerator(SSL_CTX* ctx)
+  {
+    InitExDataIndexes();
+
+    DtlsCookieGenerator* generator = new DtlsCookieGenerator();
+    if (SSL_CTX_set_ex_data(ctx, _ctxGeneratorIndex, generator) != 1) {
+      delete generator;
+      throw std::runtime_error("DTLS cookie generator could not be attached to the context.");
+    }
+
+    SSL_CTX_set_cookie_generate_cb(ctx, generate_cookie);
+    SSL_CTX_set_cookie_verify_cb(ctx, verify_cookie);
+  }
+
+  DtlsCookieGenerator* GetDtlsCookieGenerator(SSL_CTX* ctx)
+  {
+    InitExDataIndexes();
+    return (DtlsCookieGenerator*)SSL_CTX_get_ex_data(ctx, _ctxGeneratorIndex);
+  }
+
+  void SetDtlsCookiePeer(SSL* ssl, const PeerAddress* peer)
+  {
+    InitExDataIndexes();
+    SSL_set_ex_data(ssl, _sslPeerIndex, (void*)peer);
+  }
+}
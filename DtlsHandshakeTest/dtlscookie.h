@@ -0,0 +1,162 @@
+//-----------------------------------------------------------------------------
+// Filename: dtlscookie.h
+//
+// Description: Stateless DTLS cookies, RFC 6347 section 4.2.1. A server
+// answers a ClientHello with a HelloVerifyRequest carrying a cookie and only
+// commits handshake state once the cookie comes back, proving the client
+// can receive at the address it claims. The cookie has to be checkable
+// without the server remembering it:
+//
+//   +--------+------------------+--------------------------------------+
+//   | secret |    timestamp     | HMAC-SHA256(secret, timestamp, peer  |
+//   |   ID   |    (seconds)     |   address and port), first 16 bytes  |
+//   +--------+------------------+--------------------------------------+
+//       1             4                          16
+//
+// The secret is random and replaced every DTLS_COOKIE_SECRET_ROTATION_SECONDS,
+// cookies from the current and previous secrets are accepted. The secret ID
+// picks which, so checking a cookie, like making one, is a single HMAC. The
+// HMAC contexts are keyed once per secret and only re-initialised for each
+// cookie, the key schedule isn't repeated.
+//
+// ParseDtlsClientHello and WriteDtlsHelloVerifyRequest let a server answer
+// and check cookies itself, before a datagram goes anywhere near an SSL, so a
+// flood of spoofed ClientHellos costs a parse and an HMAC each.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 18 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//
+// OpenSSL License:
+// This application includes software developed by the OpenSSL Project and
+// cryptographic software written by Eric Young (eay@cryptsoft.com)
+// See https://github.com/openssl/openssl/blob/master/LICENSE for conditions.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_DTLSCOOKIE_H
+#define SIPSORCERY_DTLSCOOKIE_H
+
+#include "udpsocket.h"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/ssl.h>
+
+#include <chrono>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DTLS_COOKIE_SECRET_LENGTH 32
+#define DTLS_COOKIE_MAC_LENGTH 16
+#define DTLS_COOKIE_LENGTH (1 + 4 + DTLS_COOKIE_MAC_LENGTH)
+#define DTLS_COOKIE_SECRET_ROTATION_SECONDS 30
+#define DTLS_HELLO_VERIFY_REQUEST_MAX_LENGTH (13 + 12 + 3 + DTLS_COOKIE_LENGTH)   // Record and handshake headers, version and cookie.
+
+namespace sipsorcery
+{
+  class DtlsCookieGenerator
+  {
+  public:
+    /**
+    * Throws std::runtime_error if the HMAC contexts cannot be created.
+    */
+    DtlsCookieGenerator();
+    ~DtlsCookieGenerator();
+
+    DtlsCookieGenerator(const DtlsCookieGenerator&) = delete;
+    DtlsCookieGenerator& operator=(const DtlsCookieGenerator&) = delete;
+
+    /**
+    * Makes a cookie for a peer.
+    * @param[out] cookie: at least DTLS_COOKIE_LENGTH bytes.
+    * @@Returns the cookie length, DTLS_COOKIE_LENGTH, or 0 on failure.
+    */
+    size_t Generate(const PeerAddress& peer, uint8_t* cookie);
+
+    /**
+    * @@Returns true if the cookie was made for the peer with the current or
+    *  previous secret.
+    */
+    bool Verify(const PeerAddress& peer, const uint8_t* cookie, size_t length);
+
+  private:
+    struct Secret
+    {
+      uint8_t Id;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+      EVP_MAC_CTX* Mac;
+#else
+      HMAC_CTX* Mac;
+#endif
+    };
+
+    std::mutex _mutex;
+    Secret _current;
+    Secret _previous;
+    bool _hasPrevious;
+    std::chrono::steady_clock::time_point _epoch;     // Cookie timestamps count from here.
+    std::chrono::steady_clock::time_point _nextRotation;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    EVP_MAC* _hmac{ nullptr };
+#endif
+
+    void Free();
+    void RotateIfDue(std::chrono::steady_clock::time_point now);
+    bool Rekey(Secret& secret);
+    bool ComputeMac(Secret& secret, uint32_t timestamp, const PeerAddress& peer, uint8_t* mac);
+  };
+
+  /**
+  * The parts of an unfragmented ClientHello needed to answer it.
+  */
+  struct DtlsClientHelloInfo
+  {
+    uint8_t RecordSequence[6];
+    const uint8_t* Cookie;        // Points into the datagram.
+    size_t CookieLength;
+  };
+
+  /**
+  * Checks a datagram from an unknown peer is a ClientHello and finds its
+  * cookie. Anything else, including a ClientHello split across records,
+  * which an honest client won't send, is rejected.
+  * @@Returns false if the datagram isn't a ClientHello.
+  */
+  bool ParseDtlsClientHello(const uint8_t* buf, size_t length, DtlsClientHelloInfo& hello);
+
+  /**
+  * Writes a HelloVerifyRequest in reply to a ClientHello, the same one
+  * DTLSv1_listen would send.
+  * @param[out] buf: at least DTLS_HELLO_VERIFY_REQUEST_MAX_LENGTH bytes.
+  * @@Returns the length of the datagram.
+  */
+  size_t WriteDtlsHelloVerifyRequest(uint8_t* buf, const DtlsClientHelloInfo& hello, const uint8_t* cookie, size_t cookieLength);
+
+  /**
+  * Attaches a new cookie generator to a server context, it's freed with
+  * the context, and sets the context's cookie callbacks to use it.
+  * Throws std::runtime_error if the generator cannot be created.
+  */
+  void AttachDtlsCookieGenerator(SSL_CTX* ctx);
+
+  /**
+  * @@Returns the context's cookie generator, nullptr if it doesn't have one.
+  */
+  DtlsCookieGenerator* GetDtlsCookieGenerator(SSL_CTX* ctx);
+
+  /**
+  * Tells the cookie callbacks the address of the peer an SSL is listening
+  * to. Needed with memory BIOs, a datagram BIO knows the peer's address
+  * itself.
+  * @param[in] peer: must stay valid until cleared with nullptr.
+  */
+  void SetDtlsCookiePeer(SSL* ssl, const PeerAddress* peer);
+}
+
+#endif // SIPSORCERY_DTLSCOOKIE_H
@@ -0,0 +1,939 @@
+#include "dtlsloadtest.h"
+#include "dtlsconnection.h"
+#include "dtlscontext.h"
+#include "dtlscookie.h"
+#include "dtlsserver.h"
+#include "dtlssession.h"
+#include "timerwheel.h"
+
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+#define LOAD_TEST_POLL_MS 10
+#define LOAD_TEST_MAX_WAIT_MS 100          // Longest the clients wait before checking the test deadline.
+#define LOAD_TEST_TIMER_TICK_MS 10
+#define LOAD_TEST_TIMER_SLOTS 1024
+#define LOAD_TEST_PING_PREFIX "ping "
+#define LOAD_TEST_PING_RETRY_SECONDS 1
+#define LOAD_TEST_KEEPALIVE_SECONDS 5     // Well inside the server's idle timeout, as STUN consent checks would be.
+#define FLOOD_TEST_SOURCES 256             // Spoofed source addresses, 127.0.0.2 upwards.
+#define FLOOD_TEST_SOURCE_PORT 5000
+#define FLOOD_TEST_IN_FLIGHT 64
+#define FLOOD_TEST_COST_ITERATIONS 100000
+
+namespace sipsorcery
+{
+  struct LoadTestPeer
+  {
+    std::unique_ptr<UdpSocket> Socket;
+    std::unique_ptr<DtlsConnection> Connection;
+    std::chrono::steady_clock::time_point Started;
+    std::chrono::steady_clock::time_point PingSent;
+    std::string Ping;
+    bool Echoed;
+    std::chrono::steady_clock::time_point TimerDeadline;
+  };
+
+  typedef TimerWheel<size_t> LoadTestTimerWheel;
+
+  static void FlushToServer(LoadTestPeer& peer, const PeerAddress& server)
+  {
+    size_t length = 0;
+    const uint8_t* datagram = nullptr;
+
+    while ((datagram = peer.Connection->NextDatagram(length)) != nullptr) {
+      peer.Socket->SendTo(datagram, length, server);
+    }
+  }
+
+  static double Percentile(const std::vector<double>& sorted, double fraction)
+  {
+    if (sorted.empty()) {
+      return 0.0;
+    }
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+  }
+
+  /**
+  * Each peer's socket is a file descriptor, the usual soft limit of 1024
+  * would cap the test well short of the peers asked for.
+  */
+  static void RaiseDescriptorLimit(int peerCount)
+  {
+#ifndef _WIN32
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+      rlim_t needed = (rlim_t)peerCount + 256;
+      if (limit.rlim_cur < needed) {
+        limit.rlim_cur = std::min(needed, limit.rlim_max);
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur < needed) {
+          std::cerr << "File descriptor limit " << limit.rlim_cur << " is below the " << needed
+            << " needed, raise the hard limit with ulimit -n." << std::endl;
+        }
+      }
+    }
+#endif
+  }
+
+  /**
+  * @@Returns the CPU time used by every thread in the process so far.
+  */
+  static double GetProcessCpuSeconds()
+  {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+      return 0.0;
+    }
+    uint64_t kernel100ns = (uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime;
+    uint64_t user100ns = (uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime;
+    return (kernel100ns + user100ns) / 1e7;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+      return 0.0;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#endif
+  }
+
+  /**
+  * Sets a timer for the peer's next retransmission or ping, unless it
+  * already has one as early.
+  */
+  static void ArmTimer(LoadTestPeer& peer, size_t id, LoadTestTimerWheel& timers, std::chrono::steady_clock::time_point now)
+  {
+    std::chrono::steady_clock::time_point deadline;
+    std::chrono::milliseconds retransmit;
+
+    if (peer.Connection->GetState() == DtlsState::Handshaking && peer.Connection->GetTimeout(retransmit)) {
+      deadline = now + retransmit;
+    }
+    else if (peer.Connection->GetState() == DtlsState::Connected) {
+      deadline = peer.PingSent + std::chrono::seconds(peer.Echoed ? LOAD_TEST_KEEPALIVE_SECONDS : LOAD_TEST_PING_RETRY_SECONDS);
+    }
+    else {
+      return;
+    }
+
+    if (peer.TimerDeadline == std::chrono::steady_clock::time_point() || deadline < peer.TimerDeadline) {
+      peer.TimerDeadline = deadline;
+      timers.Schedule(id, deadline);
+    }
+  }
+
+  /**
+  * @@Returns the key a client peer's session is cached under.
+  */
+  static std::string GetSessionKey(const PeerAddress& server, size_t peerIndex)
+  {
+    return server.ToString() + " peer " + std::to_string(peerIndex);
+  }
+
+  /**
+  * The outcome of connecting a swarm of client peers.
+  */
+  struct SwarmResult
+  {
+    int Started;
+    int Connected;
+    int Resumed;                  // Of those connected, how many resumed a session rather than a full handshake.
+    int Echoed;
+    int Failed;
+    int Dropped;
+    double ElapsedSeconds;        // Until every handshake had finished and every connected peer had its echo.
+    double HoldCpuSeconds;        // Used by the whole process while the peers were held connected.
+    std::vector<double> LatenciesMs;
+  };
+
+  /**
+  * Connects peers to the server and pings each one until every handshake has
+  * finished one way or the other, then keeps the connected peers alive for
+  * holdSeconds. The peers are left connected for the caller to inspect the
+  * server and then close them with CloseSwarm.
+  * @param[in] sessions: if set, each peer offers the session the peer with
+  *  the same index got last time, as a client reconnecting from a new
+  *  address would, and stores the one it gets. Can be nullptr.
+  */
+  static void RunClientSwarm(SSL_CTX* clientCtx, const PeerAddress& serverAddress, AddressFamily family,
+    int peerCount, int maxInFlight, int holdSeconds, DtlsSessionCache* sessions, std::vector<LoadTestPeer>& peers, SwarmResult& result)
+  {
+    std::vector<size_t> readyIds;
+    SocketPoller poller;
+    LoadTestTimerWheel timers(std::chrono::milliseconds(LOAD_TEST_TIMER_TICK_MS), LOAD_TEST_TIMER_SLOTS);
+    std::vector<LoadTestTimerWheel::Expiry> expired;
+    uint8_t buf[DTLS_MAX_DATAGRAM_LENGTH];
+    int inFlight = 0;
+
+    peers.clear();
+    peers.resize(peerCount);
+    result = SwarmResult();
+    result.LatenciesMs.reserve(peerCount);
+
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::seconds(DTLS_LOAD_TEST_TIMEOUT_SECONDS);
+    std::chrono::steady_clock::time_point holdUntil;
+    double holdCpuStart = 0.0;
+    bool holding = false;
+
+    while (true) {
+      auto now = std::chrono::steady_clock::now();
+      if (!holding && result.Echoed + result.Failed >= result.Started && result.Started >= peerCount) {
+        result.ElapsedSeconds = std::chrono::duration<double>(now - start).count();
+        holdUntil = now + std::chrono::seconds(holdSeconds);
+        holdCpuStart = GetProcessCpuSeconds();
+        holding = true;
+      }
+
+      if (holding && now >= holdUntil) {
+        break;
+      }
+      else if (now > deadline) {
+        std::cerr << "Load test timed out." << std::endl;
+        break;
+      }
+
+      while (result.Started < peerCount && inFlight < maxInFlight) {
+        LoadTestPeer& peer = peers[result.Started];
+
+        try {
+          peer.Socket.reset(new UdpSocket(PeerAddress::Loopback(family, 0), DTLS_LOAD_TEST_CLIENT_BUFFER_SIZE));
+          peer.Connection.reset(new DtlsConnection(clientCtx, false));
+        }
+        catch (const std::exception& excp) {
+          std::cerr << "Peer " << result.Started << " could not be created, " << excp.what() << std::endl;
+          peerCount = result.Started;
+          break;
+        }
+
+        poller.Add(*peer.Socket, result.Started);
+        peer.Started = std::chrono::steady_clock::now();
+        peer.Ping = LOAD_TEST_PING_PREFIX + std::to_string(result.Started);
+        peer.Echoed = false;
+
+        if (sessions != nullptr) {
+          SSL_SESSION* session = sessions->Get(GetSessionKey(serverAddress, result.Started));
+          if (session != nullptr) {
+            SSL_set_session(peer.Connection->GetSsl(), session);
+            SSL_SESSION_free(session);
+          }
+        }
+
+        peer.Connection->Handshake();
+        FlushToServer(peer, serverAddress);
+        ArmTimer(peer, result.Started, timers, peer.Started);
+
+        result.Started++;
+        inFlight++;
+      }
+
+      int untilTimerMs = timers.GetNextTimeoutMs(std::chrono::steady_clock::now());
+      poller.Wait((untilTimerMs < 0) ? LOAD_TEST_MAX_WAIT_MS : std::min(untilTimerMs, LOAD_TEST_MAX_WAIT_MS), readyIds);
+
+      for (size_t id : readyIds) {
+        LoadTestPeer& peer = peers[id];
+        DtlsConnection& connection = *peer.Connection;
+        PeerAddress src;
+        int length = 0;
+
+        while ((length = peer.Socket->RecvFrom(buf, sizeof(buf), src)) >= 0) {
+          if (src != serverAddress ||
+            (connection.GetState() != DtlsState::Handshaking && connection.GetState() != DtlsState::Connected)) {
+            continue;
+          }
+
+          connection.Feed(buf, length);
+
+          if (connection.GetState() == DtlsState::Handshaking) {
+            DtlsState state = connection.Handshake();
+            if (state == DtlsState::Connected) {
+              result.LatenciesMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - peer.Started).count());
+              result.Connected++;
+              inFlight--;
+
+              if (SSL_session_reused(connection.GetSsl())) {
+                result.Resumed++;
+              }
+
+              if (sessions != nullptr) {
+                SSL_SESSION* session = SSL_get1_session(connection.GetSsl());
+                if (session != nullptr) {
+                  sessions->Put(GetSessionKey(serverAddress, id), session);
+                  SSL_SESSION_free(session);
+                }
+              }
+
+              connection.Write((const uint8_t*)peer.Ping.data(), peer.Ping.size());
+              peer.PingSent = std::chrono::steady_clock::now();
+            }
+            else if (state != DtlsState::Handshaking) {
+              result.Failed++;
+              inFlight--;
+            }
+          }
+
+          if (connection.GetState() == DtlsState::Connected) {
+            int read = 0;
+            while ((read = connection.Read(buf, sizeof(buf))) > 0) {
+              if (!peer.Echoed && std::string((const char*)buf, read) == peer.Ping) {
+                peer.Echoed = true;
+                result.Echoed++;
+              }
+            }
+            if (read < 0) {
+              peer.Echoed ? result.Dropped++ : result.Failed++;
+            }
+          }
+
+          FlushToServer(peer, serverAddress);
+        }
+
+        ArmTimer(peer, id, timers, std::chrono::steady_clock::now());
+      }
+
+      now = std::chrono::steady_clock::now();
+      timers.Expire(now, expired);
+
+      for (const auto& expiry : expired) {
+        LoadTestPeer& peer = peers[expiry.first];
+        if (peer.TimerDeadline != expiry.second) {
+          continue;
+        }
+
+        peer.TimerDeadline = std::chrono::steady_clock::time_point();
+        DtlsState state = peer.Connection->GetState();
+
+        if (state == DtlsState::Handshaking) {
+          if (peer.Connection->HandleTimeout()) {
+            FlushToServer(peer, serverAddress);
+          }
+          else if (peer.Connection->GetState() == DtlsState::Failed) {
+            result.Failed++;
+            inFlight--;
+          }
+        }
+        else if (state == DtlsState::Connected &&
+          now - peer.PingSent >= std::chrono::seconds(peer.Echoed ? LOAD_TEST_KEEPALIVE_SECONDS : LOAD_TEST_PING_RETRY_SECONDS)) {
+          // Application data isn't retransmitted, a ping without an echo
+          // is sent again. Once echoed pings keep the peer from idling out.
+          peer.Connection->Write((const uint8_t*)peer.Ping.data(), peer.Ping.size());
+          peer.PingSent = now;
+          FlushToServer(peer, serverAddress);
+        }
+
+        ArmTimer(peer, expiry.first, timers, now);
+      }
+    }
+
+    if (holding) {
+      result.HoldCpuSeconds = GetProcessCpuSeconds() - holdCpuStart;
+    }
+    else {
+      result.ElapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    std::sort(result.LatenciesMs.begin(), result.LatenciesMs.end());
+  }
+
+  /**
+  * Closes every peer in the swarm and waits for the server to see the
+  * close_notifys.
+  */
+  static void CloseSwarm(std::vector<LoadTestPeer>& peers, int started, const PeerAddress& serverAddress, const DtlsServer& server)
+  {
+    for (int i = 0; i < started; i++) {
+      peers[i].Connection->Shutdown();
+      FlushToServer(peers[i], serverAddress);
+    }
+
+    auto closeDeadline = std::chrono::steady_clock::now() + std::chrono::seconds(DTLS_LOAD_TEST_CLOSE_TIMEOUT_SECONDS);
+    while (server.GetStats().Peers > 0 && std::chrono::steady_clock::now() < closeDeadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(LOAD_TEST_POLL_MS));
+    }
+  }
+
+  static void EchoHandler(DtlsServer& server, const PeerAddress& peer, const uint8_t* data, size_t length)
+  {
+    server.Send(peer, data, length);
+  }
+
+  void RunDtlsLoadTest(int peerCount, int maxInFlight, AddressFamily family)
+  {
+    std::cout << "DTLS load test " << peerCount << " peers, " << maxInFlight << " handshakes in flight, "
+      << ((family == AddressFamily::IPv6) ? "IPv6" : "IPv4") << " loopback." << std::endl;
+
+    RaiseDescriptorLimit(peerCount);
+
+    SSL_CTX* serverCtx = nullptr;
+    SSL_CTX* clientCtx = nullptr;
+    std::unique_ptr<DtlsServer> serverPtr;
+
+    try {
+      serverCtx = CreateDtlsServerContext();
+      clientCtx = CreateDtlsClientContext();
+      serverPtr.reset(new DtlsServer(serverCtx, PeerAddress::Loopback(family, 0)));
+    }
+    catch (const std::exception& excp) {
+      std::cerr << excp.what() << std::endl;
+      SSL_CTX_free(serverCtx);
+      SSL_CTX_free(clientCtx);
+      return;
+    }
+
+    // The server holds its own reference.
+    SSL_CTX_free(serverCtx);
+
+    DtlsServer& server = *serverPtr;
+    server.SetDataHandler(EchoHandler);
+
+    PeerAddress serverAddress = server.GetLocalAddress();
+    std::atomic<bool> exitServer{ false };
+    std::thread serverThread([&]() { server.Run(exitServer); });
+
+    std::vector<LoadTestPeer> peers;
+    SwarmResult result;
+    RunClientSwarm(clientCtx, serverAddress, family, peerCount, maxInFlight, DTLS_LOAD_TEST_HOLD_SECONDS, nullptr, peers, result);
+
+    DtlsServerStats connectedStats = server.GetStats();
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Connected " << result.Connected << " of " << peerCount << " peers in " << result.ElapsedSeconds << "s, "
+      << (result.Connected / result.ElapsedSeconds) << " handshakes/s, " << result.Echoed << " echoed, " << result.Failed << " failed, "
+      << result.Dropped << " dropped after connecting." << std::endl;
+    std::cout << "Handshake latency p50 " << Percentile(result.LatenciesMs, 0.5) << "ms, p99 " << Percentile(result.LatenciesMs, 0.99)
+      << "ms, max " << Percentile(result.LatenciesMs, 1.0) << "ms." << std::endl;
+    std::cout << "Held " << result.Connected << " peers for " << DTLS_LOAD_TEST_HOLD_SECONDS << "s with keepalives using "
+      << (100.0 * result.HoldCpuSeconds / DTLS_LOAD_TEST_HOLD_SECONDS) << "% CPU, clients and server." << std::endl;
+    std::cout << "Server peers " << connectedStats.Peers << " concurrent, peak " << connectedStats.PeakPeers
+      << ", hello verify requests " << connectedStats.HelloVerifyRequests
+      << ", handshakes started " << connectedStats.HandshakesStarted << ", completed " << connectedStats.HandshakesCompleted
+      << ", failed " << connectedStats.HandshakesFailed << ", timed out " << connectedStats.HandshakesTimedOut
+      << ", datagrams received " << connectedStats.DatagramsReceived << ", sent " << connectedStats.DatagramsSent << "." << std::endl;
+
+    CloseSwarm(peers, result.Started, serverAddress, server);
+
+    exitServer = true;
+    serverThread.join();
+
+    DtlsServerStats closedStats = server.GetStats();
+    std::cout << "Closed, server peers " << closedStats.Peers << ", closed by peers " << closedStats.PeersClosed << "." << std::endl;
+
+    peers.clear();
+    SSL_CTX_free(clientCtx);
+  }
+
+  /**
+  * Builds the two datagrams the flood is made of from a real client's first
+  * ClientHello: the ClientHello as it is, without a cookie, and a copy with
+  * a forged cookie of the right length spliced in.
+  */
+  static bool MakeFloodDatagrams(SSL_CTX* clientCtx, std::vector<uint8_t>& noCookie, std::vector<uint8_t>& forgedCookie)
+  {
+    DtlsConnection client(clientCtx, false);
+    client.Handshake();
+
+    size_t length = 0;
+    const uint8_t* datagram = client.NextDatagram(length);
+    DtlsClientHelloInfo hello;
+
+    if (datagram == nullptr || !ParseDtlsClientHello(datagram, length, hello) || hello.CookieLength != 0) {
+      return false;
+    }
+
+    noCookie.assign(datagram, datagram + length);
+
+    // The cookie has the current secret ID and a timestamp that isn't in the
+    // future, so the server has to compute the HMAC to find it's wrong.
+    uint8_t cookie[DTLS_COOKIE_LENGTH] = { 0 };
+    RAND_bytes(cookie + 5, DTLS_COOKIE_MAC_LENGTH);
+
+    size_t cookieOffset = hello.Cookie - datagram;
+    forgedCookie.assign(datagram, datagram + cookieOffset);
+    forgedCookie.insert(forgedCookie.end(), cookie, cookie + sizeof(cookie));
+    forgedCookie.insert(forgedCookie.end(), datagram + cookieOffset, datagram + length);
+    forgedCookie[cookieOffset - 1] = DTLS_COOKIE_LENGTH;
+
+    // Record length, then the handshake message and fragment lengths.
+    size_t recordLength = (forgedCookie[11] << 8 | forgedCookie[12]) + DTLS_COOKIE_LENGTH;
+    forgedCookie[11] = recordLength >> 8 & 0xff;
+    forgedCookie[12] = recordLength & 0xff;
+
+    uint8_t* msg = forgedCookie.data() + DTLS_RECORD_HEADER_LENGTH;
+    size_t msgLength = ((size_t)msg[1] << 16 | msg[2] << 8 | msg[3]) + DTLS_COOKIE_LENGTH;
+    msg[1] = msg[9] = msgLength >> 16 & 0xff;
+    msg[2] = msg[10] = msgLength >> 8 & 0xff;
+    msg[3] = msg[11] = msgLength & 0xff;
+
+    DtlsClientHelloInfo forged;
+    return ParseDtlsClientHello(forgedCookie.data(), forgedCookie.size(), forged) && forged.CookieLength == DTLS_COOKIE_LENGTH;
+  }
+
+  /**
+  * Times what the server spends on one flood datagram: answering a
+  * ClientHello with no cookie or checking a forged one, against
+  * DTLSv1_listen doing the same for a ClientHello with no cookie.
+  */
+  static void MeasureFloodDatagramCost(SSL_CTX* serverCtx, const std::vector<uint8_t>& noCookie, const std::vector<uint8_t>& forgedCookie)
+  {
+    DtlsCookieGenerator* cookies = GetDtlsCookieGenerator(serverCtx);
+    if (cookies == nullptr) {
+      return;
+    }
+
+    PeerAddress src = PeerAddress::Loopback(AddressFamily::IPv4, FLOOD_TEST_SOURCE_PORT);
+    uint8_t hvr[DTLS_HELLO_VERIFY_REQUEST_MAX_LENGTH];
+    uint8_t cookie[DTLS_COOKIE_LENGTH];
+    DtlsClientHelloInfo hello;
+    size_t answered = 0;
+    size_t rejected = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < FLOOD_TEST_COST_ITERATIONS; i++) {
+      if (ParseDtlsClientHello(noCookie.data(), noCookie.size(), hello) && hello.CookieLength == 0) {
+        size_t cookieLength = cookies->Generate(src, cookie);
+        answered += WriteDtlsHelloVerifyRequest(hvr, hello, cookie, cookieLength) > 0;
+      }
+    }
+    double generateNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / FLOOD_TEST_COST_ITERATIONS;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < FLOOD_TEST_COST_ITERATIONS; i++) {
+      if (ParseDtlsClientHello(forgedCookie.data(), forgedCookie.size(), hello)) {
+        rejected += !cookies->Verify(src, hello.Cookie, hello.CookieLength);
+      }
+    }
+    double verifyNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / FLOOD_TEST_COST_ITERATIONS;
+
+    DtlsConnection listener(serverCtx, true);
+    size_t listenAnswered = 0;
+    size_t length = 0;
+
+    SetDtlsCookiePeer(listener.GetSsl(), &src);
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < FLOOD_TEST_COST_ITERATIONS; i++) {
+      listener.Listen(noCookie.data(), noCookie.size());
+      while (listener.NextDatagram(length) != nullptr) {
+        listenAnswered++;
+      }
+    }
+    double listenNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / FLOOD_TEST_COST_ITERATIONS;
+    SetDtlsCookiePeer(listener.GetSsl(), nullptr);
+
+    std::cout << std::fixed << std::setprecision(0);
+    std::cout << "Per datagram: no cookie, HMAC and HelloVerifyRequest " << generateNs << "ns (" << answered << " answered), forged cookie "
+      << verifyNs << "ns (" << rejected << " rejected), DTLSv1_listen no cookie " << listenNs << "ns (" << listenAnswered << " answered)." << std::endl;
+  }
+
+  /**
+  * Sends the flood datagrams alternately from FLOOD_TEST_SOURCES
+  * loopback addresses at a steady rate until told to stop.
+  */
+  static void RunFlood(const PeerAddress& serverAddress, int packetsPerSecond, const std::vector<uint8_t>& noCookie,
+    const std::vector<uint8_t>& forgedCookie, const std::atomic<bool>& exit, uint64_t& sent)
+  {
+    std::vector<std::unique_ptr<UdpSocket>> sources;
+
+    for (int i = 0; i < FLOOD_TEST_SOURCES; i++) {
+      // All of 127.0.0.0/8 is loopback, each source is a different address
+      // as well as a different port.
+      PeerAddress source = PeerAddress::Loopback(AddressFamily::IPv4, 0);
+      ((sockaddr_in*)&source.Addr)->sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + i);
+
+      try {
+        sources.emplace_back(new UdpSocket(source, DTLS_LOAD_TEST_CLIENT_BUFFER_SIZE));
+      }
+      catch (const std::exception& excp) {
+        std::cerr << "Flood source " << i << " could not be created, " << excp.what() << std::endl;
+        break;
+      }
+    }
+
+    if (sources.empty()) {
+      return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t attempted = 0;
+
+    while (!exit) {
+      double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      uint64_t due = (uint64_t)(elapsedSeconds * packetsPerSecond);
+
+      for (; attempted < due; attempted++) {
+        const std::vector<uint8_t>& datagram = (attempted % 2 == 0) ? noCookie : forgedCookie;
+        if (sources[attempted % sources.size()]->SendTo(datagram.data(), datagram.size(), serverAddress) > 0) {
+          sent++;
+        }
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  void RunDtlsFloodTest(int peerCount, int maxPacketsPerSecond)
+  {
+    std::cout << "DTLS flood test " << peerCount << " peers per round, spoofed ClientHello flood up to "
+      << maxPacketsPerSecond << " datagrams/s, IPv4 loopback." << std::endl;
+
+    RaiseDescriptorLimit(peerCount + FLOOD_TEST_SOURCES);
+
+    SSL_CTX* serverCtx = nullptr;
+    SSL_CTX* clientCtx = nullptr;
+    std::vector<uint8_t> noCookie;
+    std::vector<uint8_t> forgedCookie;
+
+    try {
+      serverCtx = CreateDtlsServerContext();
+      clientCtx = CreateDtlsClientContext();
+    }
+    catch (const std::exception& excp) {
+      std::cerr << excp.what() << std::endl;
+      SSL_CTX_free(serverCtx);
+      SSL_CTX_free(clientCtx);
+      return;
+    }
+
+    if (!MakeFloodDatagrams(clientCtx, noCookie, forgedCookie)) {
+      std::cerr << "Could not build the flood ClientHellos." << std::endl;
+      SSL_CTX_free(serverCtx);
+      SSL_CTX_free(clientCtx);
+      return;
+    }
+
+    MeasureFloodDatagramCost(serverCtx, noCookie, forgedCookie);
+
+    int rates[] = { 0, maxPacketsPerSecond / 4, maxPacketsPerSecond / 2, maxPacketsPerSecond };
+
+    for (int rate : rates) {
+      std::unique_ptr<DtlsServer> serverPtr;
+
+      try {
+        serverPtr.reset(new DtlsServer(serverCtx, PeerAddress::Loopback(AddressFamily::IPv4, 0)));
+      }
+      catch (const std::exception& excp) {
+        std::cerr << excp.what() << std::endl;
+        break;
+      }
+
+      DtlsServer& server = *serverPtr;
+      server.SetDataHandler(EchoHandler);
+
+      PeerAddress serverAddress = server.GetLocalAddress();
+      std::atomic<bool> exitServer{ false };
+      std::atomic<bool> exitFlood{ false };
+      uint64_t floodSent = 0;
+      std::thread serverThread([&]() { server.Run(exitServer); });
+      std::thread floodThread;
+
+      if (rate > 0) {
+        floodThread = std::thread([&]() { RunFlood(serverAddress, rate, noCookie, forgedCookie, exitFlood, floodSent); });
+      }
+
+      std::vector<LoadTestPeer> peers;
+      SwarmResult result;
+      RunClientSwarm(clientCtx, serverAddress, AddressFamily::IPv4, peerCount, FLOOD_TEST_IN_FLIGHT, 0, nullptr, peers, result);
+
+      exitFlood = true;
+      if (floodThread.joinable()) {
+        floodThread.join();
+      }
+
+      DtlsServerStats stats = server.GetStats();
+
+      std::cout << std::fixed << std::setprecision(1);
+      std::cout << "Flood " << (floodSent / result.ElapsedSeconds) << " datagrams/s: connected " << result.Connected << " of " << peerCount
+        << " in " << result.ElapsedSeconds << "s, " << (result.Connected / result.ElapsedSeconds) << " handshakes/s, p50 "
+        << Percentile(result.LatenciesMs, 0.5) << "ms, p99 " << Percentile(result.LatenciesMs, 0.99) << "ms, " << result.Failed << " failed." << std::endl;
+      std::cout << "  Server received " << stats.DatagramsReceived << ", hello verify requests " << stats.HelloVerifyRequests
+        << ", cookies rejected " << stats.CookiesRejected << ", discarded " << stats.DatagramsDiscarded
+        << ", handshakes started " << stats.HandshakesStarted << ", completed " << stats.HandshakesCompleted << "." << std::endl;
+
+      CloseSwarm(peers, result.Started, serverAddress, server);
+
+      exitServer = true;
+      serverThread.join();
+    }
+
+    SSL_CTX_free(serverCtx);
+    SSL_CTX_free(clientCtx);
+  }
+
+  /**
+  * @@Returns the CPU time used by the calling thread so far.
+  */
+  static double GetThreadCpuSeconds()
+  {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+      return 0.0;
+    }
+    uint64_t kernel100ns = (uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime;
+    uint64_t user100ns = (uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime;
+    return (kernel100ns + user100ns) / 1e7;
+#else
+    struct timespec now;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) != 0) {
+      return 0.0;
+    }
+    return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+  }
+
+  /**
+  * Runs one benchmark configuration against a fresh server.
+  */
+  static void RunHandshakeBenchmark(DtlsKeyType keyType, X509* certificate, EVP_PKEY* key, const char* cipherList,
+    const char* srtpProfiles, int handshakes, int concurrency)
+  {
+    SSL_CTX* serverCtx = nullptr;
+    SSL_CTX* clientCtx = nullptr;
+    std::unique_ptr<DtlsServer> serverPtr;
+
+    std::cout << std::left << std::setw(12) << GetDtlsKeyTypeName(keyType) << std::setw(36) << cipherList
+      << std::setw(24) << srtpProfiles << std::flush;
+
+    try {
+      serverCtx = CreateDtlsServerContext(certificate, key, cipherList, srtpProfiles);
+      clientCtx = CreateDtlsClientContext(cipherList, srtpProfiles);
+      serverPtr.reset(new DtlsServer(serverCtx, PeerAddress::Loopback(AddressFamily::IPv4, 0)));
+    }
+    catch (const std::exception& excp) {
+      std::cout << "not run, " << excp.what() << std::endl;
+      SSL_CTX_free(serverCtx);
+      SSL_CTX_free(clientCtx);
+      return;
+    }
+
+    SSL_CTX_free(serverCtx);
+
+    DtlsServer& server = *serverPtr;
+    server.SetDataHandler(EchoHandler);
+
+    PeerAddress serverAddress = server.GetLocalAddress();
+    std::atomic<bool> exitServer{ false };
+    std::atomic<double> serverCpuSeconds{ 0.0 };
+
+    // The server thread's own CPU time is its cost for the handshakes, the
+    // rest of the process is the clients.
+    std::thread serverThread([&]() {
+      double cpuStart = GetThreadCpuSeconds();
+      while (!exitServer) {
+        server.Poll(DTLS_SERVER_RUN_WAIT_MS);
+        serverCpuSeconds = GetThreadCpuSeconds() - cpuStart;
+      }
+    });
+
+    std::vector<LoadTestPeer> peers;
+    SwarmResult result;
+    double processCpuStart = GetProcessCpuSeconds();
+    RunClientSwarm(clientCtx, serverAddress, AddressFamily::IPv4, handshakes, concurrency, 0, nullptr, peers, result);
+    double processCpu = GetProcessCpuSeconds() - processCpuStart;
+    double serverCpu = serverCpuSeconds;
+
+    std::string negotiated = "none";
+    for (int i = 0; i < result.Started; i++) {
+      SSL* ssl = peers[i].Connection->GetSsl();
+      if (peers[i].Connection->GetState() == DtlsState::Connected) {
+        SRTP_PROTECTION_PROFILE* srtp = SSL_get_selected_srtp_profile(ssl);
+        negotiated = std::string(SSL_get_cipher_name(ssl)) + " " + (srtp ? srtp->name : "no SRTP");
+        break;
+      }
+    }
+
+    if (result.Connected == 0) {
+      std::cout << "all " << handshakes << " failed" << std::endl;
+    }
+    else {
+      std::cout << std::right << std::fixed << std::setprecision(1) << std::setw(8) << (result.Connected / result.ElapsedSeconds)
+        << std::setw(9) << Percentile(result.LatenciesMs, 0.5) << std::setw(9) << Percentile(result.LatenciesMs, 0.99)
+        << std::setprecision(2) << std::setw(10) << (1000.0 * serverCpu / result.Connected)
+        << std::setw(10) << (1000.0 * (processCpu - serverCpu) / result.Connected)
+        << "  " << result.Connected << "/" << handshakes << " " << negotiated << std::endl;
+    }
+
+    CloseSwarm(peers, result.Started, serverAddress, server);
+
+    exitServer = true;
+    serverThread.join();
+
+    peers.clear();
+    SSL_CTX_free(clientCtx);
+  }
+
+  void RunDtlsHandshakeBenchmark(int handshakes, int concurrency)
+  {
+    // OpenSSL 3.0 doesn't allow Ed25519 signatures in DTLS 1.2, only TLS,
+    // with it those handshakes fail with no shared cipher.
+    const DtlsKeyType keyTypes[] = { DtlsKeyType::Rsa2048, DtlsKeyType::EcdsaP256, DtlsKeyType::Ed25519 };
+    const char* cipherLists[] = { DTLS_CIPHER_LIST, "ECDHE+AESGCM", "ECDHE+CHACHA20" };
+    const char* srtpProfiles[] = { "SRTP_AES128_CM_SHA1_80", "SRTP_AEAD_AES_128_GCM" };
+
+    std::cout << "DTLS handshake benchmark " << handshakes << " handshakes per configuration, " << concurrency
+      << " at once, IPv4 loopback, client and server in this process." << std::endl;
+
+    RaiseDescriptorLimit(handshakes);
+
+    std::cout << std::left << std::setw(12) << "Key" << std::setw(36) << "Cipher list" << std::setw(24) << "SRTP profiles"
+      << std::right << std::setw(8) << "hs/s" << std::setw(9) << "p50 ms" << std::setw(9) << "p99 ms"
+      << std::setw(10) << "srv ms/hs" << std::setw(10) << "cli ms/hs" << "  connected, negotiated" << std::endl;
+
+    for (DtlsKeyType keyType : keyTypes) {
+      X509* certificate = nullptr;
+      EVP_PKEY* key = nullptr;
+
+      try {
+        GenerateDtlsCertificate(keyType, certificate, key);
+      }
+      catch (const std::exception& excp) {
+        std::cout << excp.what() << std::endl;
+        continue;
+      }
+
+      for (const char* cipherList : cipherLists) {
+        for (const char* srtp : srtpProfiles) {
+          RunHandshakeBenchmark(keyType, certificate, key, cipherList, srtp, handshakes, concurrency);
+        }
+      }
+
+      X509_free(certificate);
+      EVP_PKEY_free(key);
+    }
+  }
+
+  /**
+  * Runs one round of the resumption benchmark against a running server and
+  * prints its row.
+  * @param[in] serverCpuSeconds: the server thread's CPU time so far, kept up
+  *  to date by that thread.
+  */
+  static void RunResumptionRound(const char* name, SSL_CTX* clientCtx, DtlsSessionCache& sessions, DtlsServer& server,
+    const std::atomic<double>& serverCpuSeconds, int handshakes, int concurrency)
+  {
+    PeerAddress serverAddress = server.GetLocalAddress();
+    std::vector<LoadTestPeer> peers;
+    SwarmResult result;
+
+    std::cout << std::left << std::setw(12) << "" << std::setw(28) << name << std::flush;
+
+    double serverCpuStart = serverCpuSeconds;
+    double processCpuStart = GetProcessCpuSeconds();
+    RunClientSwarm(clientCtx, serverAddress, AddressFamily::IPv4, handshakes, concurrency, 0, &sessions, peers, result);
+    double processCpu = GetProcessCpuSeconds() - processCpuStart;
+    double serverCpu = serverCpuSeconds - serverCpuStart;
+
+    if (result.Connected == 0) {
+      std::cout << "all " << handshakes << " failed" << std::endl;
+    }
+    else {
+      std::cout << std::right << std::fixed << std::setprecision(1) << std::setw(8) << (result.Connected / result.ElapsedSeconds)
+        << std::setw(9) << Percentile(result.LatenciesMs, 0.5) << std::setw(9) << Percentile(result.LatenciesMs, 0.99)
+        << std::setprecision(2) << std::setw(10) << (1000.0 * serverCpu / result.Connected)
+        << std::setw(10) << (1000.0 * (processCpu - serverCpu) / result.Connected)
+        << "  " << result.Connected << "/" << handshakes << ", " << result.Resumed << " resumed" << std::endl;
+    }
+
+    CloseSwarm(peers, result.Started, serverAddress, server);
+  }
+
+  void RunDtlsResumptionBenchmark(int handshakes, int concurrency)
+  {
+    const DtlsKeyType keyTypes[] = { DtlsKeyType::Rsa2048, DtlsKeyType::EcdsaP256 };
+
+    std::cout << "DTLS resumption benchmark " << handshakes << " handshakes per round, " << concurrency
+      << " at once, IPv4 loopback, client and server in this process." << std::endl;
+    std::cout << "Each resumed round reconnects the peers of the round before it from new addresses." << std::endl;
+
+    RaiseDescriptorLimit(handshakes);
+
+    std::cout << std::left << std::setw(12) << "Key" << std::setw(28) << "Round"
+      << std::right << std::setw(8) << "hs/s" << std::setw(9) << "p50 ms" << std::setw(9) << "p99 ms"
+      << std::setw(10) << "srv ms/hs" << std::setw(10) << "cli ms/hs" << "  connected" << std::endl;
+
+    for (DtlsKeyType keyType : keyTypes) {
+      X509* certificate = nullptr;
+      EVP_PKEY* key = nullptr;
+      SSL_CTX* serverCtx = nullptr;
+      SSL_CTX* ticketClientCtx = nullptr;
+      SSL_CTX* sessionIdClientCtx = nullptr;
+      std::unique_ptr<DtlsServer> serverPtr;
+
+      std::cout << GetDtlsKeyTypeName(keyType) << std::endl;
+
+      try {
+        GenerateDtlsCertificate(keyType, certificate, key);
+        serverCtx = CreateDtlsServerContext(certificate, key);
+        ticketClientCtx = CreateDtlsClientContext();
+        sessionIdClientCtx = CreateDtlsClientContext();
+        serverPtr.reset(new DtlsServer(serverCtx, PeerAddress::Loopback(AddressFamily::IPv4, 0)));
+      }
+      catch (const std::exception& excp) {
+        std::cout << "not run, " << excp.what() << std::endl;
+        SSL_CTX_free(serverCtx);
+        SSL_CTX_free(ticketClientCtx);
+        SSL_CTX_free(sessionIdClientCtx);
+        X509_free(certificate);
+        EVP_PKEY_free(key);
+        continue;
+      }
+
+      // Without a ticket to offer the client resumes by session ID from the
+      // server's cache.
+      SSL_CTX_set_options(sessionIdClientCtx, SSL_OP_NO_TICKET);
+
+      DtlsServer& server = *serverPtr;
+      server.SetDataHandler(EchoHandler);
+
+      std::atomic<bool> exitServer{ false };
+      std::atomic<double> serverCpuSeconds{ 0.0 };
+
+      std::thread serverThread([&]() {
+        double cpuStart = GetThreadCpuSeconds();
+        while (!exitServer) {
+          server.Poll(DTLS_SERVER_RUN_WAIT_MS);
+          serverCpuSeconds = GetThreadCpuSeconds() - cpuStart;
+        }
+      });
+
+      DtlsSessionCache ticketSessions;
+      DtlsSessionCache sessionIdSessions;
+
+      RunResumptionRound("full, ticket issued", ticketClientCtx, ticketSessions, server, serverCpuSeconds, handshakes, concurrency);
+      RunResumptionRound("resumed, session ticket", ticketClientCtx, ticketSessions, server, serverCpuSeconds, handshakes, concurrency);
+      RunResumptionRound("full, no ticket", sessionIdClientCtx, sessionIdSessions, server, serverCpuSeconds, handshakes, concurrency);
+      RunResumptionRound("resumed, session ID", sessionIdClientCtx, sessionIdSessions, server, serverCpuSeconds, handshakes, concurrency);
+
+      exitServer = true;
+      serverThread.join();
+
+      DtlsSessionCache* serverCache = GetDtlsSessionCache(serverCtx);
+      if (serverCache != nullptr) {
+        DtlsSessionCacheStats stats = serverCache->GetStats();
+        std::cout << std::left << std::setw(12) << "" << "server session cache " << stats.Sessions << " sessions, "
+          << stats.Hits << " hits, " << stats.Misses << " misses, " << stats.Evictions << " evictions." << std::endl;
+      }
+
+      serverPtr.reset();
+      SSL_CTX_free(serverCtx);
+      SSL_CTX_free(ticketClientCtx);
+      SSL_CTX_free(sessionIdClientCtx);
+      X509_free(certificate);
+      EVP_PKEY_free(key);
+    }
+  }
+}
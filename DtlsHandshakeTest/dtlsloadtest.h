@@ -0,0 +1,101 @@
+//-----------------------------------------------------------------------------
+// Filename: dtlsloadtest.h
+//
+// Description: Loopback load test for DtlsServer. A swarm of client peers,
+// each with its own UDP socket so the server sees a distinct 5-tuple per
+// peer, handshake with one server socket and stay connected until every
+// peer is up, showing the server holding them all at once. Each peer sends
+// a ping the server echoes back, to show the records go to the right SSL.
+//
+// The clients run on the calling thread over memory BIO DtlsConnections,
+// the same as the server's, polled with epoll or WSAPoll, with their
+// retransmission and ping timers on a TimerWheel. The server has a thread
+// of its own.
+//
+// The flood test does the same while another thread sprays the server with
+// ClientHellos from hundreds of loopback addresses that never answer, half
+// without a cookie and half with a forged one, standing in for a spoofed
+// source flood. It shows how many real handshakes still get through as the
+// flood rate goes up, and what each flood datagram costs the server.
+//
+// The handshake benchmark measures a storm of call setups: the handshake
+// rate, latency and the server's and clients' CPU per handshake, for each
+// certificate key type, cipher list and SRTP profile combination.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 18 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_DTLSLOADTEST_H
+#define SIPSORCERY_DTLSLOADTEST_H
+
+#include "udpsocket.h"
+
+#define DTLS_LOAD_TEST_DEFAULT_PEERS 10000
+#define DTLS_LOAD_TEST_DEFAULT_IN_FLIGHT 256          // Handshakes started but not finished at any one time.
+#define DTLS_LOAD_TEST_TIMEOUT_SECONDS 600
+#define DTLS_LOAD_TEST_CLOSE_TIMEOUT_SECONDS 10
+#define DTLS_LOAD_TEST_HOLD_SECONDS 10                // Peers are held connected this long to measure idle CPU.
+#define DTLS_LOAD_TEST_CLIENT_BUFFER_SIZE (64 * 1024)
+#define DTLS_FLOOD_TEST_DEFAULT_PEERS 2000
+#define DTLS_FLOOD_TEST_DEFAULT_RATE 100000          // Flood datagrams per second at the top of the sweep.
+#define DTLS_BENCHMARK_DEFAULT_HANDSHAKES 200
+#define DTLS_BENCHMARK_DEFAULT_CONCURRENCY 32
+
+namespace sipsorcery
+{
+  /**
+  * Connects peerCount client peers to a DtlsServer on loopback, checks each
+  * can exchange application data, holds them connected for a while, then
+  * closes them all. Prints the handshake rate, latency percentiles, the CPU
+  * used while holding and the server's peer counts.
+  * @param[in] peerCount: the number of peers, each needs a socket so the
+  *  process file descriptor limit is raised to fit on Linux.
+  * @param[in] maxInFlight: the most handshakes to have in progress at once.
+  * @param[in] family: IPv4 or IPv6 loopback.
+  */
+  void RunDtlsLoadTest(int peerCount, int maxInFlight, AddressFamily family);
+
+  /**
+  * Prints the server's cost per flood datagram, then connects peerCount
+  * peers to a DtlsServer on IPv4 loopback with no flood and with floods of
+  * a quarter, half and all of maxPacketsPerSecond, printing the handshake
+  * rate, latency percentiles and the server's cookie counts for each.
+  * @param[in] peerCount: the number of peers to connect at each flood rate.
+  * @param[in] maxPacketsPerSecond: the highest flood rate.
+  */
+  void RunDtlsFloodTest(int peerCount, int maxPacketsPerSecond);
+
+  /**
+  * Runs handshakes between clients and a DtlsServer on IPv4 loopback with
+  * certificates generated for RSA-2048, ECDSA P-256 and Ed25519 keys, each
+  * against a set of cipher lists and SRTP profiles. Prints the handshake
+  * rate, latency percentiles, the server and client CPU per handshake and
+  * what was negotiated for each.
+  * @param[in] handshakes: the number of handshakes for each combination.
+  * @param[in] concurrency: the most handshakes in progress at once.
+  */
+  void RunDtlsHandshakeBenchmark(int handshakes, int concurrency);
+
+  /**
+  * Measures handshake cost with and without session resumption. For
+  * certificates generated for RSA-2048 and ECDSA P-256 keys, connects
+  * handshakes peers to one DtlsServer on IPv4 loopback four times: full
+  * handshakes issuing session tickets, the same peers resuming with their
+  * tickets, full handshakes with tickets turned off and those peers
+  * resuming by session ID. Prints the same columns as the handshake
+  * benchmark for each round, with how many resumed, and the server's
+  * session cache counts.
+  * @param[in] handshakes: the number of handshakes in each round.
+  * @param[in] concurrency: the most handshakes in progress at once.
+  */
+  void RunDtlsResumptionBenchmark(int handshakes, int concurrency);
+}
+
+#endif // SIPSORCERY_DTLSLOADTEST_H
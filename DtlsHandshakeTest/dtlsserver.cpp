@@ -0,0 +1,332 @@
+#include "dtlsserver.h"
+
+#include <algorithm>
+
+namespace sipsorcery
+{
+  DtlsServer::DtlsServer(SSL_CTX* ctx, const PeerAddress& bindAddress) :
+    _ctx(ctx),
+    _cookies(GetDtlsCookieGenerator(ctx)),
+    _socket(bindAddress),
+    _poller(),
+    _listener(),
+    _peers(),
+    _dataHandler(),
+    _timers(std::chrono::milliseconds(DTLS_SERVER_TIMER_TICK_MS), DTLS_SERVER_TIMER_SLOTS),
+    _expired(),
+    _readyIds()
+  {
+    SSL_CTX_up_ref(_ctx);
+    _poller.Add(_socket, 0);
+  }
+
+  DtlsServer::~DtlsServer()
+  {
+    for (auto& entry : _peers) {
+      Peer& peer = *entry.second;
+      peer.Connection->Shutdown();
+      Flush(*peer.Connection, peer.Address);
+    }
+
+    // The connections hold their own references to the context.
+    _peers.clear();
+    _listener.reset();
+    SSL_CTX_free(_ctx);
+  }
+
+  void DtlsServer::Poll(int timeoutMs)
+  {
+    auto now = std::chrono::steady_clock::now();
+    int untilTimerMs = _timers.GetNextTimeoutMs(now);
+    int waitMs = (untilTimerMs < 0) ? timeoutMs : std::min(timeoutMs, untilTimerMs);
+
+    if (_poller.Wait(waitMs, _readyIds) > 0) {
+      now = std::chrono::steady_clock::now();
+      PeerAddress src;
+
+      for (int i = 0; i < DTLS_SERVER_RECEIVE_BATCH; i++) {
+        int length = _socket.RecvFrom(_recvBuf, sizeof(_recvBuf), src);
+        if (length < 0) {
+          break;
+        }
+
+        _datagramsReceived++;
+        OnDatagram(src, _recvBuf, length, now);
+      }
+    }
+
+    RunTimers(std::chrono::steady_clock::now());
+  }
+
+  void DtlsServer::Run(const std::atomic<bool>& exit)
+  {
+    while (!exit) {
+      Poll(DTLS_SERVER_RUN_WAIT_MS);
+    }
+  }
+
+  bool DtlsServer::Send(const PeerAddress& peer, const uint8_t* data, size_t length)
+  {
+    auto it = _peers.find(peer);
+    if (it == _peers.end() || it->second->Connection->Write(data, length) < 0) {
+      return false;
+    }
+
+    Flush(*it->second->Connection, peer);
+    return true;
+  }
+
+  DtlsServerStats DtlsServer::GetStats() const
+  {
+    DtlsServerStats stats;
+    stats.DatagramsReceived = _datagramsReceived;
+    stats.DatagramsSent = _datagramsSent;
+    stats.DatagramsDiscarded = _datagramsDiscarded;
+    stats.HelloVerifyRequests = _helloVerifyRequests;
+    stats.CookiesRejected = _cookiesRejected;
+    stats.HandshakesStarted = _handshakesStarted;
+    stats.HandshakesCompleted = _handshakesCompleted;
+    stats.HandshakesFailed = _handshakesFailed;
+    stats.HandshakesTimedOut = _handshakesTimedOut;
+    stats.PeersClosed = _peersClosed;
+    stats.Peers = _peerCount;
+    stats.PeakPeers = _peakPeers;
+    return stats;
+  }
+
+  void DtlsServer::OnDatagram(const PeerAddress& src, const uint8_t* buf, size_t length, std::chrono::steady_clock::time_point now)
+  {
+    auto it = _peers.find(src);
+    if (it == _peers.end()) {
+      OnNewPeerDatagram(src, buf, length, now);
+      return;
+    }
+
+    Peer& peer = *it->second;
+    DtlsConnection& connection = *peer.Connection;
+    peer.LastReceived = now;
+    connection.Feed(buf, length);
+
+    if (connection.GetState() == DtlsState::Handshaking) {
+      DtlsState state = connection.Handshake();
+      if (state == DtlsState::Connected) {
+        _handshakesCompleted++;
+      }
+      else if (state != DtlsState::Handshaking) {
+        // Send the alert, if there is one, before dropping the peer.
+        Flush(connection, peer.Address);
+        _handshakesFailed++;
+        RemovePeer(it);
+        return;
+      }
+    }
+
+    bool open = (connection.GetState() == DtlsState::Connected) ? ReadApplicationData(peer) : true;
+    Flush(connection, peer.Address);
+
+    if (!open) {
+      _peersClosed++;
+      RemovePeer(it);
+      return;
+    }
+
+    ArmTimer(peer, now);
+  }
+
+  void DtlsServer::OnNewPeerDatagram(const PeerAddress& src, const uint8_t* buf, size_t length, std::chrono::steady_clock::time_point now)
+  {
+    if (_cookies != nullptr && !CheckCookie(src, buf, length)) {
+      return;
+    }
+
+    if (!_listener) {
+      _listener.reset(new DtlsConnection(_ctx, true));
+    }
+
+    // The cookie gets checked again by DTLSv1_listen, and by the handshake
+    // when it picks up the ClientHello, but only for peers that have
+    // already shown they can receive.
+    SetDtlsCookiePeer(_listener->GetSsl(), &src);
+
+    if (!_listener->Listen(buf, length)) {
+      SetDtlsCookiePeer(_listener->GetSsl(), nullptr);
+      size_t sent = 0;
+      size_t datagramLength = 0;
+      const uint8_t* datagram = nullptr;
+
+      while ((datagram = _listener->NextDatagram(datagramLength)) != nullptr) {
+        if (_socket.SendTo(datagram, datagramLength, src) > 0) {
+          _datagramsSent++;
+        }
+        sent++;
+      }
+
+      if (sent > 0) {
+        _helloVerifyRequests++;
+      }
+      else {
+        _datagramsDiscarded++;
+      }
+      return;
+    }
+
+    // The ClientHello had a valid cookie, the listener becomes this peer's
+    // connection and picks up the handshake from the buffered ClientHello.
+    std::unique_ptr<Peer> peer(new Peer());
+    peer->Address = src;
+    peer->Connection = std::move(_listener);
+    peer->Started = now;
+    peer->LastReceived = now;
+    SetDtlsCookiePeer(peer->Connection->GetSsl(), &peer->Address);
+    _handshakesStarted++;
+
+    DtlsState state = peer->Connection->Handshake();
+    Flush(*peer->Connection, src);
+
+    if (state != DtlsState::Handshaking && state != DtlsState::Connected) {
+      _handshakesFailed++;
+      return;
+    }
+
+    ArmTimer(*peer, now);
+    _peers.emplace(src, std::move(peer));
+
+    uint64_t count = ++_peerCount;
+    if (count > _peakPeers) {
+      _peakPeers = count;
+    }
+  }
+
+  bool DtlsServer::CheckCookie(const PeerAddress& src, const uint8_t* buf, size_t length)
+  {
+    DtlsClientHelloInfo hello;
+    if (!ParseDtlsClientHello(buf, length, hello)) {
+      _datagramsDiscarded++;
+      return false;
+    }
+
+    if (hello.CookieLength == 0) {
+      uint8_t cookie[DTLS_COOKIE_LENGTH];
+      size_t cookieLength = _cookies->Generate(src, cookie);
+      if (cookieLength == 0) {
+        _datagramsDiscarded++;
+        return false;
+      }
+
+      size_t hvrLength = WriteDtlsHelloVerifyRequest(_helloVerifyBuf, hello, cookie, cookieLength);
+      if (_socket.SendTo(_helloVerifyBuf, hvrLength, src) > 0) {
+        _datagramsSent++;
+      }
+      _helloVerifyRequests++;
+      return false;
+    }
+
+    if (!_cookies->Verify(src, hello.Cookie, hello.CookieLength)) {
+      _cookiesRejected++;
+      return false;
+    }
+
+    return true;
+  }
+
+  bool DtlsServer::ReadApplicationData(Peer& peer)
+  {
+    int length = 0;
+
+    while ((length = peer.Connection->Read(_readBuf, sizeof(_readBuf))) > 0) {
+      if (_dataHandler) {
+        _dataHandler(*this, peer.Address, _readBuf, length);
+      }
+    }
+
+    return length == 0;
+  }
+
+  void DtlsServer::Flush(DtlsConnection& connection, const PeerAddress& dst)
+  {
+    size_t length = 0;
+    const uint8_t* datagram = nullptr;
+
+    while ((datagram = connection.NextDatagram(length)) != nullptr) {
+      if (_socket.SendTo(datagram, length, dst) > 0) {
+        _datagramsSent++;
+      }
+    }
+  }
+
+  DtlsServer::PeerMap::iterator DtlsServer::RemovePeer(PeerMap::iterator it)
+  {
+    _peerCount--;
+    return _peers.erase(it);
+  }
+
+  void DtlsServer::ArmTimer(Peer& peer, std::chrono::steady_clock::time_point now)
+  {
+    std::chrono::steady_clock::time_point deadline;
+
+    if (peer.Connection->GetState() == DtlsState::Handshaking) {
+      deadline = peer.Started + std::chrono::seconds(DTLS_SERVER_HANDSHAKE_TIMEOUT_SECONDS);
+
+      std::chrono::milliseconds retransmit;
+      if (peer.Connection->GetTimeout(retransmit)) {
+        deadline = std::min(deadline, now + retransmit);
+      }
+    }
+    else {
+      deadline = peer.LastReceived + std::chrono::seconds(DTLS_SERVER_IDLE_TIMEOUT_SECONDS);
+    }
+
+    if (peer.TimerDeadline == std::chrono::steady_clock::time_point() || deadline < peer.TimerDeadline) {
+      peer.TimerDeadline = deadline;
+      _timers.Schedule(peer.Address, deadline);
+    }
+  }
+
+  void DtlsServer::RunTimers(std::chrono::steady_clock::time_point now)
+  {
+    _timers.Expire(now, _expired);
+
+    for (const auto& expiry : _expired) {
+      // Timers for peers that have gone, or that were replaced by an
+      // earlier one, are ignored.
+      auto it = _peers.find(expiry.first);
+      if (it != _peers.end() && it->second->TimerDeadline == expiry.second) {
+        OnTimer(it, now);
+      }
+    }
+  }
+
+  void DtlsServer::OnTimer(PeerMap::iterator it, std::chrono::steady_clock::time_point now)
+  {
+    Peer& peer = *it->second;
+    DtlsConnection& connection = *peer.Connection;
+
+    peer.TimerDeadline = std::chrono::steady_clock::time_point();
+
+    if (connection.GetState() == DtlsState::Handshaking) {
+      if (now - peer.Started >= std::chrono::seconds(DTLS_SERVER_HANDSHAKE_TIMEOUT_SECONDS)) {
+        _handshakesTimedOut++;
+        RemovePeer(it);
+        return;
+      }
+
+      if (connection.HandleTimeout()) {
+        Flush(connection, peer.Address);
+      }
+      else if (connection.GetState() == DtlsState::Failed) {
+        _handshakesFailed++;
+        RemovePeer(it);
+        return;
+      }
+    }
+    else if (now - peer.LastReceived >= std::chrono::seconds(DTLS_SERVER_IDLE_TIMEOUT_SECONDS)) {
+      connection.Shutdown();
+      Flush(connection, peer.Address);
+      _peersClosed++;
+      RemovePeer(it);
+      return;
+    }
+
+    ArmTimer(peer, now);
+  }
+}
@@ -0,0 +1,200 @@
+//-----------------------------------------------------------------------------
+// Filename: dtlsserver.h
+//
+// Description: DTLS server for any number of peers on one UDP socket, as
+// needed for WebRTC ingest where every browser talks to the same port.
+//
+// Datagrams are demultiplexed by the peer's address and port into a
+// DtlsConnection each, all created from one shared SSL_CTX. A datagram from
+// an address without a connection has to be a ClientHello. If the context
+// has a DtlsCookieGenerator the server answers it with a HelloVerifyRequest,
+// or checks the cookie it came back with, itself, without keeping any state
+// or touching an SSL, so a flood from spoofed addresses costs one HMAC a
+// datagram. Only a ClientHello with a valid cookie goes to the single
+// listening connection running DTLSv1_listen, which gets handed over to the
+// new peer, and a new one is made for the next. Without a generator every
+// ClientHello goes to DTLSv1_listen.
+//
+// Everything runs on one thread, the socket is waited on with epoll, or
+// WSAPoll on Windows. Each peer has one timer on a timer wheel, set to
+// whichever comes first of OpenSSL's retransmission timer, from
+// DTLSv1_get_timeout, and the handshake or idle timeout. The poll only
+// wakes for datagrams and timers that are due, so an idle server uses next
+// to no CPU however many peers it has.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 18 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//
+// OpenSSL License:
+// This application includes software developed by the OpenSSL Project and
+// cryptographic software written by Eric Young (eay@cryptsoft.com)
+// See https://github.com/openssl/openssl/blob/master/LICENSE for conditions.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_DTLSSERVER_H
+#define SIPSORCERY_DTLSSERVER_H
+
+#include "dtlsconnection.h"
+#include "dtlscookie.h"
+#include "timerwheel.h"
+#include "udpsocket.h"
+
+#include <openssl/ssl.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#define DTLS_SERVER_TIMER_TICK_MS 10
+#define DTLS_SERVER_TIMER_SLOTS 1024
+#define DTLS_SERVER_RUN_WAIT_MS 500            // Longest Run waits before checking whether to exit.
+#define DTLS_SERVER_HANDSHAKE_TIMEOUT_SECONDS 15
+#define DTLS_SERVER_IDLE_TIMEOUT_SECONDS 30
+#define DTLS_SERVER_RECEIVE_BATCH 64        // Datagrams read per wakeup before the timers get a look in.
+
+namespace sipsorcery
+{
+  struct DtlsServerStats
+  {
+    uint64_t DatagramsReceived;
+    uint64_t DatagramsSent;
+    uint64_t DatagramsDiscarded;      // From peers without a connection that weren't a ClientHello.
+    uint64_t HelloVerifyRequests;     // ClientHellos without a cookie, answered without keeping state.
+    uint64_t CookiesRejected;         // ClientHellos with a cookie that wasn't made for the sender, or has expired.
+    uint64_t HandshakesStarted;
+    uint64_t HandshakesCompleted;
+    uint64_t HandshakesFailed;
+    uint64_t HandshakesTimedOut;
+    uint64_t PeersClosed;             // By close_notify or idle timeout.
+    uint64_t Peers;                   // Current number of connections, handshaking or connected.
+    uint64_t PeakPeers;
+  };
+
+  class DtlsServer
+  {
+  public:
+    /**
+    * Handed each piece of application data received from a connected peer.
+    */
+    typedef std::function<void(DtlsServer& server, const PeerAddress& peer, const uint8_t* data, size_t length)> DataHandler;
+
+    /**
+    * @param[in] ctx: the server context shared by all peers, the server
+    *  takes its own reference.
+    * @param[in] bindAddress: the address to listen on, port 0 for an ephemeral port.
+    * Throws std::runtime_error if the socket or poller cannot be created.
+    */
+    DtlsServer(SSL_CTX* ctx, const PeerAddress& bindAddress);
+    ~DtlsServer();
+
+    DtlsServer(const DtlsServer&) = delete;
+    DtlsServer& operator=(const DtlsServer&) = delete;
+
+    void SetDataHandler(DataHandler handler) { _dataHandler = handler; }
+
+    /**
+    * Waits for datagrams, processes them and runs the timers that are due.
+    * Everything except GetStats has to be called from the thread that polls.
+    * @param[in] timeoutMs: the longest to wait for a datagram, it's cut
+    *  short if a timer is due sooner.
+    */
+    void Poll(int timeoutMs);
+
+    /**
+    * Polls until exit is set.
+    */
+    void Run(const std::atomic<bool>& exit);
+
+    /**
+    * Sends application data to a connected peer.
+    * @@Returns false if there's no connected peer at the address.
+    */
+    bool Send(const PeerAddress& peer, const uint8_t* data, size_t length);
+
+    /**
+    * Can be called from any thread.
+    */
+    DtlsServerStats GetStats() const;
+
+    const PeerAddress& GetLocalAddress() const { return _socket.GetLocalAddress(); }
+
+  private:
+    struct Peer
+    {
+      PeerAddress Address;
+      std::unique_ptr<DtlsConnection> Connection;
+      std::chrono::steady_clock::time_point Started;
+      std::chrono::steady_clock::time_point LastReceived;
+      std::chrono::steady_clock::time_point TimerDeadline;    // Of the peer's current timer on the wheel, zero if none.
+    };
+
+    typedef std::unordered_map<PeerAddress, std::unique_ptr<Peer>, PeerAddressHash> PeerMap;
+    typedef TimerWheel<PeerAddress> PeerTimerWheel;
+
+    SSL_CTX* _ctx;
+    DtlsCookieGenerator* _cookies;    // Owned by the context, nullptr to leave cookies to DTLSv1_listen.
+    UdpSocket _socket;
+    SocketPoller _poller;
+    std::unique_ptr<DtlsConnection> _listener;
+    PeerMap _peers;
+    DataHandler _dataHandler;
+    PeerTimerWheel _timers;
+    std::vector<PeerTimerWheel::Expiry> _expired;
+    std::vector<size_t> _readyIds;
+    uint8_t _recvBuf[DTLS_MAX_DATAGRAM_LENGTH];
+    uint8_t _readBuf[DTLS_MAX_DATAGRAM_LENGTH];
+    uint8_t _helloVerifyBuf[DTLS_HELLO_VERIFY_REQUEST_MAX_LENGTH];
+
+    std::atomic<uint64_t> _datagramsReceived{ 0 };
+    std::atomic<uint64_t> _datagramsSent{ 0 };
+    std::atomic<uint64_t> _datagramsDiscarded{ 0 };
+    std::atomic<uint64_t> _helloVerifyRequests{ 0 };
+    std::atomic<uint64_t> _cookiesRejected{ 0 };
+    std::atomic<uint64_t> _handshakesStarted{ 0 };
+    std::atomic<uint64_t> _handshakesCompleted{ 0 };
+    std::atomic<uint64_t> _handshakesFailed{ 0 };
+    std::atomic<uint64_t> _handshakesTimedOut{ 0 };
+    std::atomic<uint64_t> _peersClosed{ 0 };
+    std::atomic<uint64_t> _peerCount{ 0 };
+    std::atomic<uint64_t> _peakPeers{ 0 };
+
+    void OnDatagram(const PeerAddress& src, const uint8_t* buf, size_t length, std::chrono::steady_clock::time_point now);
+    void OnNewPeerDatagram(const PeerAddress& src, const uint8_t* buf, size_t length, std::chrono::steady_clock::time_point now);
+
+    /**
+    * Answers or checks the cookie of a datagram from an unknown peer.
+    * @@Returns true if it's a ClientHello with a valid cookie and can go to
+    *  the listener.
+    */
+    bool CheckCookie(const PeerAddress& src, const uint8_t* buf, size_t length);
+
+    /**
+    * Reads application data and checks for the peer closing.
+    * @@Returns false if the peer has gone and should be removed.
+    */
+    bool ReadApplicationData(Peer& peer);
+
+    void Flush(DtlsConnection& connection, const PeerAddress& dst);
+    PeerMap::iterator RemovePeer(PeerMap::iterator it);
+
+    /**
+    * Makes sure the peer has a timer on the wheel for its next deadline. A
+    * timer that's already set for an earlier time is left, it'll set the
+    * next one when it expires.
+    */
+    void ArmTimer(Peer& peer, std::chrono::steady_clock::time_point now);
+    void RunTimers(std::chrono::steady_clock::time_point now);
+    void OnTimer(PeerMap::iterator it, std::chrono::steady_clock::time_point now);
+  };
+}
+
+#endif // SIPSORCERY_DTLSSERVER_H
@@ -0,0 +1,349 @@
+#include "dtlssession.h"
+#include "dtlscontext.h"
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
+
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <stdexcept>
+
+namespace sipsorcery
+{
+  static int _ctxCacheIndex = -1;
+  static int _ctxTicketKeysIndex = -1;
+  static std::once_flag _exDataIndexOnce;
+
+  static void FreeSessionCache(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+  {
+    delete (DtlsSessionCache*)ptr;
+  }
+
+  static void FreeTicketKeys(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*)
+  {
+    delete (DtlsTicketKeys*)ptr;
+  }
+
+  static void InitExDataIndexes()
+  {
+    std::call_once(_exDataIndexOnce, []() {
+      _ctxCacheIndex = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, FreeSessionCache);
+      _ctxTicketKeysIndex = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, FreeTicketKeys);
+    });
+  }
+
+  static std::string GetSessionKey(const unsigned char* id, unsigned int length)
+  {
+    return std::string((const char*)id, length);
+  }
+
+  static int new_session(SSL* ssl, SSL_SESSION* session)
+  {
+    DtlsSessionCache* cache = GetDtlsSessionCache(SSL_get_SSL_CTX(ssl));
+    if (cache != nullptr) {
+      unsigned int length = 0;
+      const unsigned char* id = SSL_SESSION_get_id(session, &length);
+      cache->Put(GetSessionKey(id, length), session);
+    }
+
+    // The cache takes its own reference.
+    return 0;
+  }
+
+  static SSL_SESSION* get_session(SSL* ssl, const unsigned char* id, int length, int* copy)
+  {
+    DtlsSessionCache* cache = GetDtlsSessionCache(SSL_get_SSL_CTX(ssl));
+
+    // The reference from Get is handed over.
+    *copy = 0;
+    return (cache != nullptr) ? cache->Get(GetSessionKey(id, (unsigned int)length)) : nullptr;
+  }
+
+  static void remove_session(SSL_CTX* ctx, SSL_SESSION* session)
+  {
+    DtlsSessionCache* cache = GetDtlsSessionCache(ctx);
+    if (cache != nullptr) {
+      unsigned int length = 0;
+      const unsigned char* id = SSL_SESSION_get_id(session, &length);
+      cache->Remove(GetSessionKey(id, length));
+    }
+  }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  static int ticket_key(SSL* ssl, unsigned char* keyName, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc)
+#else
+  static int ticket_key(SSL* ssl, unsigned char* keyName, unsigned char* iv, EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, int enc)
+#endif
+  {
+    DtlsTicketKeys* keys = (DtlsTicketKeys*)SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), _ctxTicketKeysIndex);
+    return (keys != nullptr) ? keys->Use(keyName, iv, cipher, mac, enc == 1) : -1;
+  }
+
+  DtlsSessionCache::DtlsSessionCache(size_t capacity, size_t shardCount) :
+    _shards(),
+    _shardCapacity(0)
+  {
+    if (shardCount == 0) {
+      shardCount = 1;
+    }
+
+    for (size_t i = 0; i < shardCount; i++) {
+      _shards.emplace_back(new Shard());
+    }
+
+    _shardCapacity = (capacity + shardCount - 1) / shardCount;
+    if (_shardCapacity == 0) {
+      _shardCapacity = 1;
+    }
+  }
+
+  DtlsSessionCache::~DtlsSessionCache()
+  {
+    for (auto& shard : _shards) {
+      for (Entry& entry : shard->Lru) {
+        SSL_SESSION_free(entry.Session);
+      }
+    }
+  }
+
+  DtlsSessionCache::Shard& DtlsSessionCache::GetShard(const std::string& key)
+  {
+    return *_shards[std::hash<std::string>()(key) % _shards.size()];
+  }
+
+  void DtlsSessionCache::Put(const std::string& key, SSL_SESSION* session)
+  {
+    Shard& shard = GetShard(key);
+    SSL_SESSION* evicted = nullptr;
+    SSL_SESSION* replaced = nullptr;
+
+    SSL_SESSION_up_ref(session);
+
+    {
+      std::lock_guard<std::mutex> lock(shard.Mutex);
+
+      auto it = shard.Index.find(key);
+      if (it != shard.Index.end()) {
+        replaced = it->second->Session;
+        it->second->Session = session;
+        shard.Lru.splice(shard.Lru.begin(), shard.Lru, it->second);
+      }
+      else {
+        if (shard.Lru.size() >= _shardCapacity) {
+          evicted = shard.Lru.back().Session;
+          shard.Index.erase(shard.Lru.back().Key);
+          shard.Lru.pop_back();
+          _evictions++;
+          _sessions--;
+        }
+
+        shard.Lru.push_front(Entry{ key, session });
+        shard.Index.emplace(key, shard.Lru.begin());
+        _sessions++;
+      }
+    }
+
+    // Freed outside the lock, it can call back into a server's cache.
+    SSL_SESSION_free(replaced);
+    SSL_SESSION_free(evicted);
+  }
+
+  SSL_SESSION* DtlsSessionCache::Get(const std::string& key)
+  {
+    Shard& shard = GetShard(key);
+    SSL_SESSION* session = nullptr;
+    SSL_SESSION* expired = nullptr;
+
+    {
+      std::lock_guard<std::mutex> lock(shard.Mutex);
+
+      auto it = shard.Index.find(key);
+      if (it != shard.Index.end()) {
+        SSL_SESSION* found = it->second->Session;
+
+        if ((long)time(nullptr) >= (long)SSL_SESSION_get_time(found) + (long)SSL_SESSION_get_timeout(found)) {
+          expired = found;
+          shard.Lru.erase(it->second);
+          shard.Index.erase(it);
+          _sessions--;
+        }
+        else {
+          shard.Lru.splice(shard.Lru.begin(), shard.Lru, it->second);
+          SSL_SESSION_up_ref(found);
+          session = found;
+        }
+      }
+    }
+
+    SSL_SESSION_free(expired);
+    (session != nullptr) ? _hits++ : _misses++;
+    return session;
+  }
+
+  void DtlsSessionCache::Remove(const std::string& key)
+  {
+    Shard& shard = GetShard(key);
+    SSL_SESSION* removed = nullptr;
+
+    {
+      std::lock_guard<std::mutex> lock(shard.Mutex);
+
+      auto it = shard.Index.find(key);
+      if (it != shard.Index.end()) {
+        removed = it->second->Session;
+        shard.Lru.erase(it->second);
+        shard.Index.erase(it);
+        _sessions--;
+      }
+    }
+
+    SSL_SESSION_free(removed);
+  }
+
+  DtlsSessionCacheStats DtlsSessionCache::GetStats() const
+  {
+    DtlsSessionCacheStats stats;
+    stats.Hits = _hits;
+    stats.Misses = _misses;
+    stats.Evictions = _evictions;
+    stats.Sessions = _sessions;
+    return stats;
+  }
+
+  DtlsTicketKeys::DtlsTicketKeys() :
+    _current(),
+    _previous(),
+    _hasPrevious(false),
+    _nextRotation(std::chrono::steady_clock::now() + std::chrono::seconds(DTLS_TICKET_KEY_ROTATION_SECONDS))
+  {
+    if (!NewKey(_current)) {
+      throw std::runtime_error("DTLS ticket key generation failed.");
+    }
+  }
+
+  DtlsTicketKeys::~DtlsTicketKeys()
+  {
+    OPENSSL_cleanse(&_current, sizeof(_current));
+    OPENSSL_cleanse(&_previous, sizeof(_previous));
+  }
+
+  bool DtlsTicketKeys::NewKey(Key& key)
+  {
+    return RAND_bytes(key.Name, sizeof(key.Name)) == 1 &&
+      RAND_bytes(key.AesKey, sizeof(key.AesKey)) == 1 &&
+      RAND_bytes(key.HmacKey, sizeof(key.HmacKey)) == 1;
+  }
+
+  void DtlsTicketKeys::RotateIfDue(std::chrono::steady_clock::time_point now)
+  {
+    if (now < _nextRotation) {
+      return;
+    }
+
+    Key next;
+    if (NewKey(next)) {
+      _previous = _current;
+      _current = next;
+      _hasPrevious = true;
+    }
+    OPENSSL_cleanse(&next, sizeof(next));
+
+    _nextRotation = now + std::chrono::seconds(DTLS_TICKET_KEY_ROTATION_SECONDS);
+  }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  int DtlsTicketKeys::Use(unsigned char* keyName, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, bool encrypt)
+#else
+  int DtlsTicketKeys::Use(unsigned char* keyName, unsigned char* iv, EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, bool encrypt)
+#endif
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    RotateIfDue(std::chrono::steady_clock::now());
+
+    const Key* key = nullptr;
+    int res = 1;
+
+    if (encrypt) {
+      key = &_current;
+      std::memcpy(keyName, key->Name, DTLS_TICKET_KEY_NAME_LENGTH);
+      if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1 ||
+        EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key->AesKey, iv) != 1) {
+        return -1;
+      }
+    }
+    else {
+      if (CRYPTO_memcmp(keyName, _current.Name, DTLS_TICKET_KEY_NAME_LENGTH) == 0) {
+        key = &_current;
+      }
+      else if (_hasPrevious && CRYPTO_memcmp(keyName, _previous.Name, DTLS_TICKET_KEY_NAME_LENGTH) == 0) {
+        key = &_previous;
+        res = 2;
+      }
+      else {
+        return 0;
+      }
+
+      if (EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key->AesKey, iv) != 1) {
+        return -1;
+      }
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, (char*)"SHA256", 0),
+      OSSL_PARAM_construct_end()
+    };
+    bool macReady = EVP_MAC_init(mac, key->HmacKey, sizeof(key->HmacKey), params) == 1;
+#else
+    bool macReady = HMAC_Init_ex(mac, key->HmacKey, sizeof(key->HmacKey), EVP_sha256(), nullptr) == 1;
+#endif
+
+    return macReady ? res : -1;
+  }
+
+  void AttachDtlsSessionResumption(SSL_CTX* ctx, size_t cacheCapacity)
+  {
+    InitExDataIndexes();
+
+    DtlsSessionCache* cache = new DtlsSessionCache(cacheCapacity);
+    if (SSL_CTX_set_ex_data(ctx, _ctxCacheIndex, cache) != 1) {
+      delete cache;
+      throw std::runtime_error("DTLS session cache could not be attached to the context.");
+    }
+
+    DtlsTicketKeys* keys = new DtlsTicketKeys();
+    if (SSL_CTX_set_ex_data(ctx, _ctxTicketKeysIndex, keys) != 1) {
+      delete keys;
+      throw std::runtime_error("DTLS ticket keys could not be attached to the context.");
+    }
+
+    // Resumed sessions are only accepted by a context with the same ID
+    // context, it's required once peers are verified.
+    if (SSL_CTX_set_session_id_context(ctx, (const unsigned char*)DTLS_SESSION_ID_CONTEXT, sizeof(DTLS_SESSION_ID_CONTEXT) - 1) != 1) {
+      throw std::runtime_error("DTLS session ID context could not be set. " + GetOpenSslErrors());
+    }
+
+    SSL_CTX_set_timeout(ctx, DTLS_SESSION_LIFETIME_SECONDS);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(ctx, new_session);
+    SSL_CTX_sess_set_get_cb(ctx, get_session);
+    SSL_CTX_sess_set_remove_cb(ctx, remove_session);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key);
+#else
+    SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_key);
+#endif
+  }
+
+  DtlsSessionCache* GetDtlsSessionCache(SSL_CTX* ctx)
+  {
+    InitExDataIndexes();
+    return (DtlsSessionCache*)SSL_CTX_get_ex_data(ctx, _ctxCacheIndex);
+  }
+}
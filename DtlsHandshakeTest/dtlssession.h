@@ -0,0 +1,194 @@
+//-----------------------------------------------------------------------------
+// Filename: dtlssession.h
+//
+// Description: DTLS session resumption, so a peer that reconnects, usually
+// from a new address after a network change, can skip the certificate,
+// signature and key exchange of a full handshake.
+//
+// A server resumes sessions two ways. Session tickets carry the session to
+// the client encrypted and authenticated with a server key, nothing is kept
+// per session. The ticket keys are random and replaced every
+// DTLS_TICKET_KEY_ROTATION_SECONDS, tickets made with the previous key are
+// still accepted and are renewed with the current one, so a ticket can be
+// used for at least one rotation period and sessions last that long. Clients
+// that don't do tickets resume by session ID from a DtlsSessionCache, which
+// replaces OpenSSL's internal cache.
+//
+// DtlsSessionCache is an LRU cache of SSL_SESSIONs split into shards, each
+// with its own lock and its own share of the capacity, so lookups from
+// many threads don't queue on one mutex. Clients use one keyed by whatever
+// identifies the server to them to find a session to resume.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 18 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//
+// OpenSSL License:
+// This application includes software developed by the OpenSSL Project and
+// cryptographic software written by Eric Young (eay@cryptsoft.com)
+// See https://github.com/openssl/openssl/blob/master/LICENSE for conditions.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_DTLSSESSION_H
+#define SIPSORCERY_DTLSSESSION_H
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/ssl.h>
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define DTLS_SESSION_CACHE_DEFAULT_CAPACITY 20000
+#define DTLS_SESSION_CACHE_SHARDS 16
+#define DTLS_SESSION_ID_CONTEXT "sipsorcery-dtls"
+#define DTLS_TICKET_KEY_NAME_LENGTH 16
+#define DTLS_TICKET_KEY_LENGTH 32
+#define DTLS_TICKET_KEY_ROTATION_SECONDS 3600
+#define DTLS_SESSION_LIFETIME_SECONDS DTLS_TICKET_KEY_ROTATION_SECONDS   // A ticket's key is kept at least this long after it's issued.
+
+namespace sipsorcery
+{
+  struct DtlsSessionCacheStats
+  {
+    uint64_t Hits;
+    uint64_t Misses;          // Including sessions found expired.
+    uint64_t Evictions;       // To make room, expired sessions don't count.
+    uint64_t Sessions;
+  };
+
+  class DtlsSessionCache
+  {
+  public:
+    /**
+    * @param[in] capacity: the most sessions to hold, split evenly between
+    *  the shards.
+    * @param[in] shardCount: the number of independently locked shards.
+    */
+    DtlsSessionCache(size_t capacity = DTLS_SESSION_CACHE_DEFAULT_CAPACITY, size_t shardCount = DTLS_SESSION_CACHE_SHARDS);
+    ~DtlsSessionCache();
+
+    DtlsSessionCache(const DtlsSessionCache&) = delete;
+    DtlsSessionCache& operator=(const DtlsSessionCache&) = delete;
+
+    /**
+    * Stores a session, replacing any with the same key. The cache takes its
+    * own reference. If the shard is full its least recently used session is
+    * evicted.
+    */
+    void Put(const std::string& key, SSL_SESSION* session);
+
+    /**
+    * @@Returns a new reference to the session, free it with
+    *  SSL_SESSION_free, or nullptr if there isn't one or it has expired.
+    */
+    SSL_SESSION* Get(const std::string& key);
+
+    void Remove(const std::string& key);
+
+    /**
+    * Can be called from any thread.
+    */
+    DtlsSessionCacheStats GetStats() const;
+
+  private:
+    struct Entry
+    {
+      std::string Key;
+      SSL_SESSION* Session;
+    };
+
+    struct Shard
+    {
+      std::mutex Mutex;
+      std::list<Entry> Lru;       // Most recently used first.
+      std::unordered_map<std::string, std::list<Entry>::iterator> Index;
+    };
+
+    std::vector<std::unique_ptr<Shard>> _shards;
+    size_t _shardCapacity;
+
+    std::atomic<uint64_t> _hits{ 0 };
+    std::atomic<uint64_t> _misses{ 0 };
+    std::atomic<uint64_t> _evictions{ 0 };
+    std::atomic<uint64_t> _sessions{ 0 };
+
+    Shard& GetShard(const std::string& key);
+  };
+
+  class DtlsTicketKeys
+  {
+  public:
+    /**
+    * Throws std::runtime_error if the first key cannot be made.
+    */
+    DtlsTicketKeys();
+    ~DtlsTicketKeys();
+
+    DtlsTicketKeys(const DtlsTicketKeys&) = delete;
+    DtlsTicketKeys& operator=(const DtlsTicketKeys&) = delete;
+
+    /**
+    * Sets up the cipher and MAC contexts OpenSSL encrypts or decrypts a
+    * ticket with, the work of the ticket key callback.
+    * @param[in,out] keyName: set to the current key's name when encrypting,
+    *  the name from the ticket when decrypting.
+    * @param[in,out] iv: set to a random IV when encrypting.
+    * @param[in] encrypt: true to make a new ticket.
+    * @@Returns 1 to use the ticket, 2 to use it and renew it with the
+    *  current key, 0 if the ticket's key is unknown or has been retired and
+    *  -1 on error, as the callback does.
+    */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    int Use(unsigned char* keyName, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, bool encrypt);
+#else
+    int Use(unsigned char* keyName, unsigned char* iv, EVP_CIPHER_CTX* cipher, HMAC_CTX* mac, bool encrypt);
+#endif
+
+  private:
+    struct Key
+    {
+      uint8_t Name[DTLS_TICKET_KEY_NAME_LENGTH];
+      uint8_t AesKey[DTLS_TICKET_KEY_LENGTH];
+      uint8_t HmacKey[DTLS_TICKET_KEY_LENGTH];
+    };
+
+    std::mutex _mutex;
+    Key _current;
+    Key _previous;
+    bool _hasPrevious;
+    std::chrono::steady_clock::time_point _nextRotation;
+
+    void RotateIfDue(std::chrono::steady_clock::time_point now);
+    static bool NewKey(Key& key);
+  };
+
+  /**
+  * Sets a server context up to resume sessions: session tickets with a new
+  * DtlsTicketKeys and a new DtlsSessionCache for session IDs, both freed with
+  * the context. Sessions last DTLS_SESSION_LIFETIME_SECONDS.
+  * Throws std::runtime_error if either cannot be created.
+  */
+  void AttachDtlsSessionResumption(SSL_CTX* ctx, size_t cacheCapacity = DTLS_SESSION_CACHE_DEFAULT_CAPACITY);
+
+  /**
+  * @@Returns the server context's session ID cache, nullptr if it doesn't
+  *  have one.
+  */
+  DtlsSessionCache* GetDtlsSessionCache(SSL_CTX* ctx);
+}
+
+#endif // SIPSORCERY_DTLSSESSION_H
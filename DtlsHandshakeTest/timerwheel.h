@@ -0,0 +1,157 @@
+//-----------------------------------------------------------------------------
+// Filename: timerwheel.h
+//
+// Description: Hashed timer wheel for the DTLS retransmission, handshake and
+// idle timers of thousands of connections on one thread. Scheduling is
+// constant time and each expiry check only looks at the slots the clock has
+// moved past, rather than every connection.
+//
+// Timers can't be cancelled. An owner that wants an earlier deadline
+// schedules a second timer and remembers which deadline is current, the
+// stale one is handed back when it expires and the owner ignores it.
+// Deadlines past the end of the wheel wait in their slot for the wheel to
+// come round again.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 18 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_TIMERWHEEL_H
+#define SIPSORCERY_TIMERWHEEL_H
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+namespace sipsorcery
+{
+  template<typename Key>
+  class TimerWheel
+  {
+  public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    typedef std::pair<Key, TimePoint> Expiry;
+
+    /**
+    * @param[in] tick: the wheel's resolution, timers fire up to a tick late.
+    * @param[in] slotCount: the number of ticks in one turn of the wheel.
+    */
+    TimerWheel(std::chrono::milliseconds tick, size_t slotCount) :
+      _tick(tick),
+      _slots(slotCount),
+      _start(std::chrono::steady_clock::now()),
+      _nextTick(0),
+      _count(0)
+    { }
+
+    /**
+    * Adds a timer, a deadline that has already passed expires on the next
+    * call to Expire.
+    */
+    void Schedule(const Key& key, TimePoint deadline)
+    {
+      // Round up so a timer never fires before its deadline.
+      uint64_t tick = (deadline > _start) ? (uint64_t)((deadline - _start + _tick - std::chrono::nanoseconds(1)) / _tick) : 0;
+      if (tick < _nextTick) {
+        tick = _nextTick;
+      }
+
+      _slots[tick % _slots.size()].push_back(Timer{ key, deadline, tick });
+      _count++;
+    }
+
+    /**
+    * Removes the timers that are due.
+    * @param[out] expired: the key and deadline of each due timer, replaces
+    *  any previous contents.
+    */
+    void Expire(TimePoint now, std::vector<Expiry>& expired)
+    {
+      expired.clear();
+
+      if (now < _start) {
+        return;
+      }
+
+      uint64_t nowTick = (uint64_t)((now - _start) / _tick);
+      if (nowTick < _nextTick) {
+        return;
+      }
+
+      // Past a full turn every slot is due a look, but only once.
+      uint64_t lastTick = nowTick;
+      if (lastTick - _nextTick >= _slots.size()) {
+        lastTick = _nextTick + _slots.size() - 1;
+      }
+
+      for (uint64_t tick = _nextTick; tick <= lastTick; tick++) {
+        std::vector<Timer>& slot = _slots[tick % _slots.size()];
+
+        for (size_t i = 0; i < slot.size(); ) {
+          if (slot[i].Tick <= nowTick) {
+            expired.emplace_back(slot[i].Id, slot[i].Deadline);
+            slot[i] = std::move(slot.back());
+            slot.pop_back();
+            _count--;
+          }
+          else {
+            i++;
+          }
+        }
+      }
+
+      _nextTick = nowTick + 1;
+    }
+
+    /**
+    * @@Returns the milliseconds until the next slot with a timer in it comes
+    *  due, which may hold only timers for a later turn, or -1 if there are
+    *  no timers.
+    */
+    int GetNextTimeoutMs(TimePoint now) const
+    {
+      if (_count == 0) {
+        return -1;
+      }
+
+      uint64_t tick = _nextTick;
+      for (size_t i = 0; i < _slots.size() && _slots[tick % _slots.size()].empty(); i++) {
+        tick++;
+      }
+
+      TimePoint due = _start + _tick * (int64_t)tick;
+      if (due <= now) {
+        return 0;
+      }
+
+      // Round up, waking a little early would only spin.
+      return (int)std::chrono::duration_cast<std::chrono::milliseconds>(due - now + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1)).count();
+    }
+
+    size_t Size() const { return _count; }
+
+  private:
+    struct Timer
+    {
+      Key Id;
+      TimePoint Deadline;
+      uint64_t Tick;
+    };
+
+    std::chrono::nanoseconds _tick;
+    std::vector<std::vector<Timer>> _slots;
+    TimePoint _start;
+    uint64_t _nextTick;     // The first tick Expire hasn't looked at.
+    size_t _count;
+  };
+}
+
+#endif // SIPSORCERY_TIMERWHEEL_H
@@ -0,0 +1,295 @@
+#include "udpsocket.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <fcntl.h>
+#endif
+
+namespace sipsorcery
+{
+  static int GetLastSocketError()
+  {
+#ifdef _WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+  }
+
+  PeerAddress::PeerAddress() :
+    Addr(),
+    Length(sizeof(Addr))
+  { }
+
+  PeerAddress PeerAddress::Loopback(AddressFamily family, uint16_t port)
+  {
+    PeerAddress address;
+
+    if (family == AddressFamily::IPv6) {
+      sockaddr_in6* addr6 = (sockaddr_in6*)&address.Addr;
+      addr6->sin6_family = AF_INET6;
+      addr6->sin6_addr = in6addr_loopback;
+      addr6->sin6_port = htons(port);
+      address.Length = sizeof(sockaddr_in6);
+    }
+    else {
+      sockaddr_in* addr4 = (sockaddr_in*)&address.Addr;
+      addr4->sin_family = AF_INET;
+      addr4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      addr4->sin_port = htons(port);
+      address.Length = sizeof(sockaddr_in);
+    }
+
+    return address;
+  }
+
+  uint16_t PeerAddress::GetPort() const
+  {
+    if (Addr.ss_family == AF_INET6) {
+      return ntohs(((const sockaddr_in6*)&Addr)->sin6_port);
+    }
+    return ntohs(((const sockaddr_in*)&Addr)->sin_port);
+  }
+
+  std::string PeerAddress::ToString() const
+  {
+    char host[INET6_ADDRSTRLEN] = { 0 };
+
+    if (Addr.ss_family == AF_INET6) {
+      inet_ntop(AF_INET6, (void*)&((const sockaddr_in6*)&Addr)->sin6_addr, host, sizeof(host));
+      return std::string("[") + host + "]:" + std::to_string(GetPort());
+    }
+
+    inet_ntop(AF_INET, (void*)&((const sockaddr_in*)&Addr)->sin_addr, host, sizeof(host));
+    return std::string(host) + ":" + std::to_string(GetPort());
+  }
+
+  bool PeerAddress::operator==(const PeerAddress& other) const
+  {
+    if (Addr.ss_family != other.Addr.ss_family) {
+      return false;
+    }
+
+    if (Addr.ss_family == AF_INET6) {
+      const sockaddr_in6* a = (const sockaddr_in6*)&Addr;
+      const sockaddr_in6* b = (const sockaddr_in6*)&other.Addr;
+      return a->sin6_port == b->sin6_port && a->sin6_scope_id == b->sin6_scope_id &&
+        std::memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0;
+    }
+
+    const sockaddr_in* a = (const sockaddr_in*)&Addr;
+    const sockaddr_in* b = (const sockaddr_in*)&other.Addr;
+    return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+  }
+
+  size_t PeerAddressHash::operator()(const PeerAddress& address) const
+  {
+    // FNV-1a over the address and port, the rest of the sockaddr can hold
+    // anything.
+    const uint8_t* addr = nullptr;
+    size_t addrLength = 0;
+    uint16_t port = 0;
+
+    if (address.Addr.ss_family == AF_INET6) {
+      const sockaddr_in6* addr6 = (const sockaddr_in6*)&address.Addr;
+      addr = (const uint8_t*)&addr6->sin6_addr;
+      addrLength = sizeof(addr6->sin6_addr);
+      port = addr6->sin6_port;
+    }
+    else {
+      const sockaddr_in* addr4 = (const sockaddr_in*)&address.Addr;
+      addr = (const uint8_t*)&addr4->sin_addr;
+      addrLength = sizeof(addr4->sin_addr);
+      port = addr4->sin_port;
+    }
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < addrLength; i++) {
+      hash = (hash ^ addr[i]) * 1099511628211ULL;
+    }
+    hash = (hash ^ (port & 0xff)) * 1099511628211ULL;
+    hash = (hash ^ (port >> 8)) * 1099511628211ULL;
+    return (size_t)hash;
+  }
+
+  UdpSocket::UdpSocket(const PeerAddress& bindAddress, int bufferSize) :
+    _socket(),
+    _localAddress(bindAddress)
+  {
+    _socket = socket(bindAddress.Addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+
+#ifdef _WIN32
+    if (_socket == INVALID_SOCKET) {
+      throw std::runtime_error("UDP socket creation failed with " + std::to_string(GetLastSocketError()) + ".");
+    }
+
+    u_long nonBlocking = 1;
+    if (ioctlsocket(_socket, FIONBIO, &nonBlocking) != 0) {
+      int err = GetLastSocketError();
+      closesocket(_socket);
+      throw std::runtime_error("UDP socket could not be made non-blocking, error " + std::to_string(err) + ".");
+    }
+#else
+    if (_socket < 0) {
+      throw std::runtime_error("UDP socket creation failed with " + std::to_string(GetLastSocketError()) + ".");
+    }
+
+    int flags = fcntl(_socket, F_GETFL, 0);
+    if (flags < 0 || fcntl(_socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+      int err = GetLastSocketError();
+      close(_socket);
+      throw std::runtime_error("UDP socket could not be made non-blocking, error " + std::to_string(err) + ".");
+    }
+#endif
+
+    // A server socket takes every peer's handshake flights, the default
+    // buffers overflow long before the CPU runs out.
+    setsockopt(_socket, SOL_SOCKET, SO_RCVBUF, (const char*)&bufferSize, sizeof(bufferSize));
+    setsockopt(_socket, SOL_SOCKET, SO_SNDBUF, (const char*)&bufferSize, sizeof(bufferSize));
+
+    if (bind(_socket, (const sockaddr*)&bindAddress.Addr, bindAddress.Length) != 0) {
+      int err = GetLastSocketError();
+#ifdef _WIN32
+      closesocket(_socket);
+#else
+      close(_socket);
+#endif
+      throw std::runtime_error("UDP socket bind to " + bindAddress.ToString() + " failed with " + std::to_string(err) + ".");
+    }
+
+    _localAddress.Length = sizeof(_localAddress.Addr);
+    getsockname(_socket, (sockaddr*)&_localAddress.Addr, &_localAddress.Length);
+  }
+
+  UdpSocket::~UdpSocket()
+  {
+#ifdef _WIN32
+    closesocket(_socket);
+#else
+    close(_socket);
+#endif
+  }
+
+  int UdpSocket::SendTo(const uint8_t* buf, size_t length, const PeerAddress& dst)
+  {
+    return (int)sendto(_socket, (const char*)buf, (int)length, 0, (const sockaddr*)&dst.Addr, dst.Length);
+  }
+
+  int UdpSocket::RecvFrom(uint8_t* buf, size_t length, PeerAddress& src)
+  {
+    src.Length = sizeof(src.Addr);
+    int res = (int)recvfrom(_socket, (char*)buf, (int)length, 0, (sockaddr*)&src.Addr, &src.Length);
+
+#ifdef _WIN32
+    // An ICMP port unreachable from an earlier send shows up as a failed
+    // receive, skip it rather than stall the socket.
+    while (res < 0 && WSAGetLastError() == WSAECONNRESET) {
+      src.Length = sizeof(src.Addr);
+      res = recvfrom(_socket, (char*)buf, (int)length, 0, (sockaddr*)&src.Addr, &src.Length);
+    }
+#endif
+
+    return res < 0 ? -1 : res;
+  }
+
+#ifdef _WIN32
+  SocketPoller::SocketPoller()
+  { }
+
+  SocketPoller::~SocketPoller()
+  { }
+
+  void SocketPoller::Add(const UdpSocket& socket, size_t id)
+  {
+    WSAPOLLFD fd = { 0 };
+    fd.fd = socket.GetHandle();
+    fd.events = POLLRDNORM;
+    _fds.push_back(fd);
+    _ids.push_back(id);
+  }
+
+  void SocketPoller::Remove(const UdpSocket& socket)
+  {
+    for (size_t i = 0; i < _fds.size(); i++) {
+      if (_fds[i].fd == socket.GetHandle()) {
+        _fds[i] = _fds.back();
+        _ids[i] = _ids.back();
+        _fds.pop_back();
+        _ids.pop_back();
+        return;
+      }
+    }
+  }
+
+  int SocketPoller::Wait(int timeoutMs, std::vector<size_t>& readyIds)
+  {
+    readyIds.clear();
+
+    if (_fds.empty()) {
+      Sleep(timeoutMs);
+      return 0;
+    }
+
+    int res = WSAPoll(_fds.data(), (ULONG)_fds.size(), timeoutMs);
+    if (res <= 0) {
+      return 0;
+    }
+
+    for (size_t i = 0; i < _fds.size() && (int)readyIds.size() < res; i++) {
+      if (_fds[i].revents != 0) {
+        readyIds.push_back(_ids[i]);
+      }
+    }
+
+    return (int)readyIds.size();
+  }
+#else
+  SocketPoller::SocketPoller() :
+    _epollFd(epoll_create1(0))
+  {
+    if (_epollFd < 0) {
+      throw std::runtime_error("epoll_create1 failed with " + std::to_string(errno) + ".");
+    }
+  }
+
+  SocketPoller::~SocketPoller()
+  {
+    close(_epollFd);
+  }
+
+  void SocketPoller::Add(const UdpSocket& socket, size_t id)
+  {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = id;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, socket.GetHandle(), &ev) == 0) {
+      _count++;
+    }
+  }
+
+  void SocketPoller::Remove(const UdpSocket& socket)
+  {
+    if (epoll_ctl(_epollFd, EPOLL_CTL_DEL, socket.GetHandle(), nullptr) == 0) {
+      _count--;
+    }
+  }
+
+  int SocketPoller::Wait(int timeoutMs, std::vector<size_t>& readyIds)
+  {
+    readyIds.clear();
+    _events.resize(_count > 0 ? _count : 1);
+
+    int res = epoll_wait(_epollFd, _events.data(), (int)_events.size(), timeoutMs);
+    for (int i = 0; i < res; i++) {
+      readyIds.push_back((size_t)_events[i].data.u64);
+    }
+
+    return res < 0 ? 0 : res;
+  }
+#endif
+}
@@ -0,0 +1,163 @@
+//-----------------------------------------------------------------------------
+// Filename: udpsocket.h
+//
+// Description: Non-blocking UDP sockets and a readiness poller, the minimum
+// needed to run many DTLS peers from one thread. The poller is epoll on
+// Linux and WSAPoll on Windows, where there is no epoll. Both are level
+// triggered and only report readability, sends on UDP don't block long
+// enough to be worth waiting for.
+//
+// WSAStartup has to have been called before any socket is created on
+// Windows.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 18 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_UDPSOCKET_H
+#define SIPSORCERY_UDPSOCKET_H
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX    // windows.h, pulled in by winsock2.h, otherwise breaks std::min and std::max.
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define UDP_SOCKET_DEFAULT_BUFFER_SIZE (4 * 1024 * 1024)
+
+namespace sipsorcery
+{
+#ifdef _WIN32
+  typedef SOCKET NativeSocket;
+#else
+  typedef int NativeSocket;
+#endif
+
+  enum class AddressFamily
+  {
+    IPv4,
+    IPv6
+  };
+
+  /**
+  * A remote or local IP address and port. A server socket's own address and
+  * the protocol are the same for every datagram it receives, so the remote
+  * address and port are all that's left of the 5-tuple to tell peers apart.
+  */
+  struct PeerAddress
+  {
+    sockaddr_storage Addr;
+    socklen_t Length;
+
+    PeerAddress();
+
+    static PeerAddress Loopback(AddressFamily family, uint16_t port);
+
+    uint16_t GetPort() const;
+    std::string ToString() const;
+
+    bool operator==(const PeerAddress& other) const;
+    bool operator!=(const PeerAddress& other) const { return !(*this == other); }
+  };
+
+  struct PeerAddressHash
+  {
+    size_t operator()(const PeerAddress& address) const;
+  };
+
+  class UdpSocket
+  {
+  public:
+    /**
+    * Creates a non-blocking socket bound to an address.
+    * @param[in] bindAddress: the address to bind to, port 0 for an ephemeral port.
+    * @param[in] bufferSize: the send and receive buffer sizes to ask for, the
+    *  system may cap them.
+    * Throws std::runtime_error if the socket cannot be created or bound.
+    */
+    UdpSocket(const PeerAddress& bindAddress, int bufferSize = UDP_SOCKET_DEFAULT_BUFFER_SIZE);
+    ~UdpSocket();
+
+    UdpSocket(const UdpSocket&) = delete;
+    UdpSocket& operator=(const UdpSocket&) = delete;
+
+    /**
+    * @@Returns the number of bytes sent or -1 on error.
+    */
+    int SendTo(const uint8_t* buf, size_t length, const PeerAddress& dst);
+
+    /**
+    * @param[out] src: the address the datagram came from.
+    * @@Returns the length of the datagram, or -1 if there are no more
+    *  datagrams waiting or on error.
+    */
+    int RecvFrom(uint8_t* buf, size_t length, PeerAddress& src);
+
+    NativeSocket GetHandle() const { return _socket; }
+    const PeerAddress& GetLocalAddress() const { return _localAddress; }
+
+  private:
+    NativeSocket _socket;
+    PeerAddress _localAddress;
+  };
+
+  class SocketPoller
+  {
+  public:
+    /**
+    * Throws std::runtime_error if the poller cannot be created.
+    */
+    SocketPoller();
+    ~SocketPoller();
+
+    SocketPoller(const SocketPoller&) = delete;
+    SocketPoller& operator=(const SocketPoller&) = delete;
+
+    /**
+    * Starts watching a socket for readability.
+    * @param[in] id: handed back by Wait when the socket is readable.
+    */
+    void Add(const UdpSocket& socket, size_t id);
+    void Remove(const UdpSocket& socket);
+
+    /**
+    * Waits for sockets to become readable.
+    * @param[in] timeoutMs: how long to wait if none are, 0 to only check.
+    * @param[out] readyIds: the IDs of the readable sockets, replaces any
+    *  previous contents.
+    * @@Returns the number of readable sockets, 0 on timeout.
+    */
+    int Wait(int timeoutMs, std::vector<size_t>& readyIds);
+
+  private:
+#ifdef _WIN32
+    std::vector<WSAPOLLFD> _fds;
+    std::vector<size_t> _ids;
+#else
+    int _epollFd;
+    std::vector<struct epoll_event> _events;
+    size_t _count{ 0 };
+#endif
+  };
+}
+
+#endif // SIPSORCERY_UDPSOCKET_H
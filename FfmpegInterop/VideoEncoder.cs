@@ -9,6 +9,7 @@ namespace FfmpegInterop
     {
         private readonly AVCodec* _videoCodec;
         private readonly AVCodecContext* _videoCodecContext;
+        private AVPacket* _packet;
         private readonly int _frameWidth;
         private readonly int _frameHeight;
 
@@ -36,10 +37,17 @@ namespace FfmpegInterop
             _videoCodecContext->pix_fmt = AVPixelFormat.AV_PIX_FMT_YUV420P;
 
             ffmpeg.avcodec_open2(_videoCodecContext, _videoCodec, null).ThrowExceptionIfError();
+
+            // A single packet is reused for every encode rather than allocating one per frame.
+            _packet = ffmpeg.av_packet_alloc();
         }
 
         public void Dispose()
         {
+            fixed (AVPacket** pPacket = &_packet)
+            {
+                ffmpeg.av_packet_free(pPacket);
+            }
             ffmpeg.avcodec_close(_videoCodecContext);
             ffmpeg.av_free(_videoCodecContext);
             ffmpeg.av_free(_videoCodec);
@@ -61,7 +69,7 @@ namespace FfmpegInterop
 
         public byte[] Encode(AVFrame* frame)
         {
-            var pPacket = ffmpeg.av_packet_alloc();
+            var pPacket = _packet;
 
             try
             {
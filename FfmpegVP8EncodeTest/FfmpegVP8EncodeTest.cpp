@@ -16,18 +16,113 @@ extern "C"
 #include <libavutil\time.h>
 }
 
+#include "colorconvert.h"
+#include "congestioncontroller.h"
+#include "containerwriter.h"
+#include "encoderbench.h"
+#include "encoderpool.h"
+#include "encodeserver.h"
+#include "framepool.h"
+#include "gopcache.h"
+#include "h264rtp.h"
+#include "latencyhistogram.h"
+#include "mjpeggateway.h"
+#include "pipeline.h"
+#include "simulcast.h"
+#include "staticscene.h"
+#include "syntheticsource.h"
+#include "videoencoder.h"
+#include "vp8receiver.h"
+#include "vp8rtp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
 #define WIDTH 640
 #define HEIGHT 480
 #define FRAMES_PER_SECOND 30
+#define LATENCY_TEST_FRAME_COUNT 300
+#define POOL_WARMUP_FRAME_COUNT 30
+#define FRAME_POOL_SIZE 4
+#define PACKET_POOL_SIZE 4
+#define BENCH_DEFAULT_FRAME_COUNT 120
+#define SERVER_DEFAULT_STREAM_COUNT 16
+#define SERVER_DEFAULT_DURATION_SECONDS 10
+#define SIMULCAST_DEFAULT_FRAME_COUNT 300
+#define CONVERT_DEFAULT_FRAME_COUNT 200
+#define RTP_DEFAULT_DESTINATION "127.0.0.1"
+#define RTP_DEFAULT_PORT 5004
+#define RTP_DEFAULT_FRAME_COUNT 300
+#define RTP_CLOCK_RATE 90000
+#define PIPELINE_DEFAULT_FRAME_COUNT 300
+#define GATEWAY_DEFAULT_STREAM_COUNT 1
+#define GATEWAY_DEFAULT_LISTEN_PORT 10100
+#define GATEWAY_DEFAULT_DURATION_SECONDS 30
+#define POOL_DEFAULT_STREAM_STARTS 20
+#define RECORD_DEFAULT_STREAM_COUNT 50
+#define RECORD_DEFAULT_DURATION_SECONDS 10
+#define RECORD_DEFAULT_FORMAT "webm"
+#define RECORD_DEFAULT_PATH_PREFIX "record"
+#define GOP_DEFAULT_VIEWERS 10
+#define GOP_DEFAULT_DURATION_SECONDS 30
+#define GOP_DEFAULT_KEYFRAME_SECONDS 10
+#define GOP_DEFAULT_BURST_KBPS 0
+#define DECODE_DEFAULT_WIDTH 1280
+#define DECODE_DEFAULT_HEIGHT 720
+#define DECODE_DEFAULT_FRAME_COUNT 600
+#define RECEIVE_DEFAULT_DURATION_SECONDS 30
+#define RECEIVE_DEFAULT_DECODE_THREADS 4
+#define SOURCE_DEFAULT_FRAME_COUNT 200
+#define STATIC_DEFAULT_FRAME_COUNT 300
+#define H264_DEFAULT_FRAME_COUNT 150
+#define CONGESTION_DEFAULT_DURATION_SECONDS 60
+#define CONGESTION_DEFAULT_LOSS_PERCENT 0.5
+#define CONGESTION_DEFAULT_RTCP_PORT 5005
 
-SwsContext* _swsContext;
-AVCodec* _codec;
-AVCodecContext* _codecCtx;
+struct Resolution
+{
+  int width;
+  int height;
+};
 
-void InitEncoder(AVCodecID codecID, int width, int height, int fps);
+void MeasureEncodeLatency(AVCodecID codecID, int width, int height, sipsorcery::EncoderPreset preset, int threads);
+void SendVp8Rtp(const std::string& dstAddress, int dstPort, int frameCount, int temporalLayers, bool sliceOutput);
+void SendH264Rtp(const std::string& dstAddress, int dstPort, int frameCount, bool sliceOutput);
 //void GetTestImage(AVFrame* imgframe, int frame_index, int width, int height);
 
-int main()
+/**
+* Usage:
+*  FfmpegVP8EncodeTest                                  per-frame latency at 480p, 720p and 1080p.
+*  FfmpegVP8EncodeTest bench [frames] [csv] [json]      codec x resolution x preset x threads sweep.
+*  FfmpegVP8EncodeTest server [streams] [seconds]       concurrent streams on a shared work stealing pool.
+*  FfmpegVP8EncodeTest simulcast [frames]               1080p/540p/270p ladder from one BGRA source.
+*  FfmpegVP8EncodeTest convert [frames]                 AVX2 RGB to YUV converter against swscale.
+*  FfmpegVP8EncodeTest rtp [address] [port] [frames] [layers] [slices]  stream realtime VP8 over RTP, RFC 7741, 1 to 3 temporal layers,
+*                                                       slices 1 to send each partition as soon as it is handed out.
+*  FfmpegVP8EncodeTest pipeline [address] [port] [frames]  threaded capture/convert/encode/send, per stage latency.
+*  FfmpegVP8EncodeTest gateway [streams] [listen port] [address] [port] [seconds]  MJPEG RTP in, VP8 RTP out, per stream threads.
+*  FfmpegVP8EncodeTest pool [starts]                    time to first packet, newly opened encoder against a pre-opened pool.
+*  FfmpegVP8EncodeTest record [streams] [seconds] [ivf|webm] [path prefix]  concurrent recordings through write behind buffers.
+*  FfmpegVP8EncodeTest gop [address] [port] [viewers] [seconds] [keyframe seconds] [burst kbps]  join latency with and without a GOP cache.
+*  FfmpegVP8EncodeTest decode [width] [height] [frames]  VP8 RTP depacketize and decode, fps per core for frame and slice threads.
+*  FfmpegVP8EncodeTest receive [listen port] [seconds] [threads]  VP8 RTP receive and decode, e.g. from the rtp mode.
+*  FfmpegVP8EncodeTest source [frames]                  AVX2 synthetic video source, I420, NV12 and BGRA.
+*  FfmpegVP8EncodeTest static [frames]                  skip encoding static frames, CPU per frame against the share of repeats.
+*  FfmpegVP8EncodeTest h264rtp [address] [port] [frames] [slices]  stream realtime H.264 over RTP, RFC 6184,
+*                                                       slices 1 to send each NAL unit as it is handed out.
+*  FfmpegVP8EncodeTest h264 [frames]                    H.264 start code search and RTP packetizer, STAP-A and FU-A counts.
+*  FfmpegVP8EncodeTest congestion [h264] [seconds] [loss %]  bandwidth estimation against a simulated bottleneck, vp8 is
+*                                                       refused as its encoder can't change bit rate while open.
+*  FfmpegVP8EncodeTest ccsend [address] [port] [rtcp port] [seconds]  H.264 over RTP under congestion control, for a shaped link,
+*                                                       e.g. tc qdisc add dev lo root netem delay 20ms rate 1mbit loss 1%.
+*  FfmpegVP8EncodeTest ccrecv [listen port] [sender address] [rtcp port] [seconds]  receiving end for ccsend, sends the feedback.
+*/
+int main(int argc, char* argv[])
 {
   std::cout << "Ffmpeg VP8 Encode Test" << std::endl;
 
@@ -35,82 +130,297 @@ int main()
   av_log_set_level(AV_LOG_INFO);
   //av_log_set_callback(av_log_default_callback);
 
-  InitEncoder(AVCodecID::AV_CODEC_ID_VP8, WIDTH, HEIGHT, FRAMES_PER_SECOND);
-  //InitEncoder(AVCodecID::AV_CODEC_ID_H264, WIDTH, HEIGHT, FRAMES_PER_SECOND);
-  //InitEncoder(AVCodecID::AV_CODEC_ID_MJPEG, WIDTH, HEIGHT, FRAMES_PER_SECOND);
+  std::string mode = (argc > 1) ? argv[1] : "";
 
-  //auto avc_class = avcodec_get_class();
-  //av_log(&avc_class, AV_LOG_ERROR, "%s");
+  if (mode == "bench") {
+    // The encoders log every option they apply, too noisy for a sweep.
+    av_log_set_level(AV_LOG_ERROR);
 
-  int linesz = av_image_get_linesize(AVPixelFormat::AV_PIX_FMT_YUV420P, WIDTH, 0);
+    int frameCount = (argc > 2) ? std::atoi(argv[2]) : BENCH_DEFAULT_FRAME_COUNT;
+    std::string csvPath = (argc > 3) ? argv[3] : "encoder_bench.csv";
+    std::string jsonPath = (argc > 4) ? argv[4] : "encoder_bench.json";
 
-  AVFrame* frame = av_frame_alloc();
-  frame->format = AVPixelFormat::AV_PIX_FMT_YUV420P;
-  frame->width = WIDTH;
-  frame->height = HEIGHT;
-  frame->pts = 0;
+    sipsorcery::RunEncoderBenchmark(sipsorcery::GetEncoderBenchCases(), FRAMES_PER_SECOND, frameCount, csvPath, jsonPath);
+    return 0;
+  }
+  else if (mode == "server") {
+    av_log_set_level(AV_LOG_ERROR);
 
-  int getbufferRes = av_frame_get_buffer(frame, 0);
-  std::cout << "av_frame_get_buffer result " << getbufferRes << "." << std::endl;
+    int streamCount = (argc > 2) ? std::atoi(argv[2]) : SERVER_DEFAULT_STREAM_COUNT;
+    int durationSeconds = (argc > 3) ? std::atoi(argv[3]) : SERVER_DEFAULT_DURATION_SECONDS;
 
-  int makeWritableResult = av_frame_make_writable(frame);
-  std::cout << "av_frame_make_writable result " << makeWritableResult << "." << std::endl;
+    try {
+      sipsorcery::RunEncodeServerTest(streamCount, FRAMES_PER_SECOND, durationSeconds);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running encode server test. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "simulcast") {
+    av_log_set_level(AV_LOG_ERROR);
 
-  //GetTestImage(frame, 0, WIDTH, HEIGHT);
+    int frameCount = (argc > 2) ? std::atoi(argv[2]) : SIMULCAST_DEFAULT_FRAME_COUNT;
 
-  for (int y = 0; y < HEIGHT; y++) {
-    for (int x = 0; x < WIDTH; x++) {
-      frame->data[0][y * frame->linesize[0] + x] = x + y + 1 * 3;
+    try {
+      sipsorcery::RunSimulcastTest(FRAMES_PER_SECOND, frameCount);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running simulcast test. " << excp.what() << std::endl;
     }
+    return 0;
   }
+  else if (mode == "convert") {
+    int frameCount = (argc > 2) ? std::atoi(argv[2]) : CONVERT_DEFAULT_FRAME_COUNT;
 
-  for (int y = 0; y < HEIGHT / 2; y++) {
-    for (int x = 0; x < WIDTH / 2; x++) {
-      frame->data[1][y * frame->linesize[1] + x] = 128 + y + 2;
-      frame->data[2][y * frame->linesize[2] + x] = 64 + y + 5;
+    try {
+      sipsorcery::RunColorConvertBenchmark(frameCount);
     }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running color conversion benchmark. " << excp.what() << std::endl;
+    }
+    return 0;
   }
+  else if (mode == "rtp") {
+    av_log_set_level(AV_LOG_ERROR);
 
-  int sendres = avcodec_send_frame(_codecCtx, frame);
-  if (sendres != 0)
-  {
-    char errBuf[2048];
-    av_strerror(sendres, errBuf, 2048);
+    std::string dstAddress = (argc > 2) ? argv[2] : RTP_DEFAULT_DESTINATION;
+    int dstPort = (argc > 3) ? std::atoi(argv[3]) : RTP_DEFAULT_PORT;
+    int frameCount = (argc > 4) ? std::atoi(argv[4]) : RTP_DEFAULT_FRAME_COUNT;
+    int temporalLayers = (argc > 5) ? std::atoi(argv[5]) : 1;
+    bool sliceOutput = (argc > 6) ? std::atoi(argv[6]) != 0 : false;
 
-    std::cout << "avcodec_send_frame result " << sendres << ", " << errBuf << "." << std::endl;
+    try {
+      SendVp8Rtp(dstAddress, dstPort, frameCount, temporalLayers, sliceOutput);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception sending VP8 RTP. " << excp.what() << std::endl;
+    }
+    return 0;
   }
+  else if (mode == "pipeline") {
+    av_log_set_level(AV_LOG_ERROR);
 
-  AVPacket* pkt = av_packet_alloc();
+    std::string dstAddress = (argc > 2) ? argv[2] : RTP_DEFAULT_DESTINATION;
+    int dstPort = (argc > 3) ? std::atoi(argv[3]) : RTP_DEFAULT_PORT;
+    int frameCount = (argc > 4) ? std::atoi(argv[4]) : PIPELINE_DEFAULT_FRAME_COUNT;
 
-  int ret = 0;
-  while (ret >= 0) {
-    ret = avcodec_receive_packet(_codecCtx, pkt);
-    if (ret == AVERROR(EAGAIN)) {
-      std::cout << "avcodec_receive_packet more data required " << ret << "." << std::endl;
+    try {
+      sipsorcery::RunPipelineTest(dstAddress, dstPort, FRAMES_PER_SECOND, frameCount);
     }
-    else if (ret < 0) {
-      fprintf(stderr, "Error during encoding\n");
-      break;
+    catch (std::exception& excp) {
+      std::cerr << "Exception running encode pipeline. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "gateway") {
+    av_log_set_level(AV_LOG_ERROR);
+
+    int streamCount = (argc > 2) ? std::atoi(argv[2]) : GATEWAY_DEFAULT_STREAM_COUNT;
+    int listenPort = (argc > 3) ? std::atoi(argv[3]) : GATEWAY_DEFAULT_LISTEN_PORT;
+    std::string dstAddress = (argc > 4) ? argv[4] : RTP_DEFAULT_DESTINATION;
+    int dstPort = (argc > 5) ? std::atoi(argv[5]) : RTP_DEFAULT_PORT;
+    int durationSeconds = (argc > 6) ? std::atoi(argv[6]) : GATEWAY_DEFAULT_DURATION_SECONDS;
+
+    try {
+      sipsorcery::RunMjpegGateway(listenPort, streamCount, dstAddress, dstPort, FRAMES_PER_SECOND, durationSeconds);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running MJPEG gateway. " << excp.what() << std::endl;
     }
-    else {
-      std::cout << "Write packet pts " << pkt->pts << ", size " << pkt->size << "." << std::endl;
-      av_packet_unref(pkt);
+    return 0;
+  }
+  else if (mode == "pool") {
+    av_log_set_level(AV_LOG_ERROR);
+
+    int streamStarts = (argc > 2) ? std::atoi(argv[2]) : POOL_DEFAULT_STREAM_STARTS;
+
+    try {
+      sipsorcery::RunEncoderPoolTest(FRAMES_PER_SECOND, streamStarts);
     }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running encoder pool test. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "record") {
+    av_log_set_level(AV_LOG_ERROR);
 
-    frame->pts++;
-    sendres = avcodec_send_frame(_codecCtx, frame);
-    if (sendres != 0)
-    {
-      char errBuf[2048];
-      av_strerror(sendres, errBuf, 2048);
-      std::cout << "avcodec_send_frame result " << sendres << ", " << errBuf << "." << std::endl;
-      break;
+    int streamCount = (argc > 2) ? std::atoi(argv[2]) : RECORD_DEFAULT_STREAM_COUNT;
+    int durationSeconds = (argc > 3) ? std::atoi(argv[3]) : RECORD_DEFAULT_DURATION_SECONDS;
+    std::string format = (argc > 4) ? argv[4] : RECORD_DEFAULT_FORMAT;
+    std::string pathPrefix = (argc > 5) ? argv[5] : RECORD_DEFAULT_PATH_PREFIX;
+
+    try {
+      sipsorcery::RunRecordingTest(streamCount, FRAMES_PER_SECOND, durationSeconds, format, pathPrefix);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running recording test. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "gop") {
+    av_log_set_level(AV_LOG_ERROR);
+
+    std::string dstAddress = (argc > 2) ? argv[2] : RTP_DEFAULT_DESTINATION;
+    int dstPort = (argc > 3) ? std::atoi(argv[3]) : RTP_DEFAULT_PORT;
+    int viewers = (argc > 4) ? std::atoi(argv[4]) : GOP_DEFAULT_VIEWERS;
+    int durationSeconds = (argc > 5) ? std::atoi(argv[5]) : GOP_DEFAULT_DURATION_SECONDS;
+    int keyframeSeconds = (argc > 6) ? std::atoi(argv[6]) : GOP_DEFAULT_KEYFRAME_SECONDS;
+    int burstKbps = (argc > 7) ? std::atoi(argv[7]) : GOP_DEFAULT_BURST_KBPS;
+
+    try {
+      sipsorcery::RunGopCacheTest(dstAddress, dstPort, FRAMES_PER_SECOND, viewers, durationSeconds, keyframeSeconds, (int64_t)burstKbps * 1000);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running GOP cache test. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "decode") {
+    av_log_set_level(AV_LOG_ERROR);
+
+    int width = (argc > 2) ? std::atoi(argv[2]) : DECODE_DEFAULT_WIDTH;
+    int height = (argc > 3) ? std::atoi(argv[3]) : DECODE_DEFAULT_HEIGHT;
+    int frameCount = (argc > 4) ? std::atoi(argv[4]) : DECODE_DEFAULT_FRAME_COUNT;
+
+    try {
+      sipsorcery::RunVp8DecodeBenchmark(width, height, FRAMES_PER_SECOND, frameCount);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running VP8 decode benchmark. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "receive") {
+    av_log_set_level(AV_LOG_ERROR);
+
+    int listenPort = (argc > 2) ? std::atoi(argv[2]) : RTP_DEFAULT_PORT;
+    int durationSeconds = (argc > 3) ? std::atoi(argv[3]) : RECEIVE_DEFAULT_DURATION_SECONDS;
+    int threads = (argc > 4) ? std::atoi(argv[4]) : RECEIVE_DEFAULT_DECODE_THREADS;
+
+    try {
+      sipsorcery::RunVp8Receiver(listenPort, threads, durationSeconds);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running VP8 receiver. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "source") {
+    int frameCount = (argc > 2) ? std::atoi(argv[2]) : SOURCE_DEFAULT_FRAME_COUNT;
+
+    try {
+      sipsorcery::RunSyntheticSourceBenchmark(frameCount);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running synthetic source benchmark. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "static") {
+    int frameCount = (argc > 2) ? std::atoi(argv[2]) : STATIC_DEFAULT_FRAME_COUNT;
+
+    try {
+      sipsorcery::RunStaticSceneBenchmark(frameCount);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running static scene benchmark. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "h264rtp") {
+    av_log_set_level(AV_LOG_ERROR);
+
+    std::string dstAddress = (argc > 2) ? argv[2] : RTP_DEFAULT_DESTINATION;
+    int dstPort = (argc > 3) ? std::atoi(argv[3]) : RTP_DEFAULT_PORT;
+    int frameCount = (argc > 4) ? std::atoi(argv[4]) : RTP_DEFAULT_FRAME_COUNT;
+    bool sliceOutput = (argc > 5) ? std::atoi(argv[5]) != 0 : false;
+
+    try {
+      SendH264Rtp(dstAddress, dstPort, frameCount, sliceOutput);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception sending H.264 RTP. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "h264") {
+    av_log_set_level(AV_LOG_ERROR);
+
+    int frameCount = (argc > 2) ? std::atoi(argv[2]) : H264_DEFAULT_FRAME_COUNT;
+
+    try {
+      sipsorcery::RunH264RtpBenchmark(frameCount);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running H.264 RTP benchmark. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "congestion") {
+    av_log_set_level(AV_LOG_ERROR);
+
+    std::string codec = (argc > 2) ? argv[2] : "h264";
+    int durationSeconds = (argc > 3) ? std::atoi(argv[3]) : CONGESTION_DEFAULT_DURATION_SECONDS;
+    double lossPercent = (argc > 4) ? std::atof(argv[4]) : CONGESTION_DEFAULT_LOSS_PERCENT;
+
+    try {
+      sipsorcery::RunCongestionSimulation((codec == "h264") ? AV_CODEC_ID_H264 : AV_CODEC_ID_VP8, durationSeconds, lossPercent);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running congestion simulation. " << excp.what() << std::endl;
     }
+    return 0;
   }
+  else if (mode == "ccsend") {
+    av_log_set_level(AV_LOG_ERROR);
+
+    std::string dstAddress = (argc > 2) ? argv[2] : RTP_DEFAULT_DESTINATION;
+    int dstPort = (argc > 3) ? std::atoi(argv[3]) : RTP_DEFAULT_PORT;
+    int rtcpPort = (argc > 4) ? std::atoi(argv[4]) : CONGESTION_DEFAULT_RTCP_PORT;
+    int durationSeconds = (argc > 5) ? std::atoi(argv[5]) : CONGESTION_DEFAULT_DURATION_SECONDS;
+
+    try {
+      sipsorcery::RunCongestionSender(dstAddress, dstPort, rtcpPort, durationSeconds);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running congestion controlled sender. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+  else if (mode == "ccrecv") {
+    av_log_set_level(AV_LOG_ERROR);
+
+    int listenPort = (argc > 2) ? std::atoi(argv[2]) : RTP_DEFAULT_PORT;
+    std::string senderAddress = (argc > 3) ? argv[3] : RTP_DEFAULT_DESTINATION;
+    int rtcpPort = (argc > 4) ? std::atoi(argv[4]) : CONGESTION_DEFAULT_RTCP_PORT;
+    int durationSeconds = (argc > 5) ? std::atoi(argv[5]) : CONGESTION_DEFAULT_DURATION_SECONDS;
+
+    try {
+      sipsorcery::RunCongestionReceiver(listenPort, senderAddress, rtcpPort, durationSeconds);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception running congestion feedback receiver. " << excp.what() << std::endl;
+    }
+    return 0;
+  }
+
+  //auto avc_class = avcodec_get_class();
+  //av_log(&avc_class, AV_LOG_ERROR, "%s");
+
+  const Resolution resolutions[] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
 
-  av_packet_free(&pkt);
-  av_frame_free(&frame);
-  avcodec_free_context(&_codecCtx);
+  for (auto res : resolutions) {
+    try {
+      MeasureEncodeLatency(AVCodecID::AV_CODEC_ID_VP8, res.width, res.height, sipsorcery::EncoderPreset::Realtime, 0);
+      //MeasureEncodeLatency(AVCodecID::AV_CODEC_ID_H264, res.width, res.height, sipsorcery::EncoderPreset::Realtime, 0);
+      //MeasureEncodeLatency(AVCodecID::AV_CODEC_ID_MJPEG, res.width, res.height, sipsorcery::EncoderPreset::Realtime, 0);
+    }
+    catch (std::exception& excp) {
+      std::cerr << "Exception measuring encode latency. " << excp.what() << std::endl;
+    }
+  }
 
   return 0;
 }
@@ -120,32 +430,263 @@ int main()
 //	std::cout << "log_callback" << "." << std::endl;
 //}
 
-void InitEncoder(AVCodecID codecID, int width, int height, int fps)
+/**
+* Encodes a fixed number of frames and reports the time between each frame
+* being sent to the encoder and its packet coming out. Latency is matched
+* on pts so presets with lookahead are measured correctly.
+*/
+void MeasureEncodeLatency(AVCodecID codecID, int width, int height, sipsorcery::EncoderPreset preset, int threads)
+{
+  sipsorcery::VideoEncoder encoder(codecID, width, height, FRAMES_PER_SECOND, preset, threads);
+
+  // Enough frames and packets to cover what the encoder holds at once. Anything
+  // beyond that shows up as an allocation after the warm up.
+  sipsorcery::FramePool framePool(width, height, AVPixelFormat::AV_PIX_FMT_YUV420P, FRAME_POOL_SIZE);
+  sipsorcery::PacketPool packetPool(PACKET_POOL_SIZE);
+  sipsorcery::PoolStats warmFrameStats{}, warmPacketStats{};
+
+  std::map<int64_t, std::chrono::steady_clock::time_point> sendTimes;
+  std::vector<double> latencies;
+  latencies.reserve(LATENCY_TEST_FRAME_COUNT);
+  int64_t totalBytes = 0;
+
+  auto onPacket = [&](AVPacket* pkt) {
+    auto sent = sendTimes.find(pkt->pts);
+    if (sent != sendTimes.end()) {
+      latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent->second).count());
+      sendTimes.erase(sent);
+    }
+    totalBytes += pkt->size;
+
+    // Take ownership of the payload without copying, as a sender queue would.
+    AVPacket* owned = packetPool.Get();
+    av_packet_move_ref(owned, pkt);
+    packetPool.Return(owned);
+  };
+
+  for (int i = 0; i < LATENCY_TEST_FRAME_COUNT; i++) {
+    if (i == POOL_WARMUP_FRAME_COUNT) {
+      warmFrameStats = framePool.GetStats();
+      warmPacketStats = packetPool.GetStats();
+    }
+
+    AVFrame* frame = framePool.Get();
+    //GetTestImage(frame, i, width, height);
+    sipsorcery::FillTestFrame(frame, i);
+    frame->pts = i;
+
+    sendTimes[frame->pts] = std::chrono::steady_clock::now();
+    int encodeRes = encoder.Encode(frame, onPacket);
+    framePool.Return(frame);
+
+    if (encodeRes < 0) {
+      break;
+    }
+  }
+
+  encoder.Flush(onPacket);
+
+  auto frameStats = framePool.GetStats();
+  auto packetStats = packetPool.GetStats();
+
+  if (latencies.size() > 0) {
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for (double l : latencies) {
+      sum += l;
+    }
+
+    std::cout << avcodec_get_name(codecID) << " " << sipsorcery::VideoEncoder::GetPresetName(preset) << " " << width << "x" << height
+      << " frames " << latencies.size()
+      << ", latency ms avg " << std::fixed << std::setprecision(2) << sum / latencies.size()
+      << ", p50 " << latencies[latencies.size() / 2]
+      << ", p99 " << latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)]
+      << ", max " << latencies.back()
+      << ", kbps " << (totalBytes * 8 * FRAMES_PER_SECOND / latencies.size()) / 1000
+      << "." << std::endl;
+  }
+
+  encoder.GetTelemetry().Print(std::cout);
+
+  std::cout << "Frame pool acquisitions " << frameStats.Acquisitions << ", allocations " << frameStats.Allocations
+    << " (" << frameStats.Allocations - warmFrameStats.Allocations << " after warm up)"
+    << ", packet pool acquisitions " << packetStats.Acquisitions << ", allocations " << packetStats.Allocations
+    << " (" << packetStats.Allocations - warmPacketStats.Allocations << " after warm up)." << std::endl;
+}
+
+/**
+* Encodes the test pattern with the realtime preset and streams it as RFC 7741
+* RTP at the nominal frame rate. The packets are payloaded and sent from the
+* encoder callback, while the encoder still holds the packet they point into.
+* With sliceOutput each partition is payloaded and sent as it's handed out
+* rather than the whole frame at once. Either way the time from the encode
+* starting to the frame's first and last packets being sent is reported.
+*/
+void SendVp8Rtp(const std::string& dstAddress, int dstPort, int frameCount, int temporalLayers, bool sliceOutput)
 {
-  _codec = avcodec_find_encoder(codecID);
-  if (_codec == NULL) {
-    throw std::runtime_error("Could not find codec for ID " + std::to_string(codecID) + ".");
+  sipsorcery::VideoEncoder encoder(AV_CODEC_ID_VP8, WIDTH, HEIGHT, FRAMES_PER_SECOND, sipsorcery::EncoderPreset::Realtime, 0, 0, temporalLayers);
+  sipsorcery::FramePool framePool(WIDTH, HEIGHT, AVPixelFormat::AV_PIX_FMT_YUV420P, FRAME_POOL_SIZE);
+
+  std::random_device rd;
+  std::mt19937 rng(rd());
+  sipsorcery::Vp8RtpPayloader payloader(rng(), VP8_DEFAULT_PAYLOAD_TYPE, RTP_DEFAULT_MTU, (uint16_t)rng(), (uint16_t)rng());
+  sipsorcery::RtpSender sender(dstAddress, dstPort);
+  std::vector<sipsorcery::RtpPacketBuffers> packets;
+  int layerFrames[VIDEO_ENCODER_MAX_TEMPORAL_LAYERS] = { 0 };
+  int64_t layerBytes[VIDEO_ENCODER_MAX_TEMPORAL_LAYERS] = { 0 };
+
+  sipsorcery::LatencyHistogram firstPacketLatency, lastPacketLatency;
+  std::chrono::steady_clock::time_point encodeStart;
+
+  std::cout << "Sending " << frameCount << " VP8 frames " << WIDTH << "x" << HEIGHT << " with " << encoder.GetTemporalLayerCount()
+    << " temporal layers to " << dstAddress << ":" << dstPort << (sliceOutput ? " a partition at a time" : "") << "." << std::endl;
+
+  auto onPacket = [&](AVPacket* pkt) {
+    uint32_t timestamp = (uint32_t)(pkt->pts * RTP_CLOCK_RATE / FRAMES_PER_SECOND);
+    bool layerSync = false;
+    bool nonReference = false;
+    int layer = encoder.GetTemporalLayer(pkt, &layerSync, &nonReference);
+
+    int packetCount = payloader.Packetize(pkt->data, pkt->size, timestamp, layer, packets, layerSync, nonReference);
+    sender.Send(packets);
+
+    auto sent = std::chrono::steady_clock::now() - encodeStart;
+    firstPacketLatency.Record(sent);
+    lastPacketLatency.Record(sent);
+
+    layerFrames[layer]++;
+    layerBytes[layer] += pkt->size + packetCount * (RTP_HEADER_LENGTH + VP8_RTP_DESCRIPTOR_LENGTH);
+  };
+
+  auto onSlice = [&](AVPacket* pkt, const sipsorcery::EncodedSlice& slice) {
+    uint32_t timestamp = (uint32_t)(pkt->pts * RTP_CLOCK_RATE / FRAMES_PER_SECOND);
+    bool layerSync = false;
+    bool nonReference = false;
+    int layer = encoder.GetTemporalLayer(pkt, &layerSync, &nonReference);
+
+    int packetCount = payloader.PacketizePartition(slice.Data, slice.Length, slice.Index, slice.Last, timestamp, layer, packets,
+      layerSync, nonReference);
+    sender.Send(packets);
+
+    if (slice.Index == 0) {
+      firstPacketLatency.Record(std::chrono::steady_clock::now() - encodeStart);
+    }
+    if (slice.Last) {
+      lastPacketLatency.Record(std::chrono::steady_clock::now() - encodeStart);
+      layerFrames[layer]++;
+    }
+    layerBytes[layer] += slice.Length + packetCount * (RTP_HEADER_LENGTH + VP8_RTP_DESCRIPTOR_LENGTH);
+  };
+
+  auto frameInterval = std::chrono::microseconds(1000000 / FRAMES_PER_SECOND);
+  auto nextFrame = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < frameCount; i++) {
+    AVFrame* frame = framePool.Get();
+    sipsorcery::FillTestFrame(frame, i);
+    frame->pts = i;
+
+    encodeStart = std::chrono::steady_clock::now();
+    int encodeRes = sliceOutput ? encoder.EncodeSlices(frame, onSlice) : encoder.Encode(frame, onPacket);
+    framePool.Return(frame);
+
+    if (encodeRes < 0) {
+      break;
+    }
+
+    nextFrame += frameInterval;
+    std::this_thread::sleep_until(nextFrame);
   }
 
-  _codecCtx = avcodec_alloc_context3(_codec);
-  _codecCtx->width = width;
-  _codecCtx->height = height;
-  //_codecCtx->bit_rate = 500000;
-  _codecCtx->time_base.den = fps;
-  _codecCtx->time_base.num = 1;
-  //_codecCtx->framerate.num = fps;
-  //_codecCtx->time_base.den = 1;
-  //_codecCtx->gop_size = 10;
-  //_codecCtx->max_b_frames = 1;
+  encoder.Flush(onPacket);
 
-#pragma warning(suppress : 26812)
-  _codecCtx->pix_fmt = AVPixelFormat::AV_PIX_FMT_YUV420P;
+  std::cout << "Sent " << sender.GetPacketsSent() << " RTP packets, " << sender.GetBytesSent() << " bytes." << std::endl;
 
-  int res = avcodec_open2(_codecCtx, _codec, NULL);
+  sipsorcery::LatencyHistogram::PrintHeader(std::cout);
+  firstPacketLatency.Print(std::cout, "first packet");
+  lastPacketLatency.Print(std::cout, "last packet");
 
-  std::cout << "avcodec_open2 result " << res << "." << std::endl;
+  // What a relay forwarding up to each layer would send a viewer.
+  int cumulativeFrames = 0;
+  int64_t cumulativeBytes = 0;
+  for (int i = 0; i < encoder.GetTemporalLayerCount(); i++) {
+    cumulativeFrames += layerFrames[i];
+    cumulativeBytes += layerBytes[i];
+    std::cout << "up to layer " << i << ": " << cumulativeFrames << " frames, " << cumulativeBytes << " bytes, "
+      << std::fixed << std::setprecision(1) << (double)cumulativeFrames * FRAMES_PER_SECOND / std::max(1, frameCount) << " fps." << std::endl;
+  }
 }
 
+void SendH264Rtp(const std::string& dstAddress, int dstPort, int frameCount, bool sliceOutput)
+{
+  sipsorcery::VideoEncoder encoder(AV_CODEC_ID_H264, WIDTH, HEIGHT, FRAMES_PER_SECOND, sipsorcery::EncoderPreset::Realtime);
+  sipsorcery::FramePool framePool(WIDTH, HEIGHT, AVPixelFormat::AV_PIX_FMT_YUV420P, FRAME_POOL_SIZE);
+
+  std::random_device rd;
+  std::mt19937 rng(rd());
+  sipsorcery::H264RtpPayloader payloader(rng(), H264_DEFAULT_PAYLOAD_TYPE, RTP_DEFAULT_MTU, (uint16_t)rng());
+  sipsorcery::RtpSender sender(dstAddress, dstPort);
+  std::vector<sipsorcery::RtpPacketBuffers> packets;
+
+  sipsorcery::LatencyHistogram firstPacketLatency, lastPacketLatency;
+  std::chrono::steady_clock::time_point encodeStart;
+
+  std::cout << "Sending " << frameCount << " H.264 frames " << WIDTH << "x" << HEIGHT << " to " << dstAddress << ":" << dstPort
+    << (sliceOutput ? " a NAL unit at a time" : "") << "." << std::endl;
+
+  auto onPacket = [&](AVPacket* pkt) {
+    uint32_t timestamp = (uint32_t)(pkt->pts * RTP_CLOCK_RATE / FRAMES_PER_SECOND);
+
+    payloader.Packetize(pkt->data, pkt->size, timestamp, packets);
+    sender.Send(packets);
+
+    auto sent = std::chrono::steady_clock::now() - encodeStart;
+    firstPacketLatency.Record(sent);
+    lastPacketLatency.Record(sent);
+  };
+
+  auto onSlice = [&](AVPacket* pkt, const sipsorcery::EncodedSlice& slice) {
+    uint32_t timestamp = (uint32_t)(pkt->pts * RTP_CLOCK_RATE / FRAMES_PER_SECOND);
+
+    payloader.PacketizeNal(slice.Data, slice.Length, slice.Last, timestamp, packets);
+    sender.Send(packets);
+
+    if (slice.Index == 0) {
+      firstPacketLatency.Record(std::chrono::steady_clock::now() - encodeStart);
+    }
+    if (slice.Last) {
+      lastPacketLatency.Record(std::chrono::steady_clock::now() - encodeStart);
+    }
+  };
+
+  auto frameInterval = std::chrono::microseconds(1000000 / FRAMES_PER_SECOND);
+  auto nextFrame = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < frameCount; i++) {
+    AVFrame* frame = framePool.Get();
+    sipsorcery::FillTestFrame(frame, i);
+    frame->pts = i;
+
+    encodeStart = std::chrono::steady_clock::now();
+    int encodeRes = sliceOutput ? encoder.EncodeSlices(frame, onSlice) : encoder.Encode(frame, onPacket);
+    framePool.Return(frame);
+
+    if (encodeRes < 0) {
+      break;
+    }
+
+    nextFrame += frameInterval;
+    std::this_thread::sleep_until(nextFrame);
+  }
+
+  encoder.Flush(onPacket);
+
+  std::cout << "Sent " << sender.GetPacketsSent() << " RTP packets, " << sender.GetBytesSent() << " bytes." << std::endl;
+
+  sipsorcery::LatencyHistogram::PrintHeader(std::cout);
+  firstPacketLatency.Print(std::cout, "first packet");
+  lastPacketLatency.Print(std::cout, "last packet");
+}
 
 //void GetTestImage(AVFrame* dstframe, int frame_index, int width, int height)
 //{
@@ -167,13 +708,7 @@ void InitEncoder(AVCodecID codecID, int width, int height, int fps)
 //	cv::putText(m, str.c_str(), { 0, 50 }, cv::HersheyFonts::FONT_HERSHEY_SIMPLEX, FONT_SCALE, CV_RGB(0, 0, 0));
 //	cv::putText(m, std::to_string(frame_index), { 100, 200 }, cv::HersheyFonts::FONT_HERSHEY_COMPLEX, FONT_SCALE, CV_RGB(0, 0, 0));
 //
-//	_swsContext = sws_getCachedContext(_swsContext, width, height, AVPixelFormat::AV_PIX_FMT_BGR24, width, height, AVPixelFormat::AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, NULL, NULL, NULL);
-//
-//	AVFrame * src = av_frame_alloc();
-//	src->data[0] = (uint8_t*)m.data;
-//	src->linesize[0] = av_image_get_linesize(AVPixelFormat::AV_PIX_FMT_BGR24, width, 0);
-//
-//	sws_scale(_swsContext, src->data, src->linesize, 0, height, dstframe->data, dstframe->linesize);
+//	static sipsorcery::ColorConverter converter(width, height, AVPixelFormat::AV_PIX_FMT_BGR24, AVPixelFormat::AV_PIX_FMT_YUV420P);
 //
-//	av_frame_free(&src);
+//	converter.Convert((uint8_t*)m.data, (int)m.step, dstframe->data, dstframe->linesize);
 //}
@@ -0,0 +1,235 @@
+//-----------------------------------------------------------------------------
+// Filename: boundedqueue.h
+//
+// Description: Fixed capacity lock free queue for handing items between
+// threads. This is Dmitry Vyukov's bounded MPMC queue: every cell carries a
+// sequence number that tells producers and consumers whether it is free to
+// write or ready to read, so a push or pop is one compare and swap on the
+// position plus the cell access.
+//
+// What happens when the queue is full is set per queue:
+//  - Block: the producer waits for space. For links where nothing may be
+//           lost, e.g. encoded packets.
+//  - DropNewest: the item being pushed is discarded.
+//  - DropOldest: the oldest queued item is discarded to make room, for live
+//                video where a newer frame is always worth more. The producer
+//                can do this itself as the queue allows multiple consumers.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_BOUNDEDQUEUE_H
+#define SIPSORCERY_BOUNDEDQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#define BOUNDED_QUEUE_CACHE_LINE 64
+#define BOUNDED_QUEUE_IDLE_SPINS 64             // Yields before a waiting consumer starts sleeping.
+#define BOUNDED_QUEUE_IDLE_SLEEP_MICROSECONDS 100
+
+namespace sipsorcery
+{
+  enum class QueueDropPolicy
+  {
+    Block,
+    DropNewest,
+    DropOldest
+  };
+
+  template<typename T>
+  class BoundedQueue
+  {
+  public:
+    /**
+    * @param[in] capacity: the maximum number of queued items, rounded up to a power of 2.
+    * @param[in] policy: what Push does when the queue is full.
+    */
+    BoundedQueue(size_t capacity, QueueDropPolicy policy) :
+      _policy(policy)
+    {
+      size_t size = 2;
+      while (size < capacity) {
+        size <<= 1;
+      }
+
+      _mask = size - 1;
+      _cells.reset(new Cell[size]);
+      for (size_t i = 0; i < size; i++) {
+        _cells[i].Sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /**
+    * Attempts to queue an item without applying the drop policy.
+    * @@Returns false if the queue is full.
+    */
+    bool TryPush(const T& item)
+    {
+      Cell* cell = nullptr;
+      size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+
+      while (true) {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->Sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+          if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        }
+        else if (diff < 0) {
+          return false;
+        }
+        else {
+          pos = _enqueuePos.load(std::memory_order_relaxed);
+        }
+      }
+
+      cell->Data = item;
+      cell->Sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+    * @@Returns false if the queue is empty.
+    */
+    bool TryPop(T& item)
+    {
+      Cell* cell = nullptr;
+      size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+
+      while (true) {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->Sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+          if (_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        }
+        else if (diff < 0) {
+          return false;
+        }
+        else {
+          pos = _dequeuePos.load(std::memory_order_relaxed);
+        }
+      }
+
+      item = cell->Data;
+      cell->Sequence.store(pos + _mask + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+    * Queues an item applying the drop policy if the queue is full.
+    * @param[in] item: the item to queue.
+    * @param[in] release: called with any item that is dropped, the pushed
+    *  item for DropNewest or the evicted one for DropOldest.
+    * @@Returns true if the item was queued.
+    */
+    template<typename ReleaseFn>
+    bool Push(const T& item, ReleaseFn release)
+    {
+      while (!TryPush(item)) {
+        if (_policy == QueueDropPolicy::Block) {
+          std::this_thread::yield();
+        }
+        else if (_policy == QueueDropPolicy::DropNewest) {
+          _dropped++;
+          release(item);
+          return false;
+        }
+        else {
+          T oldest;
+          if (TryPop(oldest)) {
+            _dropped++;
+            release(oldest);
+          }
+        }
+      }
+
+      return true;
+    }
+
+    /**
+    * Takes the next item, waiting while the queue is empty. Spins briefly
+    * before sleeping so a busy consumer doesn't pay for a sleep on every item.
+    * @param[out] item: the item taken off the queue.
+    * @param[in] done: set by the producer once it will push no more items.
+    * @@Returns false once done is set and the queue is empty.
+    */
+    bool Pop(T& item, const std::atomic<bool>& done)
+    {
+      int idle = 0;
+
+      while (true) {
+        // Check done before the pop, anything queued before done was set is then still picked up.
+        bool finished = done.load(std::memory_order_acquire);
+
+        if (TryPop(item)) {
+          return true;
+        }
+        else if (finished) {
+          return false;
+        }
+        else if (idle++ < BOUNDED_QUEUE_IDLE_SPINS) {
+          std::this_thread::yield();
+        }
+        else {
+          std::this_thread::sleep_for(std::chrono::microseconds(BOUNDED_QUEUE_IDLE_SLEEP_MICROSECONDS));
+        }
+      }
+    }
+
+    /**
+    * The number of queued items. Only approximate while other threads are
+    * pushing or popping.
+    */
+    size_t GetSize() const
+    {
+      return _enqueuePos.load(std::memory_order_relaxed) - _dequeuePos.load(std::memory_order_relaxed);
+    }
+
+    size_t GetCapacity() const { return _mask + 1; }
+    uint64_t GetDroppedCount() const { return _dropped.load(); }
+    QueueDropPolicy GetPolicy() const { return _policy; }
+
+  private:
+    struct Cell
+    {
+      std::atomic<size_t> Sequence;
+      T Data;
+    };
+
+    // The positions are written by different threads, keep them on their own cache lines.
+    char _pad0[BOUNDED_QUEUE_CACHE_LINE];
+    std::atomic<size_t> _enqueuePos{ 0 };
+    char _pad1[BOUNDED_QUEUE_CACHE_LINE];
+    std::atomic<size_t> _dequeuePos{ 0 };
+    char _pad2[BOUNDED_QUEUE_CACHE_LINE];
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    QueueDropPolicy _policy;
+    std::atomic<uint64_t> _dropped{ 0 };
+  };
+}
+
+#endif // SIPSORCERY_BOUNDEDQUEUE_H
@@ -0,0 +1,246 @@
+#include "bufferedfilewriter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace sipsorcery
+{
+  static uint8_t* AlignedAlloc(size_t size)
+  {
+#ifdef _WIN32
+    return static_cast<uint8_t*>(_aligned_malloc(size, BUFFERED_WRITER_ALIGNMENT));
+#else
+    void* ptr = nullptr;
+    return (posix_memalign(&ptr, BUFFERED_WRITER_ALIGNMENT, size) == 0) ? static_cast<uint8_t*>(ptr) : nullptr;
+#endif
+  }
+
+  static void AlignedFree(uint8_t* ptr)
+  {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+  }
+
+  static int SeekFile(std::FILE* file, uint64_t offset)
+  {
+#ifdef _WIN32
+    return _fseeki64(file, (int64_t)offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+  }
+
+  FileFlushThread::FileFlushThread()
+  {
+    _thread = std::thread(&FileFlushThread::Run, this);
+  }
+
+  FileFlushThread::~FileFlushThread()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _condition.notify_one();
+    _thread.join();
+  }
+
+  void FileFlushThread::Submit(BufferedFileWriter* writer, uint8_t* buffer, size_t length)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _queue.push_back(FlushRequest{ writer, buffer, length });
+    }
+    _condition.notify_one();
+  }
+
+  void FileFlushThread::Run()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+      _condition.wait(lock, [this] { return _stop || !_queue.empty(); });
+
+      if (_queue.empty()) {
+        break;
+      }
+
+      FlushRequest request = _queue.front();
+      _queue.pop_front();
+      lock.unlock();
+
+      request.Writer->WriteBuffer(request.Buffer, request.Length);
+      _writes++;
+      _bytes += request.Length;
+      request.Writer->Completed(request.Buffer);
+
+      lock.lock();
+    }
+  }
+
+  BufferedFileWriter::BufferedFileWriter(const std::string& path, FileFlushThread& flusher, size_t bufferSize) :
+    _path(path), _flusher(flusher),
+    _bufferSize((bufferSize + BUFFERED_WRITER_ALIGNMENT - 1) / BUFFERED_WRITER_ALIGNMENT * BUFFERED_WRITER_ALIGNMENT)
+  {
+    _file = std::fopen(path.c_str(), "wb");
+    if (_file == nullptr) {
+      throw std::runtime_error("Failed to create file " + path + ".");
+    }
+
+    // The buffers are big enough, stdio's own would only add a copy.
+    std::setvbuf(_file, NULL, _IONBF, 0);
+
+    for (int i = 0; i < BUFFERED_WRITER_BUFFER_COUNT; i++) {
+      uint8_t* buffer = AlignedAlloc(_bufferSize);
+      if (buffer == nullptr) {
+        for (auto allocated : _buffers) {
+          AlignedFree(allocated);
+        }
+        std::fclose(_file);
+        throw std::runtime_error("Failed to allocate write buffers for " + path + ".");
+      }
+      _buffers.push_back(buffer);
+      _free.push_back(buffer);
+    }
+
+    NextBuffer();
+  }
+
+  BufferedFileWriter::~BufferedFileWriter()
+  {
+    Close();
+
+    for (auto buffer : _buffers) {
+      AlignedFree(buffer);
+    }
+  }
+
+  void BufferedFileWriter::Write(const void* data, size_t length)
+  {
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+
+    while (length > 0) {
+      if (_currentLength == 0) {
+        _currentFirstWrite = std::chrono::steady_clock::now();
+      }
+
+      size_t n = std::min(length, _bufferSize - _currentLength);
+      std::memcpy(_current + _currentLength, src, n);
+      _currentLength += n;
+      _position += n;
+      src += n;
+      length -= n;
+
+      if (_currentLength == _bufferSize) {
+        Flush();
+      }
+    }
+
+    if (_currentLength > 0 &&
+      std::chrono::steady_clock::now() - _currentFirstWrite >= std::chrono::milliseconds(BUFFERED_WRITER_MAX_HOLD_MS)) {
+      Flush();
+    }
+  }
+
+  void BufferedFileWriter::Overwrite(uint64_t offset, const void* data, size_t length)
+  {
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+
+    // Whatever falls in the current buffer is patched in place.
+    if (offset + length > _currentOffset) {
+      uint64_t start = std::max(offset, _currentOffset);
+      size_t skip = (size_t)(start - offset);
+      std::memcpy(_current + (start - _currentOffset), src + skip, length - skip);
+      length = skip;
+    }
+
+    // The rest has already gone to the flush thread.
+    if (length > 0) {
+      _patches.push_back(Patch{ offset, std::vector<uint8_t>(src, src + length) });
+    }
+  }
+
+  void BufferedFileWriter::Flush()
+  {
+    if (_currentLength == 0) {
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _inFlight++;
+    }
+
+    _flusher.Submit(this, _current, _currentLength);
+
+    _currentOffset += _currentLength;
+    _current = nullptr;
+    _currentLength = 0;
+
+    NextBuffer();
+  }
+
+  void BufferedFileWriter::Close()
+  {
+    if (_file == nullptr) {
+      return;
+    }
+
+    Flush();
+
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _freeCondition.wait(lock, [this] { return _inFlight == 0; });
+    }
+
+    for (auto& patch : _patches) {
+      if (SeekFile(_file, patch.Offset) != 0 ||
+        std::fwrite(patch.Data.data(), 1, patch.Data.size(), _file) != patch.Data.size()) {
+        _failed = true;
+      }
+      _writes++;
+    }
+    _patches.clear();
+
+    if (std::fclose(_file) != 0) {
+      _failed = true;
+    }
+    _file = nullptr;
+  }
+
+  void BufferedFileWriter::NextBuffer()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _freeCondition.wait(lock, [this] { return !_free.empty(); });
+    _current = _free.back();
+    _free.pop_back();
+  }
+
+  /**
+  * Called on the flush thread. Buffers for a file are written in the order
+  * they were submitted so the file position is always the end.
+  */
+  void BufferedFileWriter::WriteBuffer(const uint8_t* buffer, size_t length)
+  {
+    if (std::fwrite(buffer, 1, length, _file) != length) {
+      _failed = true;
+    }
+    _writes++;
+  }
+
+  void BufferedFileWriter::Completed(uint8_t* buffer)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free.push_back(buffer);
+    _inFlight--;
+    _freeCondition.notify_all();
+  }
+}
@@ -0,0 +1,172 @@
+//-----------------------------------------------------------------------------
+// Filename: bufferedfilewriter.h
+//
+// Description: Write behind file output for recording many streams at once.
+// Each file is written into a few large page aligned buffers. When a buffer
+// fills, or has held data for BUFFERED_WRITER_MAX_HOLD_MS, it is handed to a
+// flush thread shared by all the files and the writer carries on in the next
+// buffer. A stream writing a frame never waits on the disk unless every one of
+// its buffers is still queued, and a 1Mbps stream costs about one write a
+// second instead of one per frame.
+//
+// Container headers that can only be filled in later, sizes, counts and
+// durations, are written with Overwrite. If the bytes are still in the
+// current buffer they're patched in memory, otherwise the patch is applied
+// when the file is closed.
+//
+// There is one flush thread so each file's buffers reach the disk in the
+// order they were filled.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_BUFFEREDFILEWRITER_H
+#define SIPSORCERY_BUFFEREDFILEWRITER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define BUFFERED_WRITER_BUFFER_SIZE (1024 * 1024)
+#define BUFFERED_WRITER_BUFFER_COUNT 3
+#define BUFFERED_WRITER_ALIGNMENT 4096        // Page and sector aligned so the buffers suit unbuffered I/O.
+#define BUFFERED_WRITER_MAX_HOLD_MS 1000      // Longest data sits in memory before it's queued for the disk.
+
+namespace sipsorcery
+{
+  class BufferedFileWriter;
+
+  class FileFlushThread
+  {
+  public:
+    FileFlushThread();
+
+    /**
+    * Writes anything still queued before returning. Every file using the
+    * thread must be closed first.
+    */
+    ~FileFlushThread();
+
+    FileFlushThread(const FileFlushThread&) = delete;
+    FileFlushThread& operator=(const FileFlushThread&) = delete;
+
+    uint64_t GetWriteCount() const { return _writes.load(); }
+    uint64_t GetBytesWritten() const { return _bytes.load(); }
+
+  private:
+    friend class BufferedFileWriter;
+
+    struct FlushRequest
+    {
+      BufferedFileWriter* Writer;
+      uint8_t* Buffer;
+      size_t Length;
+    };
+
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::deque<FlushRequest> _queue;
+    std::thread _thread;
+    bool _stop{ false };
+    std::atomic<uint64_t> _writes{ 0 };
+    std::atomic<uint64_t> _bytes{ 0 };
+
+    void Submit(BufferedFileWriter* writer, uint8_t* buffer, size_t length);
+    void Run();
+  };
+
+  class BufferedFileWriter
+  {
+  public:
+    /**
+    * @param[in] path: the file to create, an existing file is truncated.
+    * @param[in] flusher: the thread that writes the buffers, must outlive the writer.
+    * @param[in] bufferSize: the size of each buffer, rounded up to BUFFERED_WRITER_ALIGNMENT.
+    * Throws std::runtime_error if the file cannot be created.
+    */
+    BufferedFileWriter(const std::string& path, FileFlushThread& flusher, size_t bufferSize = BUFFERED_WRITER_BUFFER_SIZE);
+    ~BufferedFileWriter();
+
+    BufferedFileWriter(const BufferedFileWriter&) = delete;
+    BufferedFileWriter& operator=(const BufferedFileWriter&) = delete;
+
+    /**
+    * Appends to the file. Only blocks if every buffer is waiting on the flush thread.
+    */
+    void Write(const void* data, size_t length);
+
+    /**
+    * Replaces bytes already written, e.g. a size field in a header.
+    * @param[in] offset: the file offset to write at, the range must be before GetPosition.
+    */
+    void Overwrite(uint64_t offset, const void* data, size_t length);
+
+    /**
+    * Queues the current buffer for writing even if it isn't full.
+    */
+    void Flush();
+
+    /**
+    * Writes out everything buffered, applies any outstanding patches and
+    * closes the file. Called by the destructor if needed.
+    */
+    void Close();
+
+    uint64_t GetPosition() const { return _position; }
+    uint64_t GetWriteCount() const { return _writes.load(); }
+    bool HasFailed() const { return _failed.load(); }
+    const std::string& GetPath() const { return _path; }
+
+  private:
+    struct Patch
+    {
+      uint64_t Offset;
+      std::vector<uint8_t> Data;
+    };
+
+    std::string _path;
+    FileFlushThread& _flusher;
+    std::FILE* _file{ nullptr };
+    size_t _bufferSize;
+
+    std::vector<uint8_t*> _buffers;
+    std::mutex _mutex;
+    std::condition_variable _freeCondition;
+    std::vector<uint8_t*> _free;
+    int _inFlight{ 0 };
+
+    uint8_t* _current{ nullptr };
+    size_t _currentLength{ 0 };
+    uint64_t _currentOffset{ 0 };           // File offset of the start of the current buffer.
+    uint64_t _position{ 0 };
+    std::chrono::steady_clock::time_point _currentFirstWrite;
+    std::vector<Patch> _patches;
+
+    std::atomic<uint64_t> _writes{ 0 };
+    std::atomic<bool> _failed{ false };
+
+    void WriteBuffer(const uint8_t* buffer, size_t length);
+    void Completed(uint8_t* buffer);
+    void NextBuffer();
+
+    friend class FileFlushThread;
+  };
+}
+
+#endif // SIPSORCERY_BUFFEREDFILEWRITER_H
@@ -0,0 +1,431 @@
+#include "colorconvert.h"
+#include "framepool.h"
+
+extern "C"
+{
+#include <libswscale\swscale.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define COLOR_CONVERT_FRACTION_BITS 14   // Fixed point precision of the coefficients.
+
+namespace sipsorcery
+{
+  // Converts a pair of rows. coeffs are the 12 Y, U and V multipliers, y1 is
+  // null for an odd last row and uv is only set for NV12.
+  typedef void(*RowPairKernel)(const uint8_t* row0, const uint8_t* row1, int width, const int16_t* coeffs,
+    int yOffset, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, uint8_t* uv);
+
+  ColorConverter::ColorConverter(int width, int height, AVPixelFormat srcFormat, AVPixelFormat dstFormat,
+    ColorMatrix matrix, ColorRange range, int threads) :
+    _width(width), _height(height), _srcFormat(srcFormat), _dstFormat(dstFormat)
+  {
+    if (!IsSupported(srcFormat, dstFormat)) {
+      throw std::runtime_error("Color converter does not support " + std::string(av_get_pix_fmt_name(srcFormat)) +
+        " to " + std::string(av_get_pix_fmt_name(dstFormat)) + ".");
+    }
+    else if (width < 2 || height < 2) {
+      throw std::runtime_error("Color converter frame size " + std::to_string(width) + "x" + std::to_string(height) + " is too small.");
+    }
+
+    _bytesPerPixel = (srcFormat == AV_PIX_FMT_BGR24) ? 3 : 4;
+
+    double kr = (matrix == ColorMatrix::BT709) ? 0.2126 : 0.299;
+    double kb = (matrix == ColorMatrix::BT709) ? 0.0722 : 0.114;
+    double kg = 1.0 - kr - kb;
+    double yScale = (range == ColorRange::Limited) ? 219.0 / 255.0 : 1.0;
+    double cScale = (range == ColorRange::Limited) ? 224.0 / 255.0 : 1.0;
+
+    double y[3] = { yScale * kr, yScale * kg, yScale * kb };
+    double u[3] = { cScale * -kr / (2 * (1 - kb)), cScale * -kg / (2 * (1 - kb)), cScale * 0.5 };
+    double v[3] = { cScale * 0.5, cScale * -kg / (2 * (1 - kr)), cScale * -kb / (2 * (1 - kr)) };
+
+    // Coefficients are laid out in the order the channels appear in memory.
+    int r = (srcFormat == AV_PIX_FMT_RGBA) ? 0 : 2;
+    int b = 2 - r;
+    auto fixed = [](double c) { return (int16_t)std::lround(c * (1 << COLOR_CONVERT_FRACTION_BITS)); };
+
+    int16_t* m = _coeffs.Multipliers;
+    for (int i = 0; i < 3; i++) {
+      const double* c = (i == 0) ? y : (i == 1) ? u : v;
+      m[i * 4 + r] = fixed(c[0]);
+      m[i * 4 + 1] = fixed(c[1]);
+      m[i * 4 + b] = fixed(c[2]);
+      m[i * 4 + 3] = 0;
+    }
+    _coeffs.YOffset = (range == ColorRange::Limited) ? 16 : 0;
+
+    _useAvx2 = HasAvx2();
+
+    if (threads <= 0) {
+      threads = (width * height >= COLOR_CONVERT_PARALLEL_MIN_PIXELS) ? std::max(1, (int)std::thread::hardware_concurrency()) : 1;
+    }
+    _threadCount = std::min(threads, (height + 1) / 2);
+
+    // The calling thread converts the first band, the pool the rest.
+    if (_threadCount > 1) {
+      _pool.reset(new WorkStealingPool(_threadCount - 1));
+    }
+  }
+
+  ColorConverter::~ColorConverter()
+  { }
+
+  bool ColorConverter::IsSupported(AVPixelFormat srcFormat, AVPixelFormat dstFormat)
+  {
+    return (srcFormat == AV_PIX_FMT_BGRA || srcFormat == AV_PIX_FMT_RGBA || srcFormat == AV_PIX_FMT_BGR24) &&
+      (dstFormat == AV_PIX_FMT_YUV420P || dstFormat == AV_PIX_FMT_NV12);
+  }
+
+  bool ColorConverter::HasAvx2()
+  {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+      return false;
+    }
+
+    // AVX2 also needs the OS to save the YMM registers, checked through OSXSAVE and XCR0.
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+      return false;
+    }
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+  }
+
+  int ColorConverter::Convert(const AVFrame* src, AVFrame* dst)
+  {
+    if (src->width != _width || src->height != _height || src->format != _srcFormat ||
+      dst->width != _width || dst->height != _height || dst->format != _dstFormat) {
+      return AVERROR(EINVAL);
+    }
+
+    Convert(src->data[0], src->linesize[0], dst->data, dst->linesize);
+    return 0;
+  }
+
+  void ColorConverter::Convert(const uint8_t* src, int srcStride, uint8_t* const dst[], const int dstStride[])
+  {
+    if (_threadCount == 1) {
+      ConvertRows(src, srcStride, dst, dstStride, 0, _height);
+      return;
+    }
+
+    // Bands are whole row pairs so each band writes its own chroma rows.
+    int pairs = (_height + 1) / 2;
+
+    {
+      std::lock_guard<std::mutex> lock(_doneMutex);
+      _bandsRemaining = _threadCount - 1;
+    }
+
+    for (int band = 1; band < _threadCount; band++) {
+      int rowStart = 2 * (pairs * band / _threadCount);
+      int rowEnd = std::min(_height, 2 * (pairs * (band + 1) / _threadCount));
+
+      _pool->Submit([this, src, srcStride, dst, dstStride, rowStart, rowEnd] {
+        ConvertRows(src, srcStride, dst, dstStride, rowStart, rowEnd);
+
+        std::lock_guard<std::mutex> lock(_doneMutex);
+        _bandsRemaining--;
+        _doneCondition.notify_one();
+      });
+    }
+
+    ConvertRows(src, srcStride, dst, dstStride, 0, 2 * (pairs / _threadCount));
+
+    std::unique_lock<std::mutex> lock(_doneMutex);
+    _doneCondition.wait(lock, [this] { return _bandsRemaining == 0; });
+  }
+
+  /**
+  * Converts pixels [xStart, width) of a pair of rows. An odd last column is
+  * paired with itself for chroma, as is an odd last row by the caller
+  * passing the same row twice with y1 null.
+  */
+  template<int BPP>
+  static void ConvertRowPairScalar(const uint8_t* row0, const uint8_t* row1, int xStart, int width, const int16_t* coeffs,
+    int yOffset, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, uint8_t* uv)
+  {
+    const int16_t* cy = coeffs;
+    const int16_t* cu = coeffs + 4;
+    const int16_t* cv = coeffs + 8;
+    const int yRound = (yOffset << COLOR_CONVERT_FRACTION_BITS) + (1 << (COLOR_CONVERT_FRACTION_BITS - 1));
+    const int cRound = (128 << (COLOR_CONVERT_FRACTION_BITS + 2)) + (1 << (COLOR_CONVERT_FRACTION_BITS + 1));
+
+    for (int x = xStart; x < width; x += 2) {
+      int x1 = std::min(x + 1, width - 1);
+      const uint8_t* p[4] = { row0 + x * BPP, row0 + x1 * BPP, row1 + x * BPP, row1 + x1 * BPP };
+
+      auto luma = [&](const uint8_t* px) {
+        int sum = px[0] * cy[0] + px[1] * cy[1] + px[2] * cy[2] + yRound;
+        return (uint8_t)std::min(255, std::max(0, sum >> COLOR_CONVERT_FRACTION_BITS));
+      };
+
+      y0[x] = luma(p[0]);
+      if (x1 != x) {
+        y0[x1] = luma(p[1]);
+      }
+
+      if (y1 != nullptr) {
+        y1[x] = luma(p[2]);
+        if (x1 != x) {
+          y1[x1] = luma(p[3]);
+        }
+      }
+
+      int c0 = p[0][0] + p[1][0] + p[2][0] + p[3][0];
+      int c1 = p[0][1] + p[1][1] + p[2][1] + p[3][1];
+      int c2 = p[0][2] + p[1][2] + p[2][2] + p[3][2];
+      int cb = std::min(255, std::max(0, (c0 * cu[0] + c1 * cu[1] + c2 * cu[2] + cRound) >> (COLOR_CONVERT_FRACTION_BITS + 2)));
+      int cr = std::min(255, std::max(0, (c0 * cv[0] + c1 * cv[1] + c2 * cv[2] + cRound) >> (COLOR_CONVERT_FRACTION_BITS + 2)));
+
+      if (uv != nullptr) {
+        uv[x] = (uint8_t)cb;
+        uv[x + 1] = (uint8_t)cr;
+      }
+      else {
+        u[x / 2] = (uint8_t)cb;
+        v[x / 2] = (uint8_t)cr;
+      }
+    }
+  }
+
+  /**
+  * Loads 8 pixels as 4 byte BGRx or RGBx. BGR24 is expanded with a shuffle,
+  * which reads 4 bytes beyond the 8th pixel.
+  */
+  template<int BPP>
+  static inline __m256i Load8Pixels(const uint8_t* p)
+  {
+    if (BPP == 4) {
+      return _mm256_loadu_si256((const __m256i*)p);
+    }
+    else {
+      const __m256i expand = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+      __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)p)),
+        _mm_loadu_si128((const __m128i*)(p + 12)), 1);
+      return _mm256_shuffle_epi8(v, expand);
+    }
+  }
+
+  /**
+  * Multiplies each 4 x 16 bit pixel by the coefficients and sums the
+  * channels. lo holds pixels 0,1 | 4,5 and hi pixels 2,3 | 6,7, as unpacked
+  * from a register of 8 pixels, the result is the 8 sums in pixel order.
+  */
+  static inline __m256i PixelSums(__m256i lo, __m256i hi, __m256i coeffs)
+  {
+    return _mm256_hadd_epi32(_mm256_madd_epi16(lo, coeffs), _mm256_madd_epi16(hi, coeffs));
+  }
+
+  /**
+  * Packs 16 x 32 bit values, 8 in each register in pixel order, to 16 bytes.
+  */
+  static inline __m128i Pack16(__m256i a, __m256i b)
+  {
+    __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+    return _mm_packus_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+  }
+
+  template<int BPP>
+  static void ConvertRowPairAvx2(const uint8_t* row0, const uint8_t* row1, int width, const int16_t* coeffs,
+    int yOffset, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, uint8_t* uv)
+  {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i cy = _mm256_set1_epi64x(*(const int64_t*)coeffs);
+    const __m256i cu = _mm256_set1_epi64x(*(const int64_t*)(coeffs + 4));
+    const __m256i cv = _mm256_set1_epi64x(*(const int64_t*)(coeffs + 8));
+    const __m256i yRound = _mm256_set1_epi32((yOffset << COLOR_CONVERT_FRACTION_BITS) + (1 << (COLOR_CONVERT_FRACTION_BITS - 1)));
+    const __m256i cRound = _mm256_set1_epi32((128 << (COLOR_CONVERT_FRACTION_BITS + 2)) + (1 << (COLOR_CONVERT_FRACTION_BITS + 1)));
+
+    // BGR24 loads read 4 bytes past the 16th pixel, stop while that is still inside the row.
+    int simdWidth = (BPP == 4) ? width : width - 2;
+    int x = 0;
+
+    for (; x + 16 <= simdWidth; x += 16) {
+      __m256i a0 = Load8Pixels<BPP>(row0 + x * BPP);
+      __m256i b0 = Load8Pixels<BPP>(row0 + (x + 8) * BPP);
+      __m256i a1 = Load8Pixels<BPP>(row1 + x * BPP);
+      __m256i b1 = Load8Pixels<BPP>(row1 + (x + 8) * BPP);
+
+      __m256i a0lo = _mm256_unpacklo_epi8(a0, zero), a0hi = _mm256_unpackhi_epi8(a0, zero);
+      __m256i b0lo = _mm256_unpacklo_epi8(b0, zero), b0hi = _mm256_unpackhi_epi8(b0, zero);
+      __m256i a1lo = _mm256_unpacklo_epi8(a1, zero), a1hi = _mm256_unpackhi_epi8(a1, zero);
+      __m256i b1lo = _mm256_unpacklo_epi8(b1, zero), b1hi = _mm256_unpackhi_epi8(b1, zero);
+
+      _mm_storeu_si128((__m128i*)(y0 + x), Pack16(
+        _mm256_srai_epi32(_mm256_add_epi32(PixelSums(a0lo, a0hi, cy), yRound), COLOR_CONVERT_FRACTION_BITS),
+        _mm256_srai_epi32(_mm256_add_epi32(PixelSums(b0lo, b0hi, cy), yRound), COLOR_CONVERT_FRACTION_BITS)));
+
+      if (y1 != nullptr) {
+        _mm_storeu_si128((__m128i*)(y1 + x), Pack16(
+          _mm256_srai_epi32(_mm256_add_epi32(PixelSums(a1lo, a1hi, cy), yRound), COLOR_CONVERT_FRACTION_BITS),
+          _mm256_srai_epi32(_mm256_add_epi32(PixelSums(b1lo, b1hi, cy), yRound), COLOR_CONVERT_FRACTION_BITS)));
+      }
+
+      // Add the two rows, then the horizontal pairs, giving the sum of each 2x2 block.
+      __m256i alo = _mm256_add_epi16(a0lo, a1lo), ahi = _mm256_add_epi16(a0hi, a1hi);
+      __m256i blo = _mm256_add_epi16(b0lo, b1lo), bhi = _mm256_add_epi16(b0hi, b1hi);
+
+      __m256i cb = _mm256_permute4x64_epi64(_mm256_hadd_epi32(PixelSums(alo, ahi, cu), PixelSums(blo, bhi, cu)), 0xD8);
+      __m256i cr = _mm256_permute4x64_epi64(_mm256_hadd_epi32(PixelSums(alo, ahi, cv), PixelSums(blo, bhi, cv)), 0xD8);
+      cb = _mm256_srai_epi32(_mm256_add_epi32(cb, cRound), COLOR_CONVERT_FRACTION_BITS + 2);
+      cr = _mm256_srai_epi32(_mm256_add_epi32(cr, cRound), COLOR_CONVERT_FRACTION_BITS + 2);
+
+      __m128i chroma = Pack16(cb, cr);   // 8 U followed by 8 V.
+
+      if (uv != nullptr) {
+        _mm_storeu_si128((__m128i*)(uv + x), _mm_unpacklo_epi8(chroma, _mm_srli_si128(chroma, 8)));
+      }
+      else {
+        _mm_storel_epi64((__m128i*)(u + x / 2), chroma);
+        _mm_storel_epi64((__m128i*)(v + x / 2), _mm_srli_si128(chroma, 8));
+      }
+    }
+
+    ConvertRowPairScalar<BPP>(row0, row1, x, width, coeffs, yOffset, y0, y1, u, v, uv);
+  }
+
+  template<int BPP>
+  static void ConvertRowPairScalarAll(const uint8_t* row0, const uint8_t* row1, int width, const int16_t* coeffs,
+    int yOffset, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, uint8_t* uv)
+  {
+    ConvertRowPairScalar<BPP>(row0, row1, 0, width, coeffs, yOffset, y0, y1, u, v, uv);
+  }
+
+  void ColorConverter::ConvertRows(const uint8_t* src, int srcStride, uint8_t* const dst[], const int dstStride[], int rowStart, int rowEnd)
+  {
+    RowPairKernel kernel = nullptr;
+    if (_bytesPerPixel == 4) {
+      kernel = _useAvx2 ? ConvertRowPairAvx2<4> : ConvertRowPairScalarAll<4>;
+    }
+    else {
+      kernel = _useAvx2 ? ConvertRowPairAvx2<3> : ConvertRowPairScalarAll<3>;
+    }
+
+    bool nv12 = _dstFormat == AV_PIX_FMT_NV12;
+
+    for (int row = rowStart; row < rowEnd; row += 2) {
+      bool lastOdd = row + 1 >= _height;
+      const uint8_t* row0 = src + row * srcStride;
+      const uint8_t* row1 = lastOdd ? row0 : row0 + srcStride;
+      uint8_t* y0 = dst[0] + row * dstStride[0];
+      uint8_t* y1 = lastOdd ? nullptr : y0 + dstStride[0];
+      int chromaRow = row / 2;
+
+      if (nv12) {
+        kernel(row0, row1, _width, _coeffs.Multipliers, _coeffs.YOffset, y0, y1, nullptr, nullptr, dst[1] + chromaRow * dstStride[1]);
+      }
+      else {
+        kernel(row0, row1, _width, _coeffs.Multipliers, _coeffs.YOffset, y0, y1,
+          dst[1] + chromaRow * dstStride[1], dst[2] + chromaRow * dstStride[2], nullptr);
+      }
+    }
+  }
+
+  void RunColorConvertBenchmark(int frameCount)
+  {
+    const int resolutions[][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+    const AVPixelFormat srcFormats[] = { AV_PIX_FMT_BGR24, AV_PIX_FMT_BGRA, AV_PIX_FMT_RGBA };
+    const AVPixelFormat dstFormats[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12 };
+
+    std::cout << "Color conversion, AVX2 " << (ColorConverter::HasAvx2() ? "available" : "not available")
+      << ", ms per frame over " << frameCount << " frames." << std::endl;
+
+    for (auto& res : resolutions) {
+      int width = res[0], height = res[1];
+
+      for (auto srcFormat : srcFormats) {
+        FramePool srcPool(width, height, srcFormat, 1);
+        AVFrame* src = srcPool.Get();
+
+        // A smooth image with some hashed noise, flat test patterns flatter
+        // neither converter and hide channel order mistakes.
+        int bpp = (srcFormat == AV_PIX_FMT_BGR24) ? 3 : 4;
+        for (int y = 0; y < height; y++) {
+          uint8_t* row = src->data[0] + y * src->linesize[0];
+          for (int x = 0; x < width; x++) {
+            uint32_t noise = ((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u) >> 27;
+            row[x * bpp] = (uint8_t)(x + noise);
+            row[x * bpp + 1] = (uint8_t)(y + noise);
+            row[x * bpp + 2] = (uint8_t)(x + y + noise);
+            if (bpp == 4) {
+              row[x * bpp + 3] = 255;
+            }
+          }
+        }
+
+        for (auto dstFormat : dstFormats) {
+          FramePool dstPool(width, height, dstFormat, 2);
+          AVFrame* swsDst = dstPool.Get();
+          AVFrame* dst = dstPool.Get();
+
+          auto timeMs = [frameCount](std::function<void()> convert) {
+            convert();    // Warm the caches and, for the threaded case, the pool.
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < frameCount; i++) {
+              convert();
+            }
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frameCount;
+          };
+
+          SwsContext* sws = sws_getContext(width, height, srcFormat, width, height, dstFormat, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+          double swsMs = timeMs([&] { sws_scale(sws, src->data, src->linesize, 0, height, swsDst->data, swsDst->linesize); });
+          sws_freeContext(sws);
+
+          ColorConverter single(width, height, srcFormat, dstFormat, ColorMatrix::BT601, ColorRange::Limited, 1);
+          ColorConverter threaded(width, height, srcFormat, dstFormat, ColorMatrix::BT601, ColorRange::Limited, 0);
+
+          single.SetAvx2Enabled(false);
+          double scalarMs = timeMs([&] { single.Convert(src, dst); });
+          single.SetAvx2Enabled(true);
+          double avx2Ms = timeMs([&] { single.Convert(src, dst); });
+          double threadedMs = timeMs([&] { threaded.Convert(src, dst); });
+
+          int maxDiff = 0;
+          for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+              maxDiff = std::max(maxDiff, std::abs(swsDst->data[0][y * swsDst->linesize[0] + x] - dst->data[0][y * dst->linesize[0] + x]));
+            }
+          }
+
+          std::cout << width << "x" << height << " " << av_get_pix_fmt_name(srcFormat) << " to " << av_get_pix_fmt_name(dstFormat)
+            << std::fixed << std::setprecision(3)
+            << ": swscale " << swsMs << ", scalar " << scalarMs << ", avx2 " << avx2Ms
+            << ", avx2 " << threaded.GetThreadCount() << " threads " << threadedMs
+            << ", max Y diff from swscale " << maxDiff << "." << std::endl;
+
+          dstPool.Return(swsDst);
+          dstPool.Return(dst);
+        }
+
+        srcPool.Return(src);
+      }
+    }
+  }
+}
@@ -0,0 +1,139 @@
+//-----------------------------------------------------------------------------
+// Filename: colorconvert.h
+//
+// Description: Same size packed RGB to planar YUV conversion for the formats
+// we actually capture and encode: BGRA, RGBA and BGR24 in, I420 or NV12 out.
+// swscale handles this through its generic scaling path; here each case is a
+// dedicated fixed point kernel with an AVX2 version that does 16 pixels from
+// two rows at a time. Chroma is the average of each 2x2 block.
+//
+// The AVX2 and scalar kernels use the same integer arithmetic and produce
+// identical output, the scalar one handles the right hand edge and CPUs
+// without AVX2. Large frames are split into bands of rows that convert in
+// parallel.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_COLORCONVERT_H
+#define SIPSORCERY_COLORCONVERT_H
+
+#include "workstealingpool.h"
+
+extern "C"
+{
+#include <libavutil\frame.h>
+#include <libavutil\pixfmt.h>
+}
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#define COLOR_CONVERT_PARALLEL_MIN_PIXELS (1280 * 720)   // Below this a single thread is quicker than handing out bands.
+
+namespace sipsorcery
+{
+  enum class ColorMatrix
+  {
+    BT601,
+    BT709
+  };
+
+  enum class ColorRange
+  {
+    Limited,    // Y 16 to 235, UV 16 to 240.
+    Full        // 0 to 255, JPEG style.
+  };
+
+  class ColorConverter
+  {
+  public:
+    /**
+    * @param[in] width: the width of the frames.
+    * @param[in] height: the height of the frames.
+    * @param[in] srcFormat: AV_PIX_FMT_BGRA, AV_PIX_FMT_RGBA or AV_PIX_FMT_BGR24.
+    * @param[in] dstFormat: AV_PIX_FMT_YUV420P or AV_PIX_FMT_NV12.
+    * @param[in] matrix: the YUV matrix to convert with.
+    * @param[in] range: the YUV range to convert to.
+    * @param[in] threads: the number of threads to split the rows across, 0 to
+    *  use one per core for frames of COLOR_CONVERT_PARALLEL_MIN_PIXELS or more.
+    * Throws std::runtime_error if the format pair is not supported.
+    */
+    ColorConverter(int width, int height, AVPixelFormat srcFormat, AVPixelFormat dstFormat,
+      ColorMatrix matrix = ColorMatrix::BT601, ColorRange range = ColorRange::Limited, int threads = 0);
+    ~ColorConverter();
+
+    ColorConverter(const ColorConverter&) = delete;
+    ColorConverter& operator=(const ColorConverter&) = delete;
+
+    /**
+    * Converts one frame.
+    * @param[in] src: the packed source pixels.
+    * @param[in] srcStride: the number of bytes between source rows.
+    * @param[out] dst: the destination planes, Y U V for I420 or Y UV for NV12.
+    * @param[in] dstStride: the number of bytes between rows for each plane.
+    */
+    void Convert(const uint8_t* src, int srcStride, uint8_t* const dst[], const int dstStride[]);
+
+    /**
+    * Converts one frame.
+    * @@Returns 0 on success or AVERROR(EINVAL) if the frames don't match the converter.
+    */
+    int Convert(const AVFrame* src, AVFrame* dst);
+
+    /**
+    * Turns the AVX2 kernel off, or back on if the CPU supports it. Only
+    * intended for benchmarking the scalar kernel.
+    */
+    void SetAvx2Enabled(bool enable) { _useAvx2 = enable && HasAvx2(); }
+    bool IsAvx2Enabled() const { return _useAvx2; }
+    int GetThreadCount() const { return _threadCount; }
+
+    static bool IsSupported(AVPixelFormat srcFormat, AVPixelFormat dstFormat);
+    static bool HasAvx2();
+
+  private:
+    struct Coefficients
+    {
+      // Fixed point Y, U and V multipliers, 4 of each in source byte order.
+      // The fourth of each is for the alpha or padding byte and is always 0.
+      int16_t Multipliers[12];
+      int YOffset;
+    };
+
+    int _width;
+    int _height;
+    AVPixelFormat _srcFormat;
+    AVPixelFormat _dstFormat;
+    int _bytesPerPixel;
+    Coefficients _coeffs;
+    bool _useAvx2;
+    int _threadCount;
+    std::unique_ptr<WorkStealingPool> _pool;
+
+    std::mutex _doneMutex;
+    std::condition_variable _doneCondition;
+    int _bandsRemaining{ 0 };
+
+    void ConvertRows(const uint8_t* src, int srcStride, uint8_t* const dst[], const int dstStride[], int rowStart, int rowEnd);
+  };
+
+  /**
+  * Times swscale against the scalar and AVX2 kernels, single and multi
+  * threaded, for each source and destination format at 480p, 720p and
+  * 1080p. The largest difference from the swscale output is printed as a
+  * sanity check, small differences are expected from rounding and the way
+  * chroma is sited.
+  */
+  void RunColorConvertBenchmark(int frameCount);
+}
+
+#endif // SIPSORCERY_COLORCONVERT_H
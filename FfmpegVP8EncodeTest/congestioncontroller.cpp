@@ -0,0 +1,1111 @@
+#include "congestioncontroller.h"
+#include "encoderbench.h"
+#include "framepool.h"
+#include "h264rtp.h"
+#include "rtpsocket.h"
+#include "videoencoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#define TRENDLINE_SMOOTHING 0.9
+#define TRENDLINE_GAIN 4.0
+#define TRENDLINE_MAX_DELTAS 60                 // The trend's weight grows with the deltas seen, up to this.
+#define OVERUSE_INITIAL_THRESHOLD 12.5
+#define OVERUSE_MIN_THRESHOLD 6.0
+#define OVERUSE_MAX_THRESHOLD 600.0
+#define OVERUSE_THRESHOLD_K_UP 0.0087
+#define OVERUSE_THRESHOLD_K_DOWN 0.039
+#define OVERUSE_THRESHOLD_MAX_JUMP 15.0         // A trend this far over the threshold is a spike, not something to adapt to.
+#define OVERUSE_MIN_MS 10.0
+#define AIMD_DECREASE_FACTOR 0.85
+#define AIMD_INCREASE_PER_SECOND 1.08
+#define AIMD_MIN_ADDITIVE_BPS 4000              // A second.
+#define AIMD_ACKED_HEADROOM 1.5                 // Increases stop at this times what's getting through, plus AIMD_ACKED_HEADROOM_BPS.
+#define AIMD_ACKED_HEADROOM_BPS 10000
+#define AIMD_CAPACITY_SMOOTHING 0.05
+#define AIMD_MIN_CAPACITY_VARIANCE 0.4
+#define AIMD_MAX_CAPACITY_VARIANCE 2.5
+#define LOSS_HIGH 0.10
+#define LOSS_LOW 0.02
+#define LOSS_INCREASE 1.08
+#define CONTROLLER_APPLY_HYSTERESIS 0.05        // The encoder's bit rate is only changed when the target moves by more than this.
+
+#define RTP_VIDEO_CLOCK_RATE 90000
+#define TEST_WIDTH 640
+#define TEST_HEIGHT 480
+#define TEST_FPS 30
+#define TEST_START_BIT_RATE 800000
+#define TEST_MAX_BIT_RATE 3000000
+#define SIM_STEP_MICROS 1000
+#define SIM_ONE_WAY_DELAY_MICROS 25000
+#define SIM_QUEUE_LIMIT_MICROS 300000           // Drop tail once the bottleneck holds this much.
+#define SIM_RECEIVER_CLOCK_OFFSET_MICROS ((int64_t)RTCP_TRANSPORT_CC_REFERENCE_WRAP * RTCP_TRANSPORT_CC_REFERENCE_MICROS - 5000000)   // Only differences between arrivals should matter, the transport-cc reference time wraps 5s in.
+#define SIM_RANDOM_SEED 1234
+#define RECEIVER_RTCP_POLL_MS 10
+
+namespace sipsorcery
+{
+  static int64_t SteadyMicros(std::chrono::steady_clock::time_point time)
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+  }
+
+  /**
+  * Least squares slope of the smoothed delay against arrival time.
+  */
+  static double LinearFitSlope(const std::deque<std::pair<double, double>>& points)
+  {
+    double sumX = 0, sumY = 0;
+    for (auto& point : points) {
+      sumX += point.first;
+      sumY += point.second;
+    }
+
+    double meanX = sumX / points.size();
+    double meanY = sumY / points.size();
+    double numerator = 0, denominator = 0;
+
+    for (auto& point : points) {
+      numerator += (point.first - meanX) * (point.second - meanY);
+      denominator += (point.first - meanX) * (point.first - meanX);
+    }
+
+    return (denominator != 0) ? numerator / denominator : 0;
+  }
+
+  DelayBasedEstimator::DelayBasedEstimator() :
+    _threshold(OVERUSE_INITIAL_THRESHOLD)
+  { }
+
+  BandwidthUsage DelayBasedEstimator::Update(const std::vector<PacketFeedback>& packets)
+  {
+    for (auto& packet : packets) {
+      if (!_haveGroup) {
+        _group = PacketGroup{ packet.SendMicros, packet.SendMicros, packet.ArrivalMicros };
+        _haveGroup = true;
+      }
+      else if (packet.SendMicros < _group.FirstSendMicros) {
+        // Sent before the current group, its group has already been used.
+        continue;
+      }
+      else if (packet.SendMicros - _group.FirstSendMicros <= CONGESTION_BURST_MICROS) {
+        _group.LastSendMicros = std::max(_group.LastSendMicros, packet.SendMicros);
+        _group.LastArrivalMicros = std::max(_group.LastArrivalMicros, packet.ArrivalMicros);
+      }
+      else {
+        // The packet starts a new group so the current one is complete.
+        if (_havePreviousGroup) {
+          OnGroupDelta((_group.LastSendMicros - _previousGroup.LastSendMicros) / 1000.0,
+            (_group.LastArrivalMicros - _previousGroup.LastArrivalMicros) / 1000.0, _group.LastArrivalMicros);
+        }
+
+        _previousGroup = _group;
+        _havePreviousGroup = true;
+        _group = PacketGroup{ packet.SendMicros, packet.SendMicros, packet.ArrivalMicros };
+      }
+    }
+
+    return _state;
+  }
+
+  /**
+  * Adds the delay variation between two groups to the accumulated delay and
+  * fits the trendline over the last CONGESTION_TRENDLINE_WINDOW groups.
+  */
+  void DelayBasedEstimator::OnGroupDelta(double sendDeltaMs, double arrivalDeltaMs, int64_t arrivalMicros)
+  {
+    if (_firstArrivalMicros < 0) {
+      _firstArrivalMicros = arrivalMicros;
+    }
+
+    _deltaCount = std::min(_deltaCount + 1, TRENDLINE_MAX_DELTAS);
+    _accumulatedDelay += arrivalDeltaMs - sendDeltaMs;
+    _smoothedDelay = TRENDLINE_SMOOTHING * _smoothedDelay + (1 - TRENDLINE_SMOOTHING) * _accumulatedDelay;
+
+    _delayHistory.emplace_back((arrivalMicros - _firstArrivalMicros) / 1000.0, _smoothedDelay);
+    if (_delayHistory.size() > CONGESTION_TRENDLINE_WINDOW) {
+      _delayHistory.pop_front();
+    }
+
+    double trend = _previousTrend;
+    if (_delayHistory.size() == CONGESTION_TRENDLINE_WINDOW) {
+      trend = LinearFitSlope(_delayHistory);
+    }
+
+    Detect(trend, sendDeltaMs, arrivalMicros);
+  }
+
+  /**
+  * Overuse needs the trend over the threshold for OVERUSE_MIN_MS and at
+  * least two groups, and still rising, so one late group doesn't cut the rate.
+  */
+  void DelayBasedEstimator::Detect(double trend, double sendDeltaMs, int64_t arrivalMicros)
+  {
+    _modifiedTrend = std::min(_deltaCount, TRENDLINE_MAX_DELTAS) * trend * TRENDLINE_GAIN;
+
+    if (_modifiedTrend > _threshold) {
+      _overuseMs = (_overuseMs < 0) ? sendDeltaMs / 2 : _overuseMs + sendDeltaMs;
+      _overuseCount++;
+
+      if (_overuseMs > OVERUSE_MIN_MS && _overuseCount > 1 && trend >= _previousTrend) {
+        _overuseMs = 0;
+        _overuseCount = 0;
+        _state = BandwidthUsage::Overusing;
+      }
+    }
+    else if (_modifiedTrend < -_threshold) {
+      _overuseMs = -1;
+      _overuseCount = 0;
+      _state = BandwidthUsage::Underusing;
+    }
+    else {
+      _overuseMs = -1;
+      _overuseCount = 0;
+      _state = BandwidthUsage::Normal;
+    }
+
+    _previousTrend = trend;
+    UpdateThreshold(_modifiedTrend, arrivalMicros);
+  }
+
+  /**
+  * The threshold follows the trend, quickly down and slowly up, so the
+  * stream isn't starved by a competing TCP flow that keeps a queue standing.
+  */
+  void DelayBasedEstimator::UpdateThreshold(double modifiedTrend, int64_t arrivalMicros)
+  {
+    if (_lastThresholdMicros < 0) {
+      _lastThresholdMicros = arrivalMicros;
+    }
+
+    double absTrend = std::fabs(modifiedTrend);
+    if (absTrend > _threshold + OVERUSE_THRESHOLD_MAX_JUMP) {
+      _lastThresholdMicros = arrivalMicros;
+      return;
+    }
+
+    double k = (absTrend < _threshold) ? OVERUSE_THRESHOLD_K_DOWN : OVERUSE_THRESHOLD_K_UP;
+    double elapsedMs = std::min<double>((arrivalMicros - _lastThresholdMicros) / 1000.0, 100.0);
+
+    _threshold += k * (absTrend - _threshold) * elapsedMs;
+    _threshold = std::max(OVERUSE_MIN_THRESHOLD, std::min(OVERUSE_MAX_THRESHOLD, _threshold));
+    _lastThresholdMicros = arrivalMicros;
+  }
+
+  AimdRateControl::AimdRateControl(int64_t startBitRate, int64_t minBitRate, int64_t maxBitRate) :
+    _bitRate((double)startBitRate), _minBitRate(minBitRate), _maxBitRate(maxBitRate)
+  { }
+
+  int64_t AimdRateControl::Update(BandwidthUsage usage, int64_t ackedBitRate, int64_t rttMicros, int64_t nowMicros)
+  {
+    double elapsedSeconds = (_lastUpdateMicros < 0) ? 0 : std::min<double>((nowMicros - _lastUpdateMicros) / 1000000.0, 1.0);
+    _lastUpdateMicros = nowMicros;
+
+    if (usage == BandwidthUsage::Overusing) {
+      _state = State::Decrease;
+    }
+    else if (usage == BandwidthUsage::Underusing) {
+      _state = State::Hold;
+    }
+    else if (_state == State::Hold) {
+      _state = State::Increase;
+    }
+
+    double ackedKbps = ackedBitRate / 1000.0;
+
+    // Getting well past the old capacity means the path has changed, go back
+    // to probing multiplicatively.
+    if (ackedBitRate > 0 && _linkCapacity > 0 &&
+      ackedKbps > _linkCapacity + 3 * std::sqrt(_linkCapacityVariance * _linkCapacity)) {
+      _linkCapacity = -1;
+    }
+
+    if (_state == State::Increase) {
+      double increase;
+      if (_linkCapacity > 0) {
+        // Near the capacity, about a packet per response time.
+        double responseSeconds = (rttMicros + 100000) / 1000000.0;
+        increase = std::max<double>(AIMD_MIN_ADDITIVE_BPS, RTP_DEFAULT_MTU * 8 / responseSeconds) * elapsedSeconds;
+      }
+      else {
+        increase = std::max(1000.0, _bitRate * (std::pow(AIMD_INCREASE_PER_SECOND, elapsedSeconds) - 1));
+      }
+
+      double limit = AIMD_ACKED_HEADROOM * ackedBitRate + AIMD_ACKED_HEADROOM_BPS;
+      double increased = _bitRate + increase;
+      if (ackedBitRate > 0 && increased > limit) {
+        increased = std::max(_bitRate, limit);
+      }
+      _bitRate = increased;
+    }
+    else if (_state == State::Decrease) {
+      double decreased = AIMD_DECREASE_FACTOR * ((ackedBitRate > 0) ? ackedBitRate : _bitRate);
+      _bitRate = std::min(_bitRate, decreased);
+
+      if (ackedBitRate > 0) {
+        if (_linkCapacity < 0) {
+          _linkCapacity = ackedKbps;
+        }
+        else {
+          double error = ackedKbps - _linkCapacity;
+          _linkCapacity = (1 - AIMD_CAPACITY_SMOOTHING) * _linkCapacity + AIMD_CAPACITY_SMOOTHING * ackedKbps;
+          _linkCapacityVariance = (1 - AIMD_CAPACITY_SMOOTHING) * _linkCapacityVariance +
+            AIMD_CAPACITY_SMOOTHING * error * error / std::max(_linkCapacity, 1.0);
+          _linkCapacityVariance = std::max(AIMD_MIN_CAPACITY_VARIANCE, std::min(AIMD_MAX_CAPACITY_VARIANCE, _linkCapacityVariance));
+        }
+      }
+
+      _decreases++;
+      _state = State::Hold;
+    }
+
+    _bitRate = std::max<double>((double)_minBitRate, std::min<double>((double)_maxBitRate, _bitRate));
+    return (int64_t)_bitRate;
+  }
+
+  LossBasedEstimator::LossBasedEstimator(int64_t startBitRate, int64_t minBitRate, int64_t maxBitRate) :
+    _bitRate(startBitRate), _minBitRate(minBitRate), _maxBitRate(maxBitRate)
+  { }
+
+  int64_t LossBasedEstimator::Update(double fractionLost, int64_t currentBitRate)
+  {
+    if (fractionLost > LOSS_HIGH) {
+      _bitRate = (int64_t)(currentBitRate * (1 - 0.5 * fractionLost));
+    }
+    else if (fractionLost < LOSS_LOW) {
+      _bitRate = (int64_t)(std::min(_bitRate, currentBitRate) * LOSS_INCREASE);
+    }
+
+    _bitRate = std::max(_minBitRate, std::min(_maxBitRate, _bitRate));
+    return _bitRate;
+  }
+
+  CongestionController::CongestionController(uint32_t ssrc, int width, int height, int maxFrameRate, int64_t startBitRate,
+    int64_t minBitRate, int64_t maxBitRate) :
+    _ssrc(ssrc), _width(width), _height(height), _maxFrameRate(maxFrameRate),
+    _minBitRate(minBitRate), _maxBitRate(maxBitRate),
+    _history(CONGESTION_PACKET_HISTORY),
+    _rateControl(startBitRate, minBitRate, maxBitRate),
+    _lossEstimator(startBitRate, minBitRate, maxBitRate),
+    _targetBitRate(startBitRate),
+    _appliedBitRate(startBitRate)
+  {
+    UpdateTarget();
+  }
+
+  void CongestionController::OnPacketsSending(std::vector<RtpPacketBuffers>& packets, int64_t nowMicros)
+  {
+    const size_t slotLength = RTP_HEADER_LENGTH + RTP_TRANSPORT_CC_EXTENSION_LENGTH;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _headerSlab.resize(packets.size() * slotLength);
+
+    for (size_t i = 0; i < packets.size(); i++) {
+      RtpPacketBuffers& packet = packets[i];
+      RtpIoVec first = packet.Buffers[0];
+      bool split = first.Length > RTP_HEADER_LENGTH;
+
+      _stats.PacketsSent++;
+      _packetsSent++;
+
+      // Packets that already have CSRCs or an extension, or no buffer to
+      // spare, go as they are.
+      if (packet.Count < 1 || first.Length < RTP_HEADER_LENGTH || (first.Data[0] & 0x1f) != 0 ||
+        packet.Count + (split ? 1 : 0) > RTP_MAX_PACKET_BUFFERS) {
+        _stats.PacketsUnstamped++;
+        _octetsSent += (uint32_t)(packet.GetLength() - std::min<size_t>(packet.GetLength(), RTP_HEADER_LENGTH));
+        continue;
+      }
+
+      uint8_t* hdr = _headerSlab.data() + i * slotLength;
+      uint16_t seqNum = _transportSeqNum++;
+
+      std::memcpy(hdr, first.Data, RTP_HEADER_LENGTH);
+      hdr[0] |= 0x10;
+      WriteTransportSequenceExtension(hdr + RTP_HEADER_LENGTH, seqNum);
+
+      if (split) {
+        for (int j = packet.Count; j > 1; j--) {
+          packet.Buffers[j] = packet.Buffers[j - 1];
+        }
+        packet.Buffers[1] = RtpIoVec{ first.Data + RTP_HEADER_LENGTH, first.Length - RTP_HEADER_LENGTH };
+        packet.Count++;
+      }
+      packet.Buffers[0] = RtpIoVec{ hdr, slotLength };
+
+      size_t length = packet.GetLength();
+      _history[seqNum & (CONGESTION_PACKET_HISTORY - 1)] = SentPacket{ seqNum, true, false, nowMicros, length };
+      _octetsSent += (uint32_t)(length - slotLength);
+    }
+  }
+
+  bool CongestionController::OnRtcp(const uint8_t* buf, size_t length, int64_t nowMicros)
+  {
+    RtcpCompound compound;
+    bool valid = ParseRtcpCompound(buf, length, compound);
+    OnRtcp(compound, nowMicros);
+    return valid;
+  }
+
+  void CongestionController::OnRtcp(const RtcpCompound& compound, int64_t nowMicros)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (auto& feedback : compound.TransportFeedback) {
+      OnTransportFeedback(feedback, nowMicros);
+    }
+
+    for (auto& block : compound.ReportBlocks) {
+      if (block.Ssrc == _ssrc) {
+        OnReportBlock(block, nowMicros);
+      }
+    }
+
+    for (auto ssrc : compound.PliSsrcs) {
+      if (ssrc != _ssrc) {
+        continue;
+      }
+
+      _stats.PlisReceived++;
+      if (_lastKeyframeRequestMicros < 0 || nowMicros - _lastKeyframeRequestMicros >= CONGESTION_KEYFRAME_MIN_INTERVAL_MICROS) {
+        _keyframeRequested = true;
+        _lastKeyframeRequestMicros = nowMicros;
+        _stats.KeyframesRequested++;
+      }
+    }
+
+    UpdateTarget();
+  }
+
+  /**
+  * Matches the feedback to the sent packets, then runs the received ones
+  * through the delay based estimator and the rate control.
+  */
+  void CongestionController::OnTransportFeedback(const RtcpTransportFeedback& feedback, int64_t nowMicros)
+  {
+    _stats.FeedbackReceived++;
+    _feedbackScratch.clear();
+
+    // The reference time is taken as the one closest to the last feedback's,
+    // which carries it across the wrap and copes with reordered feedback.
+    if (_haveReferenceTime) {
+      int64_t step = (feedback.ReferenceTime - (int64_t)_referenceTime) & (RTCP_TRANSPORT_CC_REFERENCE_WRAP - 1);
+      _referenceTime += (step >= RTCP_TRANSPORT_CC_REFERENCE_WRAP / 2) ? step - RTCP_TRANSPORT_CC_REFERENCE_WRAP : step;
+    }
+    else {
+      _referenceTime = feedback.ReferenceTime;
+      _haveReferenceTime = true;
+    }
+    int64_t wrapMicros = (_referenceTime - feedback.ReferenceTime) * RTCP_TRANSPORT_CC_REFERENCE_MICROS;
+
+    for (auto& arrival : feedback.Packets) {
+      SentPacket& sent = _history[arrival.SeqNum & (CONGESTION_PACKET_HISTORY - 1)];
+      if (!sent.InUse || sent.SeqNum != arrival.SeqNum || sent.Acked) {
+        continue;
+      }
+      else if (!arrival.Received) {
+        _stats.PacketsLost++;
+        continue;
+      }
+
+      sent.Acked = true;
+      _stats.PacketsAcked++;
+      _feedbackScratch.push_back(PacketFeedback{ sent.SendMicros, arrival.ArrivalMicros + wrapMicros, sent.Size });
+    }
+
+    if (_feedbackScratch.empty()) {
+      return;
+    }
+
+    _ackedBitRate = UpdateAckedBitRate(_feedbackScratch);
+    BandwidthUsage usage = _delayEstimator.Update(_feedbackScratch);
+    _rateControl.Update(usage, _ackedBitRate, _rttMicros, nowMicros);
+  }
+
+  /**
+  * The rate the receiver got packets at over the last
+  * CONGESTION_ACKED_WINDOW_MICROS, by their arrival times.
+  */
+  int64_t CongestionController::UpdateAckedBitRate(const std::vector<PacketFeedback>& packets)
+  {
+    for (auto& packet : packets) {
+      _ackedWindow.emplace_back(packet.ArrivalMicros, packet.Size);
+      _ackedWindowBytes += packet.Size;
+    }
+
+    int64_t latest = _ackedWindow.back().first;
+    while (!_ackedWindow.empty() && _ackedWindow.front().first < latest - CONGESTION_ACKED_WINDOW_MICROS) {
+      _ackedWindowBytes -= _ackedWindow.front().second;
+      _ackedWindow.pop_front();
+    }
+
+    int64_t span = latest - _ackedWindow.front().first;
+    if (span < CONGESTION_ACKED_WINDOW_MICROS / 2) {
+      return _ackedBitRate;
+    }
+
+    return (int64_t)(_ackedWindowBytes * 8 * 1000000 / span);
+  }
+
+  /**
+  * Takes the round trip time from the echoed sender report and the loss
+  * for the loss based estimate.
+  */
+  void CongestionController::OnReportBlock(const RtcpReportBlock& block, int64_t nowMicros)
+  {
+    _stats.ReportsReceived++;
+    _fractionLost = block.FractionLost / 256.0;
+
+    if (block.LastSr != 0) {
+      uint32_t now = (uint32_t)(MicrosToNtp(nowMicros) >> 16);
+      uint32_t rtt = now - block.LastSr - block.DelaySinceLastSr;
+      if (rtt < 0x80000000) {
+        _rttMicros = std::max<int64_t>(1000, CompactNtpToMicros(rtt));
+      }
+    }
+
+    _lossEstimator.Update(_fractionLost, _targetBitRate);
+  }
+
+  /**
+  * The target is the lower of the two estimates. The frame rate is the
+  * capture rate divided by the smallest whole number that brings the bits
+  * per pixel up to CONGESTION_MIN_BITS_PER_PIXEL.
+  */
+  void CongestionController::UpdateTarget()
+  {
+    _targetBitRate = std::min(_rateControl.GetBitRate(), _lossEstimator.GetBitRate());
+    _targetBitRate = std::max(_minBitRate, std::min(_maxBitRate, _targetBitRate));
+
+    double fullRateBits = (double)_width * _height * _maxFrameRate * CONGESTION_MIN_BITS_PER_PIXEL;
+    int maxDecimation = std::max(1, _maxFrameRate / CONGESTION_MIN_FRAME_RATE);
+    int decimation = (int)std::ceil(fullRateBits / std::max<int64_t>(1, _targetBitRate));
+
+    _frameDecimation = std::max(1, std::min(maxDecimation, decimation));
+  }
+
+  size_t CongestionController::WriteSenderReport(uint8_t* buf, uint32_t rtpTimestamp, int64_t nowMicros)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    RtcpSenderInfo info{ MicrosToNtp(nowMicros), rtpTimestamp, _packetsSent, _octetsSent };
+    return WriteRtcpSenderReport(buf, _ssrc, info, nullptr);
+  }
+
+  int64_t CongestionController::GetTargetBitRate() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _targetBitRate;
+  }
+
+  int CongestionController::GetTargetFrameRate() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _maxFrameRate / _frameDecimation;
+  }
+
+  int CongestionController::GetFrameDecimation() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _frameDecimation;
+  }
+
+  bool CongestionController::ConsumeKeyframeRequest()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    bool requested = _keyframeRequested;
+    _keyframeRequested = false;
+    return requested;
+  }
+
+  bool CongestionController::Apply(VideoEncoder& encoder)
+  {
+    if (ConsumeKeyframeRequest()) {
+      encoder.RequestKeyframe();
+    }
+
+    int64_t target = GetTargetBitRate();
+
+    if (std::llabs(target - _appliedBitRate) > _appliedBitRate * CONTROLLER_APPLY_HYSTERESIS && encoder.SetBitRate(target)) {
+      _appliedBitRate = target;
+      return true;
+    }
+
+    return false;
+  }
+
+  CongestionStats CongestionController::GetStats() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    CongestionStats stats = _stats;
+    stats.TargetBitRate = _targetBitRate;
+    stats.TargetFrameRate = _maxFrameRate / _frameDecimation;
+    stats.DelayBasedBitRate = _rateControl.GetBitRate();
+    stats.LossBasedBitRate = _lossEstimator.GetBitRate();
+    stats.AckedBitRate = _ackedBitRate;
+    stats.RttMicros = _rttMicros;
+    stats.FractionLost = _fractionLost;
+    stats.Usage = _delayEstimator.GetState();
+    stats.ModifiedTrend = _delayEstimator.GetModifiedTrend();
+    stats.Threshold = _delayEstimator.GetThreshold();
+    stats.Decreases = _rateControl.GetDecreases();
+    return stats;
+  }
+
+  const char* CongestionController::GetUsageName(BandwidthUsage usage)
+  {
+    switch (usage) {
+    case BandwidthUsage::Underusing:
+      return "underuse";
+    case BandwidthUsage::Overusing:
+      return "overuse";
+    default:
+      return "normal";
+    }
+  }
+
+  RtcpFeedbackGenerator::RtcpFeedbackGenerator(uint32_t ssrc, int clockRate) :
+    _ssrc(ssrc), _clockRate(clockRate), _feedback()
+  { }
+
+  void RtcpFeedbackGenerator::OnRtpPacket(const uint8_t* packet, size_t length, int64_t arrivalMicros)
+  {
+    RtpHeaderInfo hdr;
+    if (!ParseRtpHeader(packet, length, hdr)) {
+      return;
+    }
+
+    _mediaSsrc = hdr.Ssrc;
+
+    // Sequence number statistics as RFC 3550 appendix A.1, without the probation.
+    if (!_haveSeq) {
+      _baseSeq = hdr.SeqNum;
+      _maxSeq = hdr.SeqNum;
+      _haveSeq = true;
+    }
+    else {
+      uint16_t delta = hdr.SeqNum - _maxSeq;
+      if (delta != 0 && delta < 0x8000) {
+        if (hdr.SeqNum < _maxSeq) {
+          _cycles += 0x10000;
+        }
+        _maxSeq = hdr.SeqNum;
+      }
+    }
+    _received++;
+
+    // Interarrival jitter, RFC 3550 appendix A.8.
+    int64_t transit = (int32_t)((uint32_t)(arrivalMicros * _clockRate / 1000000) - hdr.Timestamp);
+    if (_haveTransit) {
+      double d = (double)std::llabs(transit - _lastTransit);
+      _jitter += (d - _jitter) / 16;
+    }
+    _lastTransit = transit;
+    _haveTransit = true;
+
+    uint16_t transportSeq;
+    if (ReadTransportSequenceNumber(packet, length, transportSeq)) {
+      int64_t unwrapped = _haveTransportSeq ? _lastTransportSeq + (int16_t)(transportSeq - (uint16_t)_lastTransportSeq) : transportSeq;
+
+      if (!_haveTransportSeq || unwrapped > _lastTransportSeq) {
+        _lastTransportSeq = unwrapped;
+      }
+      _haveTransportSeq = true;
+
+      if (_nextFeedbackSeq < 0) {
+        _nextFeedbackSeq = unwrapped;
+      }
+
+      // Packets so late they've already been reported lost stay lost.
+      if (unwrapped >= _nextFeedbackSeq) {
+        _arrivals.emplace(unwrapped, arrivalMicros);
+      }
+    }
+  }
+
+  void RtcpFeedbackGenerator::OnRtcp(const uint8_t* buf, size_t length, int64_t arrivalMicros)
+  {
+    RtcpCompound compound;
+    if (ParseRtcpCompound(buf, length, compound) && compound.HasSenderInfo) {
+      _lastSr = (uint32_t)(compound.SenderInfo.NtpTimestamp >> 16);
+      _lastSrArrivalMicros = arrivalMicros;
+    }
+  }
+
+  void RtcpFeedbackGenerator::RequestKeyframe(int64_t nowMicros)
+  {
+    if (_lastPliMicros < 0 || nowMicros - _lastPliMicros >= CONGESTION_PLI_INTERVAL_MICROS) {
+      _pliPending = true;
+      _lastPliMicros = nowMicros;
+    }
+  }
+
+  int64_t RtcpFeedbackGenerator::GetPacketsLost() const
+  {
+    return _haveSeq ? (int64_t)GetExtendedMaxSeq() - _baseSeq + 1 - (int64_t)_received : 0;
+  }
+
+  bool RtcpFeedbackGenerator::Generate(int64_t nowMicros, std::vector<uint8_t>& rtcp)
+  {
+    rtcp.clear();
+
+    if (!_haveSeq) {
+      return false;
+    }
+
+    if (_lastReportMicros < 0 || nowMicros - _lastReportMicros >= CONGESTION_REPORT_INTERVAL_MICROS) {
+      AppendReceiverReport(nowMicros, rtcp);
+      _lastReportMicros = nowMicros;
+    }
+
+    if (!_arrivals.empty() && (_lastFeedbackMicros < 0 || nowMicros - _lastFeedbackMicros >= CONGESTION_FEEDBACK_INTERVAL_MICROS)) {
+      AppendTransportFeedback(rtcp);
+      _lastFeedbackMicros = nowMicros;
+    }
+
+    if (_pliPending) {
+      size_t start = rtcp.size();
+      rtcp.resize(start + RTCP_PLI_LENGTH);
+      WriteRtcpPli(rtcp.data() + start, _ssrc, _mediaSsrc);
+      _pliPending = false;
+      _plisSent++;
+    }
+
+    return !rtcp.empty();
+  }
+
+  void RtcpFeedbackGenerator::AppendReceiverReport(int64_t nowMicros, std::vector<uint8_t>& rtcp)
+  {
+    uint32_t extendedMax = GetExtendedMaxSeq();
+    uint32_t expected = extendedMax - _baseSeq + 1;
+    int64_t lost = (int64_t)expected - (int64_t)_received;
+
+    uint32_t expectedInterval = expected - _expectedPrior;
+    int64_t receivedInterval = (int64_t)(_received - _receivedPrior);
+    int64_t lostInterval = (int64_t)expectedInterval - receivedInterval;
+    _expectedPrior = expected;
+    _receivedPrior = _received;
+
+    RtcpReportBlock block;
+    block.Ssrc = _mediaSsrc;
+    block.FractionLost = (expectedInterval == 0 || lostInterval <= 0) ? 0 : (uint8_t)std::min<int64_t>(255, (lostInterval << 8) / expectedInterval);
+    block.CumulativeLost = (int32_t)std::max<int64_t>(-0x800000, std::min<int64_t>(0x7fffff, lost));
+    block.HighestSeqNum = extendedMax;
+    block.Jitter = (uint32_t)_jitter;
+    block.LastSr = _lastSr;
+    block.DelaySinceLastSr = (_lastSrArrivalMicros < 0) ? 0 : (uint32_t)((nowMicros - _lastSrArrivalMicros) * 65536 / 1000000);
+
+    size_t start = rtcp.size();
+    rtcp.resize(start + RTCP_RR_LENGTH + RTCP_REPORT_BLOCK_LENGTH);
+    WriteRtcpReceiverReport(rtcp.data() + start, _ssrc, &block);
+  }
+
+  /**
+  * Reports every packet from the first not yet reported to the newest, those
+  * that haven't arrived as lost, RTCP_TRANSPORT_CC_MAX_PACKETS to a feedback
+  * packet.
+  */
+  void RtcpFeedbackGenerator::AppendTransportFeedback(std::vector<uint8_t>& rtcp)
+  {
+    while (!_arrivals.empty()) {
+      int64_t begin = _nextFeedbackSeq;
+      if (_arrivals.begin()->first - begin >= RTCP_TRANSPORT_CC_MAX_PACKETS) {
+        // Too long a gap to report, most likely the sender restarted.
+        begin = _arrivals.begin()->first;
+      }
+      int64_t end = std::min(_arrivals.rbegin()->first + 1, begin + RTCP_TRANSPORT_CC_MAX_PACKETS);
+
+      _feedback.SenderSsrc = _ssrc;
+      _feedback.MediaSsrc = _mediaSsrc;
+      _feedback.FeedbackCount = _feedbackCount++;
+      _feedback.Packets.clear();
+
+      auto it = _arrivals.begin();
+      for (int64_t seq = begin; seq < end; seq++) {
+        bool received = it != _arrivals.end() && it->first == seq;
+        _feedback.Packets.push_back(RtcpPacketArrival{ (uint16_t)seq, received, received ? it->second : 0 });
+        if (received) {
+          ++it;
+        }
+      }
+
+      WriteRtcpTransportFeedback(_feedback, rtcp);
+
+      _arrivals.erase(_arrivals.begin(), it);
+      _nextFeedbackSeq = end;
+    }
+  }
+
+  /**
+  * A bottleneck link in virtual time. Packets queue behind each other and
+  * drain at the capacity, a packet that would wait longer than
+  * SIM_QUEUE_LIMIT_MICROS is dropped, as is a random share of the rest.
+  */
+  class SimulatedLink
+  {
+  public:
+    SimulatedLink(double lossPercent) :
+      _lossFraction(lossPercent / 100.0), _rng(SIM_RANDOM_SEED)
+    { }
+
+    /**
+    * @@Returns the arrival time at the far end, or -1 if the packet was dropped.
+    */
+    int64_t Send(size_t length, int64_t nowMicros, int64_t capacity)
+    {
+      int64_t queueMicros = std::max<int64_t>(0, _busyUntilMicros - nowMicros);
+
+      if (queueMicros > SIM_QUEUE_LIMIT_MICROS || _uniform(_rng) < _lossFraction) {
+        return -1;
+      }
+
+      int64_t start = std::max(nowMicros, _busyUntilMicros);
+      _busyUntilMicros = start + (int64_t)(length * 8 * 1000000 / capacity);
+      return _busyUntilMicros + SIM_ONE_WAY_DELAY_MICROS;
+    }
+
+    int64_t GetQueueMicros(int64_t nowMicros) const { return std::max<int64_t>(0, _busyUntilMicros - nowMicros); }
+
+  private:
+    double _lossFraction;
+    int64_t _busyUntilMicros{ 0 };
+    std::mt19937 _rng;
+    std::uniform_real_distribution<double> _uniform{ 0.0, 1.0 };
+  };
+
+  struct InFlightPacket
+  {
+    int64_t ArrivalMicros;
+    std::vector<uint8_t> Data;
+  };
+
+  /**
+  * The capacity steps from generous, to well under the start rate, to
+  * somewhere in between.
+  */
+  static int64_t GetSimulatedCapacity(int64_t nowMicros, int durationSeconds)
+  {
+    int64_t third = (int64_t)durationSeconds * 1000000 / 3;
+    return (nowMicros < third) ? 2000000 : (nowMicros < 2 * third) ? 400000 : 1200000;
+  }
+
+  void RunCongestionSimulation(AVCodecID codecID, int durationSeconds, double lossPercent)
+  {
+    const int64_t frameMicros = 1000000 / TEST_FPS;
+    const uint32_t ssrc = 0x5eed0001;
+
+    VideoEncoder encoder(codecID, TEST_WIDTH, TEST_HEIGHT, TEST_FPS, EncoderPreset::Realtime, 0, TEST_START_BIT_RATE);
+    if (!encoder.CanChangeBitRate()) {
+      throw std::runtime_error(std::string(encoder.GetContext()->codec->name) + " can't change bit rate while open, use h264.");
+    }
+    CongestionController controller(ssrc, TEST_WIDTH, TEST_HEIGHT, TEST_FPS, TEST_START_BIT_RATE,
+      CONGESTION_DEFAULT_MIN_BIT_RATE, TEST_MAX_BIT_RATE);
+    RtcpFeedbackGenerator generator(0x5eed0002, RTP_VIDEO_CLOCK_RATE);
+    SimulatedLink link(lossPercent);
+
+    H264RtpPayloader payloader(ssrc);
+    FramePool framePool(TEST_WIDTH, TEST_HEIGHT, AV_PIX_FMT_YUV420P, 1);
+    AVFrame* frame = framePool.Get();
+
+    std::vector<RtpPacketBuffers> packets;
+    std::deque<InFlightPacket> forward;
+    std::deque<InFlightPacket> reverse;
+    std::vector<uint8_t> rtcp;
+    int64_t nowMicros = 0;
+    int64_t nextSrMicros = 0;
+    uint16_t expectedSeq = 0;
+    bool haveSeq = false;
+
+    // Per second.
+    int64_t encodedBytes = 0, deliveredBytes = 0, queueSum = 0, queueMax = 0;
+    int framesEncoded = 0, packetsSent = 0, packetsDropped = 0, packetsDelivered = 0, keyframes = 0;
+    int64_t totalEncoded = 0, totalDropped = 0, totalSent = 0, totalKeyframes = 0;
+    double totalQueueMs = 0;
+
+    std::cout << "Congestion simulation, " << avcodec_get_name(codecID) << " " << TEST_WIDTH << "x" << TEST_HEIGHT << " " << TEST_FPS
+      << "fps realtime, " << SIM_ONE_WAY_DELAY_MICROS / 1000 << "ms one way, " << lossPercent << "% random loss, "
+      << SIM_QUEUE_LIMIT_MICROS / 1000 << "ms drop tail queue." << std::endl;
+    std::cout << std::setw(4) << "sec" << std::setw(10) << "capacity" << std::setw(10) << "target" << std::setw(6) << "fps"
+      << std::setw(10) << "encoded" << std::setw(10) << "delivered" << std::setw(10) << "queue ms" << std::setw(8) << "max ms"
+      << std::setw(8) << "loss %" << std::setw(6) << "keys" << std::setw(10) << "state" << std::endl;
+
+    auto onPacket = [&](AVPacket* pkt) {
+      uint32_t timestamp = (uint32_t)(pkt->pts * RTP_VIDEO_CLOCK_RATE / TEST_FPS);
+
+      payloader.Packetize(pkt->data, pkt->size, timestamp, packets);
+
+      controller.OnPacketsSending(packets, nowMicros);
+
+      for (auto& packet : packets) {
+        InFlightPacket inFlight{ 0, std::vector<uint8_t>() };
+        for (int i = 0; i < packet.Count; i++) {
+          inFlight.Data.insert(inFlight.Data.end(), packet.Buffers[i].Data, packet.Buffers[i].Data + packet.Buffers[i].Length);
+        }
+
+        packetsSent++;
+        inFlight.ArrivalMicros = link.Send(inFlight.Data.size(), nowMicros, GetSimulatedCapacity(nowMicros, durationSeconds));
+        if (inFlight.ArrivalMicros < 0) {
+          packetsDropped++;
+          continue;
+        }
+
+        queueSum += inFlight.ArrivalMicros - nowMicros - SIM_ONE_WAY_DELAY_MICROS;
+        queueMax = std::max(queueMax, inFlight.ArrivalMicros - nowMicros - SIM_ONE_WAY_DELAY_MICROS);
+        forward.push_back(std::move(inFlight));
+      }
+
+      encodedBytes += pkt->size;
+      keyframes += (pkt->flags & AV_PKT_FLAG_KEY) ? 1 : 0;
+    };
+
+    int64_t frameIndex = 0;
+
+    for (; nowMicros < (int64_t)durationSeconds * 1000000; nowMicros += SIM_STEP_MICROS) {
+      int64_t receiverNow = nowMicros + SIM_RECEIVER_CLOCK_OFFSET_MICROS;
+
+      // Receiver, without retransmissions any gap leaves the decoder needing a keyframe.
+      while (!forward.empty() && forward.front().ArrivalMicros <= nowMicros) {
+        InFlightPacket& packet = forward.front();
+        RtpHeaderInfo hdr;
+
+        if (IsRtcpPacket(packet.Data.data(), packet.Data.size())) {
+          generator.OnRtcp(packet.Data.data(), packet.Data.size(), receiverNow);
+        }
+        else if (ParseRtpHeader(packet.Data.data(), packet.Data.size(), hdr)) {
+          if (haveSeq && hdr.SeqNum != expectedSeq) {
+            generator.RequestKeyframe(receiverNow);
+          }
+          expectedSeq = hdr.SeqNum + 1;
+          haveSeq = true;
+
+          generator.OnRtpPacket(packet.Data.data(), packet.Data.size(), receiverNow);
+          deliveredBytes += packet.Data.size();
+          packetsDelivered++;
+        }
+
+        forward.pop_front();
+      }
+
+      if (generator.Generate(receiverNow, rtcp)) {
+        reverse.push_back(InFlightPacket{ nowMicros + SIM_ONE_WAY_DELAY_MICROS, rtcp });
+      }
+
+      // Sender.
+      while (!reverse.empty() && reverse.front().ArrivalMicros <= nowMicros) {
+        controller.OnRtcp(reverse.front().Data.data(), reverse.front().Data.size(), nowMicros);
+        reverse.pop_front();
+      }
+
+      if (nowMicros >= nextSrMicros) {
+        uint8_t sr[RTCP_SR_LENGTH];
+        size_t srLength = controller.WriteSenderReport(sr, (uint32_t)(frameIndex * RTP_VIDEO_CLOCK_RATE / TEST_FPS), nowMicros);
+        forward.push_back(InFlightPacket{ nowMicros + SIM_ONE_WAY_DELAY_MICROS, std::vector<uint8_t>(sr, sr + srLength) });
+        std::stable_sort(forward.begin(), forward.end(), [](const InFlightPacket& a, const InFlightPacket& b) { return a.ArrivalMicros < b.ArrivalMicros; });
+        nextSrMicros += CONGESTION_REPORT_INTERVAL_MICROS;
+      }
+
+      if (nowMicros >= frameIndex * frameMicros) {
+        controller.Apply(encoder);
+
+        if (frameIndex % controller.GetFrameDecimation() == 0) {
+          FillTestFrame(frame, (int)frameIndex);
+          frame->pts = frameIndex;
+          encoder.Encode(frame, onPacket);
+          framesEncoded++;
+        }
+        frameIndex++;
+      }
+
+      if ((nowMicros + SIM_STEP_MICROS) % 1000000 == 0) {
+        CongestionStats stats = controller.GetStats();
+        double queueMs = packetsDelivered > 0 ? queueSum / 1000.0 / packetsDelivered : 0;
+
+        std::cout << std::setw(4) << (nowMicros + SIM_STEP_MICROS) / 1000000
+          << std::setw(10) << GetSimulatedCapacity(nowMicros, durationSeconds) / 1000
+          << std::setw(10) << stats.TargetBitRate / 1000
+          << std::setw(6) << framesEncoded
+          << std::setw(10) << encodedBytes * 8 / 1000
+          << std::setw(10) << deliveredBytes * 8 / 1000
+          << std::fixed << std::setprecision(1)
+          << std::setw(10) << queueMs
+          << std::setw(8) << queueMax / 1000.0
+          << std::setw(8) << (packetsSent > 0 ? 100.0 * packetsDropped / packetsSent : 0.0)
+          << std::setw(6) << keyframes
+          << std::setw(10) << CongestionController::GetUsageName(stats.Usage) << std::endl;
+
+        totalEncoded += encodedBytes;
+        totalSent += packetsSent;
+        totalDropped += packetsDropped;
+        totalKeyframes += keyframes;
+        totalQueueMs += queueMs;
+        encodedBytes = deliveredBytes = queueSum = queueMax = 0;
+        framesEncoded = packetsSent = packetsDropped = packetsDelivered = keyframes = 0;
+      }
+    }
+
+    framePool.Return(frame);
+
+    CongestionStats stats = controller.GetStats();
+    std::cout << "Encoded " << totalEncoded * 8 / 1000 / std::max(1, durationSeconds) << " kbps on average, "
+      << std::fixed << std::setprecision(1) << totalQueueMs / std::max(1, durationSeconds) << "ms mean queuing delay, "
+      << (totalSent > 0 ? 100.0 * totalDropped / totalSent : 0.0) << "% of packets lost, " << totalKeyframes << " keyframes." << std::endl;
+    std::cout << "Controller: " << stats.FeedbackReceived << " feedback, " << stats.ReportsReceived << " reports, "
+      << stats.PlisReceived << " PLIs, " << stats.KeyframesRequested << " keyframes requested, " << stats.Decreases
+      << " delay based decreases, rtt " << stats.RttMicros / 1000 << "ms, " << stats.PacketsUnstamped << " packets unstamped." << std::endl;
+  }
+
+  void RunCongestionReceiver(int listenPort, const std::string& senderAddress, int senderRtcpPort, int durationSeconds)
+  {
+    std::random_device rd;
+    RtcpFeedbackGenerator generator(rd(), RTP_VIDEO_CLOCK_RATE);
+    RtpSender rtcpSender(senderAddress, senderRtcpPort);
+    RtpSocket socket(listenPort);
+    std::mutex mutex;
+    uint64_t framesOut = 0;
+    uint16_t expectedSeq = 0;
+    bool haveSeq = false;
+
+    socket.SetRtpPacketCallback([&](const uint8_t* packet, int length, std::chrono::steady_clock::time_point receivedTime) {
+      std::lock_guard<std::mutex> lock(mutex);
+      int64_t nowMicros = SteadyMicros(receivedTime);
+
+      if (IsRtcpPacket(packet, length)) {
+        generator.OnRtcp(packet, length, nowMicros);
+        return;
+      }
+
+      RtpHeaderInfo hdr;
+      if (!ParseRtpHeader(packet, length, hdr)) {
+        return;
+      }
+
+      generator.OnRtpPacket(packet, length, nowMicros);
+
+      // Without retransmissions any gap leaves the decoder needing a keyframe.
+      if (haveSeq && hdr.SeqNum != expectedSeq) {
+        generator.RequestKeyframe(nowMicros);
+      }
+      expectedSeq = hdr.SeqNum + 1;
+      haveSeq = true;
+
+      if (hdr.Marker) {
+        framesOut++;
+      }
+    });
+
+    std::cout << "Congestion receiver listening on " << listenPort << ", feedback to " << senderAddress << ":" << senderRtcpPort
+      << " for " << durationSeconds << "s." << std::endl;
+
+    socket.Start();
+
+    std::vector<uint8_t> rtcp;
+    std::vector<RtpPacketBuffers> rtcpPackets(1);
+    auto start = std::chrono::steady_clock::now();
+    auto nextPrint = start + std::chrono::seconds(1);
+    uint64_t lastReceived = 0, lastFrames = 0;
+
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds(durationSeconds)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(RECEIVER_RTCP_POLL_MS));
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (generator.Generate(SteadyMicros(std::chrono::steady_clock::now()), rtcp)) {
+        rtcpPackets[0].Count = 1;
+        rtcpPackets[0].Buffers[0] = RtpIoVec{ rtcp.data(), rtcp.size() };
+        rtcpSender.Send(rtcpPackets);
+      }
+
+      if (std::chrono::steady_clock::now() >= nextPrint) {
+        std::cout << "received " << generator.GetPacketsReceived() - lastReceived << " packets, " << framesOut - lastFrames
+          << " frames, " << generator.GetPacketsLost() << " lost in total, " << generator.GetPlisSent() << " PLIs sent." << std::endl;
+        lastReceived = generator.GetPacketsReceived();
+        lastFrames = framesOut;
+        nextPrint += std::chrono::seconds(1);
+      }
+    }
+
+    socket.Close();
+  }
+
+  void RunCongestionSender(const std::string& dstAddress, int dstPort, int rtcpPort, int durationSeconds)
+  {
+    const int64_t startBitRate = TEST_START_BIT_RATE;
+
+    std::random_device rd;
+    uint32_t ssrc = rd();
+    VideoEncoder encoder(AV_CODEC_ID_H264, TEST_WIDTH, TEST_HEIGHT, TEST_FPS, EncoderPreset::Realtime, 0, startBitRate);
+    CongestionController controller(ssrc, TEST_WIDTH, TEST_HEIGHT, TEST_FPS, startBitRate, CONGESTION_DEFAULT_MIN_BIT_RATE, TEST_MAX_BIT_RATE);
+    H264RtpPayloader payloader(ssrc, H264_DEFAULT_PAYLOAD_TYPE, RTP_DEFAULT_MTU, (uint16_t)rd());
+    RtpSender sender(dstAddress, dstPort);
+    RtpSocket rtcpSocket(rtcpPort);
+    FramePool framePool(TEST_WIDTH, TEST_HEIGHT, AV_PIX_FMT_YUV420P, 1);
+    std::vector<RtpPacketBuffers> packets;
+    std::vector<RtpPacketBuffers> srPackets(1);
+    uint8_t sr[RTCP_SR_LENGTH];
+
+    rtcpSocket.SetRtpPacketCallback([&](const uint8_t* packet, int length, std::chrono::steady_clock::time_point receivedTime) {
+      controller.OnRtcp(packet, length, SteadyMicros(receivedTime));
+    });
+    rtcpSocket.Start();
+
+    std::cout << "Sending H.264 " << TEST_WIDTH << "x" << TEST_HEIGHT << " to " << dstAddress << ":" << dstPort
+      << " under congestion control, RTCP on " << rtcpPort << ", for " << durationSeconds << "s." << std::endl;
+
+    int64_t sentBytes = 0;
+    auto onPacket = [&](AVPacket* pkt) {
+      payloader.Packetize(pkt->data, pkt->size, (uint32_t)(pkt->pts * RTP_VIDEO_CLOCK_RATE / TEST_FPS), packets);
+      controller.OnPacketsSending(packets, SteadyMicros(std::chrono::steady_clock::now()));
+      sender.Send(packets);
+      sentBytes += pkt->size;
+    };
+
+    auto frameInterval = std::chrono::microseconds(1000000 / TEST_FPS);
+    auto start = std::chrono::steady_clock::now();
+    auto nextFrame = start;
+    auto nextReport = start;
+    int frameCount = durationSeconds * TEST_FPS;
+
+    for (int i = 0; i < frameCount; i++) {
+      auto now = std::chrono::steady_clock::now();
+
+      if (now >= nextReport) {
+        srPackets[0].Count = 1;
+        srPackets[0].Buffers[0] = RtpIoVec{ sr, controller.WriteSenderReport(sr, (uint32_t)(i * RTP_VIDEO_CLOCK_RATE / TEST_FPS), SteadyMicros(now)) };
+        sender.Send(srPackets);
+
+        CongestionStats stats = controller.GetStats();
+        std::cout << "target " << stats.TargetBitRate / 1000 << " kbps at " << stats.TargetFrameRate << " fps, sent "
+          << sentBytes * 8 / 1000 << " kbps, acked " << std::max<int64_t>(0, stats.AckedBitRate) / 1000 << " kbps, rtt "
+          << stats.RttMicros / 1000 << "ms, loss " << std::fixed << std::setprecision(1) << stats.FractionLost * 100 << "%, "
+          << CongestionController::GetUsageName(stats.Usage) << ", " << stats.KeyframesRequested << " keyframes requested." << std::endl;
+        sentBytes = 0;
+        nextReport += std::chrono::seconds(1);
+      }
+
+      controller.Apply(encoder);
+
+      if (i % controller.GetFrameDecimation() == 0) {
+        AVFrame* frame = framePool.Get();
+        FillTestFrame(frame, i);
+        frame->pts = i;
+        encoder.Encode(frame, onPacket);
+        framePool.Return(frame);
+      }
+
+      nextFrame += frameInterval;
+      std::this_thread::sleep_until(nextFrame);
+    }
+
+    rtcpSocket.Close();
+  }
+}
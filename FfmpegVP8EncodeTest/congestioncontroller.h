@@ -0,0 +1,465 @@
+//-----------------------------------------------------------------------------
+// Filename: congestioncontroller.h
+//
+// Description: Send side bandwidth estimation for a live stream, so a viewer
+// whose link degrades gets a lower bit rate instead of a stream that loss is
+// tearing apart. Modelled on Google Congestion Control,
+// draft-ietf-rmcat-gcc-02, with two estimators whose lower estimate wins:
+//
+//  delay based: every RTP packet carries a transport wide sequence number,
+//               the receiver reports when each one arrived (transport-cc
+//               feedback). Packets are grouped into the bursts they were sent
+//               in, and the difference between how far apart consecutive
+//               groups were sent and how far apart they arrived is the
+//               change in queuing delay along the path. A trendline fitted
+//               to the accumulated delay going up means a queue is building,
+//               overuse, and the rate is cut to 85% of what's getting
+//               through. Otherwise the rate climbs, 8% a second, or more
+//               gently once it's close to where it last had to back off.
+//  loss based: the fraction lost from receiver reports. Over 10% cuts the
+//              rate by half the loss, under 2% lets it grow, in between holds.
+//
+// The delay based estimator reacts to a queue building, before anything is
+// lost, the loss based one catches what it can't see, a policer or a lossy
+// radio link, where packets are dropped without any queuing first.
+//
+// The controller doesn't touch the encoder itself, the encode loop calls
+// Apply between frames, which passes a changed target bit rate to the
+// VideoEncoder without reopening it, and a PLI on to it as a keyframe
+// request. Only libx264 takes a new rate while open, the libvpx wrapper in
+// FFmpeg 4.3 reads it once at open, so the test modes here use H.264. Below
+// CONGESTION_MIN_BITS_PER_PIXEL at full frame rate the target frame rate
+// comes down too, a divisor of the capture rate so the frames kept are evenly
+// spaced, down to CONGESTION_MIN_FRAME_RATE.
+//
+// RtcpFeedbackGenerator is the receiver's half, it produces the transport-cc
+// feedback, receiver reports and PLIs the controller consumes.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_CONGESTIONCONTROLLER_H
+#define SIPSORCERY_CONGESTIONCONTROLLER_H
+
+#include "rtcp.h"
+#include "rtpsender.h"
+
+extern "C"
+{
+#include <libavcodec\codec_id.h>
+}
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define CONGESTION_DEFAULT_MIN_BIT_RATE 50000
+#define CONGESTION_PACKET_HISTORY 4096              // Sent packets kept for matching to feedback, a power of 2.
+#define CONGESTION_BURST_MICROS 5000                // Packets sent within this of a group's first are one group.
+#define CONGESTION_TRENDLINE_WINDOW 20              // Packet groups the delay trend is fitted over.
+#define CONGESTION_ACKED_WINDOW_MICROS 500000
+#define CONGESTION_DEFAULT_RTT_MICROS 100000        // Until a receiver report gives a measurement.
+#define CONGESTION_MIN_BITS_PER_PIXEL 0.03          // Below this at the full frame rate, the frame rate is reduced.
+#define CONGESTION_MIN_FRAME_RATE 5
+#define CONGESTION_KEYFRAME_MIN_INTERVAL_MICROS 300000  // PLIs repeated while a keyframe is on its way don't get another.
+#define CONGESTION_FEEDBACK_INTERVAL_MICROS 50000   // Receiver, transport-cc feedback.
+#define CONGESTION_REPORT_INTERVAL_MICROS 1000000   // Receiver reports, and sender reports.
+#define CONGESTION_PLI_INTERVAL_MICROS 500000
+
+namespace sipsorcery
+{
+  class VideoEncoder;
+
+  enum class BandwidthUsage
+  {
+    Normal,
+    Underusing,
+    Overusing
+  };
+
+  struct PacketFeedback
+  {
+    int64_t SendMicros;           // Sender's clock.
+    int64_t ArrivalMicros;        // Receiver's clock.
+    size_t Size;
+  };
+
+  /**
+  * The trendline filter and overuse detector. Feed it the packets from each
+  * feedback that were received, in sequence number order.
+  */
+  class DelayBasedEstimator
+  {
+  public:
+    DelayBasedEstimator();
+
+    /**
+    * @@Returns the link state after the feedback's packets.
+    */
+    BandwidthUsage Update(const std::vector<PacketFeedback>& packets);
+
+    BandwidthUsage GetState() const { return _state; }
+    double GetModifiedTrend() const { return _modifiedTrend; }
+    double GetThreshold() const { return _threshold; }
+
+  private:
+    struct PacketGroup
+    {
+      int64_t FirstSendMicros;
+      int64_t LastSendMicros;
+      int64_t LastArrivalMicros;
+    };
+
+    bool _haveGroup{ false };
+    bool _havePreviousGroup{ false };
+    PacketGroup _group{};
+    PacketGroup _previousGroup{};
+
+    int64_t _firstArrivalMicros{ -1 };
+    int _deltaCount{ 0 };
+    double _accumulatedDelay{ 0 };
+    double _smoothedDelay{ 0 };
+    std::deque<std::pair<double, double>> _delayHistory;    // Arrival ms, smoothed accumulated delay ms.
+
+    double _modifiedTrend{ 0 };
+    double _previousTrend{ 0 };
+    double _threshold;
+    int64_t _lastThresholdMicros{ -1 };
+    double _overuseMs{ -1 };
+    int _overuseCount{ 0 };
+    BandwidthUsage _state{ BandwidthUsage::Normal };
+
+    void OnGroupDelta(double sendDeltaMs, double arrivalDeltaMs, int64_t arrivalMicros);
+    void Detect(double trend, double sendDeltaMs, int64_t arrivalMicros);
+    void UpdateThreshold(double modifiedTrend, int64_t arrivalMicros);
+  };
+
+  /**
+  * Additive increase, multiplicative decrease from the overuse detector's
+  * signal, the delay based estimate.
+  */
+  class AimdRateControl
+  {
+  public:
+    AimdRateControl(int64_t startBitRate, int64_t minBitRate, int64_t maxBitRate);
+
+    /**
+    * @param[in] usage: the detector's state.
+    * @param[in] ackedBitRate: what the receiver is getting, -1 if not known yet.
+    * @param[in] rttMicros: the round trip time.
+    * @param[in] nowMicros: the sender's clock.
+    * @@Returns the new estimate.
+    */
+    int64_t Update(BandwidthUsage usage, int64_t ackedBitRate, int64_t rttMicros, int64_t nowMicros);
+
+    int64_t GetBitRate() const { return _bitRate; }
+    uint64_t GetDecreases() const { return _decreases; }
+
+  private:
+    enum class State
+    {
+      Hold,
+      Increase,
+      Decrease
+    };
+
+    double _bitRate;
+    int64_t _minBitRate;
+    int64_t _maxBitRate;
+    State _state{ State::Hold };
+    double _linkCapacity{ -1 };           // Average acked kbps at the decreases, -1 when not known.
+    double _linkCapacityVariance{ 0.4 };  // Normalised by the capacity.
+    int64_t _lastUpdateMicros{ -1 };
+    uint64_t _decreases{ 0 };
+  };
+
+  /**
+  * The loss based estimate, from each receiver report's fraction lost.
+  */
+  class LossBasedEstimator
+  {
+  public:
+    LossBasedEstimator(int64_t startBitRate, int64_t minBitRate, int64_t maxBitRate);
+
+    /**
+    * @param[in] fractionLost: 0 to 1.
+    * @param[in] currentBitRate: the controller's target, a decrease is taken
+    *  from it and an increase can't get far ahead of it.
+    * @@Returns the new estimate.
+    */
+    int64_t Update(double fractionLost, int64_t currentBitRate);
+
+    int64_t GetBitRate() const { return _bitRate; }
+
+  private:
+    int64_t _bitRate;
+    int64_t _minBitRate;
+    int64_t _maxBitRate;
+  };
+
+  struct CongestionStats
+  {
+    int64_t TargetBitRate;
+    int TargetFrameRate;
+    int64_t DelayBasedBitRate;
+    int64_t LossBasedBitRate;
+    int64_t AckedBitRate;         // -1 until there's been enough feedback.
+    int64_t RttMicros;
+    double FractionLost;          // From the last receiver report.
+    BandwidthUsage Usage;
+    double ModifiedTrend;
+    double Threshold;
+    uint64_t PacketsSent;
+    uint64_t PacketsUnstamped;    // Sent without a transport wide sequence number, no room for the extension.
+    uint64_t PacketsAcked;
+    uint64_t PacketsLost;         // Reported not received in transport-cc feedback.
+    uint64_t FeedbackReceived;
+    uint64_t ReportsReceived;
+    uint64_t PlisReceived;
+    uint64_t KeyframesRequested;
+    uint64_t Decreases;
+  };
+
+  class CongestionController
+  {
+  public:
+    /**
+    * @param[in] ssrc: the media stream's SSRC, for sender reports and matching PLIs.
+    * @param[in] width: the encoded width, for the frame rate decision.
+    * @param[in] height: the encoded height.
+    * @param[in] maxFrameRate: the capture frame rate.
+    * @param[in] startBitRate: the bit rate the encoder was opened with.
+    * @param[in] minBitRate: the lowest target.
+    * @param[in] maxBitRate: the highest target.
+    */
+    CongestionController(uint32_t ssrc, int width, int height, int maxFrameRate, int64_t startBitRate,
+      int64_t minBitRate, int64_t maxBitRate);
+
+    CongestionController(const CongestionController&) = delete;
+    CongestionController& operator=(const CongestionController&) = delete;
+
+    /**
+    * Gives each packet a transport wide sequence number, in a header
+    * extension, and remembers when it was sent. The RTP header is copied
+    * into a slab of the controller's own, with the extension after it, and
+    * the packet's first buffer is pointed at the copy. The rest of the packet
+    * is untouched. The packets must be sent before the next call.
+    * @param[in,out] packets: the packets about to be sent.
+    * @param[in] nowMicros: the send time, the same clock as every other call.
+    */
+    void OnPacketsSending(std::vector<RtpPacketBuffers>& packets, int64_t nowMicros);
+
+    /**
+    * Takes in an RTCP packet from the receiver, transport-cc feedback,
+    * receiver reports and PLIs, and updates the estimates. Can be called on
+    * a different thread to the other calls.
+    * @@Returns false if the packet wasn't valid RTCP.
+    */
+    bool OnRtcp(const uint8_t* buf, size_t length, int64_t nowMicros);
+    void OnRtcp(const RtcpCompound& compound, int64_t nowMicros);
+
+    /**
+    * Writes a sender report, which the receiver's reports echo back for the
+    * round trip time.
+    * @@Returns the number of bytes written, at most RTCP_SR_LENGTH.
+    */
+    size_t WriteSenderReport(uint8_t* buf, uint32_t rtpTimestamp, int64_t nowMicros);
+
+    int64_t GetTargetBitRate() const;
+    int GetTargetFrameRate() const;
+
+    /**
+    * The target frame rate as a divisor of the capture rate, encode frames
+    * whose index is a multiple of it.
+    */
+    int GetFrameDecimation() const;
+
+    /**
+    * @@Returns true once for each keyframe request that needs acting on.
+    */
+    bool ConsumeKeyframeRequest();
+
+    /**
+    * Passes the target bit rate to the encoder if it's moved from the last
+    * rate the encoder accepted, and a pending keyframe request. Call from the
+    * encode thread between frames, the encoder is taken to have been opened
+    * at the start bit rate.
+    * @@Returns true if the encoder's bit rate was changed.
+    */
+    bool Apply(VideoEncoder& encoder);
+
+    CongestionStats GetStats() const;
+
+    static const char* GetUsageName(BandwidthUsage usage);
+
+  private:
+    struct SentPacket
+    {
+      uint16_t SeqNum;
+      bool InUse;
+      bool Acked;
+      int64_t SendMicros;
+      size_t Size;
+    };
+
+    mutable std::mutex _mutex;
+    uint32_t _ssrc;
+    int _width;
+    int _height;
+    int _maxFrameRate;
+    int64_t _minBitRate;
+    int64_t _maxBitRate;
+
+    uint16_t _transportSeqNum{ 0 };
+    std::vector<uint8_t> _headerSlab;
+    std::vector<SentPacket> _history;
+    uint32_t _packetsSent{ 0 };
+    uint32_t _octetsSent{ 0 };
+
+    DelayBasedEstimator _delayEstimator;
+    AimdRateControl _rateControl;
+    LossBasedEstimator _lossEstimator;
+    bool _haveReferenceTime{ false };
+    int64_t _referenceTime{ 0 };  // The last transport-cc reference time, unwrapped.
+    std::deque<std::pair<int64_t, size_t>> _ackedWindow;   // Arrival micros and size of recently acked packets.
+    uint64_t _ackedWindowBytes{ 0 };
+    int64_t _ackedBitRate{ -1 };
+    int64_t _rttMicros{ CONGESTION_DEFAULT_RTT_MICROS };
+    double _fractionLost{ 0 };
+
+    int64_t _targetBitRate;
+    int64_t _appliedBitRate;      // Encode thread only, the last rate the encoder accepted.
+    int _frameDecimation{ 1 };
+    bool _keyframeRequested{ false };
+    int64_t _lastKeyframeRequestMicros{ -1 };
+
+    CongestionStats _stats{};
+    std::vector<PacketFeedback> _feedbackScratch;
+
+    void OnTransportFeedback(const RtcpTransportFeedback& feedback, int64_t nowMicros);
+    void OnReportBlock(const RtcpReportBlock& block, int64_t nowMicros);
+    void UpdateTarget();
+    int64_t UpdateAckedBitRate(const std::vector<PacketFeedback>& packets);
+  };
+
+  /**
+  * The receiver's side, collects the arrival of every packet and the
+  * sequence number statistics and produces the RTCP the sender's
+  * CongestionController needs. Not thread safe.
+  */
+  class RtcpFeedbackGenerator
+  {
+  public:
+    /**
+    * @param[in] ssrc: the receiver's own SSRC.
+    * @param[in] clockRate: the RTP clock rate of the stream, for jitter.
+    */
+    RtcpFeedbackGenerator(uint32_t ssrc, int clockRate);
+
+    /**
+    * Records a received RTP packet.
+    * @param[in] arrivalMicros: the receiver's clock, the same as every other call.
+    */
+    void OnRtpPacket(const uint8_t* packet, size_t length, int64_t arrivalMicros);
+
+    /**
+    * Takes in the sender's RTCP, sender reports are remembered so receiver
+    * reports can echo them.
+    */
+    void OnRtcp(const uint8_t* buf, size_t length, int64_t arrivalMicros);
+
+    /**
+    * Asks for a keyframe in the next feedback. Requests closer together than
+    * CONGESTION_PLI_INTERVAL_MICROS go out as one.
+    */
+    void RequestKeyframe(int64_t nowMicros);
+
+    /**
+    * Builds the RTCP that's due, transport-cc feedback every
+    * CONGESTION_FEEDBACK_INTERVAL_MICROS, a receiver report every
+    * CONGESTION_REPORT_INTERVAL_MICROS and any PLI.
+    * @param[out] rtcp: the compound packet, cleared first.
+    * @@Returns true if there's anything to send.
+    */
+    bool Generate(int64_t nowMicros, std::vector<uint8_t>& rtcp);
+
+    uint64_t GetPacketsReceived() const { return _received; }
+    int64_t GetPacketsLost() const;
+    uint64_t GetPlisSent() const { return _plisSent; }
+
+  private:
+    uint32_t _ssrc;
+    int _clockRate;
+    uint32_t _mediaSsrc{ 0 };
+
+    bool _haveSeq{ false };
+    uint16_t _baseSeq{ 0 };
+    uint16_t _maxSeq{ 0 };
+    uint32_t _cycles{ 0 };
+    uint64_t _received{ 0 };
+    uint32_t _expectedPrior{ 0 };
+    uint64_t _receivedPrior{ 0 };
+    double _jitter{ 0 };
+    int64_t _lastTransit{ 0 };
+    bool _haveTransit{ false };
+
+    uint32_t _lastSr{ 0 };
+    int64_t _lastSrArrivalMicros{ -1 };
+
+    bool _haveTransportSeq{ false };
+    int64_t _lastTransportSeq{ 0 };       // Unwrapped.
+    int64_t _nextFeedbackSeq{ -1 };
+    std::map<int64_t, int64_t> _arrivals; // Unwrapped transport sequence number to arrival, not yet reported.
+    uint8_t _feedbackCount{ 0 };
+    RtcpTransportFeedback _feedback;
+
+    int64_t _lastFeedbackMicros{ -1 };
+    int64_t _lastReportMicros{ -1 };
+    bool _pliPending{ false };
+    int64_t _lastPliMicros{ -1 };
+    uint64_t _plisSent{ 0 };
+
+    uint32_t GetExtendedMaxSeq() const { return _cycles + _maxSeq; }
+    void AppendReceiverReport(int64_t nowMicros, std::vector<uint8_t>& rtcp);
+    void AppendTransportFeedback(std::vector<uint8_t>& rtcp);
+  };
+
+  /**
+  * Runs a realtime encoder against a simulated bottleneck, a drop tail queue
+  * draining at a capacity that steps down and back up, with a fixed one way
+  * delay and random loss, all in virtual time so a run is repeatable. Prints
+  * each second the capacity, the controller's target, what the encoder
+  * actually produced, the queuing delay and the loss. Throws
+  * std::runtime_error for an encoder that can't change rate while open.
+  * @param[in] codecID: AV_CODEC_ID_H264, VP8 is refused as above.
+  * @param[in] durationSeconds: the length of the simulation.
+  * @param[in] lossPercent: random loss on the link.
+  */
+  void RunCongestionSimulation(AVCodecID codecID, int durationSeconds, double lossPercent);
+
+  /**
+  * The receiving end for a shaped link test, receives the RTP stream on
+  * listenPort, sends feedback, reports and PLIs to the sender's RTCP port.
+  * A gap in the sequence numbers is taken as a loss the decoder would need
+  * a keyframe to recover from.
+  */
+  void RunCongestionReceiver(int listenPort, const std::string& senderAddress, int senderRtcpPort, int durationSeconds);
+
+  /**
+  * The sending end for a shaped link test, streams realtime H.264 to
+  * dstAddress:dstPort for durationSeconds under the controller, taking the
+  * receiver's RTCP on rtcpPort. Prints the controller's state each second.
+  */
+  void RunCongestionSender(const std::string& dstAddress, int dstPort, int rtcpPort, int durationSeconds);
+}
+
+#endif // SIPSORCERY_CONGESTIONCONTROLLER_H
@@ -0,0 +1,497 @@
+#include "containerwriter.h"
+#include "encoderbench.h"
+#include "framepool.h"
+#include "latencyhistogram.h"
+#include "videoencoder.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#define RECORDING_TEST_WIDTH 640
+#define RECORDING_TEST_HEIGHT 480
+#define RECORDING_TEST_CLIP_SECONDS 2       // The clip loops from its keyframe so every copy stays decodable.
+
+// Matroska element IDs, the length marker bits are part of the ID.
+#define EBML_ID_HEADER 0x1A45DFA3
+#define EBML_ID_VERSION 0x4286
+#define EBML_ID_READ_VERSION 0x42F7
+#define EBML_ID_MAX_ID_LENGTH 0x42F2
+#define EBML_ID_MAX_SIZE_LENGTH 0x42F3
+#define EBML_ID_DOC_TYPE 0x4282
+#define EBML_ID_DOC_TYPE_VERSION 0x4287
+#define EBML_ID_DOC_TYPE_READ_VERSION 0x4285
+#define EBML_ID_VOID 0xEC
+#define MKV_ID_SEGMENT 0x18538067
+#define MKV_ID_SEEKHEAD 0x114D9B74
+#define MKV_ID_SEEK 0x4DBB
+#define MKV_ID_SEEK_ID 0x53AB
+#define MKV_ID_SEEK_POSITION 0x53AC
+#define MKV_ID_INFO 0x1549A966
+#define MKV_ID_TIMECODE_SCALE 0x2AD7B1
+#define MKV_ID_DURATION 0x4489
+#define MKV_ID_MUXING_APP 0x4D80
+#define MKV_ID_WRITING_APP 0x5741
+#define MKV_ID_TRACKS 0x1654AE6B
+#define MKV_ID_TRACK_ENTRY 0xAE
+#define MKV_ID_TRACK_NUMBER 0xD7
+#define MKV_ID_TRACK_UID 0x73C5
+#define MKV_ID_TRACK_TYPE 0x83
+#define MKV_ID_FLAG_LACING 0x9C
+#define MKV_ID_CODEC_ID 0x86
+#define MKV_ID_VIDEO 0xE0
+#define MKV_ID_PIXEL_WIDTH 0xB0
+#define MKV_ID_PIXEL_HEIGHT 0xBA
+#define MKV_ID_CLUSTER 0x1F43B675
+#define MKV_ID_CLUSTER_TIMECODE 0xE7
+#define MKV_ID_SIMPLE_BLOCK 0xA3
+#define MKV_ID_CUES 0x1C53BB6B
+#define MKV_ID_CUE_POINT 0xBB
+#define MKV_ID_CUE_TIME 0xB3
+#define MKV_ID_CUE_TRACK_POSITIONS 0xB7
+#define MKV_ID_CUE_TRACK 0xF7
+#define MKV_ID_CUE_CLUSTER_POSITION 0xF1
+
+#define EBML_UNKNOWN_SIZE 0x01FFFFFFFFFFFFFFULL
+#define WEBM_TIMECODE_SCALE 1000000         // Timecodes in milliseconds.
+#define WEBM_TRACK_NUMBER 1
+#define WEBM_TRACK_TYPE_VIDEO 1
+#define WEBM_SIMPLE_BLOCK_KEYFRAME 0x80
+#define WEBM_MUXING_APP "sipsorcery"
+
+namespace sipsorcery
+{
+  static void PutLE16(uint8_t* dst, uint16_t val)
+  {
+    dst[0] = (uint8_t)val;
+    dst[1] = (uint8_t)(val >> 8);
+  }
+
+  static void PutLE32(uint8_t* dst, uint32_t val)
+  {
+    for (int i = 0; i < 4; i++) {
+      dst[i] = (uint8_t)(val >> (8 * i));
+    }
+  }
+
+  static void PutLE64(uint8_t* dst, uint64_t val)
+  {
+    for (int i = 0; i < 8; i++) {
+      dst[i] = (uint8_t)(val >> (8 * i));
+    }
+  }
+
+  static void PutBigEndian(std::vector<uint8_t>& buf, uint64_t val, int length)
+  {
+    for (int i = length - 1; i >= 0; i--) {
+      buf.push_back((uint8_t)(val >> (8 * i)));
+    }
+  }
+
+  static void PutId(std::vector<uint8_t>& buf, uint32_t id)
+  {
+    int length = (id > 0xFFFFFF) ? 4 : (id > 0xFFFF) ? 3 : (id > 0xFF) ? 2 : 1;
+    PutBigEndian(buf, id, length);
+  }
+
+  /**
+  * The shortest variable length integer for a size. The all ones value at
+  * each length is reserved for an unknown size.
+  */
+  static int GetSizeLength(uint64_t size)
+  {
+    int length = 1;
+    while (length < 8 && size >= (1ULL << (7 * length)) - 1) {
+      length++;
+    }
+    return length;
+  }
+
+  static void PutSize(std::vector<uint8_t>& buf, uint64_t size, int length)
+  {
+    PutBigEndian(buf, size | (1ULL << (7 * length)), length);
+  }
+
+  static void PutSize(std::vector<uint8_t>& buf, uint64_t size)
+  {
+    PutSize(buf, size, GetSizeLength(size));
+  }
+
+  static void PutUInt(std::vector<uint8_t>& buf, uint32_t id, uint64_t val)
+  {
+    int length = 1;
+    while (length < 8 && (val >> (8 * length)) != 0) {
+      length++;
+    }
+    PutId(buf, id);
+    PutSize(buf, length);
+    PutBigEndian(buf, val, length);
+  }
+
+  static void PutFloat(std::vector<uint8_t>& buf, uint32_t id, double val)
+  {
+    uint64_t bits;
+    std::memcpy(&bits, &val, sizeof(bits));
+    PutId(buf, id);
+    PutSize(buf, sizeof(bits));
+    PutBigEndian(buf, bits, sizeof(bits));
+  }
+
+  static void PutString(std::vector<uint8_t>& buf, uint32_t id, const char* val)
+  {
+    size_t length = std::strlen(val);
+    PutId(buf, id);
+    PutSize(buf, length);
+    buf.insert(buf.end(), val, val + length);
+  }
+
+  static void PutMaster(std::vector<uint8_t>& buf, uint32_t id, const std::vector<uint8_t>& body)
+  {
+    PutId(buf, id);
+    PutSize(buf, body.size());
+    buf.insert(buf.end(), body.begin(), body.end());
+  }
+
+  /**
+  * A Void element taking up exactly length bytes, at least 2.
+  */
+  static void PutVoid(std::vector<uint8_t>& buf, size_t length)
+  {
+    int sizeLength = (length - 1 > 127) ? 8 : 1;
+    size_t dataLength = length - 1 - sizeLength;
+    PutId(buf, EBML_ID_VOID);
+    PutSize(buf, dataLength, sizeLength);
+    buf.insert(buf.end(), dataLength, 0);
+  }
+
+  IvfWriter::IvfWriter(const std::string& path, FileFlushThread& flusher, int width, int height, int fps, const char* fourcc) :
+    _file(path, flusher)
+  {
+    uint8_t header[IVF_FILE_HEADER_LENGTH] = { 'D', 'K', 'I', 'F' };
+    PutLE16(header + 4, 0);                         // Version.
+    PutLE16(header + 6, IVF_FILE_HEADER_LENGTH);
+    std::memcpy(header + 8, fourcc, 4);
+    PutLE16(header + 12, (uint16_t)width);
+    PutLE16(header + 14, (uint16_t)height);
+    PutLE32(header + 16, (uint32_t)fps);            // Time base denominator.
+    PutLE32(header + 20, 1);                        // Time base numerator.
+    PutLE32(header + 24, 0);                        // Frame count, set on close.
+    PutLE32(header + 28, 0);
+
+    _file.Write(header, sizeof(header));
+  }
+
+  IvfWriter::~IvfWriter()
+  {
+    Close();
+  }
+
+  void IvfWriter::WriteFrame(const uint8_t* data, size_t length, int64_t pts, bool)
+  {
+    uint8_t header[IVF_FRAME_HEADER_LENGTH];
+    PutLE32(header, (uint32_t)length);
+    PutLE64(header + 4, (uint64_t)pts);
+
+    _file.Write(header, sizeof(header));
+    _file.Write(data, length);
+    _frameCount++;
+  }
+
+  void IvfWriter::Close()
+  {
+    if (_closed) {
+      return;
+    }
+    _closed = true;
+
+    uint8_t frameCount[4];
+    PutLE32(frameCount, _frameCount);
+    _file.Overwrite(24, frameCount, sizeof(frameCount));
+    _file.Close();
+  }
+
+  WebmWriter::WebmWriter(const std::string& path, FileFlushThread& flusher, int width, int height, int fps) :
+    _file(path, flusher), _fps(fps)
+  {
+    WriteHeader(width, height);
+  }
+
+  WebmWriter::~WebmWriter()
+  {
+    Close();
+  }
+
+  /**
+  * Everything up to the first Cluster. The Segment size, the SeekHead and
+  * the Duration are placeholders until the file is closed.
+  */
+  void WebmWriter::WriteHeader(int width, int height)
+  {
+    std::vector<uint8_t> header;
+    std::vector<uint8_t> body;
+
+    PutUInt(body, EBML_ID_VERSION, 1);
+    PutUInt(body, EBML_ID_READ_VERSION, 1);
+    PutUInt(body, EBML_ID_MAX_ID_LENGTH, 4);
+    PutUInt(body, EBML_ID_MAX_SIZE_LENGTH, 8);
+    PutString(body, EBML_ID_DOC_TYPE, "webm");
+    PutUInt(body, EBML_ID_DOC_TYPE_VERSION, 2);
+    PutUInt(body, EBML_ID_DOC_TYPE_READ_VERSION, 2);
+    PutMaster(header, EBML_ID_HEADER, body);
+
+    PutId(header, MKV_ID_SEGMENT);
+    _segmentSizeOffset = header.size();
+    PutSize(header, EBML_UNKNOWN_SIZE, 8);
+    _segmentStart = header.size();
+
+    _seekHeadOffset = header.size();
+    PutVoid(header, WEBM_SEEKHEAD_RESERVED);
+
+    body.clear();
+    PutUInt(body, MKV_ID_TIMECODE_SCALE, WEBM_TIMECODE_SCALE);
+    size_t durationInBody = body.size() + 2 + 1;    // After the Duration's ID and size.
+    PutFloat(body, MKV_ID_DURATION, 0.0);
+    PutString(body, MKV_ID_MUXING_APP, WEBM_MUXING_APP);
+    PutString(body, MKV_ID_WRITING_APP, WEBM_MUXING_APP);
+
+    _infoPosition = header.size() - _segmentStart;
+    _durationOffset = header.size() + 4 + GetSizeLength(body.size()) + durationInBody;
+    PutMaster(header, MKV_ID_INFO, body);
+
+    std::vector<uint8_t> video;
+    PutUInt(video, MKV_ID_PIXEL_WIDTH, width);
+    PutUInt(video, MKV_ID_PIXEL_HEIGHT, height);
+
+    std::vector<uint8_t> track;
+    PutUInt(track, MKV_ID_TRACK_NUMBER, WEBM_TRACK_NUMBER);
+    PutUInt(track, MKV_ID_TRACK_UID, WEBM_TRACK_NUMBER);
+    PutUInt(track, MKV_ID_TRACK_TYPE, WEBM_TRACK_TYPE_VIDEO);
+    PutUInt(track, MKV_ID_FLAG_LACING, 0);
+    PutString(track, MKV_ID_CODEC_ID, "V_VP8");
+    PutMaster(track, MKV_ID_VIDEO, video);
+
+    body.clear();
+    PutMaster(body, MKV_ID_TRACK_ENTRY, track);
+
+    _tracksPosition = header.size() - _segmentStart;
+    PutMaster(header, MKV_ID_TRACKS, body);
+
+    _file.Write(header.data(), header.size());
+  }
+
+  void WebmWriter::WriteFrame(const uint8_t* data, size_t length, int64_t pts, bool keyframe)
+  {
+    int64_t timecode = pts * 1000 / _fps;
+
+    if (!_clusterOpen || (keyframe && _clusterFrames > 0) || timecode - _clusterTimecode >= WEBM_MAX_CLUSTER_MS) {
+      StartCluster(timecode, keyframe);
+    }
+
+    int16_t relative = (int16_t)(timecode - _clusterTimecode);
+
+    _blockHeader.clear();
+    PutId(_blockHeader, MKV_ID_SIMPLE_BLOCK);
+    PutSize(_blockHeader, length + 4);
+    PutSize(_blockHeader, WEBM_TRACK_NUMBER);
+    PutBigEndian(_blockHeader, (uint16_t)relative, 2);
+    _blockHeader.push_back(keyframe ? WEBM_SIMPLE_BLOCK_KEYFRAME : 0);
+
+    _file.Write(_blockHeader.data(), _blockHeader.size());
+    _file.Write(data, length);
+
+    _clusterFrames++;
+    _lastTimecode = timecode;
+  }
+
+  /**
+  * Clusters are opened with an unknown size that's patched when the next
+  * one starts, by then it's normally still in the write buffer.
+  */
+  void WebmWriter::StartCluster(int64_t timecode, bool keyframe)
+  {
+    EndCluster();
+
+    uint64_t clusterPosition = _file.GetPosition() - _segmentStart;
+
+    std::vector<uint8_t> header;
+    PutId(header, MKV_ID_CLUSTER);
+    _clusterSizeOffset = _file.GetPosition() + header.size();
+    PutSize(header, EBML_UNKNOWN_SIZE, 8);
+    PutUInt(header, MKV_ID_CLUSTER_TIMECODE, (uint64_t)timecode);
+    _file.Write(header.data(), header.size());
+
+    _clusterOpen = true;
+    _clusterTimecode = timecode;
+    _clusterFrames = 0;
+
+    if (keyframe) {
+      std::vector<uint8_t> positions;
+      PutUInt(positions, MKV_ID_CUE_TRACK, WEBM_TRACK_NUMBER);
+      PutUInt(positions, MKV_ID_CUE_CLUSTER_POSITION, clusterPosition);
+
+      std::vector<uint8_t> cuePoint;
+      PutUInt(cuePoint, MKV_ID_CUE_TIME, (uint64_t)timecode);
+      PutMaster(cuePoint, MKV_ID_CUE_TRACK_POSITIONS, positions);
+
+      PutMaster(_cues, MKV_ID_CUE_POINT, cuePoint);
+    }
+  }
+
+  void WebmWriter::EndCluster()
+  {
+    if (!_clusterOpen) {
+      return;
+    }
+
+    std::vector<uint8_t> size;
+    PutSize(size, _file.GetPosition() - (_clusterSizeOffset + 8), 8);
+    _file.Overwrite(_clusterSizeOffset, size.data(), size.size());
+    _clusterOpen = false;
+  }
+
+  void WebmWriter::WriteSeekHead(uint64_t cuesPosition)
+  {
+    const uint32_t ids[] = { MKV_ID_INFO, MKV_ID_TRACKS, MKV_ID_CUES };
+    const uint64_t positions[] = { _infoPosition, _tracksPosition, cuesPosition };
+
+    std::vector<uint8_t> body;
+    for (int i = 0; i < 3; i++) {
+      if (ids[i] == MKV_ID_CUES && _cues.empty()) {
+        continue;
+      }
+
+      std::vector<uint8_t> seekID;
+      PutBigEndian(seekID, ids[i], 4);
+
+      std::vector<uint8_t> seek;
+      PutMaster(seek, MKV_ID_SEEK_ID, seekID);
+      PutUInt(seek, MKV_ID_SEEK_POSITION, positions[i]);
+      PutMaster(body, MKV_ID_SEEK, seek);
+    }
+
+    std::vector<uint8_t> seekHead;
+    PutId(seekHead, MKV_ID_SEEKHEAD);
+    size_t remaining = WEBM_SEEKHEAD_RESERVED - seekHead.size() - 1 - body.size();
+    // A Void can't be a single byte, take it up with a longer size field instead.
+    PutSize(seekHead, body.size(), (remaining == 1) ? 2 : 1);
+    seekHead.insert(seekHead.end(), body.begin(), body.end());
+    if (remaining > 1) {
+      PutVoid(seekHead, remaining);
+    }
+
+    _file.Overwrite(_seekHeadOffset, seekHead.data(), seekHead.size());
+  }
+
+  void WebmWriter::Close()
+  {
+    if (_closed) {
+      return;
+    }
+    _closed = true;
+
+    EndCluster();
+
+    uint64_t cuesPosition = _file.GetPosition() - _segmentStart;
+    if (!_cues.empty()) {
+      std::vector<uint8_t> cues;
+      PutMaster(cues, MKV_ID_CUES, _cues);
+      _file.Write(cues.data(), cues.size());
+    }
+
+    std::vector<uint8_t> patch;
+    PutSize(patch, _file.GetPosition() - _segmentStart, 8);
+    _file.Overwrite(_segmentSizeOffset, patch.data(), patch.size());
+
+    double durationMs = (double)_lastTimecode + 1000.0 / _fps;
+    uint64_t bits;
+    std::memcpy(&bits, &durationMs, sizeof(bits));
+    patch.clear();
+    PutBigEndian(patch, bits, sizeof(bits));
+    _file.Overwrite(_durationOffset, patch.data(), patch.size());
+
+    WriteSeekHead(cuesPosition);
+
+    _file.Close();
+  }
+
+  void RunRecordingTest(int streamCount, int fps, int durationSeconds, const std::string& format, const std::string& pathPrefix)
+  {
+    if (format != "ivf" && format != "webm") {
+      throw std::runtime_error("Recording format must be ivf or webm, not " + format + ".");
+    }
+
+    // Encode the clip once, every stream records the same packets.
+    std::vector<AVPacket*> clip;
+    {
+      VideoEncoder encoder(AV_CODEC_ID_VP8, RECORDING_TEST_WIDTH, RECORDING_TEST_HEIGHT, fps, EncoderPreset::Realtime);
+      FramePool framePool(RECORDING_TEST_WIDTH, RECORDING_TEST_HEIGHT, AV_PIX_FMT_YUV420P, 1);
+      AVFrame* frame = framePool.Get();
+      auto onPacket = [&](AVPacket* pkt) { clip.push_back(av_packet_clone(pkt)); };
+
+      for (int i = 0; i < RECORDING_TEST_CLIP_SECONDS * fps; i++) {
+        FillTestFrame(frame, i);
+        frame->pts = i;
+        encoder.Encode(frame, onPacket);
+      }
+      encoder.Flush(onPacket);
+      framePool.Return(frame);
+    }
+
+    LatencyHistogram writeLatency;
+    uint64_t totalWrites = 0;
+    uint64_t totalBytes = 0;
+    int failed = 0;
+
+    {
+      FileFlushThread flusher;
+      std::vector<std::unique_ptr<ContainerWriter>> writers;
+
+      for (int i = 0; i < streamCount; i++) {
+        std::string path = pathPrefix + std::to_string(i) + "." + format;
+        if (format == "ivf") {
+          writers.push_back(std::unique_ptr<ContainerWriter>(new IvfWriter(path, flusher, RECORDING_TEST_WIDTH, RECORDING_TEST_HEIGHT, fps)));
+        }
+        else {
+          writers.push_back(std::unique_ptr<ContainerWriter>(new WebmWriter(path, flusher, RECORDING_TEST_WIDTH, RECORDING_TEST_HEIGHT, fps)));
+        }
+      }
+
+      std::cout << "Recording " << streamCount << " " << format << " streams at " << fps << " fps for " << durationSeconds << "s to "
+        << pathPrefix << "N." << format << "." << std::endl;
+
+      auto frameInterval = std::chrono::microseconds(1000000 / fps);
+      auto nextFrame = std::chrono::steady_clock::now();
+
+      for (int i = 0; i < durationSeconds * fps; i++) {
+        AVPacket* pkt = clip[i % clip.size()];
+
+        for (auto& writer : writers) {
+          auto start = std::chrono::steady_clock::now();
+          writer->WriteFrame(pkt->data, pkt->size, i, (pkt->flags & AV_PKT_FLAG_KEY) != 0);
+          writeLatency.Record(std::chrono::steady_clock::now() - start);
+        }
+
+        nextFrame += frameInterval;
+        std::this_thread::sleep_until(nextFrame);
+      }
+
+      for (auto& writer : writers) {
+        writer->Close();
+        totalWrites += writer->GetFile().GetWriteCount();
+        totalBytes += writer->GetFile().GetPosition();
+        failed += writer->GetFile().HasFailed() ? 1 : 0;
+      }
+    }
+
+    for (auto& pkt : clip) {
+      av_packet_free(&pkt);
+    }
+
+    std::cout << "Wrote " << totalBytes / 1024 << " KB in " << totalWrites << " writes, "
+      << (double)totalWrites / streamCount / durationSeconds << " writes per stream per second, "
+      << failed << " files failed." << std::endl;
+
+    LatencyHistogram::PrintHeader(std::cout);
+    writeLatency.Print(std::cout, "write frame");
+  }
+}
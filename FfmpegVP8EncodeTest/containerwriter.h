@@ -0,0 +1,139 @@
+//-----------------------------------------------------------------------------
+// Filename: containerwriter.h
+//
+// Description: Native IVF and WebM writers for recording encoded VP8 without
+// going through avformat, which writes each frame as it arrives with small
+// AVIOContext writes. Both write through a BufferedFileWriter so a recording
+// is a handful of large writes a second on a shared flush thread.
+//
+// IVF is the 32 byte file header and a 12 byte header per frame, the frame
+// count is filled in on close.
+//
+// WebM is the minimum a player needs: EBML header, Segment, SeekHead, Info,
+// one video Tracks entry, Clusters of SimpleBlocks and Cues. A cluster starts
+// at every keyframe, or after WEBM_MAX_CLUSTER_MS for streams that only send
+// keyframes on request, and a cue point is added as each keyframe cluster
+// starts so closing only has to append the finished index. Sizes that aren't
+// known until later, the Segment, each Cluster and the Duration, are written
+// as placeholders and patched, usually while still in memory.
+//
+// Timestamps are in frames, a time base of 1/fps.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_CONTAINERWRITER_H
+#define SIPSORCERY_CONTAINERWRITER_H
+
+#include "bufferedfilewriter.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define IVF_FILE_HEADER_LENGTH 32
+#define IVF_FRAME_HEADER_LENGTH 12
+#define WEBM_MAX_CLUSTER_MS 5000            // Well inside the 16 bit block timecode offset.
+#define WEBM_SEEKHEAD_RESERVED 96           // Room for the SeekHead entries for Info, Tracks and Cues.
+
+namespace sipsorcery
+{
+  class ContainerWriter
+  {
+  public:
+    virtual ~ContainerWriter() { }
+
+    /**
+    * @param[in] data: the encoded frame, copied into the write buffer.
+    * @param[in] pts: the frame's timestamp in frames, must not go backwards.
+    * @param[in] keyframe: true if the frame is a keyframe.
+    */
+    virtual void WriteFrame(const uint8_t* data, size_t length, int64_t pts, bool keyframe) = 0;
+
+    /**
+    * Finishes the headers and index and closes the file.
+    */
+    virtual void Close() = 0;
+
+    virtual const BufferedFileWriter& GetFile() const = 0;
+  };
+
+  class IvfWriter : public ContainerWriter
+  {
+  public:
+    /**
+    * @param[in] fourcc: the codec, "VP80" for VP8.
+    * Throws std::runtime_error if the file cannot be created.
+    */
+    IvfWriter(const std::string& path, FileFlushThread& flusher, int width, int height, int fps, const char* fourcc = "VP80");
+    ~IvfWriter();
+
+    void WriteFrame(const uint8_t* data, size_t length, int64_t pts, bool keyframe) override;
+    void Close() override;
+    const BufferedFileWriter& GetFile() const override { return _file; }
+
+  private:
+    BufferedFileWriter _file;
+    uint32_t _frameCount{ 0 };
+    bool _closed{ false };
+  };
+
+  class WebmWriter : public ContainerWriter
+  {
+  public:
+    /**
+    * Writes a VP8 video only WebM file.
+    * Throws std::runtime_error if the file cannot be created.
+    */
+    WebmWriter(const std::string& path, FileFlushThread& flusher, int width, int height, int fps);
+    ~WebmWriter();
+
+    void WriteFrame(const uint8_t* data, size_t length, int64_t pts, bool keyframe) override;
+    void Close() override;
+    const BufferedFileWriter& GetFile() const override { return _file; }
+
+  private:
+    BufferedFileWriter _file;
+    int _fps;
+    bool _closed{ false };
+
+    uint64_t _segmentSizeOffset{ 0 };
+    uint64_t _segmentStart{ 0 };
+    uint64_t _seekHeadOffset{ 0 };
+    uint64_t _durationOffset{ 0 };
+    uint64_t _infoPosition{ 0 };            // Positions are relative to the start of the Segment's data.
+    uint64_t _tracksPosition{ 0 };
+
+    bool _clusterOpen{ false };
+    uint64_t _clusterSizeOffset{ 0 };
+    int64_t _clusterTimecode{ 0 };
+    int _clusterFrames{ 0 };
+    int64_t _lastTimecode{ 0 };
+
+    std::vector<uint8_t> _cues;             // CuePoint elements, the Cues header is added on close.
+    std::vector<uint8_t> _blockHeader;
+
+    void WriteHeader(int width, int height);
+    void StartCluster(int64_t timecode, bool keyframe);
+    void EndCluster();
+    void WriteSeekHead(uint64_t cuesPosition);
+  };
+
+  /**
+  * Records streamCount copies of an encoded 640x480 VP8 clip in real time for
+  * durationSeconds and reports the number of disk writes per stream per
+  * second and the time taken to write each frame.
+  * @param[in] format: "ivf" or "webm".
+  * @param[in] pathPrefix: files are written to pathPrefix<stream>.<format>.
+  */
+  void RunRecordingTest(int streamCount, int fps, int durationSeconds, const std::string& format, const std::string& pathPrefix);
+}
+
+#endif // SIPSORCERY_CONTAINERWRITER_H
@@ -0,0 +1,123 @@
+#include "encodedslices.h"
+#include "colorconvert.h"
+#include "vp8rtp.h"
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#define H264_START_CODE_LENGTH 3
+#define H264_START_CODE_AVX2_READ 34      // Checking 32 positions reads the two bytes after them too.
+
+namespace sipsorcery
+{
+  typedef const uint8_t* (*StartCodeFinder)(const uint8_t* data, const uint8_t* end);
+
+  static inline int CountTrailingZeros(uint32_t mask)
+  {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+  }
+
+  const uint8_t* FindH264StartCode(const uint8_t* data, const uint8_t* end)
+  {
+    // Checking the CPU is a cpuid, only done once.
+    static const StartCodeFinder finder = ColorConverter::HasAvx2() ? FindH264StartCodeAvx2 : FindH264StartCodeScalar;
+    return finder(data, end);
+  }
+
+  const uint8_t* FindH264StartCodeScalar(const uint8_t* data, const uint8_t* end)
+  {
+    for (const uint8_t* p = data; p + H264_START_CODE_LENGTH <= end; p++) {
+      if (p[2] > 1) {
+        // Neither this position nor the next two can start a start code.
+        p += 2;
+      }
+      else if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+        return p;
+      }
+    }
+    return end;
+  }
+
+  /**
+  * Compares 32 positions at once against each byte of the start code, the
+  * three masks ANDed leave a bit set for every position a start code begins.
+  * Emulation prevention keeps 00 00 01 out of NAL unit payloads, so almost
+  * every block is a single test and branch.
+  */
+  const uint8_t* FindH264StartCodeAvx2(const uint8_t* data, const uint8_t* end)
+  {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    const uint8_t* p = data;
+
+    for (; end - p >= H264_START_CODE_AVX2_READ; p += 32) {
+      __m256i b0 = _mm256_loadu_si256((const __m256i*)p);
+      __m256i b1 = _mm256_loadu_si256((const __m256i*)(p + 1));
+      __m256i b2 = _mm256_loadu_si256((const __m256i*)(p + 2));
+
+      __m256i match = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+        _mm256_cmpeq_epi8(b2, one));
+      uint32_t mask = (uint32_t)_mm256_movemask_epi8(match);
+
+      if (mask != 0) {
+        return p + CountTrailingZeros(mask);
+      }
+    }
+
+    return FindH264StartCodeScalar(p, end);
+  }
+
+  int SplitEncodedFrame(AVCodecID codecID, const uint8_t* data, size_t length, std::vector<EncodedSlice>& slices)
+  {
+    slices.clear();
+
+    if (codecID == AV_CODEC_ID_VP8) {
+      Vp8FrameInfo info;
+      if (ParseVp8Frame(data, length, info)) {
+        for (int i = 0; i < info.PartitionCount; i++) {
+          if (info.PartitionLength[i] > 0) {
+            slices.push_back(EncodedSlice{ data + info.PartitionStart[i], info.PartitionLength[i], i, false });
+          }
+        }
+      }
+    }
+    else if (codecID == AV_CODEC_ID_H264) {
+      const uint8_t* end = data + length;
+      const uint8_t* startCode = FindH264StartCode(data, end);
+
+      while (startCode < end) {
+        const uint8_t* nal = startCode + H264_START_CODE_LENGTH;
+        startCode = FindH264StartCode(nal, end);
+
+        // Trailing zeros belong to the next start code when it's the 4 byte form, or are padding.
+        const uint8_t* nalEnd = startCode;
+        while (nalEnd > nal && nalEnd[-1] == 0) {
+          nalEnd--;
+        }
+
+        if (nalEnd > nal) {
+          slices.push_back(EncodedSlice{ nal, (size_t)(nalEnd - nal), (int)slices.size(), false });
+        }
+      }
+    }
+
+    if (slices.empty() && length > 0) {
+      slices.push_back(EncodedSlice{ data, length, 0, false });
+    }
+
+    if (!slices.empty()) {
+      slices.back().Last = true;
+    }
+
+    return (int)slices.size();
+  }
+}
@@ -0,0 +1,77 @@
+//-----------------------------------------------------------------------------
+// Filename: encodedslices.h
+//
+// Description: Splits an encoded frame into the pieces a packetizer can send
+// on their own, VP8 partitions or H.264 NAL units. VideoEncoder::EncodeSlices
+// hands them out one at a time so the first can be on the wire before the
+// rest have been packetized.
+//
+// libavcodec only returns a frame once all of it is encoded. libvpx can
+// output each partition as it completes, VPX_CODEC_USE_OUTPUT_PARTITION, and
+// x264 each NAL, its nalu_process callback, but the libavcodec wrappers don't
+// expose either. The pieces here come from parsing the finished frame, so
+// the saving is the packetize and send time of everything after the first
+// piece, not the encode time. If the encoders are ever driven directly the
+// callers won't need to change.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_ENCODEDSLICES_H
+#define SIPSORCERY_ENCODEDSLICES_H
+
+extern "C"
+{
+#include <libavcodec\avcodec.h>
+}
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace sipsorcery
+{
+  struct EncodedSlice
+  {
+    const uint8_t* Data;      // Points into the encoded frame. H.264 NAL units start at the NAL header, without the start code.
+    size_t Length;
+    int Index;                // The VP8 partition index or the H.264 NAL unit's position in the frame.
+    bool Last;                // The last piece of the frame.
+  };
+
+  /**
+  * Splits an encoded frame. VP8 frames split at their partitions, H.264
+  * Annex B frames at their start codes and anything else, or a frame that
+  * can't be parsed, is a single piece.
+  * @param[in] codecID: the codec the frame was encoded with.
+  * @param[in] data: the encoded frame.
+  * @param[in] length: the length of the encoded frame.
+  * @param[out] slices: the pieces in bitstream order, replaces any previous contents.
+  * @@Returns the number of pieces.
+  */
+  int SplitEncodedFrame(AVCodecID codecID, const uint8_t* data, size_t length, std::vector<EncodedSlice>& slices);
+
+  /**
+  * Finds the next H.264 Annex B start code, 00 00 01, at or after data.
+  * Uses the AVX2 search if the CPU supports it.
+  * @@Returns a pointer to the first zero of the start code or end if there isn't one.
+  */
+  const uint8_t* FindH264StartCode(const uint8_t* data, const uint8_t* end);
+
+  /**
+  * The two searches FindH264StartCode picks between, for benchmarking. The
+  * AVX2 one checks 32 positions at a time and must only be called if
+  * ColorConverter::HasAvx2 says the CPU supports it.
+  */
+  const uint8_t* FindH264StartCodeScalar(const uint8_t* data, const uint8_t* end);
+  const uint8_t* FindH264StartCodeAvx2(const uint8_t* data, const uint8_t* end);
+}
+
+#endif // SIPSORCERY_ENCODEDSLICES_H
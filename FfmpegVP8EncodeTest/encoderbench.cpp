@@ -0,0 +1,258 @@
+#include "encoderbench.h"
+#include "framepool.h"
+#include "syntheticsource.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#define BENCH_CLIP_FRAME_COUNT 30     // Frames in the synthetic clip, looped for longer runs.
+#define BENCH_PACKET_POOL_SIZE 8
+
+namespace sipsorcery
+{
+  static const AVCodecID _benchCodecs[] = { AV_CODEC_ID_VP8, AV_CODEC_ID_H264, AV_CODEC_ID_MJPEG };
+  static const int _benchResolutions[][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+  static const EncoderPreset _benchPresets[] = { EncoderPreset::Realtime, EncoderPreset::Balanced, EncoderPreset::Archival };
+  static const int _benchThreads[] = { 1, 2, 4, 8 };
+
+  /**
+  * std::clock can't be used as on Windows it returns wall clock time.
+  */
+  double GetProcessCpuSeconds()
+  {
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+      ULARGE_INTEGER kernel, user;
+      kernel.LowPart = kernelTime.dwLowDateTime;
+      kernel.HighPart = kernelTime.dwHighDateTime;
+      user.LowPart = userTime.dwLowDateTime;
+      user.HighPart = userTime.dwHighDateTime;
+      return (kernel.QuadPart + user.QuadPart) / 1e7;   // FILETIME units are 100ns.
+    }
+    return 0;
+#else
+    return (double)std::clock() / CLOCKS_PER_SEC;
+#endif
+  }
+
+  std::vector<EncoderBenchCase> GetEncoderBenchCases()
+  {
+    std::vector<EncoderBenchCase> cases;
+
+    for (auto codecID : _benchCodecs) {
+      for (auto& res : _benchResolutions) {
+        for (auto preset : _benchPresets) {
+          for (auto threads : _benchThreads) {
+            cases.push_back(EncoderBenchCase{ codecID, res[0], res[1], preset, threads });
+          }
+        }
+      }
+    }
+
+    return cases;
+  }
+
+  EncoderBenchResult RunEncoderBenchCase(const EncoderBenchCase& benchCase, int fps, int frameCount)
+  {
+    EncoderBenchResult result;
+    result.Case = benchCase;
+
+    // The clip is generated up front so filling frames doesn't count towards
+    // the CPU time. Frames are only read by the encoder so they can be resent.
+    FramePool framePool(benchCase.Width, benchCase.Height, AV_PIX_FMT_YUV420P, BENCH_CLIP_FRAME_COUNT);
+    PacketPool packetPool(BENCH_PACKET_POOL_SIZE);
+    std::vector<AVFrame*> clip;
+    for (int i = 0; i < BENCH_CLIP_FRAME_COUNT; i++) {
+      clip.push_back(framePool.Get());
+      FillTestFrame(clip.back(), i);
+    }
+
+    std::map<int64_t, std::chrono::steady_clock::time_point> sendTimes;
+    std::vector<double> latencies;
+    latencies.reserve(frameCount);
+    int64_t totalBytes = 0;
+
+    auto onPacket = [&](AVPacket* pkt) {
+      auto sent = sendTimes.find(pkt->pts);
+      if (sent != sendTimes.end()) {
+        latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent->second).count());
+        sendTimes.erase(sent);
+      }
+      totalBytes += pkt->size;
+
+      AVPacket* owned = packetPool.Get();
+      av_packet_move_ref(owned, pkt);
+      packetPool.Return(owned);
+    };
+
+    try {
+      VideoEncoder encoder(benchCase.CodecID, benchCase.Width, benchCase.Height, fps, benchCase.Preset, benchCase.Threads);
+
+      double cpuStart = GetProcessCpuSeconds();
+      auto wallStart = std::chrono::steady_clock::now();
+
+      for (int i = 0; i < frameCount; i++) {
+        AVFrame* frame = clip[i % BENCH_CLIP_FRAME_COUNT];
+        frame->pts = i;
+        sendTimes[frame->pts] = std::chrono::steady_clock::now();
+        if (encoder.Encode(frame, onPacket) < 0) {
+          result.Error = "encode failed at frame " + std::to_string(i);
+          break;
+        }
+      }
+      encoder.Flush(onPacket);
+
+      result.WallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+      result.CpuSeconds = GetProcessCpuSeconds() - cpuStart;
+    }
+    catch (std::exception& excp) {
+      result.Error = excp.what();
+    }
+
+    for (auto frame : clip) {
+      framePool.Return(frame);
+    }
+
+    result.Frames = (int)latencies.size();
+    if (result.Frames > 0) {
+      std::sort(latencies.begin(), latencies.end());
+      double sum = 0;
+      for (double l : latencies) {
+        sum += l;
+      }
+
+      result.Fps = (result.WallSeconds > 0) ? result.Frames / result.WallSeconds : 0;
+      result.AvgLatencyMs = sum / result.Frames;
+      result.P50LatencyMs = latencies[latencies.size() / 2];
+      result.P99LatencyMs = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+      result.MaxLatencyMs = latencies.back();
+      result.Kbps = (double)totalBytes * 8 * fps / result.Frames / 1000;
+    }
+
+    return result;
+  }
+
+  std::vector<EncoderBenchResult> RunEncoderBenchmark(const std::vector<EncoderBenchCase>& cases,
+    int fps, int frameCount, const std::string& csvPath, const std::string& jsonPath)
+  {
+    std::vector<EncoderBenchResult> results;
+
+    for (auto& benchCase : cases) {
+      results.push_back(RunEncoderBenchCase(benchCase, fps, frameCount));
+      PrintEncoderBenchResult(results.back());
+    }
+
+    if (!csvPath.empty() && !WriteEncoderBenchCsv(csvPath, results)) {
+      std::cerr << "Failed to write benchmark CSV to " << csvPath << "." << std::endl;
+    }
+
+    if (!jsonPath.empty() && !WriteEncoderBenchJson(jsonPath, results)) {
+      std::cerr << "Failed to write benchmark JSON to " << jsonPath << "." << std::endl;
+    }
+
+    return results;
+  }
+
+  void PrintEncoderBenchResult(const EncoderBenchResult& result)
+  {
+    std::cout << avcodec_get_name(result.Case.CodecID) << " " << result.Case.Width << "x" << result.Case.Height
+      << " " << VideoEncoder::GetPresetName(result.Case.Preset) << " threads " << result.Case.Threads;
+
+    if (!result.Error.empty()) {
+      std::cout << " error: " << result.Error << "." << std::endl;
+    }
+    else {
+      std::cout << std::fixed << std::setprecision(2)
+        << ", fps " << result.Fps
+        << ", latency ms p50 " << result.P50LatencyMs << " p99 " << result.P99LatencyMs
+        << ", kbps " << result.Kbps
+        << ", cpu s " << result.CpuSeconds << " (" << (result.WallSeconds > 0 ? result.CpuSeconds / result.WallSeconds : 0) << " cores)"
+        << "." << std::endl;
+    }
+  }
+
+  bool WriteEncoderBenchCsv(const std::string& path, const std::vector<EncoderBenchResult>& results)
+  {
+    std::ofstream csv(path, std::ios::out | std::ios::trunc);
+    if (!csv.is_open()) {
+      return false;
+    }
+
+    csv << "codec,width,height,preset,threads,frames,wall_s,cpu_s,fps,avg_ms,p50_ms,p99_ms,max_ms,kbps,error" << std::endl;
+    csv << std::fixed << std::setprecision(3);
+
+    for (auto& r : results) {
+      csv << avcodec_get_name(r.Case.CodecID) << "," << r.Case.Width << "," << r.Case.Height << ","
+        << VideoEncoder::GetPresetName(r.Case.Preset) << "," << r.Case.Threads << ","
+        << r.Frames << "," << r.WallSeconds << "," << r.CpuSeconds << "," << r.Fps << ","
+        << r.AvgLatencyMs << "," << r.P50LatencyMs << "," << r.P99LatencyMs << "," << r.MaxLatencyMs << ","
+        << r.Kbps << ",\"" << r.Error << "\"" << std::endl;
+    }
+
+    return csv.good();
+  }
+
+  bool WriteEncoderBenchJson(const std::string& path, const std::vector<EncoderBenchResult>& results)
+  {
+    std::ofstream json(path, std::ios::out | std::ios::trunc);
+    if (!json.is_open()) {
+      return false;
+    }
+
+    json << "[" << std::endl << std::fixed << std::setprecision(3);
+
+    for (size_t i = 0; i < results.size(); i++) {
+      auto& r = results[i];
+
+      // The error text comes from FFmpeg and exception messages, neither of
+      // which contain quotes or control characters in practice. Escape the
+      // two that would break the document anyway.
+      std::string error;
+      for (char c : r.Error) {
+        if (c == '"' || c == '\\') {
+          error.push_back('\\');
+        }
+        error.push_back(c);
+      }
+
+      json << "  { \"codec\": \"" << avcodec_get_name(r.Case.CodecID) << "\""
+        << ", \"width\": " << r.Case.Width << ", \"height\": " << r.Case.Height
+        << ", \"preset\": \"" << VideoEncoder::GetPresetName(r.Case.Preset) << "\""
+        << ", \"threads\": " << r.Case.Threads
+        << ", \"frames\": " << r.Frames
+        << ", \"wall_s\": " << r.WallSeconds << ", \"cpu_s\": " << r.CpuSeconds
+        << ", \"fps\": " << r.Fps
+        << ", \"avg_ms\": " << r.AvgLatencyMs << ", \"p50_ms\": " << r.P50LatencyMs
+        << ", \"p99_ms\": " << r.P99LatencyMs << ", \"max_ms\": " << r.MaxLatencyMs
+        << ", \"kbps\": " << r.Kbps
+        << ", \"error\": \"" << error << "\" }"
+        << ((i + 1 < results.size()) ? "," : "") << std::endl;
+    }
+
+    json << "]" << std::endl;
+
+    return json.good();
+  }
+
+  /**
+  * The default synthetic source, a drifting gradient with noise, moving boxes
+  * and text. The noise keeps the encoders from collapsing the picture into a
+  * handful of bits, which would make every setting look equally fast.
+  */
+  void FillTestFrame(AVFrame* frame, int frame_index)
+  {
+    SyntheticVideoSource source(frame->width, frame->height, (AVPixelFormat)frame->format);
+    source.Fill(frame, frame_index);
+  }
+}
@@ -0,0 +1,90 @@
+//-----------------------------------------------------------------------------
+// Filename: encoderbench.h
+//
+// Description: Encoder benchmark that sweeps codec, resolution, preset and
+// thread count over a fixed synthetic clip. Each case reports throughput,
+// per-frame latency percentiles, output bit rate and the CPU time consumed
+// so encoder settings can be chosen per server type. Results can be written
+// as CSV and JSON for comparing machines.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_ENCODERBENCH_H
+#define SIPSORCERY_ENCODERBENCH_H
+
+#include "videoencoder.h"
+
+#include <string>
+#include <vector>
+
+namespace sipsorcery
+{
+  struct EncoderBenchCase
+  {
+    AVCodecID CodecID;
+    int Width;
+    int Height;
+    EncoderPreset Preset;
+    int Threads;
+  };
+
+  struct EncoderBenchResult
+  {
+    EncoderBenchCase Case;
+    int Frames{ 0 };
+    double WallSeconds{ 0 };
+    double CpuSeconds{ 0 };            // Process CPU time, includes all encoder threads.
+    double Fps{ 0 };
+    double AvgLatencyMs{ 0 };
+    double P50LatencyMs{ 0 };
+    double P99LatencyMs{ 0 };
+    double MaxLatencyMs{ 0 };
+    double Kbps{ 0 };                  // Output bit rate at the nominal frame rate.
+    std::string Error;
+  };
+
+  /**
+  * Gets the full codec x resolution x preset x thread count sweep.
+  */
+  std::vector<EncoderBenchCase> GetEncoderBenchCases();
+
+  /**
+  * Encodes frameCount frames from the synthetic clip for a single case.
+  * Failures, such as a codec missing from the FFmpeg build, are recorded in
+  * the result's Error field rather than thrown.
+  */
+  EncoderBenchResult RunEncoderBenchCase(const EncoderBenchCase& benchCase, int fps, int frameCount);
+
+  /**
+  * Runs every case, prints a line per case and optionally writes the
+  * results to CSV and JSON files. Empty paths skip the file.
+  */
+  std::vector<EncoderBenchResult> RunEncoderBenchmark(const std::vector<EncoderBenchCase>& cases,
+    int fps, int frameCount, const std::string& csvPath, const std::string& jsonPath);
+
+  void PrintEncoderBenchResult(const EncoderBenchResult& result);
+  bool WriteEncoderBenchCsv(const std::string& path, const std::vector<EncoderBenchResult>& results);
+  bool WriteEncoderBenchJson(const std::string& path, const std::vector<EncoderBenchResult>& results);
+
+  /**
+  * Fills a YUV420P, NV12 or BGRA frame with the benchmark clip's content for
+  * frame_index, see SyntheticVideoSource. The content is deterministic so
+  * repeated runs encode identical input.
+  */
+  void FillTestFrame(AVFrame* frame, int frame_index);
+
+  /**
+  * Gets the CPU time used by all threads in the process so far.
+  */
+  double GetProcessCpuSeconds();
+}
+
+#endif // SIPSORCERY_ENCODERBENCH_H
@@ -0,0 +1,256 @@
+#include "encoderpool.h"
+#include "encoderbench.h"
+#include "framepool.h"
+#include "latencyhistogram.h"
+
+#include <iostream>
+
+#define ENCODER_POOL_TEST_REFILL_TIMEOUT_MS 2000
+
+namespace sipsorcery
+{
+  EncoderPool::EncoderPool(int fps, int threads) :
+    _fps(fps), _threads(threads)
+  { }
+
+  EncoderPool::~EncoderPool()
+  {
+    Stop();
+  }
+
+  void EncoderPool::AddConfiguration(const EncoderPoolKey& key, int idleTarget)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      Configuration& config = _configurations[key];
+      config.IdleTarget = idleTarget;
+    }
+    _fillCondition.notify_one();
+  }
+
+  void EncoderPool::Start()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_fillThread == nullptr) {
+      _stop = false;
+      _fillThread.reset(new std::thread(&EncoderPool::Fill, this));
+    }
+  }
+
+  void EncoderPool::Stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _fillCondition.notify_one();
+
+    if (_fillThread != nullptr && _fillThread->joinable()) {
+      _fillThread->join();
+    }
+    _fillThread.reset();
+  }
+
+  std::unique_ptr<VideoEncoder> EncoderPool::Open(const EncoderPoolKey& key)
+  {
+    return std::unique_ptr<VideoEncoder>(new VideoEncoder(key.CodecID, key.Width, key.Height, _fps, key.Preset, _threads));
+  }
+
+  std::unique_ptr<VideoEncoder> EncoderPool::Checkout(const EncoderPoolKey& key)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      auto config = _configurations.find(key);
+      if (config != _configurations.end() && !config->second.Idle.empty()) {
+        std::unique_ptr<VideoEncoder> encoder = std::move(config->second.Idle.back());
+        config->second.Idle.pop_back();
+        _stats.Hits++;
+        _fillCondition.notify_one();
+        return encoder;
+      }
+
+      _stats.Misses++;
+    }
+
+    return Open(key);
+  }
+
+  void EncoderPool::Return(std::unique_ptr<VideoEncoder> encoder)
+  {
+    if (encoder == nullptr) {
+      return;
+    }
+
+    bool reset = encoder->Reset();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (reset) {
+      EncoderPoolKey key{ encoder->GetCodecID(), encoder->GetWidth(), encoder->GetHeight(), encoder->GetPreset() };
+      auto config = _configurations.find(key);
+
+      // A reset encoder is ready now, it takes the place of any still being opened.
+      if (config != _configurations.end() && (int)config->second.Idle.size() < config->second.IdleTarget) {
+        config->second.Idle.push_back(std::move(encoder));
+        _stats.Reused++;
+        return;
+      }
+    }
+
+    // The encoder isn't wanted, it's closed as it goes out of scope.
+    _stats.Discarded++;
+  }
+
+  int EncoderPool::GetIdleCount(const EncoderPoolKey& key)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto config = _configurations.find(key);
+    return (config != _configurations.end()) ? (int)config->second.Idle.size() : 0;
+  }
+
+  EncoderPoolStats EncoderPool::GetStats()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+  }
+
+  /**
+  * Opens encoders one at a time for whichever configuration is short. The
+  * open is done outside the lock so checkouts aren't held up by it.
+  */
+  void EncoderPool::Fill()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (!_stop) {
+      auto shortConfig = _configurations.end();
+      for (auto it = _configurations.begin(); it != _configurations.end(); ++it) {
+        if ((int)it->second.Idle.size() + it->second.Opening < it->second.IdleTarget) {
+          shortConfig = it;
+          break;
+        }
+      }
+
+      if (shortConfig == _configurations.end()) {
+        _fillCondition.wait(lock);
+        continue;
+      }
+
+      EncoderPoolKey key = shortConfig->first;
+      shortConfig->second.Opening++;
+      lock.unlock();
+
+      std::unique_ptr<VideoEncoder> encoder;
+      try {
+        encoder = Open(key);
+      }
+      catch (std::exception& excp) {
+        std::cerr << "Encoder pool failed to open " << key.Width << "x" << key.Height << " encoder. " << excp.what() << std::endl;
+      }
+
+      lock.lock();
+      Configuration& config = _configurations[key];
+      config.Opening--;
+
+      if (encoder != nullptr) {
+        config.Idle.push_back(std::move(encoder));
+        _stats.Opened++;
+      }
+      else {
+        // Retrying won't help, stop filling this configuration.
+        config.IdleTarget = 0;
+      }
+    }
+  }
+
+  /**
+  * Encodes frame as the first frame of a stream and returns once the first
+  * packet comes out.
+  */
+  static bool EncodeFirstPacket(VideoEncoder& encoder, AVFrame* frame)
+  {
+    bool gotPacket = false;
+    auto onPacket = [&](AVPacket*) { gotPacket = true; };
+
+    frame->pts = 0;
+    encoder.Encode(frame, onPacket);
+
+    // The realtime preset has no lookahead but allow for an encoder that does.
+    for (int64_t pts = 1; !gotPacket && pts < 64; pts++) {
+      frame->pts = pts;
+      encoder.Encode(frame, onPacket);
+    }
+
+    return gotPacket;
+  }
+
+  void RunEncoderPoolTest(int fps, int streamStarts)
+  {
+    const EncoderPoolKey configs[] = {
+      { AV_CODEC_ID_VP8, 640, 480, EncoderPreset::Realtime },
+      { AV_CODEC_ID_VP8, 1280, 720, EncoderPreset::Realtime }
+    };
+
+    EncoderPool pool(fps);
+    for (auto& key : configs) {
+      pool.AddConfiguration(key);
+    }
+    pool.Start();
+
+    std::cout << "Encoder pool test, " << streamStarts << " stream starts per configuration, VP8 realtime at " << fps << " fps." << std::endl;
+
+    for (auto& key : configs) {
+      FramePool framePool(key.Width, key.Height, AV_PIX_FMT_YUV420P, 1);
+      AVFrame* frame = framePool.Get();
+      FillTestFrame(frame, 0);
+
+      LatencyHistogram coldOpen, coldFirstPacket, pooledCheckout, pooledFirstPacket;
+
+      for (int i = 0; i < streamStarts; i++) {
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<VideoEncoder> encoder(new VideoEncoder(key.CodecID, key.Width, key.Height, fps, key.Preset, 1));
+        auto opened = std::chrono::steady_clock::now();
+        EncodeFirstPacket(*encoder, frame);
+        auto firstPacket = std::chrono::steady_clock::now();
+
+        coldOpen.Record(opened - start);
+        coldFirstPacket.Record(firstPacket - start);
+      }
+
+      for (int i = 0; i < streamStarts; i++) {
+        // Streams start further apart than the pool takes to refill.
+        auto refillDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ENCODER_POOL_TEST_REFILL_TIMEOUT_MS);
+        while (pool.GetIdleCount(key) < ENCODER_POOL_DEFAULT_IDLE && std::chrono::steady_clock::now() < refillDeadline) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<VideoEncoder> encoder = pool.Checkout(key);
+        auto checkedOut = std::chrono::steady_clock::now();
+        EncodeFirstPacket(*encoder, frame);
+        auto firstPacket = std::chrono::steady_clock::now();
+
+        pooledCheckout.Record(checkedOut - start);
+        pooledFirstPacket.Record(firstPacket - start);
+
+        pool.Return(std::move(encoder));
+      }
+
+      framePool.Return(frame);
+
+      std::cout << key.Width << "x" << key.Height << ":" << std::endl;
+      LatencyHistogram::PrintHeader(std::cout);
+      coldOpen.Print(std::cout, "open");
+      coldFirstPacket.Print(std::cout, "open to packet");
+      pooledCheckout.Print(std::cout, "checkout");
+      pooledFirstPacket.Print(std::cout, "pool to packet");
+    }
+
+    pool.Stop();
+
+    EncoderPoolStats stats = pool.GetStats();
+    std::cout << "Pool hits " << stats.Hits << ", misses " << stats.Misses << ", opened in background " << stats.Opened
+      << ", reset and reused " << stats.Reused << ", discarded " << stats.Discarded << "." << std::endl;
+  }
+}
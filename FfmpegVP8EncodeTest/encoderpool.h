@@ -0,0 +1,141 @@
+//-----------------------------------------------------------------------------
+// Filename: encoderpool.h
+//
+// Description: Pool of encoders opened ahead of time so a stream that starts,
+// typically because a viewer has joined, gets an encoder straight away rather
+// than waiting on avcodec_find_encoder, avcodec_alloc_context3 and
+// avcodec_open2. For VP8 the open is where libvpx allocates its frame buffers
+// and lookup tables and costs tens of milliseconds, more at higher resolutions.
+//
+// Encoders are grouped by (codec, resolution, preset). Each configuration has
+// a target number of idle encoders that a background thread keeps topped up,
+// it starts filling as soon as the pool starts and refills after every
+// checkout. A stream that ends returns its encoder, which is reset rather
+// than closed and goes back in the pool if there's room.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_ENCODERPOOL_H
+#define SIPSORCERY_ENCODERPOOL_H
+
+#include "videoencoder.h"
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define ENCODER_POOL_DEFAULT_IDLE 2
+
+namespace sipsorcery
+{
+  struct EncoderPoolKey
+  {
+    AVCodecID CodecID;
+    int Width;
+    int Height;
+    EncoderPreset Preset;
+
+    bool operator<(const EncoderPoolKey& other) const
+    {
+      if (CodecID != other.CodecID) return CodecID < other.CodecID;
+      if (Width != other.Width) return Width < other.Width;
+      if (Height != other.Height) return Height < other.Height;
+      return Preset < other.Preset;
+    }
+  };
+
+  struct EncoderPoolStats
+  {
+    uint64_t Hits;          // Checkouts given an idle encoder.
+    uint64_t Misses;        // Checkouts that had to open an encoder themselves.
+    uint64_t Opened;        // Encoders opened by the background fill.
+    uint64_t Reused;        // Returned encoders reset and put back in the pool.
+    uint64_t Discarded;     // Returned encoders that couldn't be reset or weren't needed.
+  };
+
+  class EncoderPool
+  {
+  public:
+    /**
+    * @param[in] fps: the frame rate every encoder in the pool is opened for.
+    * @param[in] threads: the number of threads for each encoder.
+    */
+    EncoderPool(int fps, int threads = 1);
+    ~EncoderPool();
+
+    EncoderPool(const EncoderPool&) = delete;
+    EncoderPool& operator=(const EncoderPool&) = delete;
+
+    /**
+    * Adds a configuration to keep encoders open for. Can be called before or
+    * after Start.
+    * @param[in] idleTarget: the number of open encoders to keep on hand.
+    */
+    void AddConfiguration(const EncoderPoolKey& key, int idleTarget = ENCODER_POOL_DEFAULT_IDLE);
+
+    /**
+    * Starts the background thread that fills the pool.
+    */
+    void Start();
+    void Stop();
+
+    /**
+    * Takes an encoder for a new stream. If none is idle, or the configuration
+    * wasn't added, one is opened on the calling thread.
+    * Throws std::runtime_error if an encoder has to be opened and can't be.
+    */
+    std::unique_ptr<VideoEncoder> Checkout(const EncoderPoolKey& key);
+
+    /**
+    * Gives back an encoder once its stream has ended. The encoder is reset on
+    * the calling thread, which is cheap, and kept if the pool needs it.
+    */
+    void Return(std::unique_ptr<VideoEncoder> encoder);
+
+    int GetIdleCount(const EncoderPoolKey& key);
+    EncoderPoolStats GetStats();
+
+  private:
+    struct Configuration
+    {
+      int IdleTarget{ 0 };
+      int Opening{ 0 };
+      std::vector<std::unique_ptr<VideoEncoder>> Idle;
+    };
+
+    int _fps;
+    int _threads;
+
+    std::mutex _mutex;
+    std::condition_variable _fillCondition;
+    std::map<EncoderPoolKey, Configuration> _configurations;
+    std::unique_ptr<std::thread> _fillThread;
+    bool _stop{ false };
+
+    EncoderPoolStats _stats{ 0, 0, 0, 0, 0 };
+
+    std::unique_ptr<VideoEncoder> Open(const EncoderPoolKey& key);
+    void Fill();
+  };
+
+  /**
+  * Compares the time from a stream starting to its first encoded packet with
+  * a newly opened encoder against one checked out of the pool, for realtime
+  * VP8 at 640x480 and 1280x720.
+  * @param[in] streamStarts: the number of stream starts to time each way.
+  */
+  void RunEncoderPoolTest(int fps, int streamStarts);
+}
+
+#endif // SIPSORCERY_ENCODERPOOL_H
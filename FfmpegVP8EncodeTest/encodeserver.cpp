@@ -0,0 +1,318 @@
+#include "encodeserver.h"
+#include "encoderbench.h"
+#include "framepool.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#define ENCODE_SERVER_TEST_WIDTH 640
+#define ENCODE_SERVER_TEST_HEIGHT 480
+#define ENCODE_SERVER_TEST_CLIP_FRAMES 30
+
+namespace sipsorcery
+{
+  EncodeStream::EncodeStream(int streamID, WorkStealingPool& pool, AVCodecID codecID, int width, int height,
+    int fps, EncoderPreset preset, std::chrono::milliseconds maxDelay, EncodedPacketCallback onPacket,
+    bool skipStaticFrames) :
+    _streamID(streamID), _pool(pool),
+    _encoder(codecID, width, height, fps, preset, 1),
+    _maxDelay(maxDelay), _onPacket(onPacket)
+  {
+    _encoder.SetStaticFrameSkipping(skipStaticFrames);
+
+    for (int i = 0; i < ENCODE_STREAM_MAX_PENDING_FRAMES; i++) {
+      _spareFrames.push_back(av_frame_alloc());
+    }
+  }
+
+  EncodeStream::~EncodeStream()
+  {
+    Close();
+
+    for (auto frame : _spareFrames) {
+      av_frame_free(&frame);
+    }
+  }
+
+  void EncodeStream::SubmitFrame(const AVFrame* frame)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_closed) {
+      return;
+    }
+
+    _submitted++;
+
+    // The encoder hasn't got to the oldest frame yet, it's already late so
+    // drop it in favour of the new one.
+    while (_pending.size() >= ENCODE_STREAM_MAX_PENDING_FRAMES) {
+      ReleaseFrame(_pending.front().Frame);
+      _pending.pop_front();
+      _droppedOverrun++;
+    }
+
+    AVFrame* ref = nullptr;
+    if (!_spareFrames.empty()) {
+      ref = _spareFrames.back();
+      _spareFrames.pop_back();
+    }
+    else {
+      ref = av_frame_alloc();
+    }
+
+    if (av_frame_ref(ref, frame) < 0) {
+      std::cerr << "Encode stream " << _streamID << " failed to reference frame." << std::endl;
+      _spareFrames.push_back(ref);
+      return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    _pending.push_back(PendingFrame{ ref, now, now + _maxDelay });
+
+    if (!_scheduled) {
+      _scheduled = true;
+      auto self = shared_from_this();
+      _pool.Submit([self] { self->EncodeNext(); });
+    }
+  }
+
+  void EncodeStream::Close()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _closed = true;
+    while (!_pending.empty()) {
+      ReleaseFrame(_pending.front().Frame);
+      _pending.pop_front();
+    }
+  }
+
+  EncodeStreamStats EncodeStream::GetStats()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return EncodeStreamStats{ _submitted, _encoded, _droppedLate, _droppedOverrun,
+      (_encoded > 0) ? _totalLatencyMs / _encoded : 0, _maxLatencyMs };
+  }
+
+  /**
+  * Encodes one pending frame then, if there are more, requeues itself behind
+  * the other streams' work. Only one EncodeNext per stream is ever queued or
+  * running so the encoder needs no locking of its own.
+  */
+  void EncodeStream::EncodeNext()
+  {
+    PendingFrame next;
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_closed || _pending.empty()) {
+        _scheduled = false;
+        return;
+      }
+      next = _pending.front();
+      _pending.pop_front();
+    }
+
+    bool late = std::chrono::steady_clock::now() > next.Deadline;
+
+    if (!late) {
+      _encoder.Encode(next.Frame, next.Submitted, [this](AVPacket* pkt) {
+        if (_onPacket != nullptr) {
+          _onPacket(_streamID, pkt);
+        }
+      });
+    }
+
+    double latencyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - next.Submitted).count();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (late) {
+      _droppedLate++;
+    }
+    else {
+      _encoded++;
+      _totalLatencyMs += latencyMs;
+      _maxLatencyMs = std::max(_maxLatencyMs, latencyMs);
+    }
+    ReleaseFrame(next.Frame);
+
+    if (!_closed && !_pending.empty()) {
+      auto self = shared_from_this();
+      _pool.SubmitFair([self] { self->EncodeNext(); });
+    }
+    else {
+      _scheduled = false;
+    }
+  }
+
+  /**
+  * Must be called with the stream lock held.
+  */
+  void EncodeStream::ReleaseFrame(AVFrame* frame)
+  {
+    av_frame_unref(frame);
+    _spareFrames.push_back(frame);
+  }
+
+  EncodeServer::EncodeServer(int threadCount) :
+    _pool(threadCount)
+  { }
+
+  EncodeServer::~EncodeServer()
+  {
+    std::lock_guard<std::mutex> lock(_streamsMutex);
+    for (auto& stream : _streams) {
+      stream.second->Close();
+    }
+    // Queued tasks hold their own reference to the stream so it stays alive
+    // until the pool, destroyed after this, has finished with it.
+    _streams.clear();
+  }
+
+  int EncodeServer::AddStream(AVCodecID codecID, int width, int height, int fps, EncoderPreset preset,
+    std::chrono::milliseconds maxDelay, EncodedPacketCallback onPacket, bool skipStaticFrames)
+  {
+    std::lock_guard<std::mutex> lock(_streamsMutex);
+
+    int streamID = _nextStreamID++;
+    _streams[streamID] = std::make_shared<EncodeStream>(streamID, _pool, codecID, width, height, fps, preset, maxDelay, onPacket, skipStaticFrames);
+    return streamID;
+  }
+
+  void EncodeServer::RemoveStream(int streamID)
+  {
+    std::lock_guard<std::mutex> lock(_streamsMutex);
+
+    auto it = _streams.find(streamID);
+    if (it != _streams.end()) {
+      it->second->Close();
+      _streams.erase(it);
+    }
+  }
+
+  void EncodeServer::SubmitFrame(int streamID, const AVFrame* frame)
+  {
+    std::shared_ptr<EncodeStream> stream;
+
+    {
+      std::lock_guard<std::mutex> lock(_streamsMutex);
+      auto it = _streams.find(streamID);
+      if (it == _streams.end()) {
+        return;
+      }
+      stream = it->second;
+    }
+
+    stream->SubmitFrame(frame);
+  }
+
+  std::map<int, EncodeStreamStats> EncodeServer::GetStats()
+  {
+    std::map<int, EncodeStreamStats> stats;
+
+    std::lock_guard<std::mutex> lock(_streamsMutex);
+    for (auto& stream : _streams) {
+      stats[stream.first] = stream.second->GetStats();
+    }
+
+    return stats;
+  }
+
+  bool EncodeServer::PrintTelemetry(int streamID, std::ostream& os)
+  {
+    std::shared_ptr<EncodeStream> stream;
+
+    {
+      std::lock_guard<std::mutex> lock(_streamsMutex);
+      auto it = _streams.find(streamID);
+      if (it == _streams.end()) {
+        return false;
+      }
+      stream = it->second;
+    }
+
+    stream->GetTelemetry().Print(os);
+    return true;
+  }
+
+  void RunEncodeServerTest(int streamCount, int fps, int durationSeconds)
+  {
+    // Declared before the server so it outlives any encode still running when the server shuts down.
+    std::vector<std::unique_ptr<std::atomic<uint64_t>>> streamBytes;
+    EncodeServer server;
+
+    std::cout << "Encode server test " << streamCount << " streams at " << fps << " fps on "
+      << server.GetPool().GetThreadCount() << " threads." << std::endl;
+
+    auto frameInterval = std::chrono::milliseconds(1000 / fps);
+
+    for (int i = 0; i < streamCount; i++) {
+      streamBytes.push_back(std::unique_ptr<std::atomic<uint64_t>>(new std::atomic<uint64_t>(0)));
+    }
+
+    for (int i = 0; i < streamCount; i++) {
+      server.AddStream(AV_CODEC_ID_VP8, ENCODE_SERVER_TEST_WIDTH, ENCODE_SERVER_TEST_HEIGHT, fps, EncoderPreset::Realtime,
+        frameInterval, [&streamBytes](int streamID, AVPacket* pkt) { *streamBytes[streamID] += pkt->size; });
+    }
+
+    // All streams share one clip, they only read the frames.
+    FramePool framePool(ENCODE_SERVER_TEST_WIDTH, ENCODE_SERVER_TEST_HEIGHT, AV_PIX_FMT_YUV420P, ENCODE_SERVER_TEST_CLIP_FRAMES);
+    std::vector<AVFrame*> clip;
+    for (int i = 0; i < ENCODE_SERVER_TEST_CLIP_FRAMES; i++) {
+      clip.push_back(framePool.Get());
+      FillTestFrame(clip.back(), i);
+    }
+
+    auto nextTick = std::chrono::steady_clock::now();
+    int totalFrames = durationSeconds * fps;
+
+    for (int i = 0; i < totalFrames; i++) {
+      AVFrame* frame = clip[i % ENCODE_SERVER_TEST_CLIP_FRAMES];
+      frame->pts = i;
+
+      for (int streamID = 0; streamID < streamCount; streamID++) {
+        server.SubmitFrame(streamID, frame);
+      }
+
+      nextTick += frameInterval;
+      std::this_thread::sleep_until(nextTick);
+    }
+
+    // Give the last frames a chance to finish.
+    std::this_thread::sleep_for(frameInterval * ENCODE_STREAM_MAX_PENDING_FRAMES);
+
+    uint64_t totalEncoded = 0, totalDropped = 0;
+    auto stats = server.GetStats();
+
+    for (auto& s : stats) {
+      totalEncoded += s.second.FramesEncoded;
+      totalDropped += s.second.FramesDroppedLate + s.second.FramesDroppedOverrun;
+
+      std::cout << "stream " << s.first << " submitted " << s.second.FramesSubmitted << ", encoded " << s.second.FramesEncoded
+        << ", dropped late " << s.second.FramesDroppedLate << ", dropped overrun " << s.second.FramesDroppedOverrun
+        << std::fixed << std::setprecision(2)
+        << ", latency ms avg " << s.second.AvgLatencyMs << " max " << s.second.MaxLatencyMs
+        << ", kbps " << (double)*streamBytes[s.first] * 8 / durationSeconds / 1000 << "." << std::endl;
+    }
+
+    std::cout << "Total encoded " << totalEncoded << ", dropped " << totalDropped
+      << ", pool tasks " << server.GetPool().GetExecutedCount() << ", steals " << server.GetPool().GetStealCount() << "." << std::endl;
+
+    if (!stats.empty()) {
+      std::cout << "Stream " << stats.begin()->first << " encode telemetry:" << std::endl;
+      server.PrintTelemetry(stats.begin()->first, std::cout);
+    }
+
+    for (auto stream : stats) {
+      server.RemoveStream(stream.first);
+    }
+
+    for (auto frame : clip) {
+      framePool.Return(frame);
+    }
+  }
+}
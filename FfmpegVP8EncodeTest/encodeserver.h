@@ -0,0 +1,164 @@
+//-----------------------------------------------------------------------------
+// Filename: encodeserver.h
+//
+// Description: In process multi-stream encode service. Every stream has its
+// own single threaded encoder and all streams share one work stealing pool
+// sized to the machine, instead of each encode being a process with its own
+// threads that oversubscribe the cores.
+//
+// A stream only ever has one encode task queued or running at a time, so its
+// encoder is used serially, and after each frame the task goes to the back of
+// the queue so streams take turns. Frames carry a deadline; a frame that has
+// not started encoding by its deadline, or that is overtaken by newer frames
+// while waiting, is dropped rather than left to build up latency.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_ENCODESERVER_H
+#define SIPSORCERY_ENCODESERVER_H
+
+#include "videoencoder.h"
+#include "workstealingpool.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+
+#define ENCODE_STREAM_MAX_PENDING_FRAMES 2
+
+namespace sipsorcery
+{
+  typedef std::function<void(int streamID, AVPacket* pkt)> EncodedPacketCallback;
+
+  struct EncodeStreamStats
+  {
+    uint64_t FramesSubmitted;
+    uint64_t FramesEncoded;
+    uint64_t FramesDroppedLate;       // Deadline passed before the encode started.
+    uint64_t FramesDroppedOverrun;    // Replaced by a newer frame while waiting.
+    double AvgLatencyMs;              // Submit to encode complete.
+    double MaxLatencyMs;
+  };
+
+  class EncodeStream : public std::enable_shared_from_this<EncodeStream>
+  {
+  public:
+    EncodeStream(int streamID, WorkStealingPool& pool, AVCodecID codecID, int width, int height,
+      int fps, EncoderPreset preset, std::chrono::milliseconds maxDelay, EncodedPacketCallback onPacket,
+      bool skipStaticFrames = false);
+    ~EncodeStream();
+
+    EncodeStream(const EncodeStream&) = delete;
+    EncodeStream& operator=(const EncodeStream&) = delete;
+
+    /**
+    * Queues a frame for encoding. The stream takes its own reference to the
+    * frame so the caller can reuse or release it straight away.
+    */
+    void SubmitFrame(const AVFrame* frame);
+
+    /**
+    * Stops encoding, any pending frames are released.
+    */
+    void Close();
+
+    int GetID() const { return _streamID; }
+    EncodeStreamStats GetStats();
+
+    /**
+    * The encoder's per frame statistics, safe to read while it's encoding.
+    */
+    const EncodeTelemetry& GetTelemetry() { return _encoder.GetTelemetry(); }
+
+  private:
+    struct PendingFrame
+    {
+      AVFrame* Frame;
+      std::chrono::steady_clock::time_point Submitted;
+      std::chrono::steady_clock::time_point Deadline;
+    };
+
+    int _streamID;
+    WorkStealingPool& _pool;
+    VideoEncoder _encoder;
+    std::chrono::milliseconds _maxDelay;
+    EncodedPacketCallback _onPacket;
+
+    std::mutex _mutex;
+    std::deque<PendingFrame> _pending;
+    std::vector<AVFrame*> _spareFrames;     // Recycled AVFrame structs for the pending queue.
+    bool _scheduled{ false };
+    bool _closed{ false };
+
+    uint64_t _submitted{ 0 };
+    uint64_t _encoded{ 0 };
+    uint64_t _droppedLate{ 0 };
+    uint64_t _droppedOverrun{ 0 };
+    double _totalLatencyMs{ 0 };
+    double _maxLatencyMs{ 0 };
+
+    void EncodeNext();
+    void ReleaseFrame(AVFrame* frame);
+  };
+
+  class EncodeServer
+  {
+  public:
+    /**
+    * @param[in] threadCount: the number of worker threads shared by all
+    *  streams, 0 for one per core.
+    */
+    explicit EncodeServer(int threadCount = 0);
+    ~EncodeServer();
+
+    /**
+    * Adds a stream. The encoder is single threaded, parallelism comes from
+    * running many streams on the shared pool.
+    * @param[in] maxDelay: how long a frame can wait to start encoding
+    *  before it is dropped. Typically one frame interval.
+    * @param[in] skipStaticFrames: true to skip encoding frames that are the
+    *  same as the last one encoded, see staticscene.h.
+    * @@Returns the ID of the new stream.
+    */
+    int AddStream(AVCodecID codecID, int width, int height, int fps, EncoderPreset preset,
+      std::chrono::milliseconds maxDelay, EncodedPacketCallback onPacket, bool skipStaticFrames = false);
+
+    void RemoveStream(int streamID);
+    void SubmitFrame(int streamID, const AVFrame* frame);
+    std::map<int, EncodeStreamStats> GetStats();
+
+    /**
+    * Writes a stream's encode telemetry.
+    * @@Returns false if there is no such stream.
+    */
+    bool PrintTelemetry(int streamID, std::ostream& os);
+
+    WorkStealingPool& GetPool() { return _pool; }
+
+  private:
+    WorkStealingPool _pool;
+    std::mutex _streamsMutex;
+    std::map<int, std::shared_ptr<EncodeStream>> _streams;
+    int _nextStreamID{ 0 };
+  };
+
+  /**
+  * Runs streamCount 640x480 realtime VP8 streams at fps on one server for
+  * durationSeconds and prints the per stream encode and drop counts.
+  */
+  void RunEncodeServerTest(int streamCount, int fps, int durationSeconds);
+}
+
+#endif // SIPSORCERY_ENCODESERVER_H
@@ -0,0 +1,218 @@
+#include "encodetelemetry.h"
+
+extern "C"
+{
+#include <libavutil\intreadwrite.h>
+}
+
+#include <algorithm>
+#include <iomanip>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define QUALITY_STATS_MIN_LENGTH 5        // 32 bit quality then the picture type.
+
+namespace sipsorcery
+{
+  static const char* _metricNames[(int)EncodeMetric::Count] =
+  {
+    "encode wall", "encode cpu", "queue delay", "frame size", "keyframe size", "key interval"
+  };
+
+  EncodeTelemetry::EncodeTelemetry()
+  {
+    Reset();
+  }
+
+  void EncodeTelemetry::RecordFrame(int64_t wallMicros, int64_t cpuMicros, int64_t queueDelayMicros)
+  {
+    _framesSent.fetch_add(1, std::memory_order_relaxed);
+    _histograms[(int)EncodeMetric::WallTime].Record(wallMicros);
+    _histograms[(int)EncodeMetric::CpuTime].Record(cpuMicros);
+    if (queueDelayMicros >= 0) {
+      _histograms[(int)EncodeMetric::QueueDelay].Record(queueDelayMicros);
+    }
+  }
+
+  void EncodeTelemetry::RecordPacket(const AVPacket* pkt, int64_t wallMicros, int64_t cpuMicros, int64_t queueDelayMicros)
+  {
+    EncodeFrameStats stats;
+    stats.Pts = pkt->pts;
+    stats.Size = pkt->size;
+    stats.KeyFrame = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+    stats.WallMicros = wallMicros;
+    stats.CpuMicros = cpuMicros;
+    stats.QueueDelayMicros = queueDelayMicros;
+
+    if (!GetPacketQuality(pkt, stats.Qp, stats.PictureType)) {
+      stats.Qp = -1;
+      stats.PictureType = stats.KeyFrame ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_P;
+    }
+
+    uint64_t packetIndex = _packets.fetch_add(1, std::memory_order_relaxed);
+    _bytes.fetch_add((uint64_t)pkt->size, std::memory_order_relaxed);
+    _histograms[(int)EncodeMetric::FrameSize].Record(pkt->size);
+
+    if (stats.KeyFrame) {
+      if (_keyframes.fetch_add(1, std::memory_order_relaxed) > 0) {
+        _histograms[(int)EncodeMetric::KeyframeInterval].Record((int64_t)(packetIndex - _lastKeyframePacket));
+      }
+      _lastKeyframePacket = packetIndex;
+      _keyframeBytes.fetch_add((uint64_t)pkt->size, std::memory_order_relaxed);
+      _histograms[(int)EncodeMetric::KeyframeSize].Record(pkt->size);
+    }
+
+    if (stats.Qp >= 0) {
+      _packetsWithQp.fetch_add(1, std::memory_order_relaxed);
+      _qpCounts[std::min(stats.Qp, ENCODE_TELEMETRY_MAX_QP)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (_onFrameStats != nullptr) {
+      _onFrameStats(stats);
+    }
+  }
+
+  EncodeTelemetrySnapshot EncodeTelemetry::GetSnapshot() const
+  {
+    EncodeTelemetrySnapshot snapshot;
+    snapshot.FramesSent = _framesSent.load(std::memory_order_relaxed);
+    snapshot.FramesSkipped = _framesSkipped.load(std::memory_order_relaxed);
+    snapshot.Packets = _packets.load(std::memory_order_relaxed);
+    snapshot.Keyframes = _keyframes.load(std::memory_order_relaxed);
+    snapshot.Bytes = _bytes.load(std::memory_order_relaxed);
+    snapshot.KeyframeBytes = _keyframeBytes.load(std::memory_order_relaxed);
+    snapshot.PacketsWithQp = _packetsWithQp.load(std::memory_order_relaxed);
+
+    for (int i = 0; i < (int)EncodeMetric::Count; i++) {
+      snapshot.Metrics[i] = _histograms[i].GetSummary();
+    }
+    snapshot.Qp = GetQpSummary();
+
+    return snapshot;
+  }
+
+  /**
+  * QPs are counted exactly, the latency buckets would be 4 wide at typical values.
+  */
+  HistogramSummary EncodeTelemetry::GetQpSummary() const
+  {
+    uint64_t counts[ENCODE_TELEMETRY_MAX_QP + 1];
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    int max = 0;
+
+    for (int qp = 0; qp <= ENCODE_TELEMETRY_MAX_QP; qp++) {
+      counts[qp] = _qpCounts[qp].load(std::memory_order_relaxed);
+      total += counts[qp];
+      sum += counts[qp] * qp;
+      if (counts[qp] > 0) {
+        max = qp;
+      }
+    }
+
+    HistogramSummary summary{ total, (total > 0) ? (double)sum / total : 0, 0, 0, 0, (double)max };
+    const double percentiles[] = { 50, 90, 99 };
+    double* results[] = { &summary.P50, &summary.P90, &summary.P99 };
+
+    for (int i = 0; i < 3 && total > 0; i++) {
+      uint64_t target = std::max<uint64_t>(1, (uint64_t)(total * percentiles[i] / 100.0 + 0.5));
+      uint64_t seen = 0;
+      for (int qp = 0; qp <= ENCODE_TELEMETRY_MAX_QP; qp++) {
+        seen += counts[qp];
+        if (seen >= target) {
+          *results[i] = qp;
+          break;
+        }
+      }
+    }
+
+    return summary;
+  }
+
+  void EncodeTelemetry::Reset()
+  {
+    for (auto& histogram : _histograms) {
+      histogram.Reset();
+    }
+    for (auto& count : _qpCounts) {
+      count.store(0, std::memory_order_relaxed);
+    }
+    _framesSent = 0;
+    _framesSkipped = 0;
+    _packets = 0;
+    _keyframes = 0;
+    _bytes = 0;
+    _keyframeBytes = 0;
+    _packetsWithQp = 0;
+    _lastKeyframePacket = 0;
+  }
+
+  void EncodeTelemetry::Print(std::ostream& os) const
+  {
+    EncodeTelemetrySnapshot snapshot = GetSnapshot();
+
+    os << "Frames sent " << snapshot.FramesSent << ", skipped static " << snapshot.FramesSkipped << ", packets " << snapshot.Packets
+      << ", keyframes " << snapshot.Keyframes
+      << ", KB " << snapshot.Bytes / 1024 << " (keyframes " << snapshot.KeyframeBytes / 1024 << ")"
+      << ", packets with QP " << snapshot.PacketsWithQp << "." << std::endl;
+
+    LatencyHistogram::PrintHeader(os);
+    for (auto metric : { EncodeMetric::WallTime, EncodeMetric::CpuTime, EncodeMetric::QueueDelay }) {
+      LatencyHistogram::PrintRow(os, _metricNames[(int)metric], snapshot.Metrics[(int)metric], 1000.0);
+    }
+
+    LatencyHistogram::PrintHeader(os, "KB");
+    for (auto metric : { EncodeMetric::FrameSize, EncodeMetric::KeyframeSize }) {
+      LatencyHistogram::PrintRow(os, _metricNames[(int)metric], snapshot.Metrics[(int)metric], 1024.0);
+    }
+
+    LatencyHistogram::PrintHeader(os, "");
+    LatencyHistogram::PrintRow(os, "qp", snapshot.Qp, 1.0);
+    LatencyHistogram::PrintRow(os, _metricNames[(int)EncodeMetric::KeyframeInterval], snapshot.Metrics[(int)EncodeMetric::KeyframeInterval], 1.0);
+  }
+
+  bool EncodeTelemetry::GetPacketQuality(const AVPacket* pkt, int& qp, AVPictureType& pictureType)
+  {
+    int size = 0;
+    const uint8_t* stats = av_packet_get_side_data(pkt, AV_PKT_DATA_QUALITY_STATS, &size);
+    if (stats == NULL || size < QUALITY_STATS_MIN_LENGTH) {
+      return false;
+    }
+
+    uint32_t quality = AV_RL32(stats);
+    if (quality == 0) {
+      return false;
+    }
+
+    qp = (int)((quality + FF_QP2LAMBDA / 2) / FF_QP2LAMBDA);
+    pictureType = (AVPictureType)stats[4];
+    return true;
+  }
+
+  int64_t EncodeTelemetry::GetThreadCpuMicros()
+  {
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+      ULARGE_INTEGER kernel, user;
+      kernel.LowPart = kernelTime.dwLowDateTime;
+      kernel.HighPart = kernelTime.dwHighDateTime;
+      user.LowPart = userTime.dwLowDateTime;
+      user.HighPart = userTime.dwHighDateTime;
+      return (int64_t)((kernel.QuadPart + user.QuadPart) / 10);   // FILETIME units are 100ns.
+    }
+    return 0;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+      return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+    return 0;
+#endif
+  }
+}
@@ -0,0 +1,165 @@
+//-----------------------------------------------------------------------------
+// Filename: encodetelemetry.h
+//
+// Description: Per frame statistics for an encoder, so a bit rate spike can
+// be lined up with the encode time and QP that went with it. Every frame
+// sent to the encoder records its wall time, the CPU time of the calling
+// thread and, if the caller knows when it was queued, how long it waited.
+// Every packet that comes out records its size, frame type and QP.
+//
+// The QP comes from the AV_PKT_DATA_QUALITY_STATS side data the encoder
+// attaches, the quality field is the QP times FF_QP2LAMBDA. Encoders that
+// don't attach it, or leave the quality at 0, count as frames without a QP.
+//
+// The CPU time is the encoding thread's only. With encoder threads the work
+// they do isn't included, with one thread, as the encode server uses, it's
+// the whole cost. On Windows thread times advance in scheduler ticks so a
+// single frame's value is coarse, the mean over many frames is still sound.
+//
+// Recording is lock free, LatencyHistograms and atomic counters, so the
+// statistics can be read with GetSnapshot from another thread while the
+// encoder is running. A callback can also be set to see each frame as it's
+// encoded, e.g. to log keyframes.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_ENCODETELEMETRY_H
+#define SIPSORCERY_ENCODETELEMETRY_H
+
+#include "latencyhistogram.h"
+
+extern "C"
+{
+#include <libavcodec\avcodec.h>
+}
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <ostream>
+
+#define ENCODE_TELEMETRY_MAX_QP 127      // VP8's quantiser index range, H.264 QPs fit within it.
+
+namespace sipsorcery
+{
+  enum class EncodeMetric
+  {
+    WallTime,           // Microseconds in the encode call, per frame sent.
+    CpuTime,            // Microseconds of the calling thread's CPU time, per frame sent.
+    QueueDelay,         // Microseconds from the frame being queued to the encode starting.
+    FrameSize,          // Bytes, every packet.
+    KeyframeSize,       // Bytes, keyframes only.
+    KeyframeInterval,   // Frames from one keyframe to the next.
+    Count
+  };
+
+  /**
+  * The statistics for one encoded packet.
+  */
+  struct EncodeFrameStats
+  {
+    int64_t Pts;
+    int Size;
+    bool KeyFrame;
+    AVPictureType PictureType;      // From the side data, or I/P from the key flag without it.
+    int Qp;                         // -1 if the encoder didn't report one.
+    int64_t WallMicros;             // Of the encode call that produced the packet.
+    int64_t CpuMicros;
+    int64_t QueueDelayMicros;       // -1 if not known.
+  };
+
+  struct EncodeTelemetrySnapshot
+  {
+    uint64_t FramesSent;
+    uint64_t FramesSkipped;
+    uint64_t Packets;
+    uint64_t Keyframes;
+    uint64_t Bytes;
+    uint64_t KeyframeBytes;
+    uint64_t PacketsWithQp;
+    HistogramSummary Metrics[(int)EncodeMetric::Count];
+    HistogramSummary Qp;
+  };
+
+  typedef std::function<void(const EncodeFrameStats& stats)> EncodeFrameStatsCallback;
+
+  class EncodeTelemetry
+  {
+  public:
+    EncodeTelemetry();
+
+    EncodeTelemetry(const EncodeTelemetry&) = delete;
+    EncodeTelemetry& operator=(const EncodeTelemetry&) = delete;
+
+    /**
+    * Records the cost of sending one frame to the encoder.
+    * @param[in] queueDelayMicros: -1 if not known.
+    */
+    void RecordFrame(int64_t wallMicros, int64_t cpuMicros, int64_t queueDelayMicros);
+
+    /**
+    * Records a frame that wasn't sent to the encoder because it was static.
+    */
+    void RecordSkippedFrame() { _framesSkipped.fetch_add(1, std::memory_order_relaxed); }
+
+    /**
+    * Records an encoded packet and calls the callback, if there is one.
+    * @param[in] wallMicros: the wall time of the encode call so far.
+    */
+    void RecordPacket(const AVPacket* pkt, int64_t wallMicros, int64_t cpuMicros, int64_t queueDelayMicros);
+
+    /**
+    * Set before encoding starts, it's called on the encoding thread.
+    */
+    void SetFrameStatsCallback(EncodeFrameStatsCallback cb) { _onFrameStats = cb; }
+
+    EncodeTelemetrySnapshot GetSnapshot() const;
+
+    const LatencyHistogram& GetHistogram(EncodeMetric metric) const { return _histograms[(int)metric]; }
+
+    void Reset();
+
+    /**
+    * Writes the counters and a row per histogram, times in ms and sizes in KB.
+    */
+    void Print(std::ostream& os) const;
+
+    /**
+    * Reads the QP and picture type from a packet's quality stats side data.
+    * @@Returns false if the packet has none or the quality is 0.
+    */
+    static bool GetPacketQuality(const AVPacket* pkt, int& qp, AVPictureType& pictureType);
+
+    /**
+    * Gets the CPU time the calling thread has used so far in microseconds.
+    */
+    static int64_t GetThreadCpuMicros();
+
+  private:
+    LatencyHistogram _histograms[(int)EncodeMetric::Count];
+    std::atomic<uint64_t> _qpCounts[ENCODE_TELEMETRY_MAX_QP + 1];
+
+    std::atomic<uint64_t> _framesSent{ 0 };
+    std::atomic<uint64_t> _framesSkipped{ 0 };
+    std::atomic<uint64_t> _packets{ 0 };
+    std::atomic<uint64_t> _keyframes{ 0 };
+    std::atomic<uint64_t> _bytes{ 0 };
+    std::atomic<uint64_t> _keyframeBytes{ 0 };
+    std::atomic<uint64_t> _packetsWithQp{ 0 };
+    uint64_t _lastKeyframePacket{ 0 };      // Only touched on the encoding thread.
+
+    EncodeFrameStatsCallback _onFrameStats{ nullptr };
+
+    HistogramSummary GetQpSummary() const;
+  };
+}
+
+#endif // SIPSORCERY_ENCODETELEMETRY_H
@@ -0,0 +1,214 @@
+#include "framepool.h"
+
+#include <stdexcept>
+#include <string>
+
+extern "C"
+{
+#include <libavutil\imgutils.h>
+}
+
+namespace sipsorcery
+{
+  FramePool::FramePool(int width, int height, AVPixelFormat pixFmt, int initialSize) :
+    _width(width), _height(height), _pixFmt(pixFmt)
+  {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(pixFmt);
+    if (desc == NULL || (desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+      throw std::runtime_error("Frame pool does not support pixel format " + std::to_string(pixFmt) + ".");
+    }
+
+    int res = av_image_fill_linesizes(_linesizes, pixFmt, FFALIGN(width, FRAME_POOL_ALIGNMENT));
+    if (res < 0) {
+      throw std::runtime_error("Frame pool could not get line sizes for " + std::to_string(width) + "x" + std::to_string(height) + ".");
+    }
+
+    _planeCount = av_pix_fmt_count_planes(pixFmt);
+
+    for (int i = 0; i < _planeCount; i++) {
+      _linesizes[i] = FFALIGN(_linesizes[i], FRAME_POOL_ALIGNMENT);
+      int planeHeight = (i == 1 || i == 2) ? AV_CEIL_RSHIFT(height, desc->log2_chroma_h) : height;
+      // Extra row of padding so SIMD code reading a full vector past the end of the last row stays in bounds.
+      _planeSizes[i] = _linesizes[i] * (planeHeight + 1);
+      _bufferPools[i] = av_buffer_pool_init2(_planeSizes[i], this, AllocatePlane, NULL);
+    }
+
+    _free.reserve(initialSize);
+    for (int i = 0; i < initialSize; i++) {
+      _free.push_back(CreateFrame());
+    }
+  }
+
+  FramePool::~FramePool()
+  {
+    for (auto frame : _free) {
+      av_frame_free(&frame);
+    }
+
+    // Frames still held by callers keep their planes alive, uninit only
+    // frees the pool once the last buffer has been returned.
+    for (int i = 0; i < _planeCount; i++) {
+      av_buffer_pool_uninit(&_bufferPools[i]);
+    }
+  }
+
+  AVFrame* FramePool::Get()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    AVFrame* frame = nullptr;
+
+    while (!_free.empty() && frame == nullptr) {
+      frame = _free.back();
+      _free.pop_back();
+
+      if (!IsWritable(frame)) {
+        // Someone, usually the encoder, still holds a reference to the planes.
+        // Let them keep the old planes and attach fresh ones from the buffer pool.
+        av_frame_unref(frame);
+        if (!AttachPlanes(frame)) {
+          av_frame_free(&frame);
+        }
+      }
+    }
+
+    if (frame == nullptr) {
+      frame = CreateFrame();
+    }
+
+    frame->pts = AV_NOPTS_VALUE;
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+    frame->key_frame = 0;
+
+    _acquisitions++;
+    _inUse++;
+
+    return frame;
+  }
+
+  void FramePool::Return(AVFrame* frame)
+  {
+    if (frame == nullptr) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free.push_back(frame);
+    _inUse--;
+  }
+
+  PoolStats FramePool::GetStats()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return PoolStats{ _acquisitions, _allocations, _inUse };
+  }
+
+  AVFrame* FramePool::CreateFrame()
+  {
+    AVFrame* frame = av_frame_alloc();
+    if (frame == NULL) {
+      throw std::runtime_error("Frame pool failed to allocate a frame.");
+    }
+    _allocations++;
+
+    if (!AttachPlanes(frame)) {
+      av_frame_free(&frame);
+      throw std::runtime_error("Frame pool failed to allocate frame planes.");
+    }
+
+    return frame;
+  }
+
+  bool FramePool::AttachPlanes(AVFrame* frame)
+  {
+    frame->format = _pixFmt;
+    frame->width = _width;
+    frame->height = _height;
+
+    for (int i = 0; i < _planeCount; i++) {
+      frame->buf[i] = av_buffer_pool_get(_bufferPools[i]);
+      if (frame->buf[i] == NULL) {
+        return false;
+      }
+      frame->data[i] = frame->buf[i]->data;
+      frame->linesize[i] = _linesizes[i];
+    }
+
+    frame->extended_data = frame->data;
+    return true;
+  }
+
+  bool FramePool::IsWritable(const AVFrame* frame)
+  {
+    for (int i = 0; i < AV_NUM_DATA_POINTERS; i++) {
+      if (frame->buf[i] != NULL && !av_buffer_is_writable(frame->buf[i])) {
+        return false;
+      }
+    }
+    return frame->buf[0] != NULL;
+  }
+
+  AVBufferRef* FramePool::AllocatePlane(void* opaque, int size)
+  {
+    static_cast<FramePool*>(opaque)->_allocations++;
+    return av_buffer_alloc(size);
+  }
+
+  PacketPool::PacketPool(int initialSize)
+  {
+    _free.reserve(initialSize);
+    for (int i = 0; i < initialSize; i++) {
+      _free.push_back(av_packet_alloc());
+      _allocations++;
+    }
+  }
+
+  PacketPool::~PacketPool()
+  {
+    for (auto pkt : _free) {
+      av_packet_free(&pkt);
+    }
+  }
+
+  AVPacket* PacketPool::Get()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    AVPacket* pkt = nullptr;
+    if (!_free.empty()) {
+      pkt = _free.back();
+      _free.pop_back();
+    }
+    else {
+      pkt = av_packet_alloc();
+      if (pkt == NULL) {
+        throw std::runtime_error("Packet pool failed to allocate a packet.");
+      }
+      _allocations++;
+    }
+
+    _acquisitions++;
+    _inUse++;
+
+    return pkt;
+  }
+
+  void PacketPool::Return(AVPacket* pkt)
+  {
+    if (pkt == nullptr) {
+      return;
+    }
+
+    av_packet_unref(pkt);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free.push_back(pkt);
+    _inUse--;
+  }
+
+  PoolStats PacketPool::GetStats()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return PoolStats{ _acquisitions, _allocations, _inUse };
+  }
+}
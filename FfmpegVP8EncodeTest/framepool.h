@@ -0,0 +1,136 @@
+//-----------------------------------------------------------------------------
+// Filename: framepool.h
+//
+// Description: Recycling pools for the AVFrames and AVPackets used on the
+// encode path. Frame planes come from an AVBufferPool per plane and the
+// AVFrame structs keep their planes attached while they sit in the pool, so
+// once the pool has warmed up getting a frame does not touch the heap. The
+// packet pool recycles AVPacket structs which are filled by moving the
+// encoder's packet reference into them.
+//
+// The allocation counters only go up when a pool has to grow. Comparing them
+// before and after a run is the check that steady state encoding is not
+// allocating. Note the counters only cover what the pools hand out, any small
+// allocations libavcodec makes internally are not visible here.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_FRAMEPOOL_H
+#define SIPSORCERY_FRAMEPOOL_H
+
+extern "C"
+{
+#include <libavcodec\avcodec.h>
+#include <libavutil\buffer.h>
+#include <libavutil\frame.h>
+#include <libavutil\pixdesc.h>
+}
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#define FRAME_POOL_ALIGNMENT 32   // Enough for AVX2 loads on every row.
+
+namespace sipsorcery
+{
+  struct PoolStats
+  {
+    uint64_t Acquisitions;    // Number of times an item was handed out.
+    uint64_t Allocations;     // Number of heap allocations the pool made.
+    uint64_t InUse;           // Items currently handed out.
+  };
+
+  class FramePool
+  {
+  public:
+    /**
+    * @param[in] width: the width of the frames in the pool.
+    * @param[in] height: the height of the frames in the pool.
+    * @param[in] pixFmt: the pixel format of the frames in the pool.
+    * @param[in] initialSize: the number of frames to allocate up front. Should
+    *  cover the frames the encoder and any queues will hold at once.
+    */
+    FramePool(int width, int height, AVPixelFormat pixFmt, int initialSize);
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    /**
+    * Gets a frame with writable planes. The frame must be handed back with
+    * Return once the caller, and the encoder, are finished with it.
+    */
+    AVFrame* Get();
+
+    /**
+    * Hands a frame back to the pool. The frame's planes stay attached so
+    * the next Get can reuse them without going back to the buffer pool.
+    */
+    void Return(AVFrame* frame);
+
+    PoolStats GetStats();
+    int GetWidth() const { return _width; }
+    int GetHeight() const { return _height; }
+    AVPixelFormat GetPixelFormat() const { return _pixFmt; }
+
+  private:
+    int _width;
+    int _height;
+    AVPixelFormat _pixFmt;
+    int _planeCount{ 0 };
+    int _linesizes[AV_NUM_DATA_POINTERS]{ 0 };
+    int _planeSizes[AV_NUM_DATA_POINTERS]{ 0 };
+    AVBufferPool* _bufferPools[AV_NUM_DATA_POINTERS]{ nullptr };
+    std::vector<AVFrame*> _free;
+    std::mutex _mutex;
+    uint64_t _acquisitions{ 0 };
+    std::atomic<uint64_t> _allocations{ 0 };
+    uint64_t _inUse{ 0 };
+
+    AVFrame* CreateFrame();
+    bool AttachPlanes(AVFrame* frame);
+    static bool IsWritable(const AVFrame* frame);
+    static AVBufferRef* AllocatePlane(void* opaque, int size);
+  };
+
+  class PacketPool
+  {
+  public:
+    PacketPool(int initialSize);
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    /**
+    * Gets an empty packet. Typically filled with av_packet_move_ref from the
+    * encoder's packet so the payload is not copied.
+    */
+    AVPacket* Get();
+
+    /**
+    * Unreferences the packet's payload and keeps the struct for reuse.
+    */
+    void Return(AVPacket* pkt);
+
+    PoolStats GetStats();
+
+  private:
+    std::vector<AVPacket*> _free;
+    std::mutex _mutex;
+    uint64_t _acquisitions{ 0 };
+    uint64_t _allocations{ 0 };
+    uint64_t _inUse{ 0 };
+  };
+}
+
+#endif // SIPSORCERY_FRAMEPOOL_H
@@ -0,0 +1,345 @@
+#include "gopcache.h"
+#include "encoderbench.h"
+#include "videoencoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <random>
+
+#define GOP_RELAY_PACKET_POOL_SIZE 64
+#define GOP_CACHE_TEST_WIDTH 640
+#define GOP_CACHE_TEST_HEIGHT 480
+#define GOP_CACHE_TEST_CLIP_FRAMES 30
+
+namespace sipsorcery
+{
+  GopCache::GopCache(PacketPool& pool, int maxPackets, size_t maxBytes) :
+    _pool(pool), _maxPackets(maxPackets), _maxBytes(maxBytes)
+  {
+    _packets.reserve(maxPackets);
+  }
+
+  GopCache::~GopCache()
+  {
+    Clear();
+  }
+
+  void GopCache::Add(const AVPacket* pkt)
+  {
+    if (pkt->flags & AV_PKT_FLAG_KEY) {
+      Clear();
+      _valid = true;
+    }
+    else if (!_valid) {
+      return;
+    }
+
+    if ((int)_packets.size() >= _maxPackets || _bytes + pkt->size > _maxBytes) {
+      // Too long since the last keyframe, a joiner will have to ask for one.
+      Clear();
+      return;
+    }
+
+    AVPacket* ref = _pool.Get();
+    if (av_packet_ref(ref, pkt) < 0) {
+      _pool.Return(ref);
+      Clear();
+      return;
+    }
+
+    _packets.push_back(ref);
+    _bytes += pkt->size;
+  }
+
+  bool GopCache::Snapshot(std::vector<AVPacket*>& packets)
+  {
+    if (!_valid || _packets.empty()) {
+      return false;
+    }
+
+    for (auto cached : _packets) {
+      AVPacket* ref = _pool.Get();
+      if (av_packet_ref(ref, cached) < 0) {
+        _pool.Return(ref);
+        break;
+      }
+      packets.push_back(ref);
+    }
+
+    return true;
+  }
+
+  void GopCache::Clear()
+  {
+    for (auto pkt : _packets) {
+      _pool.Return(pkt);
+    }
+    _packets.clear();
+    _bytes = 0;
+    _valid = false;
+  }
+
+  GopRelay::GopRelay(int fps, int64_t burstBitRate, KeyframeRequestCallback onKeyframeRequest) :
+    _fps(fps), _burstBitRate(burstBitRate), _onKeyframeRequest(onKeyframeRequest),
+    _packetPool(GOP_RELAY_PACKET_POOL_SIZE),
+    _cache(_packetPool)
+  {
+    _sendThread = std::thread(&GopRelay::Send, this);
+  }
+
+  GopRelay::~GopRelay()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _sendCondition.notify_one();
+    _sendThread.join();
+
+    for (auto& entry : _subscribers) {
+      ReleaseQueue(*entry.second);
+    }
+    _subscribers.clear();
+    _cache.Clear();
+  }
+
+  int GopRelay::Subscribe(const std::string& dstAddress, int dstPort, bool useCache)
+  {
+    std::random_device rd;
+    auto subscriber = std::make_shared<Subscriber>();
+    subscriber->Payloader.reset(new Vp8RtpPayloader(rd(), VP8_DEFAULT_PAYLOAD_TYPE, RTP_DEFAULT_MTU, (uint16_t)rd(), (uint16_t)(rd() & 0x7fff)));
+    subscriber->Sender.reset(new RtpSender(dstAddress, dstPort));
+    subscriber->JoinTime = std::chrono::steady_clock::now();
+    subscriber->UseCache = useCache;
+    subscriber->WaitingForKeyframe = true;
+    subscriber->Joined = false;
+
+    bool requestKeyframe = false;
+    int subscriberID = 0;
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      std::vector<AVPacket*> burst;
+      if (useCache && _cache.Snapshot(burst)) {
+        // Each packet is due once the ones before it have had their share of the burst rate.
+        uint64_t burstBytes = 0;
+        for (auto pkt : burst) {
+          auto offset = (_burstBitRate > 0) ? std::chrono::microseconds(burstBytes * 8 * 1000000 / _burstBitRate) : std::chrono::microseconds(0);
+          subscriber->Queue.push_back(QueuedPacket{ pkt, subscriber->JoinTime + offset, true });
+          burstBytes += pkt->size;
+        }
+        subscriber->WaitingForKeyframe = false;
+      }
+      else if (useCache && !_keyframeRequested) {
+        _keyframeRequested = true;
+        requestKeyframe = true;
+        _stats.KeyframeRequests++;
+      }
+
+      subscriberID = _nextSubscriberID++;
+      _subscribers[subscriberID] = subscriber;
+    }
+
+    _sendCondition.notify_one();
+
+    if (requestKeyframe && _onKeyframeRequest != nullptr) {
+      _onKeyframeRequest();
+    }
+
+    return subscriberID;
+  }
+
+  void GopRelay::Unsubscribe(int subscriberID)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto entry = _subscribers.find(subscriberID);
+    if (entry != _subscribers.end()) {
+      ReleaseQueue(*entry->second);
+      _subscribers.erase(entry);
+    }
+  }
+
+  void GopRelay::ReleaseQueue(Subscriber& subscriber)
+  {
+    for (auto& queued : subscriber.Queue) {
+      _packetPool.Return(queued.Packet);
+    }
+    subscriber.Queue.clear();
+  }
+
+  void GopRelay::OnPacket(const AVPacket* pkt)
+  {
+    bool keyframe = (pkt->flags & AV_PKT_FLAG_KEY) != 0;
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+
+      _stats.PacketsIn++;
+      _cache.Add(pkt);
+
+      if (keyframe) {
+        _keyframeRequested = false;
+      }
+
+      auto now = std::chrono::steady_clock::now();
+
+      for (auto& entry : _subscribers) {
+        Subscriber& subscriber = *entry.second;
+
+        if (subscriber.WaitingForKeyframe) {
+          if (!keyframe) {
+            continue;
+          }
+          subscriber.WaitingForKeyframe = false;
+        }
+
+        // Queued behind any burst still going out, the queue is sent in order.
+        AVPacket* ref = _packetPool.Get();
+        if (av_packet_ref(ref, pkt) < 0) {
+          _packetPool.Return(ref);
+          continue;
+        }
+        subscriber.Queue.push_back(QueuedPacket{ ref, now, false });
+      }
+    }
+
+    _sendCondition.notify_one();
+  }
+
+  GopRelayStats GopRelay::GetStats()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+  }
+
+  /**
+  * Takes every packet that's due across all the subscribers and sends them
+  * outside the lock. The subscriber's payloader and socket are only used on
+  * this thread so they need no locking of their own.
+  */
+  void GopRelay::Send()
+  {
+    struct ReadyPacket
+    {
+      std::shared_ptr<Subscriber> Target;
+      QueuedPacket Queued;
+    };
+
+    std::vector<ReadyPacket> ready;
+    std::vector<RtpPacketBuffers> rtpPackets;
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (!_stop) {
+      auto now = std::chrono::steady_clock::now();
+      auto nextDue = std::chrono::steady_clock::time_point::max();
+      ready.clear();
+
+      for (auto& entry : _subscribers) {
+        auto& queue = entry.second->Queue;
+        while (!queue.empty() && queue.front().Due <= now) {
+          ready.push_back(ReadyPacket{ entry.second, queue.front() });
+          queue.pop_front();
+        }
+        if (!queue.empty()) {
+          nextDue = std::min(nextDue, queue.front().Due);
+        }
+      }
+
+      if (ready.empty()) {
+        if (nextDue == std::chrono::steady_clock::time_point::max()) {
+          _sendCondition.wait(lock);
+        }
+        else {
+          _sendCondition.wait_until(lock, nextDue);
+        }
+        continue;
+      }
+
+      lock.unlock();
+
+      uint64_t burstFrames = 0;
+      for (auto& item : ready) {
+        Subscriber& subscriber = *item.Target;
+        AVPacket* pkt = item.Queued.Packet;
+
+        uint32_t timestamp = (uint32_t)(pkt->pts * GOP_RELAY_RTP_CLOCK_RATE / _fps);
+        subscriber.Payloader->Packetize(pkt->data, pkt->size, timestamp, 0, rtpPackets);
+        subscriber.Sender->Send(rtpPackets);
+
+        if (!subscriber.Joined && (pkt->flags & AV_PKT_FLAG_KEY)) {
+          subscriber.Joined = true;
+          (subscriber.UseCache ? _cachedJoins : _liveJoins).Record(std::chrono::steady_clock::now() - subscriber.JoinTime);
+        }
+
+        burstFrames += item.Queued.Burst ? 1 : 0;
+        _packetPool.Return(pkt);
+      }
+
+      lock.lock();
+      _stats.FramesSent += ready.size();
+      _stats.BurstFramesSent += burstFrames;
+    }
+  }
+
+  void RunGopCacheTest(const std::string& dstAddress, int dstPort, int fps, int viewers, int durationSeconds,
+    int keyframeSeconds, int64_t burstBitRate)
+  {
+    std::atomic<bool> keyframeRequested{ false };
+    GopRelay relay(fps, burstBitRate, [&keyframeRequested]() { keyframeRequested = true; });
+    VideoEncoder encoder(AV_CODEC_ID_VP8, GOP_CACHE_TEST_WIDTH, GOP_CACHE_TEST_HEIGHT, fps, EncoderPreset::Realtime, 1);
+
+    FramePool framePool(GOP_CACHE_TEST_WIDTH, GOP_CACHE_TEST_HEIGHT, AV_PIX_FMT_YUV420P, GOP_CACHE_TEST_CLIP_FRAMES);
+    std::vector<AVFrame*> clip;
+    for (int i = 0; i < GOP_CACHE_TEST_CLIP_FRAMES; i++) {
+      clip.push_back(framePool.Get());
+      FillTestFrame(clip.back(), i);
+    }
+
+    int totalFrames = durationSeconds * fps;
+    int keyframeInterval = std::max(1, keyframeSeconds * fps);
+    int joinInterval = std::max(1, totalFrames / (viewers + 1));
+    std::vector<int> subscriberIDs;
+
+    std::cout << "GOP cache test, " << viewers << " viewers joining over " << durationSeconds << "s, keyframe every "
+      << keyframeSeconds << "s, burst " << ((burstBitRate > 0) ? std::to_string(burstBitRate / 1000) + "kbps" : "unpaced")
+      << ", sending to " << dstAddress << ":" << dstPort << "." << std::endl;
+
+    auto frameInterval = std::chrono::microseconds(1000000 / fps);
+    auto nextFrame = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < totalFrames; i++) {
+      if (i > 0 && i % joinInterval == 0 && (int)subscriberIDs.size() < viewers) {
+        // Alternate viewers use the cache so both get the same spread of join points.
+        subscriberIDs.push_back(relay.Subscribe(dstAddress, dstPort, subscriberIDs.size() % 2 == 0));
+      }
+
+      AVFrame* frame = clip[i % GOP_CACHE_TEST_CLIP_FRAMES];
+      frame->pts = i;
+      frame->pict_type = (i % keyframeInterval == 0 || keyframeRequested.exchange(false)) ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+      encoder.Encode(frame, [&relay](AVPacket* pkt) { relay.OnPacket(pkt); });
+
+      nextFrame += frameInterval;
+      std::this_thread::sleep_until(nextFrame);
+    }
+
+    for (auto subscriberID : subscriberIDs) {
+      relay.Unsubscribe(subscriberID);
+    }
+
+    for (auto frame : clip) {
+      framePool.Return(frame);
+    }
+
+    GopRelayStats stats = relay.GetStats();
+    std::cout << "Packets in " << stats.PacketsIn << ", frames sent " << stats.FramesSent << ", from cache " << stats.BurstFramesSent
+      << ", keyframe requests " << stats.KeyframeRequests << "." << std::endl;
+
+    LatencyHistogram::PrintHeader(std::cout);
+    relay.GetJoinHistogram(true).Print(std::cout, "join cached");
+    relay.GetJoinHistogram(false).Print(std::cout, "join live");
+  }
+}
@@ -0,0 +1,203 @@
+//-----------------------------------------------------------------------------
+// Filename: gopcache.h
+//
+// Description: Instant join for viewers of an encoded VP8 stream. Without a
+// cache a new viewer either waits for the next keyframe, which for a
+// realtime stream that only sends keyframes on request could be minutes, or
+// asks for one, and every viewer then pays for the keyframe's size and the
+// encoder for its cost.
+//
+// GopCache keeps a reference to every packet from the last keyframe on. The
+// packets are the encoder's own reference counted buffers, caching one is a
+// reference count increment, not a copy. When the cache would grow past its
+// limits it's emptied and stays empty until the next keyframe.
+//
+// GopRelay fans a stream out to RTP subscribers. A new subscriber is given
+// the cached packets straight away, optionally paced at a burst bit rate so
+// the burst doesn't overrun the viewer's link, then carries on with the live
+// packets. Its join time is then the network round trip plus the burst. If
+// the cache is empty the relay asks the encoder for a keyframe, once, however
+// many subscribers are waiting.
+//
+// Each subscriber has its own payloader, so its own SSRC, sequence numbers
+// and PictureIDs, and its own queue. One thread sends for all subscribers.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_GOPCACHE_H
+#define SIPSORCERY_GOPCACHE_H
+
+#include "framepool.h"
+#include "latencyhistogram.h"
+#include "rtpsender.h"
+#include "vp8rtp.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GOP_CACHE_DEFAULT_MAX_PACKETS 900         // 30s at 30fps.
+#define GOP_CACHE_DEFAULT_MAX_BYTES (16 * 1024 * 1024)
+#define GOP_RELAY_RTP_CLOCK_RATE 90000
+
+namespace sipsorcery
+{
+  class GopCache
+  {
+  public:
+    /**
+    * @param[in] pool: where the cache gets the packet structs for its references.
+    * @param[in] maxPackets: the most packets to hold before giving up until the next keyframe.
+    * @param[in] maxBytes: the most payload bytes to hold.
+    */
+    GopCache(PacketPool& pool, int maxPackets = GOP_CACHE_DEFAULT_MAX_PACKETS, size_t maxBytes = GOP_CACHE_DEFAULT_MAX_BYTES);
+    ~GopCache();
+
+    GopCache(const GopCache&) = delete;
+    GopCache& operator=(const GopCache&) = delete;
+
+    /**
+    * Adds a reference to an encoded packet. A keyframe replaces what's cached.
+    * Not thread safe, the owner serialises access.
+    */
+    void Add(const AVPacket* pkt);
+
+    /**
+    * Adds a new reference to each cached packet, from the pool, to packets.
+    * @@Returns false if the cache doesn't start at a keyframe.
+    */
+    bool Snapshot(std::vector<AVPacket*>& packets);
+
+    void Clear();
+
+    bool IsValid() const { return _valid; }
+    int GetPacketCount() const { return (int)_packets.size(); }
+    size_t GetByteCount() const { return _bytes; }
+
+  private:
+    PacketPool& _pool;
+    int _maxPackets;
+    size_t _maxBytes;
+    std::vector<AVPacket*> _packets;
+    size_t _bytes{ 0 };
+    bool _valid{ false };
+  };
+
+  struct GopRelayStats
+  {
+    uint64_t PacketsIn;
+    uint64_t FramesSent;
+    uint64_t BurstFramesSent;
+    uint64_t KeyframeRequests;
+  };
+
+  class GopRelay
+  {
+  public:
+    typedef std::function<void()> KeyframeRequestCallback;
+
+    /**
+    * @param[in] fps: the stream's frame rate, pts are in frames.
+    * @param[in] burstBitRate: the rate cached packets are sent to a new
+    *  subscriber at in bits per second, 0 to send them all at once.
+    * @param[in] onKeyframeRequest: called when a subscriber joins and there's
+    *  no keyframe cached. Optional.
+    */
+    GopRelay(int fps, int64_t burstBitRate, KeyframeRequestCallback onKeyframeRequest);
+    ~GopRelay();
+
+    GopRelay(const GopRelay&) = delete;
+    GopRelay& operator=(const GopRelay&) = delete;
+
+    /**
+    * Adds a subscriber that will be sent the stream from a keyframe on.
+    * @param[in] useCache: false to make the subscriber wait for a live keyframe,
+    *  for comparison.
+    * @@Returns the subscriber's ID.
+    * Throws std::runtime_error if the subscriber's socket can't be created.
+    */
+    int Subscribe(const std::string& dstAddress, int dstPort, bool useCache = true);
+
+    void Unsubscribe(int subscriberID);
+
+    /**
+    * Caches the packet and queues it for every subscriber. The relay takes its
+    * own references, the caller keeps ownership of pkt.
+    */
+    void OnPacket(const AVPacket* pkt);
+
+    /**
+    * Time from Subscribe to the subscriber's first keyframe being sent, for
+    * subscribers that did and didn't use the cache.
+    */
+    const LatencyHistogram& GetJoinHistogram(bool cached) const { return cached ? _cachedJoins : _liveJoins; }
+
+    GopRelayStats GetStats();
+
+  private:
+    struct QueuedPacket
+    {
+      AVPacket* Packet;
+      std::chrono::steady_clock::time_point Due;
+      bool Burst;
+    };
+
+    struct Subscriber
+    {
+      std::unique_ptr<Vp8RtpPayloader> Payloader;
+      std::unique_ptr<RtpSender> Sender;
+      std::deque<QueuedPacket> Queue;
+      std::chrono::steady_clock::time_point JoinTime;
+      bool UseCache;
+      bool WaitingForKeyframe;      // Live packets are skipped until a keyframe.
+      bool Joined;                  // The first keyframe has been sent.
+    };
+
+    int _fps;
+    int64_t _burstBitRate;
+    KeyframeRequestCallback _onKeyframeRequest;
+
+    PacketPool _packetPool;
+    GopCache _cache;
+
+    std::mutex _mutex;
+    std::condition_variable _sendCondition;
+    std::map<int, std::shared_ptr<Subscriber>> _subscribers;
+    int _nextSubscriberID{ 0 };
+    bool _keyframeRequested{ false };
+    bool _stop{ false };
+    std::thread _sendThread;
+
+    LatencyHistogram _cachedJoins;
+    LatencyHistogram _liveJoins;
+    GopRelayStats _stats{ 0, 0, 0, 0 };
+
+    void Send();
+    void ReleaseQueue(Subscriber& subscriber);
+  };
+
+  /**
+  * Relays a live 640x480 realtime VP8 stream with a keyframe every
+  * keyframeSeconds while viewers join at intervals over durationSeconds,
+  * alternately with and without the cache, and prints the join latencies.
+  */
+  void RunGopCacheTest(const std::string& dstAddress, int dstPort, int fps, int viewers, int durationSeconds,
+    int keyframeSeconds, int64_t burstBitRate);
+}
+
+#endif // SIPSORCERY_GOPCACHE_H
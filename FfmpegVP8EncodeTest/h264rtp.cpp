@@ -0,0 +1,325 @@
+#include "h264rtp.h"
+#include "colorconvert.h"
+#include "framepool.h"
+#include "syntheticsource.h"
+#include "videoencoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#define H264_RTP_TEST_WIDTH 1280
+#define H264_RTP_TEST_HEIGHT 720
+#define H264_RTP_TEST_FPS 30
+#define H264_RTP_TEST_SEARCH_PASSES 20      // The clip is only a few MB, search it several times for a steadier rate.
+
+namespace sipsorcery
+{
+  H264RtpPayloader::H264RtpPayloader(uint32_t ssrc, uint8_t payloadType, int mtu, uint16_t initialSeqNum) :
+    _ssrc(ssrc), _payloadType(payloadType),
+    _maxPayload(std::max(H264_FU_A_HEADER_LENGTH + 1, mtu - RTP_HEADER_LENGTH)),
+    _seqNum(initialSeqNum)
+  { }
+
+  int H264RtpPayloader::Packetize(const uint8_t* data, size_t length, uint32_t timestamp, std::vector<RtpPacketBuffers>& packets)
+  {
+    SplitEncodedFrame(AV_CODEC_ID_H264, data, length, _nals);
+    PlanPackets();
+    return BuildPackets(timestamp, true, packets);
+  }
+
+  int H264RtpPayloader::PacketizeNal(const uint8_t* nal, size_t length, bool lastNal, uint32_t timestamp, std::vector<RtpPacketBuffers>& packets)
+  {
+    _nals.clear();
+    if (length > 0) {
+      _nals.push_back(EncodedSlice{ nal, length, 0, true });
+    }
+
+    PlanPackets();
+    return BuildPackets(timestamp, lastNal, packets);
+  }
+
+  /**
+  * Works out the packets for the NAL units. A run of NAL units that fit in a
+  * packet together is aggregated if there are at least two of them, a NAL
+  * unit that doesn't fit in a packet on its own is split into the fewest
+  * evenly sized fragments that do.
+  */
+  void H264RtpPayloader::PlanPackets()
+  {
+    _plans.clear();
+    size_t slabLength = 0;
+    size_t i = 0;
+
+    while (i < _nals.size()) {
+      size_t length = _nals[i].Length;
+
+      if (length > _maxPayload) {
+        // The NAL header byte travels in the FU indicator and FU header, not in the fragments.
+        size_t payload = length - 1;
+        size_t maxFragment = _maxPayload - H264_FU_A_HEADER_LENGTH;
+        size_t pieces = (payload + maxFragment - 1) / maxFragment;
+        size_t pieceLength = (payload + pieces - 1) / pieces;
+
+        for (size_t offset = 0; offset < payload; offset += pieceLength) {
+          _plans.push_back(PacketPlan{ PacketType::FuA, i, 1, 1 + offset, std::min(pieceLength, payload - offset),
+            offset == 0, offset + pieceLength >= payload, slabLength });
+          slabLength += RTP_HEADER_LENGTH + H264_FU_A_HEADER_LENGTH;
+        }
+
+        i++;
+        continue;
+      }
+
+      size_t count = 0;
+      size_t aggregateLength = H264_STAP_A_HEADER_LENGTH;
+      while (i + count < _nals.size() && count < H264_STAP_A_MAX_NALS &&
+        aggregateLength + H264_STAP_A_SIZE_LENGTH + _nals[i + count].Length <= _maxPayload) {
+        aggregateLength += H264_STAP_A_SIZE_LENGTH + _nals[i + count].Length;
+        count++;
+      }
+
+      if (count >= 2) {
+        _plans.push_back(PacketPlan{ PacketType::StapA, i, count, 0, 0, false, false, slabLength });
+        slabLength += RTP_HEADER_LENGTH + H264_STAP_A_HEADER_LENGTH + count * H264_STAP_A_SIZE_LENGTH;
+        i += count;
+      }
+      else {
+        _plans.push_back(PacketPlan{ PacketType::Single, i, 1, 0, 0, false, false, slabLength });
+        slabLength += RTP_HEADER_LENGTH;
+        i++;
+      }
+    }
+
+    // Sized before any pointers into it are taken.
+    if (_headerSlab.size() < slabLength) {
+      _headerSlab.resize(slabLength);
+    }
+  }
+
+  int H264RtpPayloader::BuildPackets(uint32_t timestamp, bool marker, std::vector<RtpPacketBuffers>& packets)
+  {
+    packets.clear();
+
+    for (size_t i = 0; i < _plans.size(); i++) {
+      const PacketPlan& plan = _plans[i];
+      const EncodedSlice& nal = _nals[plan.FirstNal];
+      uint8_t* hdr = _headerSlab.data() + plan.SlabOffset;
+
+      WriteRtpHeader(hdr, marker && i == _plans.size() - 1, _payloadType, _seqNum++, timestamp, _ssrc);
+
+      RtpPacketBuffers packet;
+
+      if (plan.Type == PacketType::Single) {
+        packet.Count = 2;
+        packet.Buffers[0] = RtpIoVec{ hdr, RTP_HEADER_LENGTH };
+        packet.Buffers[1] = RtpIoVec{ nal.Data, nal.Length };
+      }
+      else if (plan.Type == PacketType::StapA) {
+        // The forbidden bit if any NAL unit has it and the highest NRI of them.
+        uint8_t forbidden = 0, nri = 0;
+        for (size_t n = 0; n < plan.NalCount; n++) {
+          uint8_t nalHeader = _nals[plan.FirstNal + n].Data[0];
+          forbidden |= nalHeader & 0x80;
+          nri = std::max<uint8_t>(nri, nalHeader & 0x60);
+        }
+
+        hdr[RTP_HEADER_LENGTH] = forbidden | nri | H264_NAL_TYPE_STAP_A;
+        uint8_t* sizes = hdr + RTP_HEADER_LENGTH + H264_STAP_A_HEADER_LENGTH;
+
+        // The first size field shares the RTP header's buffer, the rest sit between the NAL units.
+        packet.Count = 0;
+        packet.Buffers[packet.Count++] = RtpIoVec{ hdr, RTP_HEADER_LENGTH + H264_STAP_A_HEADER_LENGTH + H264_STAP_A_SIZE_LENGTH };
+
+        for (size_t n = 0; n < plan.NalCount; n++) {
+          const EncodedSlice& aggregated = _nals[plan.FirstNal + n];
+          uint8_t* size = sizes + n * H264_STAP_A_SIZE_LENGTH;
+          size[0] = (aggregated.Length >> 8) & 0xff;
+          size[1] = aggregated.Length & 0xff;
+
+          if (n > 0) {
+            packet.Buffers[packet.Count++] = RtpIoVec{ size, H264_STAP_A_SIZE_LENGTH };
+          }
+          packet.Buffers[packet.Count++] = RtpIoVec{ aggregated.Data, aggregated.Length };
+        }
+      }
+      else {
+        uint8_t nalHeader = nal.Data[0];
+        hdr[RTP_HEADER_LENGTH] = (nalHeader & 0xe0) | H264_NAL_TYPE_FU_A;     // F, NRI
+        hdr[RTP_HEADER_LENGTH + 1] = (plan.FragmentStart ? 0x80 : 0x00) | (plan.FragmentEnd ? 0x40 : 0x00) | (nalHeader & 0x1f);   // S, E, type
+
+        packet.Count = 2;
+        packet.Buffers[0] = RtpIoVec{ hdr, RTP_HEADER_LENGTH + H264_FU_A_HEADER_LENGTH };
+        packet.Buffers[1] = RtpIoVec{ nal.Data + plan.Offset, plan.Length };
+      }
+
+      packets.push_back(packet);
+    }
+
+    return (int)packets.size();
+  }
+
+  /**
+  * Gathers each packet into a datagram, as the socket would, and unpacks the
+  * NAL units from it. Counts the single NAL unit, STAP-A and FU-A packets.
+  * @@Returns false if a packet is over the MTU, the marker is anywhere but
+  *  the last packet or a payload is malformed.
+  */
+  static bool ReassembleNals(const std::vector<RtpPacketBuffers>& packets, size_t mtu, std::vector<std::vector<uint8_t>>& nals, uint64_t counts[3])
+  {
+    std::vector<uint8_t> datagram;
+
+    for (size_t i = 0; i < packets.size(); i++) {
+      datagram.clear();
+      for (int b = 0; b < packets[i].Count; b++) {
+        datagram.insert(datagram.end(), packets[i].Buffers[b].Data, packets[i].Buffers[b].Data + packets[i].Buffers[b].Length);
+      }
+
+      RtpHeaderInfo hdr;
+      if (datagram.size() > mtu || !ParseRtpHeader(datagram.data(), datagram.size(), hdr) ||
+        hdr.Marker != (i == packets.size() - 1) || hdr.PayloadLength < 1) {
+        return false;
+      }
+
+      const uint8_t* payload = datagram.data() + hdr.PayloadOffset;
+      size_t length = hdr.PayloadLength;
+      int type = payload[0] & 0x1f;
+
+      if (type == H264_NAL_TYPE_STAP_A) {
+        counts[1]++;
+        size_t pos = H264_STAP_A_HEADER_LENGTH;
+        while (pos < length) {
+          if (pos + H264_STAP_A_SIZE_LENGTH > length) {
+            return false;
+          }
+          size_t size = (size_t)payload[pos] << 8 | payload[pos + 1];
+          pos += H264_STAP_A_SIZE_LENGTH;
+          if (size == 0 || pos + size > length) {
+            return false;
+          }
+          nals.emplace_back(payload + pos, payload + pos + size);
+          pos += size;
+        }
+      }
+      else if (type == H264_NAL_TYPE_FU_A) {
+        counts[2]++;
+        if (length < H264_FU_A_HEADER_LENGTH) {
+          return false;
+        }
+        if (payload[1] & 0x80) {
+          nals.emplace_back(1, (uint8_t)((payload[0] & 0xe0) | (payload[1] & 0x1f)));
+        }
+        else if (nals.empty()) {
+          return false;
+        }
+        nals.back().insert(nals.back().end(), payload + H264_FU_A_HEADER_LENGTH, payload + length);
+      }
+      else {
+        counts[0]++;
+        nals.emplace_back(payload, payload + length);
+      }
+    }
+
+    return true;
+  }
+
+  void RunH264RtpBenchmark(int frameCount)
+  {
+    const EncoderPreset presets[] = { EncoderPreset::Realtime, EncoderPreset::Balanced };
+
+    frameCount = std::max(1, frameCount);
+
+    std::cout << "H.264 RTP packetizer, " << H264_RTP_TEST_WIDTH << "x" << H264_RTP_TEST_HEIGHT << " " << frameCount
+      << " frames, MTU " << RTP_DEFAULT_MTU << ", AVX2 " << (ColorConverter::HasAvx2() ? "available" : "not available") << "." << std::endl;
+
+    FramePool framePool(H264_RTP_TEST_WIDTH, H264_RTP_TEST_HEIGHT, AV_PIX_FMT_YUV420P, 1);
+    AVFrame* frame = framePool.Get();
+
+    for (auto preset : presets) {
+      std::vector<std::vector<uint8_t>> accessUnits;
+      size_t totalBytes = 0;
+
+      {
+        VideoEncoder encoder(AV_CODEC_ID_H264, H264_RTP_TEST_WIDTH, H264_RTP_TEST_HEIGHT, H264_RTP_TEST_FPS, preset);
+        SyntheticVideoSource source(H264_RTP_TEST_WIDTH, H264_RTP_TEST_HEIGHT, AV_PIX_FMT_YUV420P);
+
+        auto onPacket = [&](AVPacket* pkt) {
+          accessUnits.emplace_back(pkt->data, pkt->data + pkt->size);
+          totalBytes += pkt->size;
+        };
+
+        for (int i = 0; i < frameCount; i++) {
+          source.Fill(frame, i);
+          frame->pts = i;
+          encoder.Encode(frame, onPacket);
+        }
+        encoder.Flush(onPacket);
+      }
+
+      // Every start code in the clip, the way SplitEncodedFrame walks a frame.
+      auto timeSearch = [&](const uint8_t* (*finder)(const uint8_t*, const uint8_t*), uint64_t& found) {
+        found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int pass = 0; pass < H264_RTP_TEST_SEARCH_PASSES; pass++) {
+          for (auto& au : accessUnits) {
+            const uint8_t* end = au.data() + au.size();
+            for (const uint8_t* p = finder(au.data(), end); p < end; p = finder(p + 3, end)) {
+              found++;
+            }
+          }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return (double)totalBytes * H264_RTP_TEST_SEARCH_PASSES / 1e6 / std::max(seconds, 1e-9);
+      };
+
+      uint64_t scalarFound = 0, avx2Found = 0;
+      double scalarRate = timeSearch(FindH264StartCodeScalar, scalarFound);
+      double avx2Rate = ColorConverter::HasAvx2() ? timeSearch(FindH264StartCodeAvx2, avx2Found) : 0;
+
+      H264RtpPayloader payloader(0x12345678);
+      std::vector<RtpPacketBuffers> packets;
+      uint64_t packetCount = 0;
+
+      auto start = std::chrono::steady_clock::now();
+      for (auto& au : accessUnits) {
+        packetCount += payloader.Packetize(au.data(), au.size(), 0, packets);
+      }
+      double packetizeMicros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count()
+        / std::max<size_t>(1, accessUnits.size());
+
+      // Every NAL unit has to come back out of the packets exactly as it went in.
+      uint64_t counts[3] = { 0, 0, 0 };
+      std::vector<EncodedSlice> expected;
+      std::vector<std::vector<uint8_t>> received;
+      bool reassembled = true;
+
+      for (auto& au : accessUnits) {
+        payloader.Packetize(au.data(), au.size(), 0, packets);
+        SplitEncodedFrame(AV_CODEC_ID_H264, au.data(), au.size(), expected);
+
+        received.clear();
+        if (!ReassembleNals(packets, RTP_DEFAULT_MTU, received, counts) || received.size() != expected.size()) {
+          reassembled = false;
+          break;
+        }
+
+        for (size_t n = 0; n < expected.size() && reassembled; n++) {
+          reassembled = received[n].size() == expected[n].Length && memcmp(received[n].data(), expected[n].Data, expected[n].Length) == 0;
+        }
+      }
+
+      std::cout << VideoEncoder::GetPresetName(preset) << ": " << accessUnits.size() << " access units, " << totalBytes / 1024 << " KB"
+        << std::fixed << std::setprecision(0)
+        << ", start code search MB/s scalar " << scalarRate << ", avx2 " << avx2Rate
+        << ", avx2 matches scalar " << ((avx2Found == scalarFound || !ColorConverter::HasAvx2()) ? "yes" : "NO") << "." << std::endl;
+
+      std::cout << "  " << packetCount << " packets, single " << counts[0] << ", STAP-A " << counts[1] << ", FU-A " << counts[2]
+        << std::setprecision(2) << ", packetize " << packetizeMicros << " us per access unit"
+        << ", NAL units reassemble " << (reassembled ? "yes" : "NO") << "." << std::endl;
+    }
+
+    framePool.Return(frame);
+  }
+}
@@ -0,0 +1,144 @@
+//-----------------------------------------------------------------------------
+// Filename: h264rtp.h
+//
+// Description: RTP payloader for H.264 as specified in RFC 6184:
+// https://tools.ietf.org/html/rfc6184, packetization-mode=1.
+//
+// An Annex B access unit is split into NAL units at its start codes, found
+// with the AVX2 search in encodedslices.cpp. Each NAL unit then goes out in
+// one of three ways:
+//
+//  single NAL unit: a NAL unit that fits in a packet on its own and can't
+//                   share it is sent as is.
+//  STAP-A: consecutive small NAL units, typically the SPS, PPS and SEI ahead
+//          of a keyframe, are aggregated into one packet, each prefixed
+//          with its 16 bit size.
+//  FU-A: a NAL unit that is bigger than a packet is split into evenly sized
+//        fragments, its header byte is replaced by the FU indicator and
+//        FU header on each fragment.
+//
+//  STAP-A:                              FU-A:
+//   +-+-+-+-+-+-+-+-+                    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |F|NRI| Type 24 |                    |F|NRI| Type 28 |S|E|R|  Type   |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |  NALU 1 size  | NALU 1 ...    |    | FU indicator  |   FU header   |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//
+// As with VP8 the headers, size fields included, are written to a slab of
+// the payloader's own and the packet buffers point at the NAL units where
+// the encoder left them, no payload is copied. A STAP-A takes two buffers per
+// NAL unit so aggregates at most H264_STAP_A_MAX_NALS of them, leaving a
+// buffer spare for CongestionController to splice a header extension in.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_H264RTP_H
+#define SIPSORCERY_H264RTP_H
+
+#include "encodedslices.h"
+#include "rtpsender.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define H264_DEFAULT_PAYLOAD_TYPE 97
+#define H264_NAL_TYPE_STAP_A 24
+#define H264_NAL_TYPE_FU_A 28
+#define H264_STAP_A_HEADER_LENGTH 1
+#define H264_STAP_A_SIZE_LENGTH 2
+#define H264_FU_A_HEADER_LENGTH 2
+#define H264_STAP_A_MAX_NALS ((RTP_MAX_PACKET_BUFFERS - 1) / 2)
+
+namespace sipsorcery
+{
+  class H264RtpPayloader
+  {
+  public:
+    /**
+    * @param[in] ssrc: the RTP synchronisation source.
+    * @param[in] payloadType: the dynamic RTP payload type negotiated for H.264.
+    * @param[in] mtu: the maximum size of an RTP packet, header included.
+    * @param[in] initialSeqNum: the first RTP sequence number, normally random.
+    */
+    H264RtpPayloader(uint32_t ssrc, uint8_t payloadType = H264_DEFAULT_PAYLOAD_TYPE, int mtu = RTP_DEFAULT_MTU,
+      uint16_t initialSeqNum = 0);
+
+    /**
+    * Splits an encoded access unit into RTP packets. The packets reference
+    * the access unit and this payloader's header slab, both must stay
+    * unchanged until the packets are sent. The next call reuses the slab.
+    * @param[in] data: the Annex B access unit.
+    * @param[in] length: the length of the access unit.
+    * @param[in] timestamp: the 90kHz RTP timestamp for the access unit.
+    * @param[out] packets: the packets for the access unit, replaces any previous contents.
+    * @@Returns the number of packets.
+    */
+    int Packetize(const uint8_t* data, size_t length, uint32_t timestamp, std::vector<RtpPacketBuffers>& packets);
+
+    /**
+    * Packetizes one NAL unit of an access unit, for sending NAL units as
+    * VideoEncoder::EncodeSlices hands them out. NAL units aren't aggregated
+    * as the next one may not be available yet. The packets must be sent
+    * before the next call.
+    * @param[in] nal: the NAL unit, starting at its header, without the start code.
+    * @param[in] length: the length of the NAL unit.
+    * @param[in] lastNal: true for the access unit's last NAL unit, its last packet gets the marker.
+    * @param[in] timestamp: the 90kHz RTP timestamp for the access unit.
+    * @param[out] packets: the packets for the NAL unit, replaces any previous contents.
+    * @@Returns the number of packets.
+    */
+    int PacketizeNal(const uint8_t* nal, size_t length, bool lastNal, uint32_t timestamp, std::vector<RtpPacketBuffers>& packets);
+
+    uint16_t GetSequenceNumber() const { return _seqNum; }
+
+  private:
+    enum class PacketType
+    {
+      Single,
+      StapA,
+      FuA
+    };
+
+    struct PacketPlan
+    {
+      PacketType Type;
+      size_t FirstNal;
+      size_t NalCount;          // NAL units in a STAP-A, otherwise 1.
+      size_t Offset;            // FU-A fragment's position in the NAL unit.
+      size_t Length;            // FU-A fragment's length.
+      bool FragmentStart;
+      bool FragmentEnd;
+      size_t SlabOffset;
+    };
+
+    uint32_t _ssrc;
+    uint8_t _payloadType;
+    size_t _maxPayload;
+    uint16_t _seqNum;
+    std::vector<uint8_t> _headerSlab;
+    std::vector<EncodedSlice> _nals;
+    std::vector<PacketPlan> _plans;
+
+    void PlanPackets();
+    int BuildPackets(uint32_t timestamp, bool marker, std::vector<RtpPacketBuffers>& packets);
+  };
+
+  /**
+  * Encodes a 720p clip with the Realtime and Balanced H.264 presets, times
+  * the scalar and AVX2 start code searches over it, packetizes it, checks
+  * the NAL units reassemble from the packets and prints how many went in
+  * each kind of packet.
+  */
+  void RunH264RtpBenchmark(int frameCount);
+}
+
+#endif // SIPSORCERY_H264RTP_H
@@ -0,0 +1,141 @@
+#include "latencyhistogram.h"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace sipsorcery
+{
+  LatencyHistogram::LatencyHistogram()
+  {
+    Reset();
+  }
+
+  void LatencyHistogram::Record(int64_t micros)
+  {
+    if (micros < 0) {
+      micros = 0;
+    }
+
+    _buckets[GetBucketIndex((uint64_t)micros)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add((uint64_t)micros, std::memory_order_relaxed);
+
+    int64_t max = _max.load(std::memory_order_relaxed);
+    while (micros > max && !_max.compare_exchange_weak(max, micros, std::memory_order_relaxed)) {}
+  }
+
+  double LatencyHistogram::GetMeanMs() const
+  {
+    uint64_t count = GetCount();
+    return (count > 0) ? (double)_sum.load(std::memory_order_relaxed) / count / 1000.0 : 0;
+  }
+
+  double LatencyHistogram::GetPercentileMs(double percentile) const
+  {
+    return GetPercentile(percentile) / 1000.0;
+  }
+
+  uint64_t LatencyHistogram::GetPercentile(double percentile) const
+  {
+    uint64_t count = GetCount();
+    if (count == 0) {
+      return 0;
+    }
+
+    uint64_t target = std::max<uint64_t>(1, (uint64_t)(count * percentile / 100.0 + 0.5));
+    uint64_t seen = 0;
+    uint64_t max = (uint64_t)_max.load(std::memory_order_relaxed);
+
+    for (int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+      seen += _buckets[i].load(std::memory_order_relaxed);
+      if (seen >= target) {
+        // Never report more than the largest value actually seen.
+        return std::min<uint64_t>(GetBucketUpperBound(i), max);
+      }
+    }
+
+    return max;
+  }
+
+  HistogramSummary LatencyHistogram::GetSummary() const
+  {
+    uint64_t count = GetCount();
+
+    return HistogramSummary{ count,
+      (count > 0) ? (double)_sum.load(std::memory_order_relaxed) / count : 0,
+      (double)GetPercentile(50),
+      (double)GetPercentile(90),
+      (double)GetPercentile(99),
+      (double)_max.load(std::memory_order_relaxed) };
+  }
+
+  void LatencyHistogram::Reset()
+  {
+    for (auto& bucket : _buckets) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+    _count = 0;
+    _sum = 0;
+    _max = 0;
+  }
+
+  void LatencyHistogram::PrintHeader(std::ostream& os, const std::string& units)
+  {
+    os << std::left << std::setw(14) << "stage" << std::right
+      << std::setw(8) << "count" << std::setw(10) << "mean " + units << std::setw(10) << "p50 " + units
+      << std::setw(10) << "p90 " + units << std::setw(10) << "p99 " + units << std::setw(10) << "max " + units << std::endl;
+  }
+
+  void LatencyHistogram::Print(std::ostream& os, const std::string& name) const
+  {
+    Print(os, name, 1000.0);
+  }
+
+  void LatencyHistogram::Print(std::ostream& os, const std::string& name, double scale) const
+  {
+    PrintRow(os, name, GetSummary(), scale);
+  }
+
+  void LatencyHistogram::PrintRow(std::ostream& os, const std::string& name, const HistogramSummary& summary, double scale)
+  {
+    os << std::left << std::setw(14) << name << std::right
+      << std::fixed << std::setprecision(2)
+      << std::setw(8) << summary.Count
+      << std::setw(10) << summary.Mean / scale
+      << std::setw(10) << summary.P50 / scale
+      << std::setw(10) << summary.P90 / scale
+      << std::setw(10) << summary.P99 / scale
+      << std::setw(10) << summary.Max / scale << std::endl;
+  }
+
+  int LatencyHistogram::GetBucketIndex(uint64_t micros)
+  {
+    if (micros < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+      return (int)micros;
+    }
+
+    int exponent = 0;
+    for (uint64_t v = micros; v > 1; v >>= 1) {
+      exponent++;
+    }
+
+    int shift = exponent - LATENCY_HISTOGRAM_SUB_BUCKET_BITS;
+    int subBucket = (int)(micros >> shift) & (LATENCY_HISTOGRAM_SUB_BUCKETS - 1);
+    int index = LATENCY_HISTOGRAM_SUB_BUCKETS + shift * LATENCY_HISTOGRAM_SUB_BUCKETS + subBucket;
+
+    return std::min(index, LATENCY_HISTOGRAM_BUCKETS - 1);
+  }
+
+  uint64_t LatencyHistogram::GetBucketUpperBound(int index)
+  {
+    if (index < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+      return (uint64_t)index;
+    }
+
+    int shift = (index - LATENCY_HISTOGRAM_SUB_BUCKETS) / LATENCY_HISTOGRAM_SUB_BUCKETS;
+    int subBucket = (index - LATENCY_HISTOGRAM_SUB_BUCKETS) % LATENCY_HISTOGRAM_SUB_BUCKETS;
+    uint64_t lower = (uint64_t)(LATENCY_HISTOGRAM_SUB_BUCKETS + subBucket) << shift;
+
+    return lower + ((uint64_t)1 << shift) - 1;
+  }
+}
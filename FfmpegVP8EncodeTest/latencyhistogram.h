@@ -0,0 +1,118 @@
+//-----------------------------------------------------------------------------
+// Filename: latencyhistogram.h
+//
+// Description: Fixed memory histogram for latencies in microseconds. Values
+// under 8us get a bucket each, above that every power of two is split into 8
+// buckets, so any value is recorded to within 12.5% from 1us to over an hour.
+// Buckets are atomic counters, recording is a handful of instructions and
+// can be done from any thread while another reads the percentiles.
+//
+// Nothing in the bucketing is specific to time, a histogram can just as well
+// hold sizes in bytes. GetSummary and the Print overload with a scale work in
+// whatever unit was recorded.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_LATENCYHISTOGRAM_H
+#define SIPSORCERY_LATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 3
+#define LATENCY_HISTOGRAM_SUB_BUCKETS (1 << LATENCY_HISTOGRAM_SUB_BUCKET_BITS)
+#define LATENCY_HISTOGRAM_BUCKETS (LATENCY_HISTOGRAM_SUB_BUCKETS * 30)    // Up to 2^32us.
+
+namespace sipsorcery
+{
+  /**
+  * A point in time copy of a histogram's statistics, in the recorded units.
+  * Percentiles are the upper bound of the bucket they fall in.
+  */
+  struct HistogramSummary
+  {
+    uint64_t Count;
+    double Mean;
+    double P50;
+    double P90;
+    double P99;
+    double Max;
+  };
+
+  class LatencyHistogram
+  {
+  public:
+    LatencyHistogram();
+
+    void Record(int64_t micros);
+
+    void Record(std::chrono::steady_clock::duration duration)
+    {
+      Record(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    }
+
+    uint64_t GetCount() const { return _count.load(std::memory_order_relaxed); }
+    double GetMeanMs() const;
+    double GetMaxMs() const { return _max.load(std::memory_order_relaxed) / 1000.0; }
+
+    /**
+    * @param[in] percentile: 0 to 100.
+    * @@Returns the upper bound of the bucket the percentile falls in, in milliseconds.
+    */
+    double GetPercentileMs(double percentile) const;
+
+    /**
+    * @param[in] percentile: 0 to 100.
+    * @@Returns the upper bound of the bucket the percentile falls in, in the recorded units.
+    */
+    uint64_t GetPercentile(double percentile) const;
+
+    HistogramSummary GetSummary() const;
+
+    void Reset();
+
+    /**
+    * Writes the column headings for Print.
+    * @param[in] units: the units shown in the headings.
+    */
+    static void PrintHeader(std::ostream& os, const std::string& units = "ms");
+
+    /**
+    * Writes one table row with the count, mean, p50, p90, p99 and max.
+    */
+    void Print(std::ostream& os, const std::string& name) const;
+
+    /**
+    * Writes one table row with the values divided by scale, e.g. 1024 for
+    * sizes recorded in bytes shown in KB.
+    */
+    void Print(std::ostream& os, const std::string& name, double scale) const;
+
+    /**
+    * Writes a row for a summary from this or any other source.
+    */
+    static void PrintRow(std::ostream& os, const std::string& name, const HistogramSummary& summary, double scale);
+
+  private:
+    std::atomic<uint64_t> _buckets[LATENCY_HISTOGRAM_BUCKETS];
+    std::atomic<uint64_t> _count{ 0 };
+    std::atomic<uint64_t> _sum{ 0 };
+    std::atomic<int64_t> _max{ 0 };
+
+    static int GetBucketIndex(uint64_t micros);
+    static uint64_t GetBucketUpperBound(int index);
+  };
+}
+
+#endif // SIPSORCERY_LATENCYHISTOGRAM_H
@@ -0,0 +1,244 @@
+#include "mjpeggateway.h"
+
+#include <iostream>
+#include <random>
+
+namespace sipsorcery
+{
+  static const char* _histogramNames[(int)GatewayHistogram::Count] =
+  {
+    "assemble", "queue wait", "decode", "encode", "send", "end to end"
+  };
+
+  MjpegGatewayStream::MjpegGatewayStream(int listenPort, const std::string& dstAddress, int dstPort, int fps) :
+    _listenPort(listenPort), _fps(fps),
+    _jpegBuffers(MJPEG_GATEWAY_JPEG_BUFFERS),
+    _freeJpegs(MJPEG_GATEWAY_JPEG_BUFFERS, QueueDropPolicy::DropNewest),
+    _jpegQueue(MJPEG_GATEWAY_QUEUE_CAPACITY, QueueDropPolicy::DropOldest),
+    _socket(listenPort),
+    _decoder(AV_CODEC_ID_MJPEG, 1),
+    _payloader(std::random_device()(), VP8_DEFAULT_PAYLOAD_TYPE, RTP_DEFAULT_MTU),
+    _sender(dstAddress, dstPort)
+  {
+    for (auto& jpeg : _jpegBuffers) {
+      jpeg.Stream = this;
+      _freeJpegs.TryPush(&jpeg);
+    }
+
+    _packet = av_packet_alloc();
+
+    _socket.SetJpegFrameReadyCallback([this](std::vector<uint8_t>& jpeg, uint32_t timestamp, std::chrono::steady_clock::time_point firstPacketTime) {
+      OnJpegFrame(jpeg, timestamp, firstPacketTime);
+    });
+  }
+
+  MjpegGatewayStream::~MjpegGatewayStream()
+  {
+    Stop();
+
+    // The encoder can hold references to decoder surfaces, it goes first.
+    _encoder.reset();
+    _convertPool.reset();
+    sws_freeContext(_swsContext);
+    av_packet_free(&_packet);
+  }
+
+  void MjpegGatewayStream::Start()
+  {
+    _stopped = false;
+    _transcodeThread.reset(new std::thread(&MjpegGatewayStream::Transcode, this));
+    _socket.Start();
+  }
+
+  void MjpegGatewayStream::Stop()
+  {
+    _socket.Close();
+    _stopped.store(true, std::memory_order_release);
+
+    if (_transcodeThread != nullptr && _transcodeThread->joinable()) {
+      _transcodeThread->join();
+    }
+  }
+
+  /**
+  * Called on the receive thread with each complete JPEG. The frame's bytes
+  * are swapped into a free buffer and the socket gets that buffer's old
+  * storage back to assemble the next frame in.
+  */
+  void MjpegGatewayStream::OnJpegFrame(std::vector<uint8_t>& jpeg, uint32_t timestamp, std::chrono::steady_clock::time_point firstPacketTime)
+  {
+    _framesReceived++;
+
+    JpegBuffer* buffer = nullptr;
+    if (!_freeJpegs.TryPop(buffer)) {
+      // Every buffer is queued or being decoded.
+      _receiveDropped++;
+      return;
+    }
+
+    std::swap(buffer->Data, jpeg);
+    buffer->Length = buffer->Data.size();
+    buffer->Data.resize(buffer->Length + AV_INPUT_BUFFER_PADDING_SIZE, 0);
+    buffer->RtpTimestamp = timestamp;
+    buffer->FirstPacketTime = firstPacketTime;
+    buffer->ReceivedTime = std::chrono::steady_clock::now();
+
+    _jpegQueue.Push(buffer, [this](JpegBuffer* dropped) { _freeJpegs.TryPush(dropped); });
+  }
+
+  void MjpegGatewayStream::ReleaseJpeg(void* opaque, uint8_t*)
+  {
+    JpegBuffer* buffer = static_cast<JpegBuffer*>(opaque);
+    buffer->Stream->_freeJpegs.TryPush(buffer);
+  }
+
+  void MjpegGatewayStream::Transcode()
+  {
+    JpegBuffer* buffer = nullptr;
+
+    while (_jpegQueue.Pop(buffer, _stopped)) {
+      auto decodeStartTime = std::chrono::steady_clock::now();
+
+      // The buffer goes back on the free list when the decoder lets go of
+      // the packet, which may be before Decode returns, so take what's needed now.
+      uint32_t rtpTimestamp = buffer->RtpTimestamp;
+      auto firstPacketTime = buffer->FirstPacketTime;
+
+      _histograms[(int)GatewayHistogram::Assemble].Record(buffer->ReceivedTime - buffer->FirstPacketTime);
+      _histograms[(int)GatewayHistogram::QueueWait].Record(decodeStartTime - buffer->ReceivedTime);
+
+      _packet->buf = av_buffer_create(buffer->Data.data(), (int)buffer->Data.size(), ReleaseJpeg, buffer, 0);
+      if (_packet->buf == NULL) {
+        _freeJpegs.TryPush(buffer);
+        continue;
+      }
+      _packet->data = buffer->Data.data();
+      _packet->size = (int)buffer->Length;
+
+      int res = _decoder.Decode(_packet, [&](AVFrame* frame) {
+        EncodeFrame(frame, rtpTimestamp, firstPacketTime, decodeStartTime);
+      });
+      av_packet_unref(_packet);
+
+      if (res < 0) {
+        _decodeErrors++;
+      }
+    }
+  }
+
+  void MjpegGatewayStream::EncodeFrame(AVFrame* frame, uint32_t rtpTimestamp, std::chrono::steady_clock::time_point firstPacketTime,
+    std::chrono::steady_clock::time_point decodeStartTime)
+  {
+    auto encodeStartTime = std::chrono::steady_clock::now();
+    _histograms[(int)GatewayHistogram::Decode].Record(encodeStartTime - decodeStartTime);
+
+    if (_encoder == nullptr || _encoder->GetWidth() != frame->width || _encoder->GetHeight() != frame->height) {
+      std::cout << "Gateway stream on port " << _listenPort << " encoding " << frame->width << "x" << frame->height << "." << std::endl;
+      _encoder.reset(new VideoEncoder(AV_CODEC_ID_VP8, frame->width, frame->height, _fps, EncoderPreset::Realtime, MJPEG_GATEWAY_ENCODER_THREADS));
+    }
+
+    AVFrame* encodeFrame = ConvertFrame(frame);
+    if (encodeFrame == nullptr) {
+      _decodeErrors++;
+      return;
+    }
+
+    encodeFrame->pts = _frameCount++;
+    // The JPEG decoder marks every frame as intra, which the encoder would take as a keyframe request.
+    encodeFrame->pict_type = AV_PICTURE_TYPE_NONE;
+    encodeFrame->key_frame = 0;
+
+    auto encodeEndTime = encodeStartTime;
+
+    _encoder->Encode(encodeFrame, [&](AVPacket* pkt) {
+      encodeEndTime = std::chrono::steady_clock::now();
+
+      // JPEG and VP8 both use a 90kHz clock so the camera's timestamps carry straight over.
+      _payloader.Packetize(pkt->data, pkt->size, rtpTimestamp, 0, _rtpPackets);
+      _sender.Send(_rtpPackets);
+
+      auto sendEndTime = std::chrono::steady_clock::now();
+      _framesSent++;
+
+      _histograms[(int)GatewayHistogram::Encode].Record(encodeEndTime - encodeStartTime);
+      _histograms[(int)GatewayHistogram::Send].Record(sendEndTime - encodeEndTime);
+      _histograms[(int)GatewayHistogram::EndToEnd].Record(sendEndTime - firstPacketTime);
+    });
+
+    if (encodeFrame != frame) {
+      _convertPool->Return(encodeFrame);
+    }
+  }
+
+  /**
+  * 4:2:0 JPEGs are relabelled and passed straight through, anything else is
+  * converted into a pooled frame.
+  */
+  AVFrame* MjpegGatewayStream::ConvertFrame(AVFrame* frame)
+  {
+    if (frame->format == AV_PIX_FMT_YUVJ420P || frame->format == AV_PIX_FMT_YUV420P) {
+      frame->format = AV_PIX_FMT_YUV420P;
+      return frame;
+    }
+
+    if (_convertPool == nullptr || _convertPool->GetWidth() != frame->width || _convertPool->GetHeight() != frame->height) {
+      _convertPool.reset(new FramePool(frame->width, frame->height, AV_PIX_FMT_YUV420P, 2));
+    }
+
+    _swsContext = sws_getCachedContext(_swsContext, frame->width, frame->height, (AVPixelFormat)frame->format,
+      frame->width, frame->height, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    if (_swsContext == nullptr) {
+      return nullptr;
+    }
+
+    AVFrame* converted = _convertPool->Get();
+    sws_scale(_swsContext, frame->data, frame->linesize, 0, frame->height, converted->data, converted->linesize);
+    return converted;
+  }
+
+  void MjpegGatewayStream::PrintStats()
+  {
+    PoolStats surfaces = _decoder.GetSurfaceStats();
+
+    std::cout << "Stream " << _listenPort << ": received " << _framesReceived
+      << ", dropped at receive " << _receiveDropped
+      << ", at queue " << _jpegQueue.GetDroppedCount()
+      << ", decode errors " << _decodeErrors
+      << ", sent " << _framesSent
+      << ", RTP packets " << _sender.GetPacketsSent()
+      << ", decoder surfaces allocated " << surfaces.Allocations << " for " << surfaces.Acquisitions << " frames." << std::endl;
+
+    LatencyHistogram::PrintHeader(std::cout);
+    for (int i = 0; i < (int)GatewayHistogram::Count; i++) {
+      _histograms[i].Print(std::cout, _histogramNames[i]);
+    }
+  }
+
+  void RunMjpegGateway(int listenBasePort, int streamCount, const std::string& dstAddress, int dstBasePort,
+    int fps, int durationSeconds)
+  {
+    std::vector<std::unique_ptr<MjpegGatewayStream>> streams;
+
+    for (int i = 0; i < streamCount; i++) {
+      streams.push_back(std::unique_ptr<MjpegGatewayStream>(
+        new MjpegGatewayStream(listenBasePort + i, dstAddress, dstBasePort + 2 * i, fps)));
+    }
+
+    std::cout << "MJPEG to VP8 gateway, " << streamCount << " streams, listening on " << listenBasePort << " to "
+      << listenBasePort + streamCount - 1 << ", sending to " << dstAddress << ":" << dstBasePort << " for " << durationSeconds << "s." << std::endl;
+
+    for (auto& stream : streams) {
+      stream->Start();
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(durationSeconds));
+
+    for (auto& stream : streams) {
+      stream->Stop();
+    }
+
+    for (auto& stream : streams) {
+      stream->PrintStats();
+    }
+  }
+}
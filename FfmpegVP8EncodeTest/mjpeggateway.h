@@ -0,0 +1,170 @@
+//-----------------------------------------------------------------------------
+// Filename: mjpeggateway.h
+//
+// Description: Gateway that takes MJPEG over RTP, RFC 2435, from cameras and
+// sends it on as VP8 over RTP, RFC 7741, for WebRTC viewers. Each stream has
+// two threads:
+//
+//  receive: the MjpegReceiver RtpSocket reassembles the JPEG frames and the
+//           gateway swaps each one into a pooled buffer, no copy.
+//  transcode: decodes the JPEG into a pooled surface, encodes it to VP8 and
+//             packetizes and sends it.
+//
+// The two are joined by a bounded queue that drops the oldest frame, if the
+// transcode falls behind the camera the viewer gets the newest frame rather
+// than a growing delay. The JPEG buffer is handed to the decoder wrapped with
+// av_buffer_create and the decoded planes go to the encoder as is, so the
+// only copies of the picture are the decoder writing it and libvpx reading it.
+//
+// RTP/JPEG type 1 frames decode as 4:2:0 and are passed to the encoder
+// without conversion. The samples are full range JPEG values, VP8 has no way
+// to signal that so viewers see slightly more contrast than the camera sent.
+// Type 0, 4:2:2, frames are converted with swscale.
+//
+// Latency is measured from the arrival of a frame's first RTP packet to the
+// last VP8 packet being sent, along with the time spent in each step.
+//
+// A test source:
+//  ffmpeg -re -f lavfi -i testsrc=size=640x480:rate=30 -pix_fmt yuvj420p -c:v mjpeg -f rtp rtp://127.0.0.1:10100
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_MJPEGGATEWAY_H
+#define SIPSORCERY_MJPEGGATEWAY_H
+
+#include "boundedqueue.h"
+#include "framepool.h"
+#include "latencyhistogram.h"
+#include "rtpsender.h"
+#include "rtpsocket.h"
+#include "videodecoder.h"
+#include "videoencoder.h"
+#include "vp8rtp.h"
+
+extern "C"
+{
+#include <libswscale\swscale.h>
+}
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define MJPEG_GATEWAY_JPEG_BUFFERS 8
+#define MJPEG_GATEWAY_QUEUE_CAPACITY 2
+#define MJPEG_GATEWAY_ENCODER_THREADS 1     // Streams scale across cores, one thread each keeps per frame latency predictable.
+
+namespace sipsorcery
+{
+  class MjpegGatewayStream;
+
+  /**
+  * A reassembled JPEG frame. The data is padded with zeros as libavcodec
+  * requires so it can be given to the decoder without copying.
+  */
+  struct JpegBuffer
+  {
+    std::vector<uint8_t> Data;
+    size_t Length;
+    uint32_t RtpTimestamp;
+    std::chrono::steady_clock::time_point FirstPacketTime;
+    std::chrono::steady_clock::time_point ReceivedTime;
+    MjpegGatewayStream* Stream;
+  };
+
+  enum class GatewayHistogram
+  {
+    Assemble,
+    QueueWait,
+    Decode,
+    Encode,
+    Send,
+    EndToEnd,
+    Count
+  };
+
+  class MjpegGatewayStream
+  {
+  public:
+    /**
+    * @param[in] listenPort: the loopback UDP port to receive the MJPEG RTP stream on.
+    * @param[in] dstAddress: the IPv4 address to send the VP8 RTP stream to.
+    * @param[in] dstPort: the UDP port to send the VP8 RTP stream to.
+    * @param[in] fps: the camera's nominal frame rate, used for the encoder's rate control.
+    * Throws std::runtime_error if the decoder or send socket cannot be created.
+    */
+    MjpegGatewayStream(int listenPort, const std::string& dstAddress, int dstPort, int fps);
+    ~MjpegGatewayStream();
+
+    MjpegGatewayStream(const MjpegGatewayStream&) = delete;
+    MjpegGatewayStream& operator=(const MjpegGatewayStream&) = delete;
+
+    void Start();
+
+    /**
+    * Stops receiving, then lets the transcode thread finish what is queued.
+    */
+    void Stop();
+
+    void PrintStats();
+
+    int GetListenPort() const { return _listenPort; }
+    const LatencyHistogram& GetHistogram(GatewayHistogram histogram) const { return _histograms[(int)histogram]; }
+
+  private:
+    int _listenPort;
+    int _fps;
+
+    std::vector<JpegBuffer> _jpegBuffers;
+    BoundedQueue<JpegBuffer*> _freeJpegs;
+    BoundedQueue<JpegBuffer*> _jpegQueue;
+
+    RtpSocket _socket;
+    VideoDecoder _decoder;
+    std::unique_ptr<VideoEncoder> _encoder;       // Created once the frame size is known.
+    std::unique_ptr<FramePool> _convertPool;      // Only for JPEGs that don't decode to 4:2:0.
+    SwsContext* _swsContext{ nullptr };
+    Vp8RtpPayloader _payloader;
+    RtpSender _sender;
+    AVPacket* _packet{ nullptr };
+    std::vector<RtpPacketBuffers> _rtpPackets;
+
+    std::unique_ptr<std::thread> _transcodeThread;
+    std::atomic<bool> _stopped{ false };
+    int64_t _frameCount{ 0 };
+    std::atomic<uint64_t> _framesReceived{ 0 };
+    std::atomic<uint64_t> _receiveDropped{ 0 };
+    uint64_t _decodeErrors{ 0 };
+    uint64_t _framesSent{ 0 };
+
+    LatencyHistogram _histograms[(int)GatewayHistogram::Count];
+
+    void OnJpegFrame(std::vector<uint8_t>& jpeg, uint32_t timestamp, std::chrono::steady_clock::time_point firstPacketTime);
+    void Transcode();
+    void EncodeFrame(AVFrame* frame, uint32_t rtpTimestamp, std::chrono::steady_clock::time_point firstPacketTime,
+      std::chrono::steady_clock::time_point decodeStartTime);
+    AVFrame* ConvertFrame(AVFrame* frame);
+
+    static void ReleaseJpeg(void* opaque, uint8_t* data);
+  };
+
+  /**
+  * Runs a gateway stream per listen port, from listenBasePort up, sending VP8
+  * to dstBasePort and up in steps of 2 so RTCP can have the odd ports.
+  */
+  void RunMjpegGateway(int listenBasePort, int streamCount, const std::string& dstAddress, int dstBasePort,
+    int fps, int durationSeconds);
+}
+
+#endif // SIPSORCERY_MJPEGGATEWAY_H
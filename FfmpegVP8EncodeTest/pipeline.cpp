@@ -0,0 +1,269 @@
+#include "pipeline.h"
+#include "encoderbench.h"
+
+#include <iostream>
+#include <random>
+#include <thread>
+
+#define PIPELINE_RTP_CLOCK_RATE 90000
+#define PIPELINE_TEST_WIDTH 640
+#define PIPELINE_TEST_HEIGHT 480
+#define PIPELINE_TEST_CLIP_FRAMES 30
+
+namespace sipsorcery
+{
+  static const char* _histogramNames[(int)PipelineHistogram::Count] =
+  {
+    "convert wait", "convert", "encode wait", "encode", "send wait", "send", "end to end"
+  };
+
+  EncodePipeline::EncodePipeline(int width, int height, int fps, const std::string& dstAddress, int dstPort) :
+    _width(width), _height(height), _fps(fps),
+    _capturePool(width, height, AV_PIX_FMT_BGRA, PIPELINE_MAX_IN_FLIGHT),
+    _convertPool(width, height, AV_PIX_FMT_YUV420P, PIPELINE_MAX_IN_FLIGHT),
+    _packetPool(PIPELINE_MAX_IN_FLIGHT),
+    _frames(PIPELINE_MAX_IN_FLIGHT),
+    _freeFrames(PIPELINE_MAX_IN_FLIGHT, QueueDropPolicy::DropNewest),
+    _convertQueue(PIPELINE_QUEUE_CAPACITY, QueueDropPolicy::DropOldest),
+    _encodeQueue(PIPELINE_QUEUE_CAPACITY, QueueDropPolicy::DropOldest),
+    _sendQueue(PIPELINE_QUEUE_CAPACITY, QueueDropPolicy::Block),
+    _converter(width, height, AV_PIX_FMT_BGRA, AV_PIX_FMT_YUV420P),
+    _encoder(AV_CODEC_ID_VP8, width, height, fps, EncoderPreset::Realtime),
+    _payloader(std::random_device()(), VP8_DEFAULT_PAYLOAD_TYPE, RTP_DEFAULT_MTU),
+    _sender(dstAddress, dstPort)
+  {
+    for (auto& frame : _frames) {
+      frame.Captured = nullptr;
+      frame.Converted = nullptr;
+      frame.Packet = nullptr;
+      _freeFrames.TryPush(&frame);
+    }
+
+    // Render the clip the source plays back in BGRA so the pipeline has the
+    // same colour conversion to do as a screen or camera capture.
+    for (int i = 0; i < PIPELINE_TEST_CLIP_FRAMES; i++) {
+      AVFrame* bgra = av_frame_alloc();
+      bgra->format = AV_PIX_FMT_BGRA;
+      bgra->width = width;
+      bgra->height = height;
+      av_frame_get_buffer(bgra, FRAME_POOL_ALIGNMENT);
+      FillTestFrame(bgra, i);
+      _clip.push_back(bgra);
+    }
+  }
+
+  EncodePipeline::~EncodePipeline()
+  {
+    for (auto& frame : _clip) {
+      av_frame_free(&frame);
+    }
+  }
+
+  void EncodePipeline::Release(PipelineFrame* frame)
+  {
+    if (frame->Captured != nullptr) {
+      _capturePool.Return(frame->Captured);
+      frame->Captured = nullptr;
+    }
+
+    if (frame->Converted != nullptr) {
+      _convertPool.Return(frame->Converted);
+      frame->Converted = nullptr;
+    }
+
+    if (frame->Packet != nullptr) {
+      _packetPool.Return(frame->Packet);
+      frame->Packet = nullptr;
+    }
+
+    _freeFrames.TryPush(frame);
+  }
+
+  void EncodePipeline::Run(int frameCount)
+  {
+    _sourceDone = false;
+    _convertDone = false;
+    _encodeDone = false;
+
+    std::thread send(&EncodePipeline::SendStage, this);
+    std::thread encode(&EncodePipeline::EncodeStage, this);
+    std::thread convert(&EncodePipeline::ConvertStage, this);
+    std::thread source(&EncodePipeline::SourceStage, this, frameCount);
+
+    source.join();
+    convert.join();
+    encode.join();
+    send.join();
+  }
+
+  /**
+  * Plays the clip back at the frame rate as if it were being captured. If
+  * every frame is still somewhere in the pipeline the capture is dropped,
+  * the same as a camera overwriting a buffer nobody has collected.
+  */
+  void EncodePipeline::SourceStage(int frameCount)
+  {
+    auto release = [this](PipelineFrame* frame) { Release(frame); };
+    auto frameInterval = std::chrono::microseconds(1000000 / _fps);
+    auto nextFrame = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < frameCount; i++) {
+      PipelineFrame* frame = nullptr;
+
+      if (!_freeFrames.TryPop(frame)) {
+        _sourceDropped++;
+      }
+      else {
+        frame->Index = i;
+        frame->Captured = _capturePool.Get();
+        av_frame_copy(frame->Captured, _clip[i % _clip.size()]);
+        frame->CaptureTime = std::chrono::steady_clock::now();
+
+        _convertQueue.Push(frame, release);
+      }
+
+      nextFrame += frameInterval;
+      std::this_thread::sleep_until(nextFrame);
+    }
+
+    _sourceDone.store(true, std::memory_order_release);
+  }
+
+  void EncodePipeline::ConvertStage()
+  {
+    auto release = [this](PipelineFrame* frame) { Release(frame); };
+    PipelineFrame* frame = nullptr;
+
+    while (_convertQueue.Pop(frame, _sourceDone)) {
+      frame->ConvertStartTime = std::chrono::steady_clock::now();
+
+      frame->Converted = _convertPool.Get();
+      _converter.Convert(frame->Captured, frame->Converted);
+      frame->Converted->pts = frame->Index;
+
+      _capturePool.Return(frame->Captured);
+      frame->Captured = nullptr;
+
+      frame->ConvertEndTime = std::chrono::steady_clock::now();
+      _encodeQueue.Push(frame, release);
+    }
+
+    _convertDone.store(true, std::memory_order_release);
+  }
+
+  /**
+  * Frames waiting on the encoder are kept by pts so each packet can be matched
+  * back to its frame. A frame older than the packet that comes out was dropped
+  * by the encoder's rate control.
+  */
+  void EncodePipeline::EncodeStage()
+  {
+    auto release = [this](PipelineFrame* frame) { Release(frame); };
+    std::map<int64_t, PipelineFrame*> pending;
+
+    auto onPacket = [&](AVPacket* pkt) {
+      auto match = pending.find(pkt->pts);
+      if (match == pending.end()) {
+        return;
+      }
+
+      for (auto it = pending.begin(); it != match; it = pending.erase(it)) {
+        _encoderDropped++;
+        Release(it->second);
+      }
+
+      PipelineFrame* frame = match->second;
+      pending.erase(match);
+
+      frame->Packet = _packetPool.Get();
+      av_packet_move_ref(frame->Packet, pkt);
+      frame->EncodeEndTime = std::chrono::steady_clock::now();
+
+      _sendQueue.Push(frame, release);
+    };
+
+    PipelineFrame* frame = nullptr;
+
+    while (_encodeQueue.Pop(frame, _convertDone)) {
+      frame->EncodeStartTime = std::chrono::steady_clock::now();
+      pending[frame->Index] = frame;
+
+      int encodeRes = _encoder.Encode(frame->Converted, frame->ConvertEndTime, onPacket);
+
+      // The encoder has taken its own reference to anything it needs to keep.
+      if (frame->Converted != nullptr) {
+        _convertPool.Return(frame->Converted);
+        frame->Converted = nullptr;
+      }
+
+      if (encodeRes < 0) {
+        std::cerr << "Pipeline encode failed for frame " << frame->Index << ", " << VideoEncoder::GetErrorString(encodeRes) << "." << std::endl;
+      }
+    }
+
+    _encoder.Flush(onPacket);
+
+    for (auto& entry : pending) {
+      _encoderDropped++;
+      Release(entry.second);
+    }
+
+    _encodeDone.store(true, std::memory_order_release);
+  }
+
+  void EncodePipeline::SendStage()
+  {
+    std::vector<RtpPacketBuffers> packets;
+    PipelineFrame* frame = nullptr;
+
+    while (_sendQueue.Pop(frame, _encodeDone)) {
+      frame->SendStartTime = std::chrono::steady_clock::now();
+
+      uint32_t timestamp = (uint32_t)(frame->Index * PIPELINE_RTP_CLOCK_RATE / _fps);
+      _payloader.Packetize(frame->Packet->data, frame->Packet->size, timestamp, 0, packets);
+      _sender.Send(packets);
+
+      frame->SendEndTime = std::chrono::steady_clock::now();
+      _framesSent++;
+
+      _histograms[(int)PipelineHistogram::ConvertWait].Record(frame->ConvertStartTime - frame->CaptureTime);
+      _histograms[(int)PipelineHistogram::Convert].Record(frame->ConvertEndTime - frame->ConvertStartTime);
+      _histograms[(int)PipelineHistogram::EncodeWait].Record(frame->EncodeStartTime - frame->ConvertEndTime);
+      _histograms[(int)PipelineHistogram::Encode].Record(frame->EncodeEndTime - frame->EncodeStartTime);
+      _histograms[(int)PipelineHistogram::SendWait].Record(frame->SendStartTime - frame->EncodeEndTime);
+      _histograms[(int)PipelineHistogram::Send].Record(frame->SendEndTime - frame->SendStartTime);
+      _histograms[(int)PipelineHistogram::EndToEnd].Record(frame->SendEndTime - frame->CaptureTime);
+
+      Release(frame);
+    }
+  }
+
+  void EncodePipeline::PrintStats()
+  {
+    std::cout << "Frames sent " << _framesSent
+      << ", dropped at source " << _sourceDropped
+      << ", at convert queue " << _convertQueue.GetDroppedCount()
+      << ", at encode queue " << _encodeQueue.GetDroppedCount()
+      << ", by encoder " << _encoderDropped
+      << ", RTP packets " << _sender.GetPacketsSent()
+      << ", bytes " << _sender.GetBytesSent() << "." << std::endl;
+
+    LatencyHistogram::PrintHeader(std::cout);
+    for (int i = 0; i < (int)PipelineHistogram::Count; i++) {
+      _histograms[i].Print(std::cout, _histogramNames[i]);
+    }
+
+    _encoder.GetTelemetry().Print(std::cout);
+  }
+
+  void RunPipelineTest(const std::string& dstAddress, int dstPort, int fps, int frameCount)
+  {
+    EncodePipeline pipeline(PIPELINE_TEST_WIDTH, PIPELINE_TEST_HEIGHT, fps, dstAddress, dstPort);
+
+    std::cout << "Pipeline " << PIPELINE_TEST_WIDTH << "x" << PIPELINE_TEST_HEIGHT << " VP8 " << frameCount << " frames at "
+      << fps << " fps to " << dstAddress << ":" << dstPort << "." << std::endl;
+
+    pipeline.Run(frameCount);
+    pipeline.PrintStats();
+  }
+}
@@ -0,0 +1,154 @@
+//-----------------------------------------------------------------------------
+// Filename: pipeline.h
+//
+// Description: Live encode pipeline with each stage on its own thread:
+//
+//  source -> [queue] -> convert -> [queue] -> encode -> [queue] -> packetize/send
+//
+// The source captures BGRA frames at the frame rate, convert produces I420,
+// encode produces VP8 and the last stage payloads to RTP and sends. Stages
+// are joined by lock free bounded queues. The raw frame queues drop the
+// oldest frame when full, a stalled encoder then costs frames rather than
+// latency, and the encoded packet queue blocks as losing an encoded frame
+// would break every frame that references it.
+//
+// Every frame is stamped as it enters and leaves each stage and the send
+// stage records the queue wait and the work time for each stage, plus the
+// end to end time, in latency histograms.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_PIPELINE_H
+#define SIPSORCERY_PIPELINE_H
+
+#include "boundedqueue.h"
+#include "colorconvert.h"
+#include "framepool.h"
+#include "latencyhistogram.h"
+#include "rtpsender.h"
+#include "videoencoder.h"
+#include "vp8rtp.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#define PIPELINE_QUEUE_CAPACITY 4
+#define PIPELINE_MAX_IN_FLIGHT 16       // Frames anywhere in the pipeline, the source drops when they are all in use.
+
+namespace sipsorcery
+{
+  /**
+  * A frame on its way through the pipeline along with the time it reached
+  * each point.
+  */
+  struct PipelineFrame
+  {
+    int64_t Index;
+    AVFrame* Captured;      // BGRA from the source.
+    AVFrame* Converted;     // I420 for the encoder.
+    AVPacket* Packet;       // VP8 for the sender.
+
+    std::chrono::steady_clock::time_point CaptureTime;
+    std::chrono::steady_clock::time_point ConvertStartTime;
+    std::chrono::steady_clock::time_point ConvertEndTime;
+    std::chrono::steady_clock::time_point EncodeStartTime;
+    std::chrono::steady_clock::time_point EncodeEndTime;
+    std::chrono::steady_clock::time_point SendStartTime;
+    std::chrono::steady_clock::time_point SendEndTime;
+  };
+
+  enum class PipelineHistogram
+  {
+    ConvertWait,
+    Convert,
+    EncodeWait,
+    Encode,
+    SendWait,
+    Send,
+    EndToEnd,
+    Count
+  };
+
+  class EncodePipeline
+  {
+  public:
+    /**
+    * @param[in] width: the width of the captured frames.
+    * @param[in] height: the height of the captured frames.
+    * @param[in] fps: the capture frame rate.
+    * @param[in] dstAddress: the IPv4 address to send the RTP stream to.
+    * @param[in] dstPort: the UDP port to send the RTP stream to.
+    * Throws std::runtime_error if the encoder or socket cannot be created.
+    */
+    EncodePipeline(int width, int height, int fps, const std::string& dstAddress, int dstPort);
+    ~EncodePipeline();
+
+    EncodePipeline(const EncodePipeline&) = delete;
+    EncodePipeline& operator=(const EncodePipeline&) = delete;
+
+    /**
+    * Runs the pipeline until the source has produced frameCount frames and
+    * everything has drained through.
+    */
+    void Run(int frameCount);
+
+    void PrintStats();
+
+    const LatencyHistogram& GetHistogram(PipelineHistogram histogram) const { return _histograms[(int)histogram]; }
+
+  private:
+    int _width;
+    int _height;
+    int _fps;
+
+    FramePool _capturePool;
+    FramePool _convertPool;
+    PacketPool _packetPool;
+    std::vector<AVFrame*> _clip;                // Pre-rendered BGRA frames the source "captures" from.
+    std::vector<PipelineFrame> _frames;
+    BoundedQueue<PipelineFrame*> _freeFrames;
+
+    BoundedQueue<PipelineFrame*> _convertQueue;
+    BoundedQueue<PipelineFrame*> _encodeQueue;
+    BoundedQueue<PipelineFrame*> _sendQueue;
+
+    ColorConverter _converter;
+    VideoEncoder _encoder;
+    Vp8RtpPayloader _payloader;
+    RtpSender _sender;
+
+    std::atomic<bool> _sourceDone{ false };
+    std::atomic<bool> _convertDone{ false };
+    std::atomic<bool> _encodeDone{ false };
+    uint64_t _sourceDropped{ 0 };
+    uint64_t _encoderDropped{ 0 };
+    uint64_t _framesSent{ 0 };
+
+    LatencyHistogram _histograms[(int)PipelineHistogram::Count];
+
+    void SourceStage(int frameCount);
+    void ConvertStage();
+    void EncodeStage();
+    void SendStage();
+    void Release(PipelineFrame* frame);
+  };
+
+  /**
+  * Runs the pipeline at 640x480 for the given number of frames, streaming to
+  * dstAddress:dstPort, and prints the per stage latencies.
+  */
+  void RunPipelineTest(const std::string& dstAddress, int dstPort, int fps, int frameCount);
+}
+
+#endif // SIPSORCERY_PIPELINE_H
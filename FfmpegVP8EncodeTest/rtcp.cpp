@@ -0,0 +1,462 @@
+#include "rtcp.h"
+#include "rtpsender.h"
+
+#include <algorithm>
+
+#define RTCP_VERSION 2
+#define TRANSPORT_CC_SYMBOL_NOT_RECEIVED 0
+#define TRANSPORT_CC_SYMBOL_SMALL_DELTA 1
+#define TRANSPORT_CC_SYMBOL_LARGE_DELTA 2
+#define TRANSPORT_CC_VECTOR_SYMBOLS 7       // Two bit symbols in a status vector chunk.
+#define TRANSPORT_CC_MAX_RUN_LENGTH 8191
+#define RTP_ONE_BYTE_EXTENSION_PROFILE 0xBEDE
+
+namespace sipsorcery
+{
+  static inline uint16_t Read16(const uint8_t* buf)
+  {
+    return (uint16_t)(buf[0] << 8 | buf[1]);
+  }
+
+  static inline uint32_t Read24(const uint8_t* buf)
+  {
+    return (uint32_t)buf[0] << 16 | buf[1] << 8 | buf[2];
+  }
+
+  static inline uint32_t Read32(const uint8_t* buf)
+  {
+    return (uint32_t)buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+  }
+
+  static inline void Write16(uint8_t* buf, uint16_t val)
+  {
+    buf[0] = val >> 8 & 0xff;
+    buf[1] = val & 0xff;
+  }
+
+  static inline void Write24(uint8_t* buf, uint32_t val)
+  {
+    buf[0] = val >> 16 & 0xff;
+    buf[1] = val >> 8 & 0xff;
+    buf[2] = val & 0xff;
+  }
+
+  static inline void Write32(uint8_t* buf, uint32_t val)
+  {
+    buf[0] = val >> 24 & 0xff;
+    buf[1] = val >> 16 & 0xff;
+    buf[2] = val >> 8 & 0xff;
+    buf[3] = val & 0xff;
+  }
+
+  static inline int64_t FloorDiv(int64_t num, int64_t den)
+  {
+    int64_t quotient = num / den;
+    return (num % den != 0 && num < 0) ? quotient - 1 : quotient;
+  }
+
+  /**
+  * Writes the common header, the length is the packet's total length in
+  * bytes, a multiple of 4.
+  */
+  static void WriteRtcpHeader(uint8_t* buf, bool padding, int count, uint8_t packetType, size_t length)
+  {
+    buf[0] = (uint8_t)(RTCP_VERSION << 6 | (padding ? 0x20 : 0x00) | (count & 0x1f));
+    buf[1] = packetType;
+    Write16(buf + 2, (uint16_t)(length / 4 - 1));
+  }
+
+  static void WriteReportBlock(uint8_t* buf, const RtcpReportBlock& block)
+  {
+    Write32(buf, block.Ssrc);
+    buf[4] = block.FractionLost;
+    Write24(buf + 5, (uint32_t)block.CumulativeLost & 0xffffff);
+    Write32(buf + 8, block.HighestSeqNum);
+    Write32(buf + 12, block.Jitter);
+    Write32(buf + 16, block.LastSr);
+    Write32(buf + 20, block.DelaySinceLastSr);
+  }
+
+  static void ReadReportBlock(const uint8_t* buf, RtcpReportBlock& block)
+  {
+    block.Ssrc = Read32(buf);
+    block.FractionLost = buf[4];
+    uint32_t lost = Read24(buf + 5);
+    block.CumulativeLost = (lost & 0x800000) ? (int32_t)(lost | 0xff000000) : (int32_t)lost;
+    block.HighestSeqNum = Read32(buf + 8);
+    block.Jitter = Read32(buf + 12);
+    block.LastSr = Read32(buf + 16);
+    block.DelaySinceLastSr = Read32(buf + 20);
+  }
+
+  /**
+  * Reads the body of a transport-cc feedback packet, after the common
+  * header. The status chunks are expanded to one symbol per packet before
+  * the deltas, which follow the last chunk, are read.
+  */
+  static bool ParseTransportFeedback(const uint8_t* buf, size_t length, RtcpTransportFeedback& feedback)
+  {
+    if (length < RTCP_TRANSPORT_CC_HEADER_LENGTH - RTCP_HEADER_LENGTH) {
+      return false;
+    }
+
+    feedback.SenderSsrc = Read32(buf);
+    feedback.MediaSsrc = Read32(buf + 4);
+    uint16_t baseSeqNum = Read16(buf + 8);
+    uint16_t statusCount = Read16(buf + 10);
+    feedback.ReferenceTime = Read24(buf + 12);
+    feedback.FeedbackCount = buf[15];
+
+    size_t posn = RTCP_TRANSPORT_CC_HEADER_LENGTH - RTCP_HEADER_LENGTH;
+    std::vector<uint8_t> symbols;
+    symbols.reserve(statusCount);
+
+    while (symbols.size() < statusCount) {
+      if (posn + 2 > length) {
+        return false;
+      }
+
+      uint16_t chunk = Read16(buf + posn);
+      posn += 2;
+
+      if ((chunk & 0x8000) == 0) {
+        // Run length chunk.
+        uint8_t symbol = chunk >> 13 & 0x03;
+        size_t run = std::min<size_t>(chunk & 0x1fff, statusCount - symbols.size());
+        symbols.insert(symbols.end(), run, symbol);
+      }
+      else if ((chunk & 0x4000) == 0) {
+        // One bit status vector, received or not, a received packet has a one byte delta.
+        for (int i = 13; i >= 0 && symbols.size() < statusCount; i--) {
+          symbols.push_back(chunk >> i & 0x01);
+        }
+      }
+      else {
+        for (int i = 12; i >= 0 && symbols.size() < statusCount; i -= 2) {
+          symbols.push_back(chunk >> i & 0x03);
+        }
+      }
+    }
+
+    feedback.Packets.resize(statusCount);
+    int64_t ticks = (int64_t)feedback.ReferenceTime * (RTCP_TRANSPORT_CC_REFERENCE_MICROS / RTCP_TRANSPORT_CC_DELTA_MICROS);
+
+    for (size_t i = 0; i < statusCount; i++) {
+      RtcpPacketArrival& packet = feedback.Packets[i];
+      packet.SeqNum = (uint16_t)(baseSeqNum + i);
+      packet.Received = symbols[i] != TRANSPORT_CC_SYMBOL_NOT_RECEIVED;
+      packet.ArrivalMicros = 0;
+
+      if (symbols[i] == TRANSPORT_CC_SYMBOL_SMALL_DELTA) {
+        if (posn + 1 > length) {
+          return false;
+        }
+        ticks += buf[posn++];
+      }
+      else if (symbols[i] == TRANSPORT_CC_SYMBOL_LARGE_DELTA) {
+        if (posn + 2 > length) {
+          return false;
+        }
+        ticks += (int16_t)Read16(buf + posn);
+        posn += 2;
+      }
+      else if (symbols[i] != TRANSPORT_CC_SYMBOL_NOT_RECEIVED) {
+        return false;
+      }
+
+      if (packet.Received) {
+        packet.ArrivalMicros = ticks * RTCP_TRANSPORT_CC_DELTA_MICROS;
+      }
+    }
+
+    return true;
+  }
+
+  void RtcpCompound::Clear()
+  {
+    HasSenderInfo = false;
+    SenderSsrc = 0;
+    SenderInfo = RtcpSenderInfo{};
+    ReportBlocks.clear();
+    PliSsrcs.clear();
+    TransportFeedback.clear();
+  }
+
+  bool IsRtcpPacket(const uint8_t* buf, size_t length)
+  {
+    return length >= RTCP_HEADER_LENGTH && (buf[0] >> 6) == RTCP_VERSION && buf[1] >= 192 && buf[1] <= 223;
+  }
+
+  bool ParseRtcpCompound(const uint8_t* buf, size_t length, RtcpCompound& compound)
+  {
+    compound.Clear();
+
+    size_t posn = 0;
+
+    while (posn < length) {
+      if (!IsRtcpPacket(buf + posn, length - posn)) {
+        return false;
+      }
+
+      const uint8_t* hdr = buf + posn;
+      int count = hdr[0] & 0x1f;
+      uint8_t packetType = hdr[1];
+      size_t packetLength = ((size_t)Read16(hdr + 2) + 1) * 4;
+
+      if (posn + packetLength > length) {
+        return false;
+      }
+
+      const uint8_t* body = hdr + RTCP_HEADER_LENGTH;
+      size_t bodyLength = packetLength - RTCP_HEADER_LENGTH;
+
+      if (hdr[0] & 0x20) {
+        size_t padding = hdr[packetLength - 1];
+        if (padding > bodyLength) {
+          return false;
+        }
+        bodyLength -= padding;
+      }
+
+      if (packetType == RTCP_TYPE_SR || packetType == RTCP_TYPE_RR) {
+        size_t infoLength = (packetType == RTCP_TYPE_SR) ? RTCP_SR_LENGTH - RTCP_HEADER_LENGTH : RTCP_RR_LENGTH - RTCP_HEADER_LENGTH;
+        if (bodyLength < infoLength + (size_t)count * RTCP_REPORT_BLOCK_LENGTH) {
+          return false;
+        }
+
+        compound.SenderSsrc = Read32(body);
+
+        if (packetType == RTCP_TYPE_SR) {
+          compound.HasSenderInfo = true;
+          compound.SenderInfo.NtpTimestamp = (uint64_t)Read32(body + 4) << 32 | Read32(body + 8);
+          compound.SenderInfo.RtpTimestamp = Read32(body + 12);
+          compound.SenderInfo.PacketCount = Read32(body + 16);
+          compound.SenderInfo.OctetCount = Read32(body + 20);
+        }
+
+        for (int i = 0; i < count; i++) {
+          RtcpReportBlock block;
+          ReadReportBlock(body + infoLength + i * RTCP_REPORT_BLOCK_LENGTH, block);
+          compound.ReportBlocks.push_back(block);
+        }
+      }
+      else if (packetType == RTCP_TYPE_PSFB && count == RTCP_FMT_PLI) {
+        if (bodyLength < RTCP_PLI_LENGTH - RTCP_HEADER_LENGTH) {
+          return false;
+        }
+        compound.PliSsrcs.push_back(Read32(body + 4));
+      }
+      else if (packetType == RTCP_TYPE_RTPFB && count == RTCP_FMT_TRANSPORT_CC) {
+        RtcpTransportFeedback feedback;
+        if (!ParseTransportFeedback(body, bodyLength, feedback)) {
+          return false;
+        }
+        compound.TransportFeedback.push_back(std::move(feedback));
+      }
+
+      posn += packetLength;
+    }
+
+    return true;
+  }
+
+  size_t WriteRtcpSenderReport(uint8_t* buf, uint32_t ssrc, const RtcpSenderInfo& info, const RtcpReportBlock* block)
+  {
+    size_t length = RTCP_SR_LENGTH + ((block != nullptr) ? RTCP_REPORT_BLOCK_LENGTH : 0);
+
+    WriteRtcpHeader(buf, false, (block != nullptr) ? 1 : 0, RTCP_TYPE_SR, length);
+    Write32(buf + 4, ssrc);
+    Write32(buf + 8, (uint32_t)(info.NtpTimestamp >> 32));
+    Write32(buf + 12, (uint32_t)info.NtpTimestamp);
+    Write32(buf + 16, info.RtpTimestamp);
+    Write32(buf + 20, info.PacketCount);
+    Write32(buf + 24, info.OctetCount);
+
+    if (block != nullptr) {
+      WriteReportBlock(buf + RTCP_SR_LENGTH, *block);
+    }
+
+    return length;
+  }
+
+  size_t WriteRtcpReceiverReport(uint8_t* buf, uint32_t ssrc, const RtcpReportBlock* block)
+  {
+    size_t length = RTCP_RR_LENGTH + ((block != nullptr) ? RTCP_REPORT_BLOCK_LENGTH : 0);
+
+    WriteRtcpHeader(buf, false, (block != nullptr) ? 1 : 0, RTCP_TYPE_RR, length);
+    Write32(buf + 4, ssrc);
+
+    if (block != nullptr) {
+      WriteReportBlock(buf + RTCP_RR_LENGTH, *block);
+    }
+
+    return length;
+  }
+
+  size_t WriteRtcpPli(uint8_t* buf, uint32_t senderSsrc, uint32_t mediaSsrc)
+  {
+    WriteRtcpHeader(buf, false, RTCP_FMT_PLI, RTCP_TYPE_PSFB, RTCP_PLI_LENGTH);
+    Write32(buf + 4, senderSsrc);
+    Write32(buf + 8, mediaSsrc);
+    return RTCP_PLI_LENGTH;
+  }
+
+  size_t WriteRtcpTransportFeedback(const RtcpTransportFeedback& feedback, std::vector<uint8_t>& buf)
+  {
+    const std::vector<RtcpPacketArrival>& packets = feedback.Packets;
+
+    auto firstReceived = std::find_if(packets.begin(), packets.end(), [](const RtcpPacketArrival& packet) { return packet.Received; });
+
+    if (packets.size() > RTCP_TRANSPORT_CC_MAX_PACKETS || firstReceived == packets.end()) {
+      return 0;
+    }
+
+    // Deltas are taken between arrival times rounded down to 250us, rather
+    // than rounding each delta, so the error doesn't build up along the packet.
+    int64_t referenceTime = FloorDiv(firstReceived->ArrivalMicros, RTCP_TRANSPORT_CC_REFERENCE_MICROS);
+    int64_t lastTicks = referenceTime * (RTCP_TRANSPORT_CC_REFERENCE_MICROS / RTCP_TRANSPORT_CC_DELTA_MICROS);
+
+    uint8_t symbols[RTCP_TRANSPORT_CC_MAX_PACKETS];
+    int16_t deltas[RTCP_TRANSPORT_CC_MAX_PACKETS];
+    size_t deltaBytes = 0;
+
+    for (size_t i = 0; i < packets.size(); i++) {
+      if (!packets[i].Received) {
+        symbols[i] = TRANSPORT_CC_SYMBOL_NOT_RECEIVED;
+        continue;
+      }
+
+      int64_t ticks = FloorDiv(packets[i].ArrivalMicros, RTCP_TRANSPORT_CC_DELTA_MICROS);
+      int64_t delta = ticks - lastTicks;
+      lastTicks = ticks;
+
+      if (delta < INT16_MIN || delta > INT16_MAX) {
+        return 0;
+      }
+
+      deltas[i] = (int16_t)delta;
+      symbols[i] = (delta >= 0 && delta <= 0xff) ? TRANSPORT_CC_SYMBOL_SMALL_DELTA : TRANSPORT_CC_SYMBOL_LARGE_DELTA;
+      deltaBytes += symbols[i];
+    }
+
+    size_t start = buf.size();
+    buf.resize(start + RTCP_TRANSPORT_CC_HEADER_LENGTH);
+
+    uint8_t* hdr = buf.data() + start;
+    Write32(hdr + 4, feedback.SenderSsrc);
+    Write32(hdr + 8, feedback.MediaSsrc);
+    Write16(hdr + 12, packets.front().SeqNum);
+    Write16(hdr + 14, (uint16_t)packets.size());
+    Write24(hdr + 16, (uint32_t)(referenceTime & (RTCP_TRANSPORT_CC_REFERENCE_WRAP - 1)));
+    hdr[19] = feedback.FeedbackCount;
+
+    // A run of 7 or more of the same status is cheaper as a run length chunk
+    // than as status vectors.
+    size_t i = 0;
+    while (i < packets.size()) {
+      size_t run = 1;
+      while (i + run < packets.size() && run < TRANSPORT_CC_MAX_RUN_LENGTH && symbols[i + run] == symbols[i]) {
+        run++;
+      }
+
+      uint16_t chunk;
+      if (run >= TRANSPORT_CC_VECTOR_SYMBOLS) {
+        chunk = (uint16_t)(symbols[i] << 13 | run);
+        i += run;
+      }
+      else {
+        chunk = 0xc000;
+        for (int j = 0; j < TRANSPORT_CC_VECTOR_SYMBOLS && i < packets.size(); j++, i++) {
+          chunk |= symbols[i] << (12 - 2 * j);
+        }
+      }
+
+      buf.push_back(chunk >> 8 & 0xff);
+      buf.push_back(chunk & 0xff);
+    }
+
+    for (size_t i = 0; i < packets.size(); i++) {
+      if (!packets[i].Received) {
+        continue;
+      }
+      else if (symbols[i] == TRANSPORT_CC_SYMBOL_SMALL_DELTA) {
+        buf.push_back((uint8_t)deltas[i]);
+      }
+      else {
+        buf.push_back((uint16_t)deltas[i] >> 8 & 0xff);
+        buf.push_back((uint16_t)deltas[i] & 0xff);
+      }
+    }
+
+    // Padded to a 32 bit boundary, the last byte of the padding is its length.
+    size_t padding = (4 - (buf.size() - start) % 4) % 4;
+    for (size_t i = 0; i < padding; i++) {
+      buf.push_back((i == padding - 1) ? (uint8_t)padding : 0);
+    }
+
+    size_t length = buf.size() - start;
+    WriteRtcpHeader(buf.data() + start, padding > 0, RTCP_FMT_TRANSPORT_CC, RTCP_TYPE_RTPFB, length);
+    return length;
+  }
+
+  void WriteTransportSequenceExtension(uint8_t* buf, uint16_t seqNum)
+  {
+    Write16(buf, RTP_ONE_BYTE_EXTENSION_PROFILE);
+    Write16(buf + 2, 1);      // Length in 32 bit words.
+    buf[4] = RTP_TRANSPORT_CC_EXTENSION_ID << 4 | 1;    // Element length less one.
+    Write16(buf + 5, seqNum);
+    buf[7] = 0;
+  }
+
+  bool ReadTransportSequenceNumber(const uint8_t* packet, size_t length, uint16_t& seqNum)
+  {
+    if (length < RTP_HEADER_LENGTH || (packet[0] & 0x10) == 0) {
+      return false;
+    }
+
+    size_t posn = RTP_HEADER_LENGTH + (packet[0] & 0x0f) * 4;
+    if (posn + 4 > length || Read16(packet + posn) != RTP_ONE_BYTE_EXTENSION_PROFILE) {
+      return false;
+    }
+
+    size_t end = posn + 4 + (size_t)Read16(packet + posn + 2) * 4;
+    if (end > length) {
+      return false;
+    }
+
+    posn += 4;
+    while (posn < end) {
+      uint8_t id = packet[posn] >> 4;
+      size_t elementLength = (packet[posn] & 0x0f) + 1;
+
+      if (packet[posn] == 0) {
+        // Padding between elements.
+        posn++;
+        continue;
+      }
+      else if (id == 15 || posn + 1 + elementLength > end) {
+        break;
+      }
+      else if (id == RTP_TRANSPORT_CC_EXTENSION_ID && elementLength == 2) {
+        seqNum = Read16(packet + posn + 1);
+        return true;
+      }
+
+      posn += 1 + elementLength;
+    }
+
+    return false;
+  }
+
+  uint64_t MicrosToNtp(int64_t micros)
+  {
+    uint64_t seconds = (uint64_t)(micros / 1000000);
+    uint64_t fraction = ((uint64_t)(micros % 1000000) << 32) / 1000000;
+    return seconds << 32 | fraction;
+  }
+
+  int64_t CompactNtpToMicros(uint32_t compactNtp)
+  {
+    return (int64_t)(compactNtp >> 16) * 1000000 + (((int64_t)(compactNtp & 0xffff) * 1000000) >> 16);
+  }
+}
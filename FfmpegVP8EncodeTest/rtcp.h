@@ -0,0 +1,195 @@
+//-----------------------------------------------------------------------------
+// Filename: rtcp.h
+//
+// Description: Just enough RTCP to close the loop between a viewer and the
+// encoder. Reads and writes:
+//
+//  SR, RR: sender and receiver reports, RFC 3550. The report blocks carry the
+//          fraction of packets lost and, with the sender report timestamps
+//          echoed back, the round trip time.
+//  PLI: picture loss indication, RFC 4585, the viewer asking for a keyframe.
+//  transport-cc: transport wide congestion control feedback,
+//                draft-holmer-rmcat-transport-wide-cc-extensions-01. The
+//                arrival time of every packet, to 250us, keyed by a sequence
+//                number the sender puts in an RTP header extension.
+//
+// RTCP shares the RTP port (rtcp-mux, RFC 5761), packet types 200 to 206 sit
+// where RTP payload types 72 to 78 would, which nobody uses for media.
+//
+// transport-cc feedback:
+//
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//   |V=2|P|  FMT=15 |    PT=205     |           length              |
+//   |                     SSRC of packet sender                     |
+//   |                      SSRC of media source                     |
+//   |      base sequence number     |      packet status count      |
+//   |                 reference time                | fb pkt. count |
+//   |          packet chunk         |         packet chunk          |
+//   |         ...                   |  recv delta   |  recv delta   |
+//   +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+//
+// The reference time is in 64ms units, each received packet's delta from the
+// previous one is a byte, or two for negative and large deltas, in 250us units.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_RTCP_H
+#define SIPSORCERY_RTCP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define RTCP_HEADER_LENGTH 4
+#define RTCP_TYPE_SR 200
+#define RTCP_TYPE_RR 201
+#define RTCP_TYPE_RTPFB 205
+#define RTCP_TYPE_PSFB 206
+#define RTCP_FMT_PLI 1
+#define RTCP_FMT_TRANSPORT_CC 15
+#define RTCP_REPORT_BLOCK_LENGTH 24
+#define RTCP_SR_LENGTH 28               // Header, SSRC and sender info, without report blocks.
+#define RTCP_RR_LENGTH 8                // Header and SSRC, without report blocks.
+#define RTCP_PLI_LENGTH 12
+#define RTCP_MAX_PACKET_LENGTH 1200
+
+#define RTCP_TRANSPORT_CC_HEADER_LENGTH 20
+#define RTCP_TRANSPORT_CC_DELTA_MICROS 250
+#define RTCP_TRANSPORT_CC_REFERENCE_MICROS 64000
+#define RTCP_TRANSPORT_CC_REFERENCE_WRAP 0x1000000  // The 24 bit reference time wraps after about 12.4 days of the receiver's clock.
+#define RTCP_TRANSPORT_CC_MAX_PACKETS 250       // Per feedback packet, fits in RTCP_MAX_PACKET_LENGTH even with every delta two bytes.
+
+#define RTP_TRANSPORT_CC_EXTENSION_ID 5         // One byte header extension ID, a=extmap:5 http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01
+#define RTP_TRANSPORT_CC_EXTENSION_LENGTH 8     // 0xBEDE profile, length, the 3 byte element and a byte of padding.
+
+namespace sipsorcery
+{
+  struct RtcpReportBlock
+  {
+    uint32_t Ssrc;                // The source being reported on.
+    uint8_t FractionLost;         // Since the last report, out of 256.
+    int32_t CumulativeLost;
+    uint32_t HighestSeqNum;       // Extended with the count of sequence number cycles.
+    uint32_t Jitter;              // RTP timestamp units.
+    uint32_t LastSr;              // Middle 32 bits of the last SR's NTP timestamp, 0 if none.
+    uint32_t DelaySinceLastSr;    // 1/65536 seconds.
+  };
+
+  struct RtcpSenderInfo
+  {
+    uint64_t NtpTimestamp;
+    uint32_t RtpTimestamp;
+    uint32_t PacketCount;
+    uint32_t OctetCount;
+  };
+
+  struct RtcpPacketArrival
+  {
+    uint16_t SeqNum;              // Transport wide sequence number.
+    bool Received;
+    int64_t ArrivalMicros;        // On the receiver's clock, only differences between arrivals mean anything.
+  };
+
+  struct RtcpTransportFeedback
+  {
+    uint32_t SenderSsrc;
+    uint32_t MediaSsrc;
+    uint8_t FeedbackCount;        // Increments with each feedback packet so the sender can spot lost feedback.
+    uint32_t ReferenceTime;       // 64ms units, mod RTCP_TRANSPORT_CC_REFERENCE_WRAP. Set when parsed, written from the arrivals.
+    std::vector<RtcpPacketArrival> Packets;     // In sequence number order, from the base sequence number.
+  };
+
+  /**
+  * Everything of interest in a compound RTCP packet.
+  */
+  struct RtcpCompound
+  {
+    bool HasSenderInfo;
+    uint32_t SenderSsrc;          // Of the SR or RR.
+    RtcpSenderInfo SenderInfo;
+    std::vector<RtcpReportBlock> ReportBlocks;
+    std::vector<uint32_t> PliSsrcs;             // Media sources a keyframe was asked for.
+    std::vector<RtcpTransportFeedback> TransportFeedback;
+
+    void Clear();
+  };
+
+  /**
+  * Tells RTCP from RTP on a muxed port, RFC 5761 section 4.
+  */
+  bool IsRtcpPacket(const uint8_t* buf, size_t length);
+
+  /**
+  * Parses a compound RTCP packet. Packet types that aren't needed, SDES,
+  * BYE, APP and other feedback messages, are skipped. Transport-cc arrival
+  * times are from the wrapped reference time, the sender has to unwrap it.
+  * @param[in] buf: the received datagram.
+  * @param[in] length: the length of the datagram.
+  * @param[out] compound: the parsed reports and feedback, cleared first.
+  * @@Returns false if the datagram isn't valid RTCP, anything parsed before
+  *  the problem is left in the compound.
+  */
+  bool ParseRtcpCompound(const uint8_t* buf, size_t length, RtcpCompound& compound);
+
+  /**
+  * Writes a sender report with at most one report block.
+  * @@Returns the number of bytes written.
+  */
+  size_t WriteRtcpSenderReport(uint8_t* buf, uint32_t ssrc, const RtcpSenderInfo& info, const RtcpReportBlock* block);
+
+  /**
+  * Writes a receiver report with at most one report block.
+  * @@Returns the number of bytes written.
+  */
+  size_t WriteRtcpReceiverReport(uint8_t* buf, uint32_t ssrc, const RtcpReportBlock* block);
+
+  /**
+  * Writes a picture loss indication.
+  * @@Returns the number of bytes written, RTCP_PLI_LENGTH.
+  */
+  size_t WriteRtcpPli(uint8_t* buf, uint32_t senderSsrc, uint32_t mediaSsrc);
+
+  /**
+  * Appends a transport-cc feedback packet. Status chunks are run length
+  * encoded where a run of the same status is long enough to be worth it,
+  * the rest use two bit status vectors.
+  * @param[in] feedback: the packets to report, consecutive sequence numbers
+  *  from the first, at least one received and at most
+  *  RTCP_TRANSPORT_CC_MAX_PACKETS.
+  * @param[in,out] buf: the feedback is appended to it.
+  * @@Returns the number of bytes appended, 0 if the packets can't be reported.
+  */
+  size_t WriteRtcpTransportFeedback(const RtcpTransportFeedback& feedback, std::vector<uint8_t>& buf);
+
+  /**
+  * Writes the RTP header extension carrying a transport wide sequence
+  * number, RTP_TRANSPORT_CC_EXTENSION_LENGTH bytes. The RTP header's X bit
+  * has to be set by the caller.
+  */
+  void WriteTransportSequenceExtension(uint8_t* buf, uint16_t seqNum);
+
+  /**
+  * Finds the transport wide sequence number in a received RTP packet's one
+  * byte header extensions.
+  * @@Returns false if the packet doesn't carry one.
+  */
+  bool ReadTransportSequenceNumber(const uint8_t* packet, size_t length, uint16_t& seqNum);
+
+  /**
+  * Converts a monotonic clock in microseconds to the 64 bit NTP format used
+  * in sender reports. Only the middle 32 bits are echoed back, so which clock
+  * it is doesn't matter as long as the sender sticks to it.
+  */
+  uint64_t MicrosToNtp(int64_t micros);
+  int64_t CompactNtpToMicros(uint32_t compactNtp);
+}
+
+#endif // SIPSORCERY_RTCP_H
@@ -0,0 +1,166 @@
+#include "rtpsender.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+
+namespace sipsorcery
+{
+  void WriteRtpHeader(uint8_t* buf, bool marker, uint8_t payloadType, uint16_t seqNum, uint32_t timestamp, uint32_t ssrc)
+  {
+    buf[0] = 0x80;    // Version 2, no padding, extension or CSRCs.
+    buf[1] = (marker ? 0x80 : 0x00) | (payloadType & 0x7f);
+    buf[2] = seqNum >> 8 & 0xff;
+    buf[3] = seqNum & 0xff;
+    buf[4] = timestamp >> 24 & 0xff;
+    buf[5] = timestamp >> 16 & 0xff;
+    buf[6] = timestamp >> 8 & 0xff;
+    buf[7] = timestamp & 0xff;
+    buf[8] = ssrc >> 24 & 0xff;
+    buf[9] = ssrc >> 16 & 0xff;
+    buf[10] = ssrc >> 8 & 0xff;
+    buf[11] = ssrc & 0xff;
+  }
+
+  bool ParseRtpHeader(const uint8_t* buf, size_t length, RtpHeaderInfo& hdr)
+  {
+    if (length < RTP_HEADER_LENGTH || (buf[0] >> 6) != 2) {
+      return false;
+    }
+
+    hdr.Marker = (buf[1] & 0x80) != 0;
+    hdr.PayloadType = buf[1] & 0x7f;
+    hdr.SeqNum = (uint16_t)(buf[2] << 8 | buf[3]);
+    hdr.Timestamp = (uint32_t)buf[4] << 24 | buf[5] << 16 | buf[6] << 8 | buf[7];
+    hdr.Ssrc = (uint32_t)buf[8] << 24 | buf[9] << 16 | buf[10] << 8 | buf[11];
+
+    size_t posn = RTP_HEADER_LENGTH + (buf[0] & 0x0f) * 4;
+
+    if (buf[0] & 0x10) {
+      if (posn + 4 > length) {
+        return false;
+      }
+      posn += 4 + (buf[posn + 2] << 8 | buf[posn + 3]) * 4;
+    }
+
+    size_t padding = (buf[0] & 0x20) ? buf[length - 1] : 0;
+    if (posn + padding > length) {
+      return false;
+    }
+
+    hdr.PayloadOffset = posn;
+    hdr.PayloadLength = length - padding - posn;
+    return true;
+  }
+
+  RtpSender::RtpSender(const std::string& dstAddress, int dstPort) :
+    _dstAddr()
+  {
+    _dstAddr.sin_family = AF_INET;
+    _dstAddr.sin_port = htons((uint16_t)dstPort);
+    if (inet_pton(AF_INET, dstAddress.c_str(), &_dstAddr.sin_addr) != 1) {
+      throw std::runtime_error("RTP sender destination address " + dstAddress + " is not a valid IPv4 address.");
+    }
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    int res = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (res != 0) {
+      throw std::runtime_error("WSAStartup failed with " + std::to_string(res) + ".");
+    }
+
+    _socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (_socket == INVALID_SOCKET) {
+      int err = WSAGetLastError();
+      WSACleanup();
+      throw std::runtime_error("RTP sender socket creation failed with " + std::to_string(err) + ".");
+    }
+#else
+    _socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (_socket < 0) {
+      throw std::runtime_error("RTP sender socket creation failed with " + std::to_string(errno) + ".");
+    }
+#endif
+  }
+
+  RtpSender::~RtpSender()
+  {
+#ifdef _WIN32
+    closesocket(_socket);
+    WSACleanup();
+#else
+    close(_socket);
+#endif
+  }
+
+  int RtpSender::Send(const std::vector<RtpPacketBuffers>& packets)
+  {
+    int sent = 0;
+
+#ifdef _WIN32
+    for (auto& packet : packets) {
+      _wsaBufs.resize(packet.Count);
+      for (int i = 0; i < packet.Count; i++) {
+        _wsaBufs[i].buf = (CHAR*)packet.Buffers[i].Data;
+        _wsaBufs[i].len = (ULONG)packet.Buffers[i].Length;
+      }
+
+      DWORD bytesSent = 0;
+      if (WSASendTo(_socket, _wsaBufs.data(), (DWORD)_wsaBufs.size(), &bytesSent, 0,
+        (const sockaddr*)&_dstAddr, sizeof(_dstAddr), NULL, NULL) == SOCKET_ERROR) {
+        std::cerr << "RTP sender WSASendTo failed with " << WSAGetLastError() << "." << std::endl;
+        break;
+      }
+
+      sent++;
+      _bytesSent += bytesSent;
+    }
+#else
+    // The message headers point at the iovec array so it has to be fully
+    // sized before any pointers into it are taken.
+    size_t iovecCount = 0;
+    for (auto& packet : packets) {
+      iovecCount += packet.Count;
+    }
+
+    _msgs.resize(packets.size());
+    _iovecs.resize(iovecCount);
+
+    size_t iovecIndex = 0;
+    for (size_t i = 0; i < packets.size(); i++) {
+      std::memset(&_msgs[i], 0, sizeof(_msgs[i]));
+      _msgs[i].msg_hdr.msg_name = &_dstAddr;
+      _msgs[i].msg_hdr.msg_namelen = sizeof(_dstAddr);
+      _msgs[i].msg_hdr.msg_iov = &_iovecs[iovecIndex];
+      _msgs[i].msg_hdr.msg_iovlen = packets[i].Count;
+
+      for (int j = 0; j < packets[i].Count; j++) {
+        _iovecs[iovecIndex].iov_base = (void*)packets[i].Buffers[j].Data;
+        _iovecs[iovecIndex].iov_len = packets[i].Buffers[j].Length;
+        iovecIndex++;
+      }
+    }
+
+    while (sent < (int)packets.size()) {
+      int res = sendmmsg(_socket, &_msgs[sent], (unsigned int)(packets.size() - sent), 0);
+      if (res < 0) {
+        std::cerr << "RTP sender sendmmsg failed with " << errno << "." << std::endl;
+        break;
+      }
+
+      for (int i = sent; i < sent + res; i++) {
+        _bytesSent += _msgs[i].msg_len;
+      }
+      sent += res;
+    }
+#endif
+
+    _packetsSent += sent;
+    return sent;
+  }
+}
@@ -0,0 +1,139 @@
+//-----------------------------------------------------------------------------
+// Filename: rtpsender.h
+//
+// Description: Sends RTP packets that are described as a list of buffers
+// rather than one contiguous datagram. Payloaders put the RTP and payload
+// headers in small slabs of their own and point the payload buffers straight
+// at the encoder's output, the socket gathers the pieces so the payload is
+// never copied in user space.
+//
+// On Windows each datagram is a WSASendTo with a WSABUF array, there is no
+// batched equivalent of sendmmsg that works with unregistered buffers. On
+// other platforms the whole frame goes out with sendmmsg.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_RTPSENDER_H
+#define SIPSORCERY_RTPSENDER_H
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX    // windows.h, pulled in by winsock2.h, otherwise breaks std::min and std::max.
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define RTP_HEADER_LENGTH 12
+#define RTP_DEFAULT_MTU 1200        // Maximum RTP packet size, leaves room for IP, UDP and any SRTP or tunnel overhead.
+#define RTP_MAX_PACKET_BUFFERS 16   // Header slab plus payload pieces for one datagram.
+
+namespace sipsorcery
+{
+  struct RtpIoVec
+  {
+    const uint8_t* Data;
+    size_t Length;
+  };
+
+  /**
+  * One RTP datagram. Buffers[0] is the header slab, the remaining buffers
+  * are payload and usually point into an encoded packet owned by someone
+  * else, which must stay referenced until the datagram has been sent.
+  */
+  struct RtpPacketBuffers
+  {
+    int Count;
+    RtpIoVec Buffers[RTP_MAX_PACKET_BUFFERS];
+
+    size_t GetLength() const
+    {
+      size_t length = 0;
+      for (int i = 0; i < Count; i++) {
+        length += Buffers[i].Length;
+      }
+      return length;
+    }
+  };
+
+  /**
+  * Writes the fixed 12 byte RTP header, no CSRCs or extensions.
+  */
+  void WriteRtpHeader(uint8_t* buf, bool marker, uint8_t payloadType, uint16_t seqNum, uint32_t timestamp, uint32_t ssrc);
+
+  struct RtpHeaderInfo
+  {
+    bool Marker;
+    uint8_t PayloadType;
+    uint16_t SeqNum;
+    uint32_t Timestamp;
+    uint32_t Ssrc;
+    size_t PayloadOffset;     // After the CSRCs and any header extension.
+    size_t PayloadLength;     // Excludes any padding.
+  };
+
+  /**
+  * Reads a received RTP header, skipping CSRCs and extensions and removing padding.
+  * @@Returns false if the packet isn't version 2 or is shorter than its header says.
+  */
+  bool ParseRtpHeader(const uint8_t* buf, size_t length, RtpHeaderInfo& hdr);
+
+  class RtpSender
+  {
+  public:
+    /**
+    * @param[in] dstAddress: the IPv4 address to send to.
+    * @param[in] dstPort: the UDP port to send to.
+    * Throws std::runtime_error if the socket cannot be created.
+    */
+    RtpSender(const std::string& dstAddress, int dstPort);
+    ~RtpSender();
+
+    RtpSender(const RtpSender&) = delete;
+    RtpSender& operator=(const RtpSender&) = delete;
+
+    /**
+    * Sends each packet as one datagram, gathering its buffers.
+    * @@Returns the number of datagrams sent, which is less than the number
+    *  of packets if the socket reported an error.
+    */
+    int Send(const std::vector<RtpPacketBuffers>& packets);
+
+    uint64_t GetPacketsSent() const { return _packetsSent; }
+    uint64_t GetBytesSent() const { return _bytesSent; }
+
+  private:
+#ifdef _WIN32
+    SOCKET _socket{ INVALID_SOCKET };
+    std::vector<WSABUF> _wsaBufs;
+#else
+    int _socket{ -1 };
+    std::vector<struct mmsghdr> _msgs;
+    std::vector<struct iovec> _iovecs;
+#endif
+    struct sockaddr_in _dstAddr;
+    uint64_t _packetsSent{ 0 };
+    uint64_t _bytesSent{ 0 };
+  };
+}
+
+#endif // SIPSORCERY_RTPSENDER_H
@@ -0,0 +1,380 @@
+#include "simulcast.h"
+#include "encoderbench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#define SIMULCAST_TEST_WIDTH 1920
+#define SIMULCAST_TEST_HEIGHT 1080
+#define SIMULCAST_TEST_LAYERS 3
+#define SIMULCAST_TEST_CLIP_FRAMES 30
+
+namespace sipsorcery
+{
+  SimulcastEncoder::SimulcastEncoder(AVCodecID codecID, int width, int height, AVPixelFormat srcFormat, int fps,
+    EncoderPreset preset, int layerCount, int threadsPerLayer) :
+    _srcFormat(srcFormat),
+    _packetPool(layerCount * 2)
+  {
+    if (layerCount < 1 || layerCount > SIMULCAST_MAX_LAYERS) {
+      throw std::runtime_error("Simulcast layer count of " + std::to_string(layerCount) + " is not supported.");
+    }
+    else if ((width >> (layerCount - 1)) < SIMULCAST_MIN_LAYER_DIMENSION || (height >> (layerCount - 1)) < SIMULCAST_MIN_LAYER_DIMENSION) {
+      throw std::runtime_error("Simulcast source " + std::to_string(width) + "x" + std::to_string(height) +
+        " is too small for " + std::to_string(layerCount) + " layers.");
+    }
+
+    for (int i = 0; i < layerCount; i++) {
+      std::unique_ptr<Layer> layer(new Layer());
+      layer->Width = width >> i;
+      layer->Height = height >> i;
+      layer->Encoder.reset(new VideoEncoder(codecID, layer->Width, layer->Height, fps, preset, threadsPerLayer));
+      layer->Frames.reset(new FramePool(layer->Width, layer->Height, AV_PIX_FMT_YUV420P, 2));
+      _layers.push_back(std::move(layer));
+    }
+
+    // The only colour conversion, everything after this works on I420.
+    if (srcFormat != AV_PIX_FMT_YUV420P) {
+      _swsCtx = sws_getContext(width, height, srcFormat, width, height, AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+      if (_swsCtx == NULL) {
+        throw std::runtime_error("Simulcast failed to create a scaler from " + std::string(av_get_pix_fmt_name(srcFormat)) + ".");
+      }
+    }
+
+    _srcRef = av_frame_alloc();
+
+    // The calling thread encodes the top rung, the pool takes the rest.
+    if (layerCount > 1) {
+      _pool.reset(new WorkStealingPool(layerCount - 1));
+    }
+  }
+
+  SimulcastEncoder::~SimulcastEncoder()
+  {
+    _pool.reset();
+
+    if (_swsCtx != NULL) {
+      sws_freeContext(_swsCtx);
+    }
+
+    av_frame_free(&_srcRef);
+  }
+
+  int SimulcastEncoder::Encode(const AVFrame* frame, SimulcastPacketCallback onPacket)
+  {
+    if (frame != nullptr) {
+      auto scaleStart = std::chrono::steady_clock::now();
+
+      int res = PrepareLayerFrames(frame, _keyframeRequested.exchange(false));
+      if (res < 0) {
+        return res;
+      }
+
+      _scaleSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - scaleStart).count();
+    }
+
+    int res = EncodeLayers(frame);
+
+    // A rung can decide to put in a keyframe by itself. The others are
+    // brought back in line on the next frame so the ladder stays switchable.
+    bool anyKeyframe = false, allKeyframe = true;
+    for (auto& layer : _layers) {
+      anyKeyframe |= layer->Keyframe;
+      allKeyframe &= layer->Keyframe;
+      layer->Keyframe = false;
+    }
+
+    if (frame != nullptr && anyKeyframe && !allKeyframe) {
+      _keyframeRealigns++;
+      _keyframeRequested = true;
+    }
+
+    int count = EmitPackets(onPacket);
+    ReleaseLayerFrames();
+
+    return (res < 0) ? res : count;
+  }
+
+  int SimulcastEncoder::Flush(SimulcastPacketCallback onPacket)
+  {
+    return Encode(nullptr, onPacket);
+  }
+
+  int SimulcastEncoder::PrepareLayerFrames(const AVFrame* frame, bool forceKeyframe)
+  {
+    Layer& top = *_layers[0];
+
+    if (frame->width != top.Width || frame->height != top.Height || frame->format != _srcFormat) {
+      std::cerr << "Simulcast frame " << frame->width << "x" << frame->height << " " << frame->format
+        << " does not match the encoder " << top.Width << "x" << top.Height << " " << _srcFormat << "." << std::endl;
+      return AVERROR(EINVAL);
+    }
+
+    if (_swsCtx == NULL) {
+      // Already I420 at the top resolution, use the source planes directly.
+      int res = av_frame_ref(_srcRef, frame);
+      if (res < 0) {
+        return res;
+      }
+      top.Frame = _srcRef;
+    }
+    else {
+      top.Frame = top.Frames->Get();
+      sws_scale(_swsCtx, frame->data, frame->linesize, 0, frame->height, top.Frame->data, top.Frame->linesize);
+    }
+
+    AVFrame* levels[SIMULCAST_MAX_LAYERS];
+    levels[0] = top.Frame;
+    for (size_t i = 1; i < _layers.size(); i++) {
+      _layers[i]->Frame = _layers[i]->Frames->Get();
+      levels[i] = _layers[i]->Frame;
+    }
+
+    BuildDownscalePyramid(levels, (int)_layers.size());
+
+    for (auto& layer : _layers) {
+      layer->Frame->pts = frame->pts;
+      layer->Frame->pict_type = forceKeyframe ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+    }
+
+    return 0;
+  }
+
+  int SimulcastEncoder::EncodeLayers(const AVFrame* frame)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_doneMutex);
+      _layersRemaining = (int)_layers.size() - 1;
+    }
+
+    for (size_t i = 1; i < _layers.size(); i++) {
+      Layer* layer = _layers[i].get();
+      _pool->Submit([this, layer, frame] {
+        EncodeLayer(*layer, frame);
+
+        std::lock_guard<std::mutex> lock(_doneMutex);
+        _layersRemaining--;
+        _doneCondition.notify_one();
+      });
+    }
+
+    EncodeLayer(*_layers[0], frame);
+
+    std::unique_lock<std::mutex> lock(_doneMutex);
+    _doneCondition.wait(lock, [this] { return _layersRemaining == 0; });
+
+    for (auto& layer : _layers) {
+      if (layer->Result < 0) {
+        return layer->Result;
+      }
+    }
+
+    return 0;
+  }
+
+  void SimulcastEncoder::EncodeLayer(Layer& layer, const AVFrame* frame)
+  {
+    // The packets are held until every rung has finished so they can be
+    // handed out in layer order from the calling thread.
+    layer.Result = layer.Encoder->Encode((frame != nullptr) ? layer.Frame : nullptr, [this, &layer](AVPacket* pkt) {
+      AVPacket* owned = _packetPool.Get();
+      av_packet_move_ref(owned, pkt);
+      if (owned->flags & AV_PKT_FLAG_KEY) {
+        layer.Keyframe = true;
+      }
+      layer.Packets.push_back(owned);
+    });
+  }
+
+  int SimulcastEncoder::EmitPackets(SimulcastPacketCallback& onPacket)
+  {
+    int count = 0;
+
+    for (size_t i = 0; i < _layers.size(); i++) {
+      for (auto pkt : _layers[i]->Packets) {
+        if (onPacket != nullptr) {
+          onPacket((int)i, pkt);
+        }
+        _packetPool.Return(pkt);
+        count++;
+      }
+      _layers[i]->Packets.clear();
+    }
+
+    return count;
+  }
+
+  void SimulcastEncoder::ReleaseLayerFrames()
+  {
+    for (auto& layer : _layers) {
+      if (layer->Frame == _srcRef) {
+        av_frame_unref(_srcRef);
+      }
+      else if (layer->Frame != nullptr) {
+        layer->Frames->Return(layer->Frame);
+      }
+      layer->Frame = nullptr;
+    }
+  }
+
+  /**
+  * Box filters rows [dstRowStart, dstRowEnd) of one plane. Source reads past
+  * an odd width or height are clamped to the last column or row.
+  */
+  static void Downscale2xRows(const uint8_t* src, int srcStride, int srcWidth, int srcHeight,
+    uint8_t* dst, int dstStride, int dstWidth, int dstRowStart, int dstRowEnd)
+  {
+    int pairs = std::min(dstWidth, srcWidth / 2);
+
+    for (int y = dstRowStart; y < dstRowEnd; y++) {
+      const uint8_t* r0 = src + (2 * y) * srcStride;
+      const uint8_t* r1 = src + std::min(2 * y + 1, srcHeight - 1) * srcStride;
+      uint8_t* d = dst + y * dstStride;
+
+      int x = 0;
+      for (; x < pairs; x++) {
+        d[x] = (uint8_t)((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+      }
+
+      for (; x < dstWidth; x++) {
+        int x0 = std::min(2 * x, srcWidth - 1);
+        int x1 = std::min(2 * x + 1, srcWidth - 1);
+        d[x] = (uint8_t)((r0[x0] + r0[x1] + r1[x0] + r1[x1] + 2) >> 2);
+      }
+    }
+  }
+
+  void BuildDownscalePyramid(AVFrame* const* levels, int count)
+  {
+    if (count < 2) {
+      return;
+    }
+
+    // A strip of this many top level rows is exactly one row of the smallest level.
+    int strip = 1 << (count - 1);
+    int topHeight = levels[0]->height;
+
+    for (int y0 = 0; y0 < topHeight; y0 += strip) {
+      bool lastStrip = y0 + strip >= topHeight;
+
+      for (int k = 1; k < count; k++) {
+        const AVFrame* src = levels[k - 1];
+        AVFrame* dst = levels[k];
+
+        for (int plane = 0; plane < 3; plane++) {
+          int shift = (plane == 0) ? 0 : 1;
+          int srcWidth = AV_CEIL_RSHIFT(src->width, shift);
+          int srcHeight = AV_CEIL_RSHIFT(src->height, shift);
+          int dstWidth = AV_CEIL_RSHIFT(dst->width, shift);
+          int dstHeight = AV_CEIL_RSHIFT(dst->height, shift);
+
+          // Rows of this level covered by the strip. Their source rows were
+          // built earlier in the same strip, or by a previous one.
+          int rowStart = std::min((y0 >> k) >> shift, dstHeight);
+          int rowEnd = lastStrip ? dstHeight : std::min(((y0 + strip) >> k) >> shift, dstHeight);
+
+          Downscale2xRows(src->data[plane], src->linesize[plane], srcWidth, srcHeight,
+            dst->data[plane], dst->linesize[plane], dstWidth, rowStart, rowEnd);
+        }
+      }
+    }
+  }
+
+  void RunSimulcastTest(int fps, int frameCount)
+  {
+    const int width = SIMULCAST_TEST_WIDTH, height = SIMULCAST_TEST_HEIGHT;
+
+    // A BGRA clip so the ladder has a real colour conversion to do.
+    FramePool bgraPool(width, height, AV_PIX_FMT_BGRA, SIMULCAST_TEST_CLIP_FRAMES);
+    std::vector<AVFrame*> clip;
+
+    for (int i = 0; i < SIMULCAST_TEST_CLIP_FRAMES; i++) {
+      clip.push_back(bgraPool.Get());
+      FillTestFrame(clip.back(), i);
+    }
+
+    SimulcastEncoder encoder(AV_CODEC_ID_VP8, width, height, AV_PIX_FMT_BGRA, fps, EncoderPreset::Realtime, SIMULCAST_TEST_LAYERS);
+
+    std::vector<int64_t> layerBytes(encoder.GetLayerCount(), 0);
+    std::vector<int> layerPackets(encoder.GetLayerCount(), 0);
+    std::vector<std::vector<int64_t>> layerKeyframes(encoder.GetLayerCount());
+
+    auto onPacket = [&](int layer, AVPacket* pkt) {
+      layerBytes[layer] += pkt->size;
+      layerPackets[layer]++;
+      if (pkt->flags & AV_PKT_FLAG_KEY) {
+        layerKeyframes[layer].push_back(pkt->pts);
+      }
+    };
+
+    auto wallStart = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < frameCount; i++) {
+      AVFrame* frame = clip[i % SIMULCAST_TEST_CLIP_FRAMES];
+      frame->pts = i;
+
+      // Simulate a receiver asking for a keyframe part way through.
+      if (i == frameCount / 2) {
+        encoder.RequestKeyframe();
+      }
+
+      if (encoder.Encode(frame, onPacket) < 0) {
+        std::cerr << "Simulcast encode failed at frame " << i << "." << std::endl;
+        break;
+      }
+    }
+    encoder.Flush(onPacket);
+
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+    std::cout << "Simulcast " << width << "x" << height << " " << encoder.GetLayerCount() << " layers, " << frameCount << " frames"
+      << std::fixed << std::setprecision(2)
+      << ", fps " << frameCount / wallSeconds
+      << ", convert and scale ms per frame " << encoder.GetScaleSeconds() * 1000 / frameCount
+      << ", keyframe realigns " << encoder.GetKeyframeRealignCount() << "." << std::endl;
+
+    for (int i = 0; i < encoder.GetLayerCount(); i++) {
+      std::cout << "layer " << i << " " << encoder.GetLayerWidth(i) << "x" << encoder.GetLayerHeight(i)
+        << " packets " << layerPackets[i] << ", kbps " << (double)layerBytes[i] * 8 * fps / frameCount / 1000
+        << ", keyframes " << layerKeyframes[i].size()
+        << ((layerKeyframes[i] == layerKeyframes[0]) ? " (aligned)" : " (NOT aligned)") << "." << std::endl;
+    }
+
+    // The approach being replaced, every rung converts and scales from the source.
+    std::vector<SwsContext*> independent;
+    std::vector<std::unique_ptr<FramePool>> independentPools;
+    for (int i = 0; i < encoder.GetLayerCount(); i++) {
+      independent.push_back(sws_getContext(width, height, AV_PIX_FMT_BGRA, encoder.GetLayerWidth(i), encoder.GetLayerHeight(i),
+        AV_PIX_FMT_YUV420P, SWS_FAST_BILINEAR, NULL, NULL, NULL));
+      independentPools.push_back(std::unique_ptr<FramePool>(new FramePool(encoder.GetLayerWidth(i), encoder.GetLayerHeight(i), AV_PIX_FMT_YUV420P, 1)));
+    }
+
+    auto independentStart = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < frameCount; i++) {
+      AVFrame* frame = clip[i % SIMULCAST_TEST_CLIP_FRAMES];
+      for (size_t j = 0; j < independent.size(); j++) {
+        AVFrame* dst = independentPools[j]->Get();
+        sws_scale(independent[j], frame->data, frame->linesize, 0, height, dst->data, dst->linesize);
+        independentPools[j]->Return(dst);
+      }
+    }
+
+    double independentSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - independentStart).count();
+
+    std::cout << "Independent swscale per rung, convert and scale ms per frame " << std::fixed << std::setprecision(2)
+      << independentSeconds * 1000 / frameCount << "." << std::endl;
+
+    for (auto sws : independent) {
+      sws_freeContext(sws);
+    }
+
+    for (auto frame : clip) {
+      bgraPool.Return(frame);
+    }
+  }
+}
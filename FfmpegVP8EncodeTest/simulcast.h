@@ -0,0 +1,167 @@
+//-----------------------------------------------------------------------------
+// Filename: simulcast.h
+//
+// Description: Encodes one source as a ladder of resolutions, each rung half
+// the width and height of the one above, e.g. 1080p, 540p and 270p. The
+// source is converted to I420 once at the top resolution and the lower rungs
+// are built from it with a 2x2 box filter pyramid, each level downscaled from
+// the level above rather than every rung converting and scaling from the
+// source. The pyramid is built in one pass over the source, a strip of rows
+// at a time, so the rows a level needs are still in cache when it is built.
+//
+// Each rung has its own encoder and the rungs encode in parallel. Every rung
+// is given the same pts and keyframes are forced on all rungs together so a
+// receiver can switch layers at any keyframe.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_SIMULCAST_H
+#define SIPSORCERY_SIMULCAST_H
+
+#include "framepool.h"
+#include "videoencoder.h"
+#include "workstealingpool.h"
+
+extern "C"
+{
+#include <libswscale\swscale.h>
+}
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define SIMULCAST_MAX_LAYERS 4
+#define SIMULCAST_MIN_LAYER_DIMENSION 16
+
+namespace sipsorcery
+{
+  /**
+  * Called once for each encoded packet. Layer 0 is the full resolution rung.
+  * For each input frame the packets are delivered in layer order on the
+  * thread that called Encode.
+  */
+  typedef std::function<void(int layer, AVPacket* pkt)> SimulcastPacketCallback;
+
+  class SimulcastEncoder
+  {
+  public:
+    /**
+    * @param[in] codecID: the codec every rung is encoded with.
+    * @param[in] width: the width of the source frames and the top rung.
+    * @param[in] height: the height of the source frames and the top rung.
+    * @param[in] srcFormat: the pixel format of the source frames.
+    * @param[in] fps: the nominal frame rate.
+    * @param[in] preset: the latency preset applied to every rung.
+    * @param[in] layerCount: the number of rungs, each half the size of the last.
+    * @param[in] threadsPerLayer: encoder threads for each rung. The rungs
+    *  already run in parallel so this is usually 1.
+    * Throws std::runtime_error if the ladder is invalid or an encoder cannot be opened.
+    */
+    SimulcastEncoder(AVCodecID codecID, int width, int height, AVPixelFormat srcFormat, int fps,
+      EncoderPreset preset, int layerCount, int threadsPerLayer = 1);
+    ~SimulcastEncoder();
+
+    SimulcastEncoder(const SimulcastEncoder&) = delete;
+    SimulcastEncoder& operator=(const SimulcastEncoder&) = delete;
+
+    /**
+    * Converts and scales the frame for every rung, encodes the rungs in
+    * parallel and passes the packets to the callback.
+    * @param[in] frame: the source frame, its pts is used for every rung.
+    * @param[in] onPacket: callback for each encoded packet.
+    * @@Returns the number of packets produced or a negative AVERROR code.
+    */
+    int Encode(const AVFrame* frame, SimulcastPacketCallback onPacket);
+
+    /**
+    * Drains every rung's encoder.
+    */
+    int Flush(SimulcastPacketCallback onPacket);
+
+    /**
+    * Forces a keyframe on every rung for the next frame.
+    */
+    void RequestKeyframe() { _keyframeRequested = true; }
+
+    int GetLayerCount() const { return (int)_layers.size(); }
+    int GetLayerWidth(int layer) const { return _layers[layer]->Width; }
+    int GetLayerHeight(int layer) const { return _layers[layer]->Height; }
+
+    /**
+    * The number of times a rung produced a keyframe on its own, for example
+    * on a scene change, and the other rungs were forced to follow.
+    */
+    uint64_t GetKeyframeRealignCount() const { return _keyframeRealigns; }
+
+    /**
+    * The time spent converting the source and building the pyramid, as
+    * opposed to encoding.
+    */
+    double GetScaleSeconds() const { return _scaleSeconds; }
+
+  private:
+    struct Layer
+    {
+      int Width;
+      int Height;
+      std::unique_ptr<VideoEncoder> Encoder;
+      std::unique_ptr<FramePool> Frames;
+      AVFrame* Frame{ nullptr };
+      std::vector<AVPacket*> Packets;         // Packets from the current frame, emitted once all rungs finish.
+      int Result{ 0 };
+      bool Keyframe{ false };
+    };
+
+    AVPixelFormat _srcFormat;
+    SwsContext* _swsCtx{ nullptr };
+    AVFrame* _srcRef{ nullptr };              // Used when the source is already I420 at the top resolution.
+    std::vector<std::unique_ptr<Layer>> _layers;
+    PacketPool _packetPool;
+    std::unique_ptr<WorkStealingPool> _pool;
+
+    std::mutex _doneMutex;
+    std::condition_variable _doneCondition;
+    int _layersRemaining{ 0 };
+
+    std::atomic<bool> _keyframeRequested{ false };
+    uint64_t _keyframeRealigns{ 0 };
+    double _scaleSeconds{ 0 };
+
+    int PrepareLayerFrames(const AVFrame* frame, bool forceKeyframe);
+    int EncodeLayers(const AVFrame* frame);
+    void EncodeLayer(Layer& layer, const AVFrame* frame);
+    int EmitPackets(SimulcastPacketCallback& onPacket);
+    void ReleaseLayerFrames();
+  };
+
+  /**
+  * Fills levels 1 to count - 1 of an I420 pyramid from level 0. Each level
+  * is a 2x2 box filter of the level above. The work is done a strip of
+  * level 0 rows at a time, with every level's rows for the strip built
+  * before moving on, so the source is only read once.
+  * @param[in,out] levels: I420 frames, each level half the size of the last.
+  * @param[in] count: the number of levels.
+  */
+  void BuildDownscalePyramid(AVFrame* const* levels, int count);
+
+  /**
+  * Encodes a 1080p BGRA clip as a 3 rung VP8 ladder and prints the per rung
+  * bit rates. For comparison it also times converting the source to each
+  * rung separately with swscale, the approach the ladder replaces.
+  */
+  void RunSimulcastTest(int fps, int frameCount);
+}
+
+#endif // SIPSORCERY_SIMULCAST_H
@@ -0,0 +1,340 @@
+#include "staticscene.h"
+#include "colorconvert.h"
+#include "encodetelemetry.h"
+#include "framepool.h"
+#include "syntheticsource.h"
+#include "videoencoder.h"
+
+extern "C"
+{
+#include <libavutil\error.h>
+#include <libavutil\pixdesc.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <immintrin.h>
+
+#define STATIC_SCENE_SAD_GROUP 8              // _mm256_sad_epu8 sums each 8 bytes into its own lane.
+#define STATIC_SCENE_TEST_WIDTH 640
+#define STATIC_SCENE_TEST_HEIGHT 480
+#define STATIC_SCENE_TEST_FPS 30
+
+namespace sipsorcery
+{
+  /**
+  * Sets groups[i] to the SAD of bytes 8i to 8i + 7 of every row, from
+  * column start, a multiple of 32, to width.
+  */
+  typedef void(*SadColumnsKernel)(const uint8_t* a, int aStride, const uint8_t* b, int bStride, int width, int rows, uint32_t* groups);
+
+  static void SadColumnsScalar(const uint8_t* a, int aStride, const uint8_t* b, int bStride, int start, int width, int rows, uint32_t* groups)
+  {
+    for (int g = start / STATIC_SCENE_SAD_GROUP; g * STATIC_SCENE_SAD_GROUP < width; g++) {
+      groups[g] = 0;
+    }
+
+    for (int y = 0; y < rows; y++) {
+      const uint8_t* rowA = a + y * aStride;
+      const uint8_t* rowB = b + y * bStride;
+      for (int x = start; x < width; x++) {
+        groups[x / STATIC_SCENE_SAD_GROUP] += (uint32_t)std::abs(rowA[x] - rowB[x]);
+      }
+    }
+  }
+
+  static void SadColumnsScalarAll(const uint8_t* a, int aStride, const uint8_t* b, int bStride, int width, int rows, uint32_t* groups)
+  {
+    SadColumnsScalar(a, aStride, b, bStride, 0, width, rows, groups);
+  }
+
+  /**
+  * Works down each 32 byte column so the four SADs stay in a register until
+  * the column is done.
+  */
+  static void SadColumnsAvx2(const uint8_t* a, int aStride, const uint8_t* b, int bStride, int width, int rows, uint32_t* groups)
+  {
+    int x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+      __m256i sum = _mm256_setzero_si256();
+      for (int y = 0; y < rows; y++) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + y * aStride + x));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + y * bStride + x));
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(va, vb));
+      }
+
+      alignas(32) uint64_t lanes[4];
+      _mm256_store_si256((__m256i*)lanes, sum);
+      for (int i = 0; i < 4; i++) {
+        groups[x / STATIC_SCENE_SAD_GROUP + i] = (uint32_t)lanes[i];
+      }
+    }
+
+    SadColumnsScalar(a, aStride, b, bStride, x, width, rows, groups);
+  }
+
+  StaticSceneDetector::StaticSceneDetector(int width, int height, AVPixelFormat format, const StaticSceneOptions& options) :
+    _width(width), _height(height), _format(format), _options(options)
+  {
+    if (!IsSupported(format)) {
+      throw std::runtime_error("Static scene detection does not support " + std::string(av_get_pix_fmt_name(format)) + ".");
+    }
+    else if (width < 2 || height < 2) {
+      throw std::runtime_error("Static scene frame size " + std::to_string(width) + "x" + std::to_string(height) + " is too small.");
+    }
+
+    _useAvx2 = ColorConverter::HasAvx2();
+    _options.Threshold = std::max(0, _options.Threshold);
+    _options.MaxSkippedFrames = std::max(0, _options.MaxSkippedFrames);
+
+    _blockColumns = (width + STATIC_SCENE_BLOCK_SIZE - 1) / STATIC_SCENE_BLOCK_SIZE;
+    _blockRows = (height + STATIC_SCENE_BLOCK_SIZE - 1) / STATIC_SCENE_BLOCK_SIZE;
+    _changed.resize((size_t)_blockColumns * _blockRows);
+
+    int chromaWidth = (width + 1) / 2;
+    int chromaHeight = (height + 1) / 2;
+
+    _planeWidth[0] = width;
+    _planeHeight[0] = height;
+
+    if (format == AV_PIX_FMT_NV12) {
+      _planeCount = 2;
+      _planeWidth[1] = chromaWidth * 2;
+      _planeHeight[1] = chromaHeight;
+    }
+    else {
+      _planeCount = 3;
+      _planeWidth[1] = _planeWidth[2] = chromaWidth;
+      _planeHeight[1] = _planeHeight[2] = chromaHeight;
+    }
+
+    for (int p = 0; p < _planeCount; p++) {
+      _reference[p].resize((size_t)_planeWidth[p] * _planeHeight[p]);
+      // Sized for two groups per block so the block sums never read past the end.
+      _groupSad[p].resize((size_t)_blockColumns * 2, 0);
+    }
+  }
+
+  bool StaticSceneDetector::IsSupported(AVPixelFormat format)
+  {
+    return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_NV12;
+  }
+
+  void StaticSceneDetector::SetAvx2Enabled(bool enable)
+  {
+    _useAvx2 = enable && ColorConverter::HasAvx2();
+  }
+
+  void StaticSceneDetector::Reset()
+  {
+    _haveReference = false;
+    _skippedInRow = 0;
+  }
+
+  int StaticSceneDetector::Compare(const AVFrame* frame)
+  {
+    if (frame == nullptr || frame->width != _width || frame->height != _height || frame->format != _format) {
+      return AVERROR(EINVAL);
+    }
+
+    _stats.FramesCompared++;
+    _stats.BlocksCompared += _changed.size();
+
+    if (!_haveReference) {
+      for (int p = 0; p < _planeCount; p++) {
+        for (int y = 0; y < _planeHeight[p]; y++) {
+          memcpy(_reference[p].data() + (size_t)y * _planeWidth[p], frame->data[p] + (size_t)y * frame->linesize[p], _planeWidth[p]);
+        }
+      }
+      std::fill(_changed.begin(), _changed.end(), 1);
+      _stats.BlocksChanged += _changed.size();
+      _haveReference = true;
+      return (int)_changed.size();
+    }
+
+    SadColumnsKernel kernel = _useAvx2 ? SadColumnsAvx2 : SadColumnsScalarAll;
+    bool nv12 = _format == AV_PIX_FMT_NV12;
+    int changedCount = 0;
+
+    for (int row = 0; row < _blockRows; row++) {
+      for (int p = 0; p < _planeCount; p++) {
+        int blockHeight = (p == 0) ? STATIC_SCENE_BLOCK_SIZE : STATIC_SCENE_BLOCK_SIZE / 2;
+        int y0 = row * blockHeight;
+        int rows = std::min(blockHeight, _planeHeight[p] - y0);
+
+        kernel(frame->data[p] + (size_t)y0 * frame->linesize[p], frame->linesize[p],
+          _reference[p].data() + (size_t)y0 * _planeWidth[p], _planeWidth[p], _planeWidth[p], rows, _groupSad[p].data());
+      }
+
+      // A luma block is two groups, its I420 chroma one group of each plane
+      // and its NV12 chroma two groups of interleaved U and V.
+      const uint32_t* luma = _groupSad[0].data();
+      const uint32_t* chroma1 = _groupSad[1].data();
+      const uint32_t* chroma2 = nv12 ? nullptr : _groupSad[2].data();
+
+      for (int column = 0; column < _blockColumns; column++) {
+        uint32_t sad = luma[column * 2] + luma[column * 2 + 1];
+        sad += nv12 ? chroma1[column * 2] + chroma1[column * 2 + 1] : chroma1[column] + chroma2[column];
+
+        bool changed = sad > (uint32_t)_options.Threshold;
+        _changed[(size_t)row * _blockColumns + column] = changed ? 1 : 0;
+
+        if (changed) {
+          CopyBlock(frame, column, row);
+          changedCount++;
+        }
+      }
+    }
+
+    _stats.BlocksChanged += changedCount;
+    return changedCount;
+  }
+
+  void StaticSceneDetector::CopyBlock(const AVFrame* frame, int column, int row)
+  {
+    for (int p = 0; p < _planeCount; p++) {
+      // NV12's chroma block is as many bytes wide as the luma's.
+      int blockWidth = (p == 0 || _format == AV_PIX_FMT_NV12) ? STATIC_SCENE_BLOCK_SIZE : STATIC_SCENE_BLOCK_SIZE / 2;
+      int blockHeight = (p == 0) ? STATIC_SCENE_BLOCK_SIZE : STATIC_SCENE_BLOCK_SIZE / 2;
+      int x0 = column * blockWidth;
+      int y0 = row * blockHeight;
+      int bytes = std::min(blockWidth, _planeWidth[p] - x0);
+      int rows = std::min(blockHeight, _planeHeight[p] - y0);
+
+      for (int y = y0; y < y0 + rows; y++) {
+        memcpy(_reference[p].data() + (size_t)y * _planeWidth[p] + x0, frame->data[p] + (size_t)y * frame->linesize[p] + x0, bytes);
+      }
+    }
+  }
+
+  bool StaticSceneDetector::IsStatic(const AVFrame* frame)
+  {
+    int changed = Compare(frame);
+
+    if (changed < 0) {
+      // Whatever does get encoded isn't in the reference, start again from the next frame.
+      Reset();
+      return false;
+    }
+    else if (changed > 0) {
+      _skippedInRow = 0;
+      return false;
+    }
+    else if (_options.MaxSkippedFrames > 0 && _skippedInRow >= _options.MaxSkippedFrames) {
+      _skippedInRow = 0;
+      _stats.FramesRefreshed++;
+      return false;
+    }
+
+    _skippedInRow++;
+    _stats.FramesStatic++;
+    return true;
+  }
+
+  void RunStaticSceneBenchmark(int frameCount)
+  {
+    const int resolutions[][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+    const int staticPercents[] = { 0, 25, 50, 75, 90 };
+
+    frameCount = std::max(2, frameCount);
+
+    std::cout << "Static scene detection, AVX2 " << (ColorConverter::HasAvx2() ? "available" : "not available")
+      << ", microseconds to compare an unchanged I420 frame over " << frameCount << " frames." << std::endl;
+
+    for (auto& res : resolutions) {
+      int width = res[0], height = res[1];
+
+      FramePool pool(width, height, AV_PIX_FMT_YUV420P, 2);
+      AVFrame* first = pool.Get();
+      AVFrame* second = pool.Get();
+      SyntheticVideoSource source(width, height, AV_PIX_FMT_YUV420P);
+      source.Fill(first, 0);
+      source.Fill(second, 1);
+
+      // An unchanged frame is the worst case, every block is compared and none can stop early.
+      auto timeMicros = [&](bool avx2) {
+        StaticSceneDetector detector(width, height, AV_PIX_FMT_YUV420P);
+        detector.SetAvx2Enabled(avx2);
+        detector.Compare(first);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < frameCount; i++) {
+          detector.Compare(first);
+        }
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / frameCount;
+      };
+
+      double scalarMicros = timeMicros(false);
+      double avx2Micros = timeMicros(true);
+
+      // Both kernels have to find the same blocks changed between two different frames.
+      StaticSceneDetector scalar(width, height, AV_PIX_FMT_YUV420P);
+      StaticSceneDetector avx2(width, height, AV_PIX_FMT_YUV420P);
+      scalar.SetAvx2Enabled(false);
+      scalar.Compare(first);
+      avx2.Compare(first);
+      int changed = scalar.Compare(second);
+      avx2.Compare(second);
+
+      std::cout << width << "x" << height << std::fixed << std::setprecision(1)
+        << ": scalar " << scalarMicros << ", avx2 " << avx2Micros
+        << ", changed blocks " << changed << " of " << scalar.GetChangedBlocks().size()
+        << ", avx2 matches scalar " << ((scalar.GetChangedBlocks() == avx2.GetChangedBlocks()) ? "yes" : "NO") << "." << std::endl;
+
+      pool.Return(first);
+      pool.Return(second);
+    }
+
+    std::cout << "VP8 realtime " << STATIC_SCENE_TEST_WIDTH << "x" << STATIC_SCENE_TEST_HEIGHT
+      << " single threaded, CPU ms per frame with and without skipping static frames." << std::endl;
+
+    FramePool pool(STATIC_SCENE_TEST_WIDTH, STATIC_SCENE_TEST_HEIGHT, AV_PIX_FMT_YUV420P, 1);
+    AVFrame* frame = pool.Get();
+
+    for (int staticPercent : staticPercents) {
+      double cpuMs[2] = { 0, 0 };
+      uint64_t encoded[2] = { 0, 0 };
+      uint64_t bytes[2] = { 0, 0 };
+
+      for (int skip = 0; skip < 2; skip++) {
+        VideoEncoder encoder(AV_CODEC_ID_VP8, STATIC_SCENE_TEST_WIDTH, STATIC_SCENE_TEST_HEIGHT, STATIC_SCENE_TEST_FPS, EncoderPreset::Realtime, 1);
+        encoder.SetStaticFrameSkipping(skip == 1);
+
+        SyntheticVideoSource source(STATIC_SCENE_TEST_WIDTH, STATIC_SCENE_TEST_HEIGHT, AV_PIX_FMT_YUV420P);
+        int64_t contentIndex = 0;
+        int64_t cpuMicros = 0;
+
+        for (int i = 0; i < frameCount; i++) {
+          // Spread the repeated frames evenly, the way a dashboard updates a few times a second.
+          bool repeat = i > 0 && (i * staticPercent) / 100 != ((i - 1) * staticPercent) / 100;
+          if (!repeat) {
+            source.Fill(frame, contentIndex++);
+          }
+          frame->pts = i;
+
+          int64_t cpuStart = EncodeTelemetry::GetThreadCpuMicros();
+          encoder.Encode(frame, [&bytes, skip](AVPacket* pkt) { bytes[skip] += pkt->size; });
+          cpuMicros += EncodeTelemetry::GetThreadCpuMicros() - cpuStart;
+        }
+
+        cpuMs[skip] = (double)cpuMicros / 1000.0 / frameCount;
+        encoded[skip] = encoder.GetTelemetry().GetSnapshot().FramesSent;
+      }
+
+      std::cout << std::setw(3) << staticPercent << "% static" << std::fixed << std::setprecision(3)
+        << ": encode all " << cpuMs[0] << " ms (" << encoded[0] << " frames, " << bytes[0] / 1024 << " KB)"
+        << ", skip static " << cpuMs[1] << " ms (" << encoded[1] << " frames, " << bytes[1] / 1024 << " KB)"
+        << ", " << std::setprecision(0) << ((cpuMs[0] > 0) ? 100.0 * cpuMs[1] / cpuMs[0] : 0) << "% of the CPU." << std::endl;
+    }
+
+    pool.Return(frame);
+  }
+}
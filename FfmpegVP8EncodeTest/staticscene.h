@@ -0,0 +1,150 @@
+//-----------------------------------------------------------------------------
+// Filename: staticscene.h
+//
+// Description: Spots raw frames that are the same as the last one the
+// encoder was given, so sources that repeat themselves, dashboards, slides,
+// rendered scopes, can skip the encode altogether instead of paying for a
+// frame of all skipped macroblocks.
+//
+// Frames are compared a 16x16 luma block, and the chroma under it, at a
+// time with the sum of absolute differences, _mm256_sad_epu8 over 32 bytes
+// of a row at once. A block has changed when its SAD is over the threshold,
+// 0 for an exact match. The comparison is against a copy of the reference
+// frame, and only the blocks that changed are copied into it, so a block
+// creeping slowly below the threshold still counts as changed once it has
+// drifted far enough from what was last encoded.
+//
+// Checking a 640x480 frame costs a few tens of microseconds with AVX2, a
+// small fraction of even a realtime VP8 encode, so per stream CPU falls close
+// to in proportion to the share of frames that are static. Frames where only
+// part of the picture changes still get encoded, for those the VP8 Realtime
+// preset sets libvpx's static-thresh so the unchanged macroblocks are skipped
+// cheaply inside the encoder.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_STATICSCENE_H
+#define SIPSORCERY_STATICSCENE_H
+
+extern "C"
+{
+#include <libavutil\frame.h>
+#include <libavutil\pixfmt.h>
+}
+
+#include <cstdint>
+#include <vector>
+
+#define STATIC_SCENE_BLOCK_SIZE 16
+#define STATIC_SCENE_DEFAULT_MAX_SKIPPED_FRAMES 30    // A static picture is still refreshed about once a second at 30 fps.
+
+namespace sipsorcery
+{
+  struct StaticSceneOptions
+  {
+    int Threshold{ 0 };           // The SAD a block, luma and chroma together, can have and still count as unchanged.
+    int MaxSkippedFrames{ STATIC_SCENE_DEFAULT_MAX_SKIPPED_FRAMES };    // 0 to never force an encode of a static frame.
+  };
+
+  struct StaticSceneStats
+  {
+    uint64_t FramesCompared;
+    uint64_t FramesStatic;        // Found to be unchanged and skipped.
+    uint64_t FramesRefreshed;     // Unchanged but encoded anyway because MaxSkippedFrames was reached.
+    uint64_t BlocksCompared;
+    uint64_t BlocksChanged;
+  };
+
+  class StaticSceneDetector
+  {
+  public:
+    /**
+    * @param[in] width: the width of the frames.
+    * @param[in] height: the height of the frames.
+    * @param[in] format: AV_PIX_FMT_YUV420P or AV_PIX_FMT_NV12.
+    * @param[in] options: the change threshold and the refresh interval.
+    * Throws std::runtime_error if the format is not supported.
+    */
+    StaticSceneDetector(int width, int height, AVPixelFormat format, const StaticSceneOptions& options = StaticSceneOptions());
+
+    /**
+    * Compares a frame with the reference and copies the blocks that changed
+    * into it.
+    * @param[in] frame: the frame to compare.
+    * @@Returns the number of blocks that changed, all of them for the first
+    *  frame or after a reset, or AVERROR(EINVAL) if the frame doesn't match.
+    */
+    int Compare(const AVFrame* frame);
+
+    /**
+    * Compares a frame and decides whether its encode can be skipped. It can
+    * if nothing changed and fewer than MaxSkippedFrames frames have been
+    * skipped in a row. A frame that doesn't match counts as changed.
+    * @@Returns true if the frame can be skipped.
+    */
+    bool IsStatic(const AVFrame* frame);
+
+    /**
+    * Whether each block changed in the last comparison, a row of blocks at
+    * a time, (width + 15) / 16 blocks a row.
+    */
+    const std::vector<uint8_t>& GetChangedBlocks() const { return _changed; }
+    int GetBlockColumns() const { return _blockColumns; }
+    int GetBlockRows() const { return _blockRows; }
+
+    /**
+    * Forgets the reference so the next frame counts as changed, e.g. when
+    * the encoder is about to produce a keyframe.
+    */
+    void Reset();
+
+    StaticSceneStats GetStats() const { return _stats; }
+
+    /**
+    * Turns the AVX2 kernel off, or back on if the CPU supports it. Only
+    * intended for benchmarking the scalar kernel.
+    */
+    void SetAvx2Enabled(bool enable);
+    bool IsAvx2Enabled() const { return _useAvx2; }
+
+    static bool IsSupported(AVPixelFormat format);
+
+  private:
+    int _width;
+    int _height;
+    AVPixelFormat _format;
+    StaticSceneOptions _options;
+    bool _useAvx2;
+    int _blockColumns;
+    int _blockRows;
+    int _planeCount;
+    int _planeWidth[3];           // Bytes, NV12's interleaved chroma is twice the chroma width.
+    int _planeHeight[3];
+    std::vector<uint8_t> _reference[3];
+    bool _haveReference{ false };
+    int _skippedInRow{ 0 };
+    std::vector<uint8_t> _changed;
+    std::vector<uint32_t> _groupSad[3];   // The SAD of each 8 byte column of a row of blocks, per plane.
+    StaticSceneStats _stats{};
+
+    void CopyBlock(const AVFrame* frame, int column, int row);
+  };
+
+  /**
+  * Times the scalar and AVX2 comparisons at 480p, 720p and 1080p, then
+  * encodes a 640x480 realtime VP8 clip in which a growing share of the
+  * frames repeat the one before, with and without skipping the static frames,
+  * and prints the CPU time per frame for each.
+  */
+  void RunStaticSceneBenchmark(int frameCount);
+}
+
+#endif // SIPSORCERY_STATICSCENE_H
@@ -0,0 +1,700 @@
+#include "syntheticsource.h"
+#include "colorconvert.h"
+#include "framepool.h"
+
+extern "C"
+{
+#include <libavutil\imgutils.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include <immintrin.h>
+
+#define SYNTHETIC_SOURCE_GLYPH_WIDTH 5
+#define SYNTHETIC_SOURCE_GLYPH_HEIGHT 7
+#define SYNTHETIC_SOURCE_GLYPH_ADVANCE 6      // Glyph width plus a column of space.
+#define SYNTHETIC_SOURCE_BOX_CELLS 4          // Checker cells along each side of a box.
+
+namespace sipsorcery
+{
+  // 5x7 glyphs, a byte per row, top row first, the left column in bit 4.
+  static const uint8_t _glyphDigits[10][SYNTHETIC_SOURCE_GLYPH_HEIGHT] =
+  {
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E }, { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F }, { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 }, { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E }, { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E }, { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C }
+  };
+
+  static const uint8_t _glyphLetters[26][SYNTHETIC_SOURCE_GLYPH_HEIGHT] =
+  {
+    { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 }, { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E },
+    { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E }, { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C },
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F }, { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 },
+    { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F }, { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 },
+    { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C },
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F },
+    { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 }, { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },
+    { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 },
+    { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D }, { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 },
+    { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E }, { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 },
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A }, { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 },
+    { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 }, { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F }
+  };
+
+  static const uint8_t _glyphSpace[SYNTHETIC_SOURCE_GLYPH_HEIGHT] = { 0 };
+  static const uint8_t _glyphColon[SYNTHETIC_SOURCE_GLYPH_HEIGHT] = { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 };
+  static const uint8_t _glyphDash[SYNTHETIC_SOURCE_GLYPH_HEIGHT] = { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 };
+  static const uint8_t _glyphDot[SYNTHETIC_SOURCE_GLYPH_HEIGHT] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C };
+
+  /**
+  * Characters without a glyph are drawn as a space.
+  */
+  static const uint8_t* GetGlyph(char c)
+  {
+    if (c >= '0' && c <= '9') {
+      return _glyphDigits[c - '0'];
+    }
+    else if (c >= 'A' && c <= 'Z') {
+      return _glyphLetters[c - 'A'];
+    }
+    else if (c >= 'a' && c <= 'z') {
+      return _glyphLetters[c - 'a'];
+    }
+
+    switch (c) {
+    case ':': return _glyphColon;
+    case '-': return _glyphDash;
+    case '.': return _glyphDot;
+    default: return _glyphSpace;
+    }
+  }
+
+  /**
+  * The splitmix64 finaliser, for expanding the seed and keying the noise.
+  */
+  static inline uint64_t Mix64(uint64_t z)
+  {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+  static inline uint64_t NextRandom(uint64_t& state)
+  {
+    state += 0x9E3779B97F4A7C15ull;
+    return Mix64(state);
+  }
+
+  static inline int RandomRange(uint64_t& state, int low, int high)
+  {
+    return low + (int)(NextRandom(state) % (uint64_t)(high - low + 1));
+  }
+
+  /**
+  * The position of a box moving at a constant speed and bouncing off the
+  * ends of [0, range], rounded down to even so it lines up with the chroma.
+  */
+  static int Bounce(int64_t position, int range)
+  {
+    if (range <= 0) {
+      return 0;
+    }
+
+    int64_t period = 2 * (int64_t)range;
+    int64_t m = position % period;
+    if (m < 0) {
+      m += period;
+    }
+    return (int)((m <= range) ? m : period - m) & ~1;
+  }
+
+  /**
+  * A channel's wave along one row, the phase at x is Start + x * XStep.
+  */
+  struct RowWave
+  {
+    uint32_t Start;
+    uint32_t XStep;
+    int Low;
+    int Range;
+    int NoiseShift;
+    int NoiseMask;
+    int NoiseHalf;
+  };
+
+  typedef void(*PlaneRowKernel)(uint8_t* dst, int width, const RowWave& wave, uint32_t key);
+  typedef void(*Nv12RowKernel)(uint8_t* dst, int width, const RowWave& u, const RowWave& v, uint32_t key);
+  typedef void(*BgraRowKernel)(uint8_t* dst, int width, const RowWave* bgr, uint32_t key);
+
+  static inline uint32_t PixelHash(uint32_t key, uint32_t x)
+  {
+    uint32_t h = (key + x) * 0x9E3779B1u;
+    h ^= h >> 15;
+    h *= 0x85EBCA77u;
+    return h ^ (h >> 13);
+  }
+
+  /**
+  * A triangle wave from Low to Low + Range plus the noise, unclamped.
+  */
+  static inline int WaveValue(const RowWave& wave, uint32_t x, uint32_t hash)
+  {
+    uint32_t phase = ((wave.Start + x * wave.XStep) >> 16) & 511;
+    int tri = (int)std::min(phase, 511 - phase);
+    int noise = (int)((hash >> wave.NoiseShift) & (uint32_t)wave.NoiseMask) - wave.NoiseHalf;
+    return wave.Low + ((tri * wave.Range) >> 8) + noise;
+  }
+
+  static inline uint8_t Clamp255(int value)
+  {
+    return (uint8_t)std::min(255, std::max(0, value));
+  }
+
+  static void PlaneRowScalar(uint8_t* dst, int xStart, int width, const RowWave& wave, uint32_t key)
+  {
+    bool noise = wave.NoiseMask != 0;
+    for (int x = xStart; x < width; x++) {
+      dst[x] = Clamp255(WaveValue(wave, x, noise ? PixelHash(key, x) : 0));
+    }
+  }
+
+  static void Nv12RowScalar(uint8_t* dst, int xStart, int width, const RowWave& u, const RowWave& v, uint32_t key)
+  {
+    bool noise = u.NoiseMask != 0 || v.NoiseMask != 0;
+    for (int x = xStart; x < width; x++) {
+      uint32_t hash = noise ? PixelHash(key, x) : 0;
+      dst[2 * x] = Clamp255(WaveValue(u, x, hash));
+      dst[2 * x + 1] = Clamp255(WaveValue(v, x, hash));
+    }
+  }
+
+  static void BgraRowScalar(uint8_t* dst, int xStart, int width, const RowWave* bgr, uint32_t key)
+  {
+    bool noise = bgr[0].NoiseMask != 0;
+    for (int x = xStart; x < width; x++) {
+      uint32_t hash = noise ? PixelHash(key, x) : 0;
+      dst[4 * x] = Clamp255(WaveValue(bgr[0], x, hash));
+      dst[4 * x + 1] = Clamp255(WaveValue(bgr[1], x, hash));
+      dst[4 * x + 2] = Clamp255(WaveValue(bgr[2], x, hash));
+      dst[4 * x + 3] = 255;
+    }
+  }
+
+  /**
+  * The per row constants of a wave, broadcast for the AVX2 kernels.
+  */
+  struct RowWaveAvx2
+  {
+    __m256i LaneSteps;    // XStep times the lane index.
+    __m256i Low;
+    __m256i Range;
+    __m256i NoiseMask;
+    __m256i NoiseHalf;
+    __m128i NoiseShift;
+
+    explicit RowWaveAvx2(const RowWave& wave)
+    {
+      LaneSteps = _mm256_mullo_epi32(_mm256_set1_epi32((int)wave.XStep), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+      Low = _mm256_set1_epi32(wave.Low);
+      Range = _mm256_set1_epi32(wave.Range);
+      NoiseMask = _mm256_set1_epi32(wave.NoiseMask);
+      NoiseHalf = _mm256_set1_epi32(wave.NoiseHalf);
+      NoiseShift = _mm_cvtsi32_si128(wave.NoiseShift);
+    }
+  };
+
+  static inline __m256i PixelHashAvx2(uint32_t key, int x)
+  {
+    __m256i h = _mm256_add_epi32(_mm256_set1_epi32((int)(key + (uint32_t)x)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)0x9E3779B1u));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32((int)0x85EBCA77u));
+    return _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+  }
+
+  /**
+  * WaveValue for pixels x to x + 7 in 32 bit lanes.
+  */
+  static inline __m256i WaveValueAvx2(const RowWave& wave, const RowWaveAvx2& c, int x, __m256i hash)
+  {
+    const __m256i mask511 = _mm256_set1_epi32(511);
+
+    __m256i phase = _mm256_add_epi32(_mm256_set1_epi32((int)(wave.Start + (uint32_t)x * wave.XStep)), c.LaneSteps);
+    phase = _mm256_and_si256(_mm256_srli_epi32(phase, 16), mask511);
+    __m256i tri = _mm256_min_epi32(phase, _mm256_sub_epi32(mask511, phase));
+
+    // tri and Range are both under 256 so the product fits the low 16 bits of each lane.
+    __m256i scaled = _mm256_srli_epi32(_mm256_mullo_epi16(tri, c.Range), 8);
+    __m256i noise = _mm256_sub_epi32(_mm256_and_si256(_mm256_srl_epi32(hash, c.NoiseShift), c.NoiseMask), c.NoiseHalf);
+
+    return _mm256_add_epi32(_mm256_add_epi32(c.Low, scaled), noise);
+  }
+
+  static inline __m256i Clamp255Avx2(__m256i value)
+  {
+    return _mm256_min_epi32(_mm256_max_epi32(value, _mm256_setzero_si256()), _mm256_set1_epi32(255));
+  }
+
+  static void PlaneRowAvx2(uint8_t* dst, int width, const RowWave& wave, uint32_t key)
+  {
+    const RowWaveAvx2 c(wave);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    bool noise = wave.NoiseMask != 0;
+    int x = 0;
+
+    for (; x + 32 <= width; x += 32) {
+      __m256i v[4];
+      for (int i = 0; i < 4; i++) {
+        v[i] = WaveValueAvx2(wave, c, x + i * 8, noise ? PixelHashAvx2(key, x + i * 8) : zero);
+      }
+
+      // The saturating packs clamp to 0 to 255 and leave the 4 byte groups interleaved by lane.
+      __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(v[0], v[1]), _mm256_packs_epi32(v[2], v[3]));
+      _mm256_storeu_si256((__m256i*)(dst + x), _mm256_permutevar8x32_epi32(bytes, order));
+    }
+
+    PlaneRowScalar(dst, x, width, wave, key);
+  }
+
+  static void Nv12RowAvx2(uint8_t* dst, int width, const RowWave& u, const RowWave& v, uint32_t key)
+  {
+    const RowWaveAvx2 cu(u), cv(v);
+    const __m256i zero = _mm256_setzero_si256();
+    bool noise = u.NoiseMask != 0 || v.NoiseMask != 0;
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16) {
+      __m256i pairs[2];
+      for (int i = 0; i < 2; i++) {
+        __m256i hash = noise ? PixelHashAvx2(key, x + i * 8) : zero;
+        __m256i uValue = Clamp255Avx2(WaveValueAvx2(u, cu, x + i * 8, hash));
+        __m256i vValue = Clamp255Avx2(WaveValueAvx2(v, cv, x + i * 8, hash));
+        pairs[i] = _mm256_or_si256(uValue, _mm256_slli_epi32(vValue, 8));
+      }
+
+      __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(pairs[0], pairs[1]), 0xD8);
+      _mm256_storeu_si256((__m256i*)(dst + 2 * x), words);
+    }
+
+    Nv12RowScalar(dst, x, width, u, v, key);
+  }
+
+  static void BgraRowAvx2(uint8_t* dst, int width, const RowWave* bgr, uint32_t key)
+  {
+    const RowWaveAvx2 cb(bgr[0]), cg(bgr[1]), cr(bgr[2]);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+    bool noise = bgr[0].NoiseMask != 0;
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+      __m256i hash = noise ? PixelHashAvx2(key, x) : zero;
+      __m256i b = Clamp255Avx2(WaveValueAvx2(bgr[0], cb, x, hash));
+      __m256i g = Clamp255Avx2(WaveValueAvx2(bgr[1], cg, x, hash));
+      __m256i r = Clamp255Avx2(WaveValueAvx2(bgr[2], cr, x, hash));
+
+      __m256i pixels = _mm256_or_si256(_mm256_or_si256(b, _mm256_slli_epi32(g, 8)), _mm256_or_si256(_mm256_slli_epi32(r, 16), alpha));
+      _mm256_storeu_si256((__m256i*)(dst + 4 * x), pixels);
+    }
+
+    BgraRowScalar(dst, x, width, bgr, key);
+  }
+
+  static void PlaneRowScalarAll(uint8_t* dst, int width, const RowWave& wave, uint32_t key)
+  {
+    PlaneRowScalar(dst, 0, width, wave, key);
+  }
+
+  static void Nv12RowScalarAll(uint8_t* dst, int width, const RowWave& u, const RowWave& v, uint32_t key)
+  {
+    Nv12RowScalar(dst, 0, width, u, v, key);
+  }
+
+  static void BgraRowScalarAll(uint8_t* dst, int width, const RowWave* bgr, uint32_t key)
+  {
+    BgraRowScalar(dst, 0, width, bgr, key);
+  }
+
+  SyntheticVideoSource::SyntheticVideoSource(int width, int height, AVPixelFormat format, const SyntheticSourceOptions& options) :
+    _width(width), _height(height), _format(format), _options(options)
+  {
+    if (!IsSupported(format)) {
+      throw std::runtime_error("Synthetic source does not support " + std::string(av_get_pix_fmt_name(format)) + ".");
+    }
+    else if (width < 2 || height < 2) {
+      throw std::runtime_error("Synthetic source frame size " + std::to_string(width) + "x" + std::to_string(height) + " is too small.");
+    }
+
+    _useAvx2 = ColorConverter::HasAvx2();
+    _options.Fps = std::max(1, _options.Fps);
+    _options.NoiseBits = std::min(SYNTHETIC_SOURCE_MAX_NOISE_BITS, std::max(0, _options.NoiseBits));
+
+    uint64_t state = _options.Seed;
+    bool bgra = format == AV_PIX_FMT_BGRA;
+
+    for (int i = 0; i < 3; i++) {
+      Channel& c = _channels[i];
+      bool chroma = !bgra && i > 0;
+
+      // Chroma pixels are twice the size, twice the step keeps their waves
+      // the same size on screen as the luma's.
+      auto randomStep = [&state](int low, int high) {
+        uint32_t step = (uint32_t)RandomRange(state, low, high);
+        return (NextRandom(state) & 1) ? step : (uint32_t)(0 - step);
+      };
+      c.XStep = randomStep(1 << 14, 1 << 17) << (chroma ? 1 : 0);
+      c.YStep = randomStep(1 << 14, 1 << 17) << (chroma ? 1 : 0);
+      c.TStep = randomStep(1 << 16, 4 << 16);
+      c.Phase = (uint32_t)NextRandom(state);
+
+      // Drawn for every format so the same seed puts the boxes in the same places.
+      int chromaRange = RandomRange(state, 64, 160);
+
+      if (bgra) {
+        c.Low = 0;
+        c.Range = 255;
+      }
+      else if (!chroma) {
+        c.Low = 16;
+        c.Range = 219;
+      }
+      else {
+        c.Range = chromaRange;
+        c.Low = 128 - c.Range / 2;
+      }
+
+      int bits = chroma ? std::max(0, _options.NoiseBits - 1) : _options.NoiseBits;
+      c.NoiseMask = (1 << bits) - 1;
+      c.NoiseHalf = (bits > 0) ? 1 << (bits - 1) : 0;
+
+      // Channels sharing a pixel hash take their noise from different bytes of it.
+      if (bgra) {
+        c.NoiseShift = 24 - 8 * i;
+      }
+      else {
+        c.NoiseShift = (format == AV_PIX_FMT_NV12 && i == 2) ? 16 : 24;
+      }
+    }
+
+    int shortSide = std::min(width, height);
+    int minSize = std::max(2 * SYNTHETIC_SOURCE_BOX_CELLS, shortSide / 12);
+    int maxSize = std::max(minSize, shortSide / 5);
+
+    for (int i = 0; i < _options.BoxCount; i++) {
+      Box box;
+      box.Size = RandomRange(state, minSize, maxSize) & ~(2 * SYNTHETIC_SOURCE_BOX_CELLS - 1);
+      box.X = RandomRange(state, 0, width);
+      box.Y = RandomRange(state, 0, height);
+      box.VX = RandomRange(state, 1, 6) * ((NextRandom(state) & 1) ? 2 : -2);
+      box.VY = RandomRange(state, 1, 6) * ((NextRandom(state) & 1) ? 2 : -2);
+
+      uint8_t r = (uint8_t)NextRandom(state), g = (uint8_t)NextRandom(state), b = (uint8_t)NextRandom(state);
+      box.Colors[0] = GetColor(r, g, b);
+      box.Colors[1] = GetColor(255 - r, 255 - g, 255 - b);
+      _boxes.push_back(box);
+    }
+
+    // An even scale keeps the glyph pixels on chroma boundaries.
+    _textScale = std::max(2, (height / 240) * 2);
+    _banner = "SIPSORCERY SYNTHETIC SOURCE - SEED " + std::to_string(_options.Seed) + " - " +
+      std::to_string(width) + "X" + std::to_string(height) + " " + av_get_pix_fmt_name(format) + " - ";
+  }
+
+  bool SyntheticVideoSource::IsSupported(AVPixelFormat format)
+  {
+    return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_NV12 || format == AV_PIX_FMT_BGRA;
+  }
+
+  void SyntheticVideoSource::SetAvx2Enabled(bool enable)
+  {
+    _useAvx2 = enable && ColorConverter::HasAvx2();
+  }
+
+  SyntheticVideoSource::Color SyntheticVideoSource::GetColor(uint8_t r, uint8_t g, uint8_t b)
+  {
+    // BT.601 limited range, the same as the colour converter's default.
+    Color color;
+    color.Y = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    color.U = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    color.V = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    color.Bgra = (uint32_t)b | ((uint32_t)g << 8) | ((uint32_t)r << 16) | 0xFF000000u;
+    return color;
+  }
+
+  int SyntheticVideoSource::Fill(AVFrame* frame, int64_t frameIndex)
+  {
+    if (frame->width != _width || frame->height != _height || frame->format != _format) {
+      return AVERROR(EINVAL);
+    }
+
+    Fill(frame->data, frame->linesize, frameIndex);
+    return 0;
+  }
+
+  void SyntheticVideoSource::Fill(uint8_t* const dst[], const int dstStride[], int64_t frameIndex)
+  {
+    FillBackground(dst, dstStride, frameIndex);
+
+    for (auto& box : _boxes) {
+      int x = Bounce(box.X + box.VX * frameIndex, _width - box.Size);
+      int y = Bounce(box.Y + box.VY * frameIndex, _height - box.Size);
+      int cell = box.Size / SYNTHETIC_SOURCE_BOX_CELLS;
+
+      for (int row = 0; row < SYNTHETIC_SOURCE_BOX_CELLS; row++) {
+        for (int col = 0; col < SYNTHETIC_SOURCE_BOX_CELLS; col++) {
+          FillRect(dst, dstStride, x + col * cell, y + row * cell, x + (col + 1) * cell, y + (row + 1) * cell,
+            box.Colors[(row + col) & 1]);
+        }
+      }
+    }
+
+    if (!_options.Text) {
+      return;
+    }
+
+    static const Color black = GetColor(0, 0, 0);
+    static const Color white = GetColor(255, 255, 255);
+    int scale = _textScale;
+    int advance = SYNTHETIC_SOURCE_GLYPH_ADVANCE * scale;
+    int lineHeight = (SYNTHETIC_SOURCE_GLYPH_HEIGHT + 2) * scale;
+
+    int64_t fps = _options.Fps;
+    int64_t seconds = frameIndex / fps;
+    char timecode[64];
+    std::snprintf(timecode, sizeof(timecode), "%02d:%02d:%02d:%02d %lld", (int)(seconds / 3600 % 100), (int)(seconds / 60 % 60),
+      (int)(seconds % 60), (int)(frameIndex % fps), (long long)frameIndex);
+
+    int margin = 2 * scale;
+    int timecodeWidth = (int)std::strlen(timecode) * advance;
+    FillRect(dst, dstStride, margin - scale, margin - scale, margin + timecodeWidth, margin - scale + lineHeight, black);
+    DrawText(dst, dstStride, timecode, margin, margin, white);
+
+    int bannerTop = (_height - lineHeight) & ~1;
+    int bannerWidth = (int)_banner.size() * advance;
+    int offset = (int)((frameIndex * scale) % bannerWidth);
+    FillRect(dst, dstStride, 0, bannerTop, _width, _height, black);
+    for (int x = -offset; x < _width; x += bannerWidth) {
+      DrawText(dst, dstStride, _banner.c_str(), x, bannerTop + scale, white);
+    }
+  }
+
+  /**
+  * Writes the gradient and noise to every pixel a row at a time.
+  */
+  void SyntheticVideoSource::FillBackground(uint8_t* const dst[], const int dstStride[], int64_t frameIndex)
+  {
+    uint32_t t = (uint32_t)frameIndex;
+
+    auto rowWave = [t](const Channel& c, int y) {
+      return RowWave{ c.Phase + (uint32_t)y * c.YStep + t * c.TStep, c.XStep, c.Low, c.Range, c.NoiseShift, c.NoiseMask, c.NoiseHalf };
+    };
+
+    // A different noise key for every row of every plane of every frame.
+    auto rowKey = [this, frameIndex](int plane, int y) {
+      return (uint32_t)(Mix64(_options.Seed + (uint64_t)frameIndex * 0x9E3779B97F4A7C15ull +
+        (uint64_t)(plane * 65536 + y) * 0xBF58476D1CE4E5B9ull) >> 32);
+    };
+
+    if (_format == AV_PIX_FMT_BGRA) {
+      BgraRowKernel kernel = _useAvx2 ? BgraRowAvx2 : BgraRowScalarAll;
+      for (int y = 0; y < _height; y++) {
+        RowWave bgr[3] = { rowWave(_channels[0], y), rowWave(_channels[1], y), rowWave(_channels[2], y) };
+        kernel(dst[0] + y * dstStride[0], _width, bgr, rowKey(0, y));
+      }
+      return;
+    }
+
+    PlaneRowKernel planeKernel = _useAvx2 ? PlaneRowAvx2 : PlaneRowScalarAll;
+    for (int y = 0; y < _height; y++) {
+      planeKernel(dst[0] + y * dstStride[0], _width, rowWave(_channels[0], y), rowKey(0, y));
+    }
+
+    int chromaWidth = (_width + 1) / 2;
+    int chromaHeight = (_height + 1) / 2;
+
+    if (_format == AV_PIX_FMT_NV12) {
+      Nv12RowKernel kernel = _useAvx2 ? Nv12RowAvx2 : Nv12RowScalarAll;
+      for (int y = 0; y < chromaHeight; y++) {
+        kernel(dst[1] + y * dstStride[1], chromaWidth, rowWave(_channels[1], y), rowWave(_channels[2], y), rowKey(1, y));
+      }
+    }
+    else {
+      for (int y = 0; y < chromaHeight; y++) {
+        planeKernel(dst[1] + y * dstStride[1], chromaWidth, rowWave(_channels[1], y), rowKey(1, y));
+        planeKernel(dst[2] + y * dstStride[2], chromaWidth, rowWave(_channels[2], y), rowKey(2, y));
+      }
+    }
+  }
+
+  /**
+  * Fills [x0, x1) x [y0, y1), clipped to the frame. Chroma covers every
+  * 2x2 block the rectangle touches.
+  */
+  void SyntheticVideoSource::FillRect(uint8_t* const dst[], const int dstStride[], int x0, int y0, int x1, int y1, const Color& color)
+  {
+    x0 = std::max(0, x0);
+    y0 = std::max(0, y0);
+    x1 = std::min(_width, x1);
+    y1 = std::min(_height, y1);
+    if (x0 >= x1 || y0 >= y1) {
+      return;
+    }
+
+    if (_format == AV_PIX_FMT_BGRA) {
+      for (int y = y0; y < y1; y++) {
+        std::fill_n((uint32_t*)(dst[0] + y * dstStride[0]) + x0, x1 - x0, color.Bgra);
+      }
+      return;
+    }
+
+    for (int y = y0; y < y1; y++) {
+      memset(dst[0] + y * dstStride[0] + x0, color.Y, x1 - x0);
+    }
+
+    int cx0 = x0 / 2, cx1 = (x1 + 1) / 2;
+    for (int y = y0 / 2; y < (y1 + 1) / 2; y++) {
+      if (_format == AV_PIX_FMT_NV12) {
+        uint16_t uv = (uint16_t)(color.U | (color.V << 8));
+        std::fill_n((uint16_t*)(dst[1] + y * dstStride[1]) + cx0, cx1 - cx0, uv);
+      }
+      else {
+        memset(dst[1] + y * dstStride[1] + cx0, color.U, cx1 - cx0);
+        memset(dst[2] + y * dstStride[2] + cx0, color.V, cx1 - cx0);
+      }
+    }
+  }
+
+  /**
+  * Draws a line of text with its top left at x, y, each run of lit glyph
+  * pixels in a row as one rectangle.
+  */
+  void SyntheticVideoSource::DrawText(uint8_t* const dst[], const int dstStride[], const char* text, int x, int y, const Color& color)
+  {
+    int scale = _textScale;
+
+    for (int i = 0; text[i] != '\0'; i++) {
+      int left = x + i * SYNTHETIC_SOURCE_GLYPH_ADVANCE * scale;
+      if (left >= _width) {
+        break;
+      }
+      else if (left + SYNTHETIC_SOURCE_GLYPH_WIDTH * scale <= 0) {
+        continue;
+      }
+
+      const uint8_t* glyph = GetGlyph(text[i]);
+
+      for (int row = 0; row < SYNTHETIC_SOURCE_GLYPH_HEIGHT; row++) {
+        int col = 0;
+        while (col < SYNTHETIC_SOURCE_GLYPH_WIDTH) {
+          if ((glyph[row] & (0x10 >> col)) == 0) {
+            col++;
+            continue;
+          }
+
+          int start = col;
+          while (col < SYNTHETIC_SOURCE_GLYPH_WIDTH && (glyph[row] & (0x10 >> col)) != 0) {
+            col++;
+          }
+          FillRect(dst, dstStride, left + start * scale, y + row * scale, left + col * scale, y + (row + 1) * scale, color);
+        }
+      }
+    }
+  }
+
+  /**
+  * Compares the visible bytes of two frames of the same size and format.
+  */
+  static bool FramesEqual(const AVFrame* a, const AVFrame* b)
+  {
+    for (int plane = 0; plane < AV_NUM_DATA_POINTERS && a->data[plane] != nullptr; plane++) {
+      int rowBytes = av_image_get_linesize((AVPixelFormat)a->format, a->width, plane);
+      int rows = (plane == 0) ? a->height : (a->height + 1) / 2;
+
+      for (int y = 0; y < rows; y++) {
+        if (memcmp(a->data[plane] + y * a->linesize[plane], b->data[plane] + y * b->linesize[plane], rowBytes) != 0) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  void RunSyntheticSourceBenchmark(int frameCount)
+  {
+    const int resolutions[][2] = { { 640, 480 }, { 1280, 720 }, { 1920, 1080 } };
+    const AVPixelFormat formats[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, AV_PIX_FMT_BGRA };
+
+    frameCount = std::max(1, frameCount);
+
+    std::cout << "Synthetic source, AVX2 " << (ColorConverter::HasAvx2() ? "available" : "not available")
+      << ", ms per frame over " << frameCount << " frames." << std::endl;
+
+    for (auto& res : resolutions) {
+      int width = res[0], height = res[1];
+
+      for (auto format : formats) {
+        FramePool pool(width, height, format, 2);
+        AVFrame* scalarFrame = pool.Get();
+        AVFrame* avx2Frame = pool.Get();
+        SyntheticVideoSource source(width, height, format);
+
+        // Every frame is different, as it would be from a camera, so nothing is served warm from the cache.
+        auto timeMs = [frameCount](std::function<void(int)> fill) {
+          auto start = std::chrono::steady_clock::now();
+          for (int i = 0; i < frameCount; i++) {
+            fill(i);
+          }
+          return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frameCount;
+        };
+
+        source.SetAvx2Enabled(false);
+        double scalarMs = timeMs([&](int i) { source.Fill(scalarFrame, i); });
+        source.SetAvx2Enabled(true);
+        double avx2Ms = timeMs([&](int i) { source.Fill(avx2Frame, i); });
+
+        std::cout << width << "x" << height << " " << av_get_pix_fmt_name(format)
+          << std::fixed << std::setprecision(3)
+          << ": scalar " << scalarMs << ", avx2 " << avx2Ms
+          << " (" << std::setprecision(0) << 1000.0 / std::max(avx2Ms, 0.001) << " fps)"
+          << ", avx2 matches scalar " << (FramesEqual(scalarFrame, avx2Frame) ? "yes" : "NO") << "." << std::endl;
+
+        pool.Return(scalarFrame);
+        pool.Return(avx2Frame);
+      }
+    }
+
+    // The same seed has to give the same clip on every run, and a different one a different clip.
+    const int width = resolutions[0][0], height = resolutions[0][1];
+    const int64_t frameIndex = frameCount - 1;
+    SyntheticSourceOptions otherSeed;
+    otherSeed.Seed = SYNTHETIC_SOURCE_DEFAULT_SEED + 1;
+
+    FramePool pool(width, height, AV_PIX_FMT_YUV420P, 3);
+    AVFrame* first = pool.Get();
+    AVFrame* again = pool.Get();
+    AVFrame* other = pool.Get();
+
+    SyntheticVideoSource(width, height, AV_PIX_FMT_YUV420P).Fill(first, frameIndex);
+    SyntheticVideoSource(width, height, AV_PIX_FMT_YUV420P).Fill(again, frameIndex);
+    SyntheticVideoSource(width, height, AV_PIX_FMT_YUV420P, otherSeed).Fill(other, frameIndex);
+
+    std::cout << "Same seed reproduces frame " << frameIndex << " " << (FramesEqual(first, again) ? "yes" : "NO")
+      << ", different seed differs " << (!FramesEqual(first, other) ? "yes" : "NO") << "." << std::endl;
+
+    pool.Return(first);
+    pool.Return(again);
+    pool.Return(other);
+  }
+}
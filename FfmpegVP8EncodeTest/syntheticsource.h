@@ -0,0 +1,156 @@
+//-----------------------------------------------------------------------------
+// Filename: syntheticsource.h
+//
+// Description: Generates test video straight into I420, NV12 or BGRA frames
+// for the encode and decode benchmarks. The picture is built in layers:
+//
+//  gradient: a triangle wave per channel that drifts with the frame index,
+//            computed with AVX2 8 pixels at a time.
+//  noise: hashed per pixel noise added to the gradient in the same pass, so
+//         no two frames are alike and the encoders have to spend real bits.
+//  boxes: checkered boxes bouncing around the frame, textured so motion
+//         search has something to lock on to.
+//  text: a timecode and frame number in the top left and a banner
+//        scrolling along the bottom, drawn with a built in 5x7 font.
+//
+// Everything is derived from the seed and the frame index alone, frames can
+// be generated in any order and a given seed always produces the same clip.
+// The seed is expanded with splitmix64 rather than the std distributions,
+// whose output differs between standard libraries. The AVX2 and scalar
+// paths use the same integer arithmetic and produce identical output.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_SYNTHETICSOURCE_H
+#define SIPSORCERY_SYNTHETICSOURCE_H
+
+extern "C"
+{
+#include <libavutil\frame.h>
+#include <libavutil\pixfmt.h>
+}
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define SYNTHETIC_SOURCE_DEFAULT_SEED 0x5eed
+#define SYNTHETIC_SOURCE_DEFAULT_NOISE_BITS 4     // +/-8 levels, roughly a clean webcam.
+#define SYNTHETIC_SOURCE_DEFAULT_BOX_COUNT 4
+#define SYNTHETIC_SOURCE_MAX_NOISE_BITS 8
+
+namespace sipsorcery
+{
+  struct SyntheticSourceOptions
+  {
+    uint32_t Seed{ SYNTHETIC_SOURCE_DEFAULT_SEED };
+    int Fps{ 30 };                                            // Only used for the timecode.
+    int NoiseBits{ SYNTHETIC_SOURCE_DEFAULT_NOISE_BITS };     // 0 for none, chroma gets one bit less.
+    int BoxCount{ SYNTHETIC_SOURCE_DEFAULT_BOX_COUNT };
+    bool Text{ true };
+  };
+
+  class SyntheticVideoSource
+  {
+  public:
+    /**
+    * @param[in] width: the width of the frames.
+    * @param[in] height: the height of the frames.
+    * @param[in] format: AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12 or AV_PIX_FMT_BGRA.
+    * @param[in] options: the seed and which layers to draw.
+    * Throws std::runtime_error if the format is not supported.
+    */
+    SyntheticVideoSource(int width, int height, AVPixelFormat format, const SyntheticSourceOptions& options = SyntheticSourceOptions());
+
+    /**
+    * Generates a frame. Not thread safe, but separate sources with the
+    * same options can fill frames in parallel.
+    * @param[out] dst: the destination planes, Y U V for I420, Y UV for NV12
+    *  or the single packed plane for BGRA.
+    * @param[in] dstStride: the number of bytes between rows for each plane.
+    * @param[in] frameIndex: the frame to generate.
+    */
+    void Fill(uint8_t* const dst[], const int dstStride[], int64_t frameIndex);
+
+    /**
+    * Generates a frame.
+    * @@Returns 0 on success or AVERROR(EINVAL) if the frame doesn't match the source.
+    */
+    int Fill(AVFrame* frame, int64_t frameIndex);
+
+    /**
+    * Turns the AVX2 kernels off, or back on if the CPU supports them. Only
+    * intended for benchmarking the scalar kernels.
+    */
+    void SetAvx2Enabled(bool enable);
+    bool IsAvx2Enabled() const { return _useAvx2; }
+
+    static bool IsSupported(AVPixelFormat format);
+
+  private:
+    struct Channel
+    {
+      // Fixed point 16.16 steps of the wave's phase, a period is 512.
+      uint32_t XStep;
+      uint32_t YStep;
+      uint32_t TStep;
+      uint32_t Phase;
+      int Low;              // The wave runs from Low to Low + Range.
+      int Range;
+      int NoiseShift;       // Which byte of the pixel hash the noise comes from.
+      int NoiseMask;
+      int NoiseHalf;
+    };
+
+    struct Color
+    {
+      uint8_t Y;
+      uint8_t U;
+      uint8_t V;
+      uint32_t Bgra;
+    };
+
+    struct Box
+    {
+      int Size;
+      int X;
+      int Y;
+      int VX;               // Pixels per frame.
+      int VY;
+      Color Colors[2];      // The checker cells alternate between the two.
+    };
+
+    int _width;
+    int _height;
+    AVPixelFormat _format;
+    SyntheticSourceOptions _options;
+    bool _useAvx2;
+    Channel _channels[3];   // Y U V, or B G R.
+    std::vector<Box> _boxes;
+    std::string _banner;
+    int _textScale;
+
+    void FillBackground(uint8_t* const dst[], const int dstStride[], int64_t frameIndex);
+    void FillRect(uint8_t* const dst[], const int dstStride[], int x0, int y0, int x1, int y1, const Color& color);
+    void DrawText(uint8_t* const dst[], const int dstStride[], const char* text, int x, int y, const Color& color);
+
+    static Color GetColor(uint8_t r, uint8_t g, uint8_t b);
+  };
+
+  /**
+  * Times the scalar and AVX2 kernels for each format at 480p, 720p and 1080p
+  * and checks the two produce the same frames and that the same seed
+  * reproduces a clip.
+  */
+  void RunSyntheticSourceBenchmark(int frameCount);
+}
+
+#endif // SIPSORCERY_SYNTHETICSOURCE_H
@@ -0,0 +1,242 @@
+#include "videodecoder.h"
+
+extern "C"
+{
+#include <libavutil\imgutils.h>
+#include <libavutil\pixdesc.h>
+}
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#define SURFACE_HEADER_LENGTH VIDEO_DECODER_SURFACE_ALIGNMENT   // Holds the block size and keeps the planes aligned.
+
+namespace sipsorcery
+{
+  /**
+  * Free list of surface blocks. Each block starts with a header recording
+  * its size so blocks from before a frame size change can be told apart.
+  * The decoder holds one reference and every outstanding surface another.
+  */
+  struct VideoDecoder::SurfacePool
+  {
+    std::mutex Mutex;
+    std::vector<uint8_t*> Free;
+    int SurfaceSize{ 0 };
+    std::atomic<int> Refs{ 1 };
+    uint64_t Acquisitions{ 0 };
+    uint64_t Allocations{ 0 };
+    uint64_t InUse{ 0 };
+
+    ~SurfacePool()
+    {
+      for (auto block : Free) {
+        av_free(block);
+      }
+    }
+
+    uint8_t* Get(int size)
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+
+      if (size > SurfaceSize) {
+        // The frames got bigger, the blocks on hand are no use any more.
+        for (auto block : Free) {
+          av_free(block);
+        }
+        Free.clear();
+        SurfaceSize = size;
+      }
+
+      uint8_t* block = nullptr;
+      if (!Free.empty()) {
+        block = Free.back();
+        Free.pop_back();
+      }
+      else {
+        block = static_cast<uint8_t*>(av_malloc(SURFACE_HEADER_LENGTH + SurfaceSize));
+        if (block == nullptr) {
+          return nullptr;
+        }
+        *reinterpret_cast<int*>(block) = SurfaceSize;
+        Allocations++;
+      }
+
+      Acquisitions++;
+      InUse++;
+      Refs++;
+
+      return block + SURFACE_HEADER_LENGTH;
+    }
+
+    void Put(uint8_t* surface)
+    {
+      uint8_t* block = surface - SURFACE_HEADER_LENGTH;
+
+      {
+        std::lock_guard<std::mutex> lock(Mutex);
+        InUse--;
+        if (*reinterpret_cast<int*>(block) < SurfaceSize) {
+          av_free(block);
+        }
+        else {
+          Free.push_back(block);
+        }
+      }
+
+      Release();
+    }
+
+    void Release()
+    {
+      if (Refs.fetch_sub(1) == 1) {
+        delete this;
+      }
+    }
+  };
+
+  VideoDecoder::VideoDecoder(AVCodecID codecID, int threads, int threadType)
+  {
+    const AVCodec* codec = avcodec_find_decoder(codecID);
+    if (codec == NULL) {
+      throw std::runtime_error("Could not find decoder for codec ID " + std::to_string(codecID) + ".");
+    }
+
+    _codecCtx = avcodec_alloc_context3(codec);
+    if (_codecCtx == NULL) {
+      throw std::runtime_error("Failed to allocate codec context for " + std::string(codec->name) + ".");
+    }
+
+    _surfaces = new SurfacePool();
+
+    _codecCtx->opaque = this;
+    _codecCtx->get_buffer2 = GetBuffer;
+    _codecCtx->thread_count = threads;
+    _codecCtx->thread_type = threadType;
+    _codecCtx->thread_safe_callbacks = 1;     // The surface pool is safe to call from the frame threads.
+
+    int res = avcodec_open2(_codecCtx, codec, NULL);
+    if (res < 0) {
+      avcodec_free_context(&_codecCtx);
+      _surfaces->Release();
+      throw std::runtime_error("avcodec_open2 failed for " + std::string(codec->name) + " decoder.");
+    }
+
+    _frame = av_frame_alloc();
+  }
+
+  VideoDecoder::~VideoDecoder()
+  {
+    av_frame_free(&_frame);
+    avcodec_free_context(&_codecCtx);
+    _surfaces->Release();
+  }
+
+  int VideoDecoder::Decode(const AVPacket* pkt, std::function<void(AVFrame*)> onFrame)
+  {
+    int sendres = avcodec_send_packet(_codecCtx, pkt);
+    if (sendres < 0 && sendres != AVERROR_EOF) {
+      return sendres;
+    }
+
+    return ReceiveFrames(onFrame);
+  }
+
+  int VideoDecoder::Flush(std::function<void(AVFrame*)> onFrame)
+  {
+    return Decode(nullptr, onFrame);
+  }
+
+  int VideoDecoder::ReceiveFrames(std::function<void(AVFrame*)>& onFrame)
+  {
+    int count = 0;
+
+    while (true) {
+      int ret = avcodec_receive_frame(_codecCtx, _frame);
+      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+        break;
+      }
+      else if (ret < 0) {
+        return ret;
+      }
+
+      count++;
+      if (onFrame != nullptr) {
+        onFrame(_frame);
+      }
+      av_frame_unref(_frame);
+    }
+
+    return count;
+  }
+
+  PoolStats VideoDecoder::GetSurfaceStats()
+  {
+    std::lock_guard<std::mutex> lock(_surfaces->Mutex);
+    return PoolStats{ _surfaces->Acquisitions, _surfaces->Allocations, _surfaces->InUse };
+  }
+
+  /**
+  * Lays the planes out in a single surface using the padded dimensions the
+  * codec asks for. Formats the pool doesn't handle, palettes and hardware
+  * surfaces, go to the default allocator.
+  */
+  int VideoDecoder::GetBuffer(AVCodecContext* ctx, AVFrame* frame, int flags)
+  {
+    VideoDecoder* decoder = static_cast<VideoDecoder*>(ctx->opaque);
+    AVPixelFormat pixFmt = static_cast<AVPixelFormat>(frame->format);
+
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(pixFmt);
+    if (desc == NULL || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_PAL))) {
+      return avcodec_default_get_buffer2(ctx, frame, flags);
+    }
+
+    int width = frame->width;
+    int height = frame->height;
+    int linesizeAlign[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(ctx, &width, &height, linesizeAlign);
+
+    int linesizes[4];
+    int res = av_image_fill_linesizes(linesizes, pixFmt, width);
+    if (res < 0) {
+      return res;
+    }
+
+    for (int i = 0; i < 4; i++) {
+      linesizes[i] = FFALIGN(linesizes[i], VIDEO_DECODER_SURFACE_ALIGNMENT);
+    }
+
+    int size = av_image_fill_pointers(frame->data, pixFmt, height, NULL, linesizes);
+    if (size < 0) {
+      return size;
+    }
+    // Padding so SIMD code reading a full vector past the end of the last row stays in bounds.
+    size += VIDEO_DECODER_SURFACE_ALIGNMENT;
+
+    uint8_t* surface = decoder->_surfaces->Get(size);
+    if (surface == nullptr) {
+      return AVERROR(ENOMEM);
+    }
+
+    frame->buf[0] = av_buffer_create(surface, size, ReleaseSurface, decoder->_surfaces, 0);
+    if (frame->buf[0] == NULL) {
+      decoder->_surfaces->Put(surface);
+      return AVERROR(ENOMEM);
+    }
+
+    av_image_fill_pointers(frame->data, pixFmt, height, surface, linesizes);
+    for (int i = 0; i < 4; i++) {
+      frame->linesize[i] = linesizes[i];
+    }
+    frame->extended_data = frame->data;
+
+    return 0;
+  }
+
+  void VideoDecoder::ReleaseSurface(void* opaque, uint8_t* data)
+  {
+    static_cast<SurfacePool*>(opaque)->Put(data);
+  }
+}
@@ -0,0 +1,98 @@
+//-----------------------------------------------------------------------------
+// Filename: videodecoder.h
+//
+// Description: Wrapper around a libavcodec video decoder that decodes
+// straight into pooled surfaces. The decoder's get_buffer2 callback hands out
+// one block of memory per frame, holding all the planes, wrapped with
+// av_buffer_create. When the last reference to a frame goes, whether that is
+// the caller, an encoder or a queue, the block goes back on the free list
+// rather than to the heap. Nothing is copied between the decoder writing the
+// pixels and whoever consumes them.
+//
+// Surfaces can outlive the decoder, the free list is reference counted and
+// goes once the decoder and every outstanding surface have released it.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_VIDEODECODER_H
+#define SIPSORCERY_VIDEODECODER_H
+
+#include "framepool.h"
+
+extern "C"
+{
+#include <libavcodec\avcodec.h>
+}
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+
+#define VIDEO_DECODER_SURFACE_ALIGNMENT 64    // Covers the stride alignment of AVX-512 builds of libavcodec.
+
+namespace sipsorcery
+{
+  class VideoDecoder
+  {
+  public:
+    /**
+    * @param[in] codecID: the codec to decode.
+    * @param[in] threads: the number of decoder threads, 0 to use one per core.
+    *  Codecs that support it use frame threading, which adds a frame of
+    *  latency per thread.
+    * @param[in] threadType: FF_THREAD_FRAME, FF_THREAD_SLICE or both. With both
+    *  libavcodec uses frame threading where the codec supports it. Slice
+    *  threading has no added latency but only scales as far as the stream
+    *  has slices, for VP8 its token partitions.
+    * Throws std::runtime_error if the decoder cannot be opened.
+    */
+    VideoDecoder(AVCodecID codecID, int threads = 1, int threadType = FF_THREAD_FRAME | FF_THREAD_SLICE);
+    ~VideoDecoder();
+
+    VideoDecoder(const VideoDecoder&) = delete;
+    VideoDecoder& operator=(const VideoDecoder&) = delete;
+
+    /**
+    * Sends a packet to the decoder and passes any frames that are ready to
+    * the callback. The frame is unreferenced once the callback returns, to
+    * keep it take a reference with av_frame_ref or av_frame_move_ref.
+    * @param[in] pkt: the packet to decode, or nullptr to drain the decoder.
+    *  A reference counted packet is referenced rather than copied.
+    * @param[in] onFrame: callback for each decoded frame.
+    * @@Returns the number of frames produced or a negative AVERROR code.
+    */
+    int Decode(const AVPacket* pkt, std::function<void(AVFrame*)> onFrame);
+
+    int Flush(std::function<void(AVFrame*)> onFrame);
+
+    AVCodecContext* GetContext() { return _codecCtx; }
+
+    /**
+    * Allocations only go up when the decoder needs more surfaces in flight
+    * than it has had before, or the frame size grows.
+    */
+    PoolStats GetSurfaceStats();
+
+  private:
+    struct SurfacePool;
+
+    AVCodecContext* _codecCtx{ nullptr };
+    AVFrame* _frame{ nullptr };
+    SurfacePool* _surfaces{ nullptr };
+
+    int ReceiveFrames(std::function<void(AVFrame*)>& onFrame);
+
+    static int GetBuffer(AVCodecContext* ctx, AVFrame* frame, int flags);
+    static void ReleaseSurface(void* opaque, uint8_t* data);
+  };
+}
+
+#endif // SIPSORCERY_VIDEODECODER_H
@@ -0,0 +1,532 @@
+#include "videoencoder.h"
+
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#define ERROR_BUFFER_SIZE 2048
+#define VP8_REALTIME_CPU_USED "8"
+#define VP8_BALANCED_CPU_USED "4"
+#define VP8_ARCHIVAL_CPU_USED "0"
+#define VP8_BALANCED_LAG_IN_FRAMES "8"
+#define VP8_ARCHIVAL_LAG_IN_FRAMES "25"
+#define REALTIME_TOKEN_PARTITIONS 4     // libavcodec maps AVCodecContext::slices to log2 VP8 token partitions.
+#define REALTIME_GOP_SIZE 3000          // Interactive streams request keyframes on demand (PLI) rather than periodically.
+#define DEFAULT_GOP_SIZE 250
+#define VP8_REALTIME_STATIC_THRESH "1"   // Skips macroblocks that haven't changed at all, as WebRTC does for camera streams.
+#define H264_REALTIME_SLICE_MAX_SIZE "1100"  // Bytes, leaves room for the RTP header and a FU-A indicator in a 1200 byte MTU.
+#define DEFAULT_BITS_PER_PIXEL 0.1      // Used to pick a bit rate when the caller doesn't supply one.
+
+// libvpx per frame encode flags from vpx/vp8cx.h, passed to libavcodec as "vp8-flags" frame metadata.
+#define VP8_EFLAG_NO_REF_LAST (1 << 16)
+#define VP8_EFLAG_NO_REF_GF (1 << 17)
+#define VP8_EFLAG_NO_UPD_LAST (1 << 18)
+#define VP8_EFLAG_NO_UPD_ENTROPY (1 << 20)
+#define VP8_EFLAG_NO_REF_ARF (1 << 21)
+#define VP8_EFLAG_NO_UPD_GF (1 << 22)
+#define VP8_EFLAG_NO_UPD_ARF (1 << 23)
+
+namespace sipsorcery
+{
+  /**
+  * The frame pattern for a temporal layer count. Layer 0 frames only use and
+  * update the last frame buffer. For 3 layers, layer 1 keeps its frame in the
+  * golden buffer for layer 2 to reference. The upper layers never update the
+  * entropy context so dropping them doesn't change how later frames decode.
+  */
+  struct TemporalLayerPattern
+  {
+    int Periodicity;
+    int LayerIDs[4];
+    uint32_t Flags[VIDEO_ENCODER_MAX_TEMPORAL_LAYERS];
+    bool LayerSync[VIDEO_ENCODER_MAX_TEMPORAL_LAYERS];          // The layer only references layer 0.
+    double BitRateShare[VIDEO_ENCODER_MAX_TEMPORAL_LAYERS];     // Cumulative share of the bit rate up to each layer.
+    int RateDecimator[VIDEO_ENCODER_MAX_TEMPORAL_LAYERS];
+  };
+
+  static const uint32_t BASE_LAYER_FLAGS = VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF;
+
+  static const TemporalLayerPattern _temporalPatterns[VIDEO_ENCODER_MAX_TEMPORAL_LAYERS - 1] =
+  {
+    // 2 layers.
+    { 2, { 0, 1 },
+      { BASE_LAYER_FLAGS,
+        VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY },
+      { false, true },
+      { 0.6, 1.0 },
+      { 2, 1 } },
+
+    // 3 layers.
+    { 4, { 0, 2, 1, 2 },
+      { BASE_LAYER_FLAGS,
+        VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY,
+        VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF | VP8_EFLAG_NO_UPD_ENTROPY },
+      { false, true, false },
+      { 0.4, 0.6, 1.0 },
+      { 4, 2, 1 } }
+  };
+
+  VideoEncoder::VideoEncoder(AVCodecID codecID, int width, int height, int fps,
+    EncoderPreset preset, int threads, int64_t bitRate, int temporalLayers) :
+    _codecID(codecID), _preset(preset), _width(width), _height(height),
+    _temporalLayers(temporalLayers)
+  {
+    if (temporalLayers < 1 || temporalLayers > VIDEO_ENCODER_MAX_TEMPORAL_LAYERS) {
+      throw std::runtime_error("Temporal layer count of " + std::to_string(temporalLayers) + " is not supported.");
+    }
+    else if (temporalLayers > 1 && codecID != AV_CODEC_ID_VP8) {
+      throw std::runtime_error("Temporal layers are only supported for VP8.");
+    }
+
+    for (int i = 0; i < VIDEO_ENCODER_LAYER_HISTORY; i++) {
+      _layerHistoryPts[i] = AV_NOPTS_VALUE;
+      _layerHistory[i] = 0;
+    }
+
+    const AVCodec* codec = avcodec_find_encoder(codecID);
+    if (codec == NULL) {
+      throw std::runtime_error("Could not find codec for ID " + std::to_string(codecID) + ".");
+    }
+
+    _codecCtx = avcodec_alloc_context3(codec);
+    if (_codecCtx == NULL) {
+      throw std::runtime_error("Failed to allocate codec context for " + std::string(codec->name) + ".");
+    }
+
+    _codecCtx->width = width;
+    _codecCtx->height = height;
+    _codecCtx->time_base.num = 1;
+    _codecCtx->time_base.den = fps;
+    _codecCtx->framerate.num = fps;
+    _codecCtx->framerate.den = 1;
+    _codecCtx->bit_rate = (bitRate > 0) ? bitRate : (int64_t)(width * height * fps * DEFAULT_BITS_PER_PIXEL);
+    _codecCtx->gop_size = (preset == EncoderPreset::Realtime) ? REALTIME_GOP_SIZE : DEFAULT_GOP_SIZE;
+    _codecCtx->max_b_frames = 0;
+
+#pragma warning(suppress : 26812)
+    _codecCtx->pix_fmt = AVPixelFormat::AV_PIX_FMT_YUV420P;
+
+    AVDictionary* opts = NULL;
+    ApplyPreset(&opts, threads);
+    ApplyTemporalLayers(&opts);
+
+    int res = avcodec_open2(_codecCtx, codec, &opts);
+
+    // Any options left in the dictionary were not recognised by the encoder.
+    AVDictionaryEntry* unused = NULL;
+    while ((unused = av_dict_get(opts, "", unused, AV_DICT_IGNORE_SUFFIX)) != NULL) {
+      std::cerr << "Encoder option " << unused->key << "=" << unused->value << " not used by " << codec->name << "." << std::endl;
+    }
+    av_dict_free(&opts);
+
+    if (res < 0) {
+      avcodec_free_context(&_codecCtx);
+      throw std::runtime_error("avcodec_open2 failed for " + std::string(codec->name) + ", " + GetErrorString(res) + ".");
+    }
+
+    _openBitRate = _codecCtx->bit_rate;
+
+    _pkt = av_packet_alloc();
+    _sendFrame = av_frame_alloc();
+    if (_pkt == NULL || _sendFrame == NULL) {
+      av_frame_free(&_sendFrame);
+      av_packet_free(&_pkt);
+      avcodec_free_context(&_codecCtx);
+      throw std::runtime_error("Failed to allocate the encoder packet or frame.");
+    }
+  }
+
+  VideoEncoder::~VideoEncoder()
+  {
+    av_frame_free(&_sendFrame);
+    av_packet_free(&_pkt);
+    avcodec_free_context(&_codecCtx);
+  }
+
+  /**
+  * Sets the codec context fields and private encoder options for the preset.
+  * Options that only apply to a particular encoder implementation go in the
+  * dictionary so they are ignored (and reported) if a different
+  * implementation of the codec gets picked up.
+  */
+  void VideoEncoder::ApplyPreset(AVDictionary** opts, int threads)
+  {
+    _codecCtx->thread_count = threads;
+
+    switch (_codecID) {
+    case AV_CODEC_ID_VP8:
+      if (_preset == EncoderPreset::Realtime) {
+        av_dict_set(opts, "deadline", "realtime", 0);
+        av_dict_set(opts, "cpu-used", VP8_REALTIME_CPU_USED, 0);
+        av_dict_set(opts, "lag-in-frames", "0", 0);
+        av_dict_set(opts, "error-resilient", "1", 0);
+        av_dict_set(opts, "auto-alt-ref", "0", 0);
+        av_dict_set(opts, "static-thresh", VP8_REALTIME_STATIC_THRESH, 0);
+        _codecCtx->slices = REALTIME_TOKEN_PARTITIONS;
+        _codecCtx->rc_max_rate = _codecCtx->bit_rate;
+        _codecCtx->rc_min_rate = _codecCtx->bit_rate;
+        _codecCtx->rc_buffer_size = (int)_codecCtx->bit_rate;
+      }
+      else if (_preset == EncoderPreset::Balanced) {
+        av_dict_set(opts, "deadline", "good", 0);
+        av_dict_set(opts, "cpu-used", VP8_BALANCED_CPU_USED, 0);
+        av_dict_set(opts, "lag-in-frames", VP8_BALANCED_LAG_IN_FRAMES, 0);
+        _codecCtx->slices = REALTIME_TOKEN_PARTITIONS;
+      }
+      else {
+        av_dict_set(opts, "deadline", "best", 0);
+        av_dict_set(opts, "cpu-used", VP8_ARCHIVAL_CPU_USED, 0);
+        av_dict_set(opts, "lag-in-frames", VP8_ARCHIVAL_LAG_IN_FRAMES, 0);
+        av_dict_set(opts, "auto-alt-ref", "1", 0);
+      }
+      break;
+
+    case AV_CODEC_ID_H264:
+      _codecCtx->profile = FF_PROFILE_H264_BASELINE;
+      if (_preset == EncoderPreset::Realtime) {
+        av_dict_set(opts, "preset", "veryfast", 0);
+        av_dict_set(opts, "tune", "zerolatency", 0);
+        av_dict_set(opts, "x264-params", "slice-max-size=" H264_REALTIME_SLICE_MAX_SIZE, 0);
+        _codecCtx->rc_max_rate = _codecCtx->bit_rate;
+        _codecCtx->rc_buffer_size = (int)_codecCtx->bit_rate;
+      }
+      else if (_preset == EncoderPreset::Balanced) {
+        _codecCtx->profile = FF_PROFILE_H264_MAIN;
+        av_dict_set(opts, "preset", "fast", 0);
+      }
+      else {
+        _codecCtx->profile = FF_PROFILE_H264_HIGH;
+        av_dict_set(opts, "preset", "slow", 0);
+      }
+      break;
+
+    case AV_CODEC_ID_MJPEG:
+      // MJPEG has no inter frame state so the only latency knob is threading
+      // across slices. The presets trade quantiser for speed.
+      _codecCtx->thread_type = FF_THREAD_SLICE;
+      _codecCtx->color_range = AVCOL_RANGE_JPEG;
+      _codecCtx->strict_std_compliance = FF_COMPLIANCE_UNOFFICIAL;
+      _codecCtx->flags |= AV_CODEC_FLAG_QSCALE;
+      _codecCtx->global_quality = FF_QP2LAMBDA * ((_preset == EncoderPreset::Realtime) ? 8 : (_preset == EncoderPreset::Balanced) ? 4 : 2);
+      av_dict_set(opts, "huffman", (_preset == EncoderPreset::Realtime) ? "default" : "optimal", 0);
+      break;
+
+    default:
+      std::cerr << "No encoder preset available for codec ID " << _codecID << ", using encoder defaults." << std::endl;
+      break;
+    }
+  }
+
+  /**
+  * Sets up libvpx's per layer rate control. The reference structure that
+  * makes the layers droppable is applied per frame in TagTemporalLayer.
+  */
+  void VideoEncoder::ApplyTemporalLayers(AVDictionary** opts)
+  {
+    if (_temporalLayers < 2) {
+      return;
+    }
+
+    const TemporalLayerPattern& pattern = _temporalPatterns[_temporalLayers - 2];
+    int64_t kbps = _codecCtx->bit_rate / 1000;
+
+    std::ostringstream ts;
+    ts << "ts_number_layers=" << _temporalLayers << ":ts_target_bitrate=";
+    for (int i = 0; i < _temporalLayers; i++) {
+      ts << ((i > 0) ? "," : "") << (int64_t)(kbps * pattern.BitRateShare[i]);
+    }
+    ts << ":ts_rate_decimator=";
+    for (int i = 0; i < _temporalLayers; i++) {
+      ts << ((i > 0) ? "," : "") << pattern.RateDecimator[i];
+    }
+    ts << ":ts_periodicity=" << pattern.Periodicity << ":ts_layer_id=";
+    for (int i = 0; i < pattern.Periodicity; i++) {
+      ts << ((i > 0) ? "," : "") << pattern.LayerIDs[i];
+    }
+
+    av_dict_set(opts, "ts-parameters", ts.str().c_str(), 0);
+  }
+
+  /**
+  * Returns the frame to send to the encoder. If it needs a keyframe forced,
+  * a temporal layer tag or its pts moving on after a reset that's done on a
+  * reference to the caller's frame, otherwise the caller's frame is sent as is.
+  */
+  const AVFrame* VideoEncoder::PrepareFrame(const AVFrame* frame)
+  {
+    if (frame == nullptr) {
+      return frame;
+    }
+
+    if (frame->pts != AV_NOPTS_VALUE) {
+      _nextPts = frame->pts + _ptsOffset + 1;
+    }
+
+    if (_temporalLayers < 2 && _ptsOffset == 0 && !_keyframePending) {
+      return frame;
+    }
+
+    if (av_frame_ref(_sendFrame, frame) < 0) {
+      return frame;
+    }
+
+    if (_keyframePending) {
+      _sendFrame->pict_type = AV_PICTURE_TYPE_I;
+      _keyframePending = false;
+    }
+
+    TagTemporalLayer(_sendFrame);
+    _sendFrame->pts += _ptsOffset;
+
+    return _sendFrame;
+  }
+
+  /**
+  * Works out the frame's temporal layer and, if layers are in use, sets the
+  * layer's reference flags on it. A forced keyframe restarts the pattern so
+  * the next frames follow on from a layer 0 frame.
+  */
+  void VideoEncoder::TagTemporalLayer(AVFrame* frame)
+  {
+    if (_temporalLayers < 2) {
+      return;
+    }
+
+    const TemporalLayerPattern& pattern = _temporalPatterns[_temporalLayers - 2];
+
+    if (frame->pict_type == AV_PICTURE_TYPE_I) {
+      _temporalFrameCount = 0;
+    }
+
+    int layer = pattern.LayerIDs[_temporalFrameCount++ % pattern.Periodicity];
+
+    int slot = (int)((uint64_t)frame->pts % VIDEO_ENCODER_LAYER_HISTORY);
+    _layerHistoryPts[slot] = frame->pts;
+    _layerHistory[slot] = (uint8_t)layer;
+
+    av_dict_set(&frame->metadata, "vp8-flags", std::to_string(pattern.Flags[layer]).c_str(), 0);
+  }
+
+  int VideoEncoder::GetTemporalLayer(const AVPacket* pkt, bool* layerSync, bool* nonReference) const
+  {
+    int layer = 0;
+
+    if (_temporalLayers > 1 && !(pkt->flags & AV_PKT_FLAG_KEY)) {
+      int slot = (int)((uint64_t)pkt->pts % VIDEO_ENCODER_LAYER_HISTORY);
+      if (_layerHistoryPts[slot] == pkt->pts) {
+        layer = _layerHistory[slot];
+      }
+    }
+
+    if (layerSync != nullptr) {
+      *layerSync = (_temporalLayers > 1) && _temporalPatterns[_temporalLayers - 2].LayerSync[layer];
+    }
+
+    if (nonReference != nullptr) {
+      const uint32_t noUpdates = VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF;
+      *nonReference = (_temporalLayers > 1) && (_temporalPatterns[_temporalLayers - 2].Flags[layer] & noUpdates) == noUpdates;
+    }
+
+    return layer;
+  }
+
+  bool VideoEncoder::CanChangeBitRate() const
+  {
+    return strcmp(_codecCtx->codec->name, "libx264") == 0;
+  }
+
+  bool VideoEncoder::SetBitRate(int64_t bitRate)
+  {
+    if (!CanChangeBitRate()) {
+      return false;
+    }
+
+    _codecCtx->bit_rate = bitRate;
+
+    if (_codecCtx->rc_max_rate > 0) {
+      _codecCtx->rc_max_rate = bitRate;
+    }
+    if (_codecCtx->rc_min_rate > 0) {
+      _codecCtx->rc_min_rate = bitRate;
+    }
+    if (_codecCtx->rc_buffer_size > 0) {
+      _codecCtx->rc_buffer_size = (int)bitRate;
+    }
+
+    return true;
+  }
+
+  int VideoEncoder::Encode(const AVFrame* frame, std::function<void(AVPacket*)> onPacket)
+  {
+    _queueDelayMicros = -1;
+    return EncodeFrame(frame, onPacket);
+  }
+
+  int VideoEncoder::Encode(const AVFrame* frame, std::chrono::steady_clock::time_point queuedTime, std::function<void(AVPacket*)> onPacket)
+  {
+    _queueDelayMicros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - queuedTime).count();
+    return EncodeFrame(frame, onPacket);
+  }
+
+  int VideoEncoder::EncodeFrame(const AVFrame* frame, std::function<void(AVPacket*)>& onPacket)
+  {
+    if (frame != nullptr && _staticScene != nullptr && !_flushed) {
+      if (_keyframePending || frame->pict_type == AV_PICTURE_TYPE_I) {
+        // The frame is going to be encoded whatever it holds, it becomes the new reference.
+        _staticScene->Reset();
+      }
+
+      if (_staticScene->IsStatic(frame)) {
+        if (frame->pts != AV_NOPTS_VALUE) {
+          _nextPts = frame->pts + _ptsOffset + 1;
+        }
+        _telemetry.RecordSkippedFrame();
+        return 0;
+      }
+    }
+
+    _encodeStartTime = std::chrono::steady_clock::now();
+    _encodeStartCpu = EncodeTelemetry::GetThreadCpuMicros();
+
+    const AVFrame* sendFrame = PrepareFrame(frame);
+    int sendres = avcodec_send_frame(_codecCtx, sendFrame);
+
+    if (sendFrame == _sendFrame) {
+      av_frame_unref(_sendFrame);
+    }
+
+    if (frame == nullptr) {
+      _flushed = true;
+    }
+    else if (sendres >= 0) {
+      _framesEncoded++;
+    }
+
+    if (sendres < 0 && sendres != AVERROR_EOF) {
+      std::cerr << "avcodec_send_frame result " << sendres << ", " << GetErrorString(sendres) << "." << std::endl;
+      return sendres;
+    }
+
+    int res = ReceivePackets(onPacket);
+
+    if (frame != nullptr) {
+      _telemetry.RecordFrame(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _encodeStartTime).count(),
+        EncodeTelemetry::GetThreadCpuMicros() - _encodeStartCpu, _queueDelayMicros);
+    }
+
+    return res;
+  }
+
+  int VideoEncoder::EncodeSlices(const AVFrame* frame, SliceCallback onSlice)
+  {
+    return Encode(frame, [this, &onSlice](AVPacket* pkt) {
+      SplitEncodedFrame(_codecID, pkt->data, pkt->size, _slices);
+      for (auto& slice : _slices) {
+        onSlice(pkt, slice);
+      }
+    });
+  }
+
+  void VideoEncoder::SetStaticFrameSkipping(bool enable, const StaticSceneOptions& options)
+  {
+    if (enable) {
+      _staticScene.reset(new StaticSceneDetector(_width, _height, AV_PIX_FMT_YUV420P, options));
+    }
+    else {
+      _staticScene.reset();
+    }
+  }
+
+  int VideoEncoder::Flush(std::function<void(AVPacket*)> onPacket)
+  {
+    return Encode(nullptr, onPacket);
+  }
+
+  bool VideoEncoder::Reset()
+  {
+    // A pooled encoder mustn't hand the last stream's congestion controlled
+    // rate or static frame skipping on to the next one, which turns skipping
+    // on itself if it wants it.
+    SetBitRate(_openBitRate);
+    _staticScene.reset();
+
+    if (_framesEncoded == 0 && !_flushed) {
+      return true;
+    }
+
+    if (_codecCtx->codec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH) {
+      avcodec_flush_buffers(_codecCtx);
+    }
+    else if (_flushed || _preset != EncoderPreset::Realtime) {
+      // Draining leaves the encoder at EOF for good, and the other presets
+      // can be holding lookahead frames from the old stream.
+      return false;
+    }
+
+    _flushed = false;
+    _framesEncoded = 0;
+    _keyframePending = true;
+    _ptsOffset = _nextPts;
+    _temporalFrameCount = 0;
+    _telemetry.Reset();
+
+    for (int i = 0; i < VIDEO_ENCODER_LAYER_HISTORY; i++) {
+      _layerHistoryPts[i] = AV_NOPTS_VALUE;
+    }
+
+    return true;
+  }
+
+  int VideoEncoder::ReceivePackets(std::function<void(AVPacket*)>& onPacket)
+  {
+    int count = 0;
+
+    while (true) {
+      int ret = avcodec_receive_packet(_codecCtx, _pkt);
+      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+        break;
+      }
+      else if (ret < 0) {
+        std::cerr << "avcodec_receive_packet result " << ret << ", " << GetErrorString(ret) << "." << std::endl;
+        return ret;
+      }
+
+      count++;
+
+      if (_ptsOffset != 0) {
+        _pkt->pts = (_pkt->pts != AV_NOPTS_VALUE) ? _pkt->pts - _ptsOffset : AV_NOPTS_VALUE;
+        _pkt->dts = (_pkt->dts != AV_NOPTS_VALUE) ? _pkt->dts - _ptsOffset : AV_NOPTS_VALUE;
+      }
+
+      // Recorded before the callback so the times are the encoder's alone.
+      _telemetry.RecordPacket(_pkt,
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _encodeStartTime).count(),
+        EncodeTelemetry::GetThreadCpuMicros() - _encodeStartCpu, _queueDelayMicros);
+
+      if (onPacket != nullptr) {
+        onPacket(_pkt);
+      }
+      av_packet_unref(_pkt);
+    }
+
+    return count;
+  }
+
+  const char* VideoEncoder::GetPresetName(EncoderPreset preset)
+  {
+    switch (preset) {
+    case EncoderPreset::Realtime: return "realtime";
+    case EncoderPreset::Balanced: return "balanced";
+    case EncoderPreset::Archival: return "archival";
+    default: return "unknown";
+    }
+  }
+
+  std::string VideoEncoder::GetErrorString(int averror)
+  {
+    char errBuf[ERROR_BUFFER_SIZE];
+    av_strerror(averror, errBuf, ERROR_BUFFER_SIZE);
+    return std::string(errBuf);
+  }
+}
@@ -0,0 +1,240 @@
+//-----------------------------------------------------------------------------
+// Filename: videoencoder.h
+//
+// Description: Reusable wrapper around a libavcodec video encoder. The
+// encoder is configured from a named preset that trades latency against
+// compression efficiency:
+//  - Realtime: lowest per-frame latency, no lookahead, for interactive feeds.
+//  - Balanced: modest lookahead and a slower speed setting for live streams
+//              where a frame or two of delay is acceptable.
+//  - Archival: best compression for recordings, latency is not a concern.
+//
+// VP8 can also be encoded with 2 or 3 temporal layers. Each frame is tagged
+// with libvpx reference flags so a frame only references frames in its own
+// or a lower layer, a relay can then drop the upper layers to give a viewer a
+// half or a quarter of the frame rate without re-encoding:
+//
+//  2 layers: TL0 TL1 TL0 TL1 ...           TL1 references TL0.
+//  3 layers: TL0 TL2 TL1 TL2 TL0 ...       TL1 references TL0, TL2 references TL0 and TL1.
+//
+// An open encoder can be reset and used for a new stream, see Reset, which is
+// what lets EncoderPool keep encoders open ahead of the streams that need them.
+//
+// Every frame and packet is recorded in the encoder's EncodeTelemetry, encode
+// time, CPU time, queue delay, size, frame type and QP.
+//
+// EncodeSlices hands each packet out a VP8 partition or H.264 NAL unit at a
+// time, see encodedslices.h for what that does and doesn't save. The H.264
+// Realtime preset caps slices at H264_REALTIME_SLICE_MAX_SIZE bytes so each
+// one fits in an RTP packet.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_VIDEOENCODER_H
+#define SIPSORCERY_VIDEOENCODER_H
+
+#include "encodedslices.h"
+#include "encodetelemetry.h"
+#include "staticscene.h"
+
+extern "C"
+{
+#include <libavcodec\avcodec.h>
+#include <libavutil\opt.h>
+}
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define VIDEO_ENCODER_MAX_TEMPORAL_LAYERS 3
+#define VIDEO_ENCODER_LAYER_HISTORY 64      // Frames the temporal layer is remembered for, must cover the encoder's lag.
+
+namespace sipsorcery
+{
+  enum class EncoderPreset
+  {
+    Realtime,
+    Balanced,
+    Archival
+  };
+
+  class VideoEncoder
+  {
+  public:
+    typedef std::function<void(AVPacket* pkt, const EncodedSlice& slice)> SliceCallback;
+
+    /**
+    * Finds and opens an encoder for the requested codec.
+    * @param[in] codecID: the codec to encode with, VP8, H264 and MJPEG have presets.
+    * @param[in] width: the width of the frames that will be supplied.
+    * @param[in] height: the height of the frames that will be supplied.
+    * @param[in] fps: the nominal frame rate, used for the time base and rate control.
+    * @param[in] preset: the latency preset to apply.
+    * @param[in] threads: the number of encoder threads, 0 to use one per core.
+    * @param[in] bitRate: the target bit rate in bits per second, 0 to pick one
+    *  from the resolution and frame rate.
+    * @param[in] temporalLayers: the number of VP8 temporal layers, 1 to 3.
+    * Throws std::runtime_error if the encoder cannot be opened.
+    */
+    VideoEncoder(AVCodecID codecID, int width, int height, int fps,
+      EncoderPreset preset, int threads = 0, int64_t bitRate = 0, int temporalLayers = 1);
+    ~VideoEncoder();
+
+    VideoEncoder(const VideoEncoder&) = delete;
+    VideoEncoder& operator=(const VideoEncoder&) = delete;
+
+    /**
+    * Sends a frame to the encoder and passes any packets that are ready to
+    * the callback. The packet is unreferenced once the callback returns.
+    * @param[in] frame: the frame to encode, or nullptr to drain the encoder.
+    * @param[in] onPacket: callback for each encoded packet.
+    * @@Returns the number of packets produced or a negative AVERROR code.
+    */
+    int Encode(const AVFrame* frame, std::function<void(AVPacket*)> onPacket);
+
+    /**
+    * As Encode, also recording the time from queuedTime to the encode
+    * starting as the frame's queue delay.
+    */
+    int Encode(const AVFrame* frame, std::chrono::steady_clock::time_point queuedTime, std::function<void(AVPacket*)> onPacket);
+
+    /**
+    * As Encode, passing each packet to the callback a piece at a time, VP8
+    * partitions or H.264 NAL units in bitstream order. The packet is the one
+    * the pieces point into, it's unreferenced after the last piece.
+    * @param[in] frame: the frame to encode, or nullptr to drain the encoder.
+    * @param[in] onSlice: callback for each piece of each encoded packet.
+    * @@Returns the number of packets produced or a negative AVERROR code.
+    */
+    int EncodeSlices(const AVFrame* frame, SliceCallback onSlice);
+
+    /**
+    * Drains any frames the encoder is still holding. After flushing the
+    * encoder cannot accept any more frames.
+    */
+    int Flush(std::function<void(AVPacket*)> onPacket);
+
+    /**
+    * Readies the encoder to start a new stream without reopening it. The next
+    * frame is encoded as a keyframe, the temporal layer pattern restarts and
+    * the new stream's pts can start again from 0. Encoders that support
+    * AV_CODEC_CAP_ENCODER_FLUSH have their state flushed. Others keep their
+    * rate control state, which is only safe if they hold no frames, so it's
+    * limited to the Realtime preset. The telemetry starts again too, the
+    * bit rate goes back to the one the encoder was opened with and static
+    * frame skipping is turned off.
+    * @@Returns true if the encoder was reset, false if it must be reopened.
+    */
+    bool Reset();
+
+    /**
+    * Turns on or off skipping frames that are the same as the last one
+    * encoded, see staticscene.h. A skipped frame isn't sent to the encoder
+    * and produces no packets. Frames that aren't I420 at the encoder's size,
+    * forced keyframes and the frame after a reset are always encoded.
+    */
+    void SetStaticFrameSkipping(bool enable, const StaticSceneOptions& options = StaticSceneOptions());
+
+    /**
+    * Forces the next frame to be a keyframe, e.g. for a viewer's PLI.
+    */
+    void RequestKeyframe() { _keyframePending = true; }
+
+    /**
+    * Changes the target bit rate of the open encoder, as a congestion
+    * controller does when the path's capacity changes. The rate control
+    * limits the preset set at open are moved with it. Only libx264 takes a
+    * new rate while open, it reconfigures itself on the next frame. The
+    * libvpx wrapper in FFmpeg 4.3 reads the rate once when the encoder is
+    * opened, for it nothing is changed.
+    * @param[in] bitRate: the new target in bits per second.
+    * @@Returns true if the encoder will use the new rate, false if it can't
+    *  change rate while open.
+    */
+    bool SetBitRate(int64_t bitRate);
+
+    /**
+    * @@Returns true if SetBitRate takes effect without reopening the encoder.
+    */
+    bool CanChangeBitRate() const;
+
+    /**
+    * @@Returns the static frame detector or nullptr if skipping is off.
+    */
+    const StaticSceneDetector* GetStaticSceneDetector() const { return _staticScene.get(); }
+
+    AVCodecContext* GetContext() { return _codecCtx; }
+    AVCodecID GetCodecID() const { return _codecID; }
+    EncoderPreset GetPreset() const { return _preset; }
+    int GetWidth() const { return _width; }
+    int GetHeight() const { return _height; }
+    int GetTemporalLayerCount() const { return _temporalLayers; }
+    int64_t GetFramesEncoded() const { return _framesEncoded; }
+    EncodeTelemetry& GetTelemetry() { return _telemetry; }
+
+    /**
+    * Gets the temporal layer an encoded packet belongs to, matched by pts to
+    * the frame it was encoded from. Keyframes are always layer 0.
+    * @param[in] pkt: a packet from this encoder.
+    * @param[out] layerSync: set to true if the frame only references layer 0,
+    *  a receiver can switch up to this layer from it. Optional.
+    * @param[out] nonReference: set to true if the frame's layer doesn't update
+    *  any reference buffer, so it can be dropped without affecting any other
+    *  frame. Optional.
+    * @@Returns the temporal layer, 0 if temporal layers aren't in use.
+    */
+    int GetTemporalLayer(const AVPacket* pkt, bool* layerSync = nullptr, bool* nonReference = nullptr) const;
+
+    static const char* GetPresetName(EncoderPreset preset);
+    static std::string GetErrorString(int averror);
+
+  private:
+    AVCodecID _codecID;
+    EncoderPreset _preset;
+    int _width;
+    int _height;
+    AVCodecContext* _codecCtx{ nullptr };
+    AVPacket* _pkt{ nullptr };
+    AVFrame* _sendFrame{ nullptr };         // Carries per frame changes without touching the caller's frame.
+
+    int64_t _framesEncoded{ 0 };
+    int64_t _openBitRate{ 0 };              // Restored by Reset after SetBitRate.
+    bool _flushed{ false };
+    bool _keyframePending{ false };
+    int64_t _ptsOffset{ 0 };                // Keeps the pts libavcodec sees increasing across resets.
+    int64_t _nextPts{ 0 };
+
+    EncodeTelemetry _telemetry;
+    std::chrono::steady_clock::time_point _encodeStartTime;     // Of the encode call in progress.
+    int64_t _encodeStartCpu{ 0 };
+    int64_t _queueDelayMicros{ -1 };
+    std::vector<EncodedSlice> _slices;
+    std::unique_ptr<StaticSceneDetector> _staticScene;
+
+    int _temporalLayers;
+    int64_t _temporalFrameCount{ 0 };
+    int64_t _layerHistoryPts[VIDEO_ENCODER_LAYER_HISTORY];
+    uint8_t _layerHistory[VIDEO_ENCODER_LAYER_HISTORY];
+
+    void ApplyPreset(AVDictionary** opts, int threads);
+    void ApplyTemporalLayers(AVDictionary** opts);
+    int EncodeFrame(const AVFrame* frame, std::function<void(AVPacket*)>& onPacket);
+    const AVFrame* PrepareFrame(const AVFrame* frame);
+    void TagTemporalLayer(AVFrame* frame);
+    int ReceivePackets(std::function<void(AVPacket*)>& onPacket);
+  };
+}
+
+#endif // SIPSORCERY_VIDEOENCODER_H
@@ -0,0 +1,365 @@
+#include "vp8depacketizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#define VP8_DEPACKETIZER_MAX_FRAME_SIZE (16 * 1024 * 1024)
+
+namespace sipsorcery
+{
+  /**
+  * Sequence number order allowing for wrap around.
+  */
+  static inline bool SeqNumBefore(uint16_t a, uint16_t b)
+  {
+    return (int16_t)(a - b) < 0;
+  }
+
+  Vp8Depacketizer::Vp8Depacketizer(int bufferSize) :
+    _bufferSize(bufferSize)
+  {
+    _pool = av_buffer_pool_init(_bufferSize, NULL);
+    _packet = av_packet_alloc();
+    if (_pool == NULL || _packet == NULL) {
+      av_buffer_pool_uninit(&_pool);
+      av_packet_free(&_packet);
+      throw std::runtime_error("Failed to allocate the VP8 depacketizer frame buffer pool.");
+    }
+
+    for (auto& frame : _frames) {
+      frame.InUse = false;
+      frame.Buffer = nullptr;
+    }
+  }
+
+  Vp8Depacketizer::~Vp8Depacketizer()
+  {
+    for (auto& frame : _frames) {
+      Release(frame);
+    }
+    av_packet_free(&_packet);
+
+    // Buffers still held downstream keep the pool alive until they're returned.
+    av_buffer_pool_uninit(&_pool);
+  }
+
+  int Vp8Depacketizer::Push(const uint8_t* packet, size_t length, std::chrono::steady_clock::time_point receivedTime,
+    Vp8FrameReadyCallback onFrame)
+  {
+    _stats.PacketsIn++;
+
+    RtpHeaderInfo hdr;
+    Vp8RtpDescriptor desc;
+    if (!ParseRtpHeader(packet, length, hdr) ||
+      !ParseVp8RtpDescriptor(packet + hdr.PayloadOffset, hdr.PayloadLength, desc) ||
+      desc.Length > hdr.PayloadLength) {
+      _stats.InvalidPackets++;
+      return -1;
+    }
+
+    if (_haveSsrc && hdr.Ssrc != _ssrc) {
+      // A new stream, nothing in progress belongs to it.
+      Reset();
+    }
+    _haveSsrc = true;
+    _ssrc = hdr.Ssrc;
+
+    int framesOut = 0;
+    FrameAssembly* frame = GetAssembly(hdr.Timestamp, hdr.SeqNum, receivedTime, onFrame, framesOut);
+    if (frame == nullptr) {
+      return framesOut;
+    }
+
+    for (auto& fragment : frame->Fragments) {
+      if (fragment.SeqNum == hdr.SeqNum) {
+        _stats.DuplicatePackets++;
+        return framesOut;
+      }
+    }
+
+    const uint8_t* payload = packet + hdr.PayloadOffset + desc.Length;
+    size_t payloadLength = hdr.PayloadLength - desc.Length;
+
+    if (SeqNumBefore(hdr.SeqNum, frame->FirstSeqNum)) {
+      frame->FirstSeqNum = hdr.SeqNum;
+    }
+
+    if (desc.StartOfPartition && desc.PartitionID == 0) {
+      frame->HaveStart = true;
+      frame->StartSeqNum = hdr.SeqNum;
+      frame->KeyFrame = payloadLength > 0 && (payload[0] & 0x01) == 0;   // The P bit of the VP8 frame tag.
+    }
+
+    if (hdr.Marker) {
+      frame->HaveEnd = true;
+      frame->EndSeqNum = hdr.SeqNum;
+    }
+
+    if (!Append(*frame, hdr.SeqNum, payload, payloadLength)) {
+      Drop(*frame);
+    }
+
+    return framesOut + Output(onFrame);
+  }
+
+  void Vp8Depacketizer::Reset()
+  {
+    for (auto& frame : _frames) {
+      Release(frame);
+    }
+    _haveLastSeqNum = false;
+    _waitingForKeyframe = true;
+  }
+
+  /**
+  * Finds the frame a packet belongs to, starting a new one if needed. If
+  * every slot is taken the oldest frame is dropped to make room.
+  * @@Returns nullptr if the packet is for a frame that's already finished.
+  */
+  Vp8Depacketizer::FrameAssembly* Vp8Depacketizer::GetAssembly(uint32_t timestamp, uint16_t seqNum,
+    std::chrono::steady_clock::time_point receivedTime, Vp8FrameReadyCallback& onFrame, int& framesOut)
+  {
+    for (auto& frame : _frames) {
+      if (frame.InUse && frame.Timestamp == timestamp) {
+        return &frame;
+      }
+    }
+
+    // Checked before making room, a late or duplicate packet mustn't cost a
+    // frame that's still being assembled.
+    if (_haveLastSeqNum && (!SeqNumBefore(_lastSeqNum, seqNum) || timestamp == _lastTimestamp)) {
+      _stats.LatePackets++;
+      return nullptr;
+    }
+
+    FrameAssembly* free = nullptr;
+    for (auto& frame : _frames) {
+      if (!frame.InUse) {
+        free = &frame;
+        break;
+      }
+    }
+
+    if (free == nullptr) {
+      free = GetOldest();
+      Drop(*free);
+      framesOut += Output(onFrame);
+    }
+
+    free->Buffer = av_buffer_pool_get(_pool);
+    if (free->Buffer == NULL) {
+      return nullptr;
+    }
+
+    free->InUse = true;
+    free->Timestamp = timestamp;
+    free->Length = 0;
+    free->Fragments.clear();
+    free->HaveStart = false;
+    free->StartSeqNum = 0;
+    free->HaveEnd = false;
+    free->EndSeqNum = 0;
+    free->FirstSeqNum = seqNum;
+    free->KeyFrame = false;
+    free->FirstPacketTime = receivedTime;
+
+    return free;
+  }
+
+  /**
+  * Copies a packet's payload onto the end of the frame buffer, moving to a
+  * bigger buffer if it doesn't fit.
+  */
+  bool Vp8Depacketizer::Append(FrameAssembly& frame, uint16_t seqNum, const uint8_t* data, size_t length)
+  {
+    size_t needed = frame.Length + length + AV_INPUT_BUFFER_PADDING_SIZE;
+
+    if (needed > (size_t)frame.Buffer->size) {
+      if (needed > VP8_DEPACKETIZER_MAX_FRAME_SIZE) {
+        return false;
+      }
+
+      if (needed > (size_t)_bufferSize) {
+        while ((size_t)_bufferSize < needed) {
+          _bufferSize *= 2;
+        }
+        av_buffer_pool_uninit(&_pool);
+        _pool = av_buffer_pool_init(_bufferSize, NULL);
+        _stats.BufferGrowths++;
+      }
+
+      AVBufferRef* bigger = (_pool != NULL) ? av_buffer_pool_get(_pool) : NULL;
+      if (bigger == NULL) {
+        return false;
+      }
+      memcpy(bigger->data, frame.Buffer->data, frame.Length);
+      av_buffer_unref(&frame.Buffer);
+      frame.Buffer = bigger;
+    }
+
+    memcpy(frame.Buffer->data + frame.Length, data, length);
+    frame.Fragments.push_back(Fragment{ seqNum, frame.Length, length });
+    frame.Length += length;
+
+    return true;
+  }
+
+  bool Vp8Depacketizer::IsComplete(const FrameAssembly& frame) const
+  {
+    return frame.HaveStart && frame.HaveEnd && frame.FirstSeqNum == frame.StartSeqNum &&
+      (size_t)(uint16_t)(frame.EndSeqNum - frame.StartSeqNum + 1) == frame.Fragments.size();
+  }
+
+  Vp8Depacketizer::FrameAssembly* Vp8Depacketizer::GetOldest()
+  {
+    FrameAssembly* oldest = nullptr;
+    for (auto& frame : _frames) {
+      if (frame.InUse && (oldest == nullptr || SeqNumBefore(frame.FirstSeqNum, oldest->FirstSeqNum))) {
+        oldest = &frame;
+      }
+    }
+    return oldest;
+  }
+
+  /**
+  * Outputs complete frames from the oldest on. A frame that doesn't follow
+  * straight on from the last one output waits in case the frames in between
+  * turn up, unless it's a keyframe, which needs nothing before it.
+  */
+  int Vp8Depacketizer::Output(Vp8FrameReadyCallback& onFrame)
+  {
+    int count = 0;
+
+    for (auto& keyframe : _frames) {
+      if (keyframe.InUse && keyframe.KeyFrame && IsComplete(keyframe)) {
+        for (auto& older : _frames) {
+          if (older.InUse && SeqNumBefore(older.FirstSeqNum, keyframe.FirstSeqNum)) {
+            _stats.FramesDropped++;
+            Release(older);
+          }
+        }
+      }
+    }
+
+    FrameAssembly* oldest = nullptr;
+    while ((oldest = GetOldest()) != nullptr && IsComplete(*oldest)) {
+      bool contiguous = _haveLastSeqNum && oldest->StartSeqNum == (uint16_t)(_lastSeqNum + 1);
+
+      if (!oldest->KeyFrame && _waitingForKeyframe) {
+        _stats.FramesSkipped++;
+        Finish(*oldest);
+      }
+      else if (!oldest->KeyFrame && !contiguous) {
+        break;
+      }
+      else if (Emit(*oldest, onFrame)) {
+        count++;
+      }
+    }
+
+    return count;
+  }
+
+  bool Vp8Depacketizer::Emit(FrameAssembly& frame, Vp8FrameReadyCallback& onFrame)
+  {
+    for (size_t i = 0; i < frame.Fragments.size(); i++) {
+      if (frame.Fragments[i].SeqNum != (uint16_t)(frame.StartSeqNum + i)) {
+        if (!Reorder(frame)) {
+          Drop(frame);
+          return false;
+        }
+        break;
+      }
+    }
+
+    memset(frame.Buffer->data + frame.Length, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    _packet->buf = frame.Buffer;
+    _packet->data = frame.Buffer->data;
+    _packet->size = (int)frame.Length;
+    _packet->pts = frame.Timestamp;
+    _packet->dts = frame.Timestamp;
+    _packet->flags = frame.KeyFrame ? AV_PKT_FLAG_KEY : 0;
+    frame.Buffer = nullptr;     // The packet has the reference now.
+
+    if (frame.KeyFrame) {
+      _waitingForKeyframe = false;
+    }
+
+    auto firstPacketTime = frame.FirstPacketTime;
+    Finish(frame);
+    _stats.FramesOut++;
+
+    onFrame(_packet, firstPacketTime);
+    av_packet_unref(_packet);
+
+    return true;
+  }
+
+  /**
+  * Copies the fragments of a frame whose packets arrived out of order into a
+  * new buffer in sequence number order.
+  */
+  bool Vp8Depacketizer::Reorder(FrameAssembly& frame)
+  {
+    AVBufferRef* ordered = av_buffer_pool_get(_pool);
+    if (ordered == NULL) {
+      return false;
+    }
+
+    uint16_t start = frame.StartSeqNum;
+    std::sort(frame.Fragments.begin(), frame.Fragments.end(), [start](const Fragment& a, const Fragment& b) {
+      return (uint16_t)(a.SeqNum - start) < (uint16_t)(b.SeqNum - start);
+    });
+
+    size_t posn = 0;
+    for (auto& fragment : frame.Fragments) {
+      memcpy(ordered->data + posn, frame.Buffer->data + fragment.Offset, fragment.Length);
+      fragment.Offset = posn;
+      posn += fragment.Length;
+    }
+
+    av_buffer_unref(&frame.Buffer);
+    frame.Buffer = ordered;
+    _stats.FramesReordered++;
+
+    return true;
+  }
+
+  /**
+  * Records a frame as done with, output or not, so its late packets are
+  * recognised, and frees its slot.
+  */
+  void Vp8Depacketizer::Finish(FrameAssembly& frame)
+  {
+    uint16_t last = frame.HaveEnd ? frame.EndSeqNum : frame.FirstSeqNum;
+    for (auto& fragment : frame.Fragments) {
+      if (SeqNumBefore(last, fragment.SeqNum)) {
+        last = fragment.SeqNum;
+      }
+    }
+
+    if (!_haveLastSeqNum || SeqNumBefore(_lastSeqNum, last)) {
+      _lastSeqNum = last;
+      _lastTimestamp = frame.Timestamp;
+      _haveLastSeqNum = true;
+    }
+
+    Release(frame);
+  }
+
+  void Vp8Depacketizer::Release(FrameAssembly& frame)
+  {
+    av_buffer_unref(&frame.Buffer);
+    frame.Fragments.clear();
+    frame.InUse = false;
+  }
+
+  void Vp8Depacketizer::Drop(FrameAssembly& frame)
+  {
+    _stats.FramesDropped++;
+    _waitingForKeyframe = true;
+    Finish(frame);
+  }
+}
@@ -0,0 +1,169 @@
+//-----------------------------------------------------------------------------
+// Filename: vp8depacketizer.h
+//
+// Description: Reassembles VP8 frames from RTP packets, RFC 7741. Packets are
+// grouped into frames by RTP timestamp and a frame is complete once it has
+// the packet starting partition 0, the packet with the marker bit and every
+// sequence number in between.
+//
+// The RTP timestamp rather than the PictureID identifies a frame. Every
+// packet of a frame carries the frame's timestamp, while the PictureID is an
+// optional descriptor field that some senders leave out and that wraps at 7
+// bits when it's short.
+//
+// Each packet's payload is appended to its frame's buffer as it arrives, so
+// in the usual case of packets arriving in order the buffer is the frame and
+// nothing more is copied. Frames whose packets arrived out of order are put
+// back in sequence number order into a second buffer when they complete. The
+// buffers come from an AVBufferPool and are handed on as the packet's buf, a
+// decoder holding a frame for reference or threading returns the buffer to
+// the pool when it's done with it.
+//
+// Frames are output in order. A complete frame waits for any earlier frame
+// still being assembled, up to VP8_DEPACKETIZER_MAX_FRAMES in progress. When
+// an incomplete frame has to make way it's dropped and nothing more is output
+// until a keyframe, the frames that follow a loss can't be decoded without
+// the missing one. NeedsKeyframe says when the sender should be asked for one.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_VP8DEPACKETIZER_H
+#define SIPSORCERY_VP8DEPACKETIZER_H
+
+#include "rtpsender.h"
+#include "vp8rtp.h"
+
+extern "C"
+{
+#include <libavcodec\avcodec.h>
+#include <libavutil\buffer.h>
+}
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#define VP8_DEPACKETIZER_MAX_FRAMES 4                   // Frames in progress, enough to ride out reordering across frame boundaries.
+#define VP8_DEPACKETIZER_BUFFER_SIZE (256 * 1024)       // Initial frame buffer size, doubled when a frame doesn't fit.
+
+namespace sipsorcery
+{
+  struct Vp8DepacketizerStats
+  {
+    uint64_t PacketsIn;
+    uint64_t InvalidPackets;     // Not RTP or a bad VP8 payload descriptor.
+    uint64_t DuplicatePackets;
+    uint64_t LatePackets;        // For a frame already output or dropped.
+    uint64_t FramesOut;
+    uint64_t FramesReordered;    // Complete frames that needed their packets putting back in order.
+    uint64_t FramesDropped;      // Incomplete when they had to make way, or overtaken by a keyframe.
+    uint64_t FramesSkipped;      // Complete but after a loss and waiting for a keyframe.
+    uint64_t BufferGrowths;
+  };
+
+  /**
+  * Called with each frame in decode order. The packet's buf is the pooled
+  * frame buffer, pts and dts are the RTP timestamp. The packet is unreferenced
+  * when the callback returns, to keep it use av_packet_ref or av_packet_move_ref.
+  * @param[in] firstPacketTime: when the first packet of the frame arrived.
+  */
+  typedef std::function<void(AVPacket* pkt, std::chrono::steady_clock::time_point firstPacketTime)> Vp8FrameReadyCallback;
+
+  class Vp8Depacketizer
+  {
+  public:
+    /**
+    * @param[in] bufferSize: the initial size of the pooled frame buffers.
+    */
+    Vp8Depacketizer(int bufferSize = VP8_DEPACKETIZER_BUFFER_SIZE);
+    ~Vp8Depacketizer();
+
+    Vp8Depacketizer(const Vp8Depacketizer&) = delete;
+    Vp8Depacketizer& operator=(const Vp8Depacketizer&) = delete;
+
+    /**
+    * Adds a received RTP packet and outputs any frames it completes. Not
+    * thread safe, one thread, normally the receive thread, pushes packets.
+    * @param[in] packet: the RTP packet, header included.
+    * @param[in] length: the length of the packet.
+    * @param[in] receivedTime: when the packet arrived.
+    * @param[in] onFrame: callback for each frame that's ready.
+    * @@Returns the number of frames output or -1 if the packet was invalid.
+    */
+    int Push(const uint8_t* packet, size_t length, std::chrono::steady_clock::time_point receivedTime,
+      Vp8FrameReadyCallback onFrame);
+
+    /**
+    * Discards the frames in progress and waits for a keyframe, e.g. when the
+    * consumer has had to drop a frame.
+    */
+    void Reset();
+
+    /**
+    * True from a frame being lost until the next keyframe is output.
+    */
+    bool NeedsKeyframe() const { return _waitingForKeyframe; }
+
+    Vp8DepacketizerStats GetStats() const { return _stats; }
+
+  private:
+    struct Fragment
+    {
+      uint16_t SeqNum;
+      size_t Offset;
+      size_t Length;
+    };
+
+    struct FrameAssembly
+    {
+      bool InUse;
+      uint32_t Timestamp;
+      AVBufferRef* Buffer;
+      size_t Length;
+      std::vector<Fragment> Fragments;
+      bool HaveStart;
+      uint16_t StartSeqNum;
+      bool HaveEnd;
+      uint16_t EndSeqNum;
+      uint16_t FirstSeqNum;          // The lowest sequence number received, orders the frames in progress.
+      bool KeyFrame;
+      std::chrono::steady_clock::time_point FirstPacketTime;
+    };
+
+    AVBufferPool* _pool{ nullptr };
+    int _bufferSize;
+    AVPacket* _packet{ nullptr };
+    FrameAssembly _frames[VP8_DEPACKETIZER_MAX_FRAMES];
+
+    bool _haveSsrc{ false };
+    uint32_t _ssrc{ 0 };
+    bool _haveLastSeqNum{ false };
+    uint16_t _lastSeqNum{ 0 };       // The last sequence number of the last frame output or dropped.
+    uint32_t _lastTimestamp{ 0 };
+    bool _waitingForKeyframe{ true };
+
+    Vp8DepacketizerStats _stats{ 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    FrameAssembly* GetAssembly(uint32_t timestamp, uint16_t seqNum, std::chrono::steady_clock::time_point receivedTime,
+      Vp8FrameReadyCallback& onFrame, int& framesOut);
+    bool Append(FrameAssembly& frame, uint16_t seqNum, const uint8_t* data, size_t length);
+    bool IsComplete(const FrameAssembly& frame) const;
+    FrameAssembly* GetOldest();
+    int Output(Vp8FrameReadyCallback& onFrame);
+    bool Emit(FrameAssembly& frame, Vp8FrameReadyCallback& onFrame);
+    bool Reorder(FrameAssembly& frame);
+    void Finish(FrameAssembly& frame);
+    void Release(FrameAssembly& frame);
+    void Drop(FrameAssembly& frame);
+  };
+}
+
+#endif // SIPSORCERY_VP8DEPACKETIZER_H
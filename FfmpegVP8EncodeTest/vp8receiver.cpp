@@ -0,0 +1,323 @@
+#include "vp8receiver.h"
+#include "encoderbench.h"
+#include "videoencoder.h"
+#include "vp8rtp.h"
+
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define VP8_DECODE_BENCH_CLIP_FRAMES 30
+#define VP8_DECODE_BENCH_ENCODER_THREADS 4
+#define VP8_RECEIVER_RTP_CLOCK_RATE 90000
+
+namespace sipsorcery
+{
+  static const char* _histogramNames[(int)Vp8ReceiveHistogram::Count] =
+  {
+    "assemble", "queue wait", "decode", "end to end"
+  };
+
+  static const int _decodeBenchThreads[] = { 1, 2, 4, 8 };
+
+  Vp8Receiver::Vp8Receiver(int listenPort, int decodeThreads, int threadType, KeyframeRequestCallback onKeyframeRequest,
+    FrameDecodedCallback onFrame) :
+    _listenPort(listenPort), _onKeyframeRequest(onKeyframeRequest), _onFrame(onFrame),
+    _socket(listenPort),
+    _decoder(AV_CODEC_ID_VP8, decodeThreads, threadType),
+    _packetPool(VP8_RECEIVER_PACKET_POOL_SIZE),
+    _queue(VP8_RECEIVER_QUEUE_CAPACITY, QueueDropPolicy::DropNewest)
+  {
+    _socket.SetRtpPacketCallback([this](const uint8_t* packet, int length, std::chrono::steady_clock::time_point receivedTime) {
+      OnRtpPacket(packet, length, receivedTime);
+    });
+  }
+
+  Vp8Receiver::~Vp8Receiver()
+  {
+    Stop();
+  }
+
+  void Vp8Receiver::Start()
+  {
+    _stopped = false;
+    _decodeThread.reset(new std::thread(&Vp8Receiver::Decode, this));
+    _socket.Start();
+  }
+
+  void Vp8Receiver::Stop()
+  {
+    _socket.Close();
+    _stopped.store(true, std::memory_order_release);
+
+    if (_decodeThread != nullptr && _decodeThread->joinable()) {
+      _decodeThread->join();
+    }
+  }
+
+  void Vp8Receiver::OnRtpPacket(const uint8_t* packet, int length, std::chrono::steady_clock::time_point receivedTime)
+  {
+    _depacketizer.Push(packet, length, receivedTime, [this](AVPacket* pkt, std::chrono::steady_clock::time_point firstPacketTime) {
+      OnFrame(pkt, firstPacketTime);
+    });
+
+    if (_depacketizer.NeedsKeyframe() || _skipToKeyframe) {
+      RequestKeyframe();
+    }
+  }
+
+  /**
+  * Called on the receive thread with each reassembled frame. The queue gets
+  * a reference to the depacketizer's buffer, not a copy.
+  */
+  void Vp8Receiver::OnFrame(AVPacket* pkt, std::chrono::steady_clock::time_point firstPacketTime)
+  {
+    if (_skipToKeyframe) {
+      if (!(pkt->flags & AV_PKT_FLAG_KEY)) {
+        return;
+      }
+      _skipToKeyframe = false;
+    }
+
+    AVPacket* ref = _packetPool.Get();
+    if (av_packet_ref(ref, pkt) < 0) {
+      _packetPool.Return(ref);
+      _skipToKeyframe = true;
+      return;
+    }
+
+    QueuedFrame queued{ ref, firstPacketTime, std::chrono::steady_clock::now() };
+    if (_queue.Push(queued, [this](const QueuedFrame& dropped) { _packetPool.Return(dropped.Packet); })) {
+      _framesQueued++;
+    }
+    else {
+      // The frames after this one reference it.
+      _skipToKeyframe = true;
+    }
+  }
+
+  void Vp8Receiver::RequestKeyframe()
+  {
+    auto now = std::chrono::steady_clock::now();
+
+    if (_keyframeRequests == 0 || now - _lastKeyframeRequest >= std::chrono::milliseconds(VP8_RECEIVER_KEYFRAME_REQUEST_MS)) {
+      _lastKeyframeRequest = now;
+      _keyframeRequests++;
+      if (_onKeyframeRequest != nullptr) {
+        _onKeyframeRequest();
+      }
+    }
+  }
+
+  void Vp8Receiver::Decode()
+  {
+    QueuedFrame queued;
+
+    while (_queue.Pop(queued, _stopped)) {
+      auto decodeStartTime = std::chrono::steady_clock::now();
+      _histograms[(int)Vp8ReceiveHistogram::Assemble].Record(queued.CompleteTime - queued.FirstPacketTime);
+      _histograms[(int)Vp8ReceiveHistogram::QueueWait].Record(decodeStartTime - queued.CompleteTime);
+
+      _inFlight.push_back(InFlightFrame{ queued.Packet->pts, queued.FirstPacketTime });
+      int res = _decoder.Decode(queued.Packet, [this](AVFrame* frame) { OnDecodedFrame(frame); });
+      _packetPool.Return(queued.Packet);
+
+      _histograms[(int)Vp8ReceiveHistogram::Decode].Record(std::chrono::steady_clock::now() - decodeStartTime);
+
+      if (res < 0) {
+        _decodeErrors++;
+      }
+    }
+
+    _decoder.Flush([this](AVFrame* frame) { OnDecodedFrame(frame); });
+    _inFlight.clear();
+  }
+
+  /**
+  * Matches the frame to its packet by timestamp. VP8 has no reordering but
+  * not every packet produces a frame, alt-ref frames are never shown.
+  */
+  void Vp8Receiver::OnDecodedFrame(AVFrame* frame)
+  {
+    while (!_inFlight.empty() && _inFlight.front().Pts != frame->pts) {
+      _inFlight.pop_front();
+    }
+
+    if (!_inFlight.empty()) {
+      _histograms[(int)Vp8ReceiveHistogram::EndToEnd].Record(std::chrono::steady_clock::now() - _inFlight.front().FirstPacketTime);
+      _inFlight.pop_front();
+    }
+
+    _framesDecoded++;
+
+    if (_onFrame != nullptr) {
+      _onFrame(frame);
+    }
+  }
+
+  void Vp8Receiver::PrintStats()
+  {
+    Vp8DepacketizerStats depacketizer = _depacketizer.GetStats();
+    PoolStats surfaces = _decoder.GetSurfaceStats();
+
+    std::cout << "VP8 receiver " << _listenPort << ": packets " << depacketizer.PacketsIn
+      << ", invalid " << depacketizer.InvalidPackets
+      << ", duplicate " << depacketizer.DuplicatePackets
+      << ", late " << depacketizer.LatePackets
+      << ", frames " << depacketizer.FramesOut
+      << ", reordered " << depacketizer.FramesReordered
+      << ", dropped " << depacketizer.FramesDropped
+      << ", skipped " << depacketizer.FramesSkipped
+      << ", dropped at queue " << _queue.GetDroppedCount()
+      << ", decoded " << _framesDecoded
+      << ", decode errors " << _decodeErrors
+      << ", keyframe requests " << _keyframeRequests
+      << ", decoder surfaces allocated " << surfaces.Allocations << " for " << surfaces.Acquisitions << " frames." << std::endl;
+
+    LatencyHistogram::PrintHeader(std::cout);
+    for (int i = 0; i < (int)Vp8ReceiveHistogram::Count; i++) {
+      _histograms[i].Print(std::cout, _histogramNames[i]);
+    }
+  }
+
+  void RunVp8Receiver(int listenPort, int decodeThreads, int durationSeconds)
+  {
+    Vp8Receiver receiver(listenPort, decodeThreads, FF_THREAD_FRAME | FF_THREAD_SLICE,
+      []() { std::cout << "Keyframe needed." << std::endl; }, nullptr);
+
+    std::cout << "VP8 receiver listening on " << listenPort << " for " << durationSeconds << "s, "
+      << decodeThreads << " decode threads." << std::endl;
+
+    receiver.Start();
+    std::this_thread::sleep_for(std::chrono::seconds(durationSeconds));
+    receiver.Stop();
+
+    receiver.PrintStats();
+  }
+
+  /**
+  * Encodes the benchmark clip and packetizes it into datagrams as they would
+  * arrive off the network.
+  */
+  static std::vector<std::vector<uint8_t>> PacketizeBenchClip(int width, int height, int fps, int frameCount)
+  {
+    VideoEncoder encoder(AV_CODEC_ID_VP8, width, height, fps, EncoderPreset::Realtime, VP8_DECODE_BENCH_ENCODER_THREADS);
+    std::random_device rd;
+    Vp8RtpPayloader payloader(rd(), VP8_DEFAULT_PAYLOAD_TYPE, RTP_DEFAULT_MTU);
+
+    FramePool framePool(width, height, AV_PIX_FMT_YUV420P, VP8_DECODE_BENCH_CLIP_FRAMES);
+    std::vector<AVFrame*> clip;
+    for (int i = 0; i < VP8_DECODE_BENCH_CLIP_FRAMES; i++) {
+      clip.push_back(framePool.Get());
+      FillTestFrame(clip.back(), i);
+    }
+
+    std::vector<std::vector<uint8_t>> datagrams;
+    std::vector<RtpPacketBuffers> rtpPackets;
+
+    auto packetize = [&](AVPacket* pkt) {
+      payloader.Packetize(pkt->data, pkt->size, (uint32_t)(pkt->pts * VP8_RECEIVER_RTP_CLOCK_RATE / fps), 0, rtpPackets);
+      for (auto& rtpPacket : rtpPackets) {
+        std::vector<uint8_t> datagram;
+        datagram.reserve(rtpPacket.GetLength());
+        for (int i = 0; i < rtpPacket.Count; i++) {
+          datagram.insert(datagram.end(), rtpPacket.Buffers[i].Data, rtpPacket.Buffers[i].Data + rtpPacket.Buffers[i].Length);
+        }
+        datagrams.push_back(std::move(datagram));
+      }
+    };
+
+    for (int i = 0; i < frameCount; i++) {
+      AVFrame* frame = clip[i % VP8_DECODE_BENCH_CLIP_FRAMES];
+      frame->pts = i;
+      encoder.Encode(frame, packetize);
+    }
+    encoder.Flush(packetize);
+
+    for (auto frame : clip) {
+      framePool.Return(frame);
+    }
+
+    return datagrams;
+  }
+
+  static void RunVp8DecodeBenchCase(const std::vector<std::vector<uint8_t>>& datagrams, int width, int height,
+    int threads, int threadType)
+  {
+    Vp8Depacketizer depacketizer;
+    VideoDecoder decoder(AV_CODEC_ID_VP8, threads, threadType);
+    int frames = 0;
+    int errors = 0;
+
+    auto countFrame = [&frames](AVFrame*) { frames++; };
+
+    auto start = std::chrono::steady_clock::now();
+    double cpuStart = GetProcessCpuSeconds();
+
+    for (auto& datagram : datagrams) {
+      depacketizer.Push(datagram.data(), datagram.size(), start, [&](AVPacket* pkt, std::chrono::steady_clock::time_point) {
+        if (decoder.Decode(pkt, countFrame) < 0) {
+          errors++;
+        }
+      });
+    }
+    decoder.Flush(countFrame);
+
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpuSeconds = GetProcessCpuSeconds() - cpuStart;
+    double cores = (wallSeconds > 0) ? cpuSeconds / wallSeconds : 0;
+    double fps = (wallSeconds > 0) ? frames / wallSeconds : 0;
+    PoolStats surfaces = decoder.GetSurfaceStats();
+
+    std::cout << "vp8 " << width << "x" << height << " " << ((threadType == FF_THREAD_FRAME) ? "frame" : "slice")
+      << " threads " << threads << std::fixed << std::setprecision(2)
+      << ", fps " << fps
+      << ", cpu s " << cpuSeconds << " (" << cores << " cores)"
+      << ", fps per core " << ((cpuSeconds > 0) ? frames / cpuSeconds : 0)
+      << ", frames " << frames << ", errors " << errors
+      << ", surfaces allocated " << surfaces.Allocations << "." << std::endl;
+  }
+
+  void RunVp8DecodeBenchmark(int width, int height, int fps, int frameCount)
+  {
+    std::cout << "Encoding " << frameCount << " frames of " << width << "x" << height << " VP8." << std::endl;
+    auto datagrams = PacketizeBenchClip(width, height, fps, frameCount);
+
+    size_t bytes = 0;
+    for (auto& datagram : datagrams) {
+      bytes += datagram.size();
+    }
+
+    // Reassembly on its own, to show what it adds to the decode.
+    Vp8Depacketizer depacketizer;
+    int frames = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto& datagram : datagrams) {
+      depacketizer.Push(datagram.data(), datagram.size(), start, [&frames](AVPacket*, std::chrono::steady_clock::time_point) { frames++; });
+    }
+    double depacketizeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Vp8DepacketizerStats stats = depacketizer.GetStats();
+
+    std::cout << datagrams.size() << " RTP packets, " << bytes / 1024 << " KB, " << frames << " frames reassembled in "
+      << std::fixed << std::setprecision(2) << depacketizeSeconds * 1000 << "ms, "
+      << ((frames > 0) ? depacketizeSeconds * 1e6 / frames : 0) << "us per frame, "
+      << stats.BufferGrowths << " buffer growths." << std::endl;
+
+    for (int threadType : { FF_THREAD_FRAME, FF_THREAD_SLICE }) {
+      for (int threads : _decodeBenchThreads) {
+        if (threadType == FF_THREAD_SLICE && threads == 1) {
+          continue;     // The same as one frame thread.
+        }
+
+        try {
+          RunVp8DecodeBenchCase(datagrams, width, height, threads, threadType);
+        }
+        catch (std::exception& excp) {
+          std::cerr << "vp8 decode threads " << threads << " error: " << excp.what() << std::endl;
+        }
+      }
+    }
+  }
+}
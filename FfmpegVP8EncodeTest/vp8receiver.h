@@ -0,0 +1,162 @@
+//-----------------------------------------------------------------------------
+// Filename: vp8receiver.h
+//
+// Description: Receives and decodes VP8 over RTP, RFC 7741. The packets come
+// in on the same MjpegReceiver RtpSocket the MJPEG gateway uses, packets that
+// aren't JPEG are passed through raw, so both codecs share one receive path.
+// Two threads:
+//
+//  receive: the socket's thread reassembles frames with a Vp8Depacketizer
+//           into pooled buffers and queues a reference to each.
+//  decode: decodes into the VideoDecoder's pooled surfaces. The decoder
+//          can use frame threading, where each frame goes to its own
+//          thread and several decode at once, or slice threading across
+//          the VP8 token partitions.
+//
+// If the decode thread falls behind, the queue drops the newest frame and
+// the frames after it are skipped until a keyframe, the same as a loss on
+// the network. Either way the keyframe request callback is called, no more
+// than once every VP8_RECEIVER_KEYFRAME_REQUEST_MS, for the application to
+// send a PLI.
+//
+// A test source is the rtp mode of this program pointed at the listen port.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_VP8RECEIVER_H
+#define SIPSORCERY_VP8RECEIVER_H
+
+#include "boundedqueue.h"
+#include "framepool.h"
+#include "latencyhistogram.h"
+#include "rtpsocket.h"
+#include "videodecoder.h"
+#include "vp8depacketizer.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#define VP8_RECEIVER_QUEUE_CAPACITY 8
+#define VP8_RECEIVER_PACKET_POOL_SIZE (VP8_RECEIVER_QUEUE_CAPACITY + 2)
+#define VP8_RECEIVER_KEYFRAME_REQUEST_MS 500
+
+namespace sipsorcery
+{
+  enum class Vp8ReceiveHistogram
+  {
+    Assemble,
+    QueueWait,
+    Decode,
+    EndToEnd,
+    Count
+  };
+
+  class Vp8Receiver
+  {
+  public:
+    typedef std::function<void()> KeyframeRequestCallback;
+    typedef std::function<void(AVFrame*)> FrameDecodedCallback;
+
+    /**
+    * @param[in] listenPort: the loopback UDP port to receive the VP8 RTP stream on.
+    * @param[in] decodeThreads: the number of decoder threads, 0 for one per core.
+    * @param[in] threadType: FF_THREAD_FRAME, FF_THREAD_SLICE or both.
+    * @param[in] onKeyframeRequest: called on the receive thread when a keyframe
+    *  is needed. Optional.
+    * @param[in] onFrame: called on the decode thread with each decoded frame,
+    *  which is only valid for the call. Optional.
+    * Throws std::runtime_error if the decoder cannot be opened.
+    */
+    Vp8Receiver(int listenPort, int decodeThreads, int threadType, KeyframeRequestCallback onKeyframeRequest,
+      FrameDecodedCallback onFrame);
+    ~Vp8Receiver();
+
+    Vp8Receiver(const Vp8Receiver&) = delete;
+    Vp8Receiver& operator=(const Vp8Receiver&) = delete;
+
+    void Start();
+
+    /**
+    * Stops receiving, then lets the decode thread finish what is queued.
+    */
+    void Stop();
+
+    void PrintStats();
+
+    const LatencyHistogram& GetHistogram(Vp8ReceiveHistogram histogram) const { return _histograms[(int)histogram]; }
+
+  private:
+    struct QueuedFrame
+    {
+      AVPacket* Packet;
+      std::chrono::steady_clock::time_point FirstPacketTime;
+      std::chrono::steady_clock::time_point CompleteTime;
+    };
+
+    // Copied from the queued frame, its packet goes back to the pool as soon
+    // as the decoder has it.
+    struct InFlightFrame
+    {
+      int64_t Pts;
+      std::chrono::steady_clock::time_point FirstPacketTime;
+    };
+
+    int _listenPort;
+    KeyframeRequestCallback _onKeyframeRequest;
+    FrameDecodedCallback _onFrame;
+
+    RtpSocket _socket;
+    Vp8Depacketizer _depacketizer;
+    VideoDecoder _decoder;
+    PacketPool _packetPool;
+    BoundedQueue<QueuedFrame> _queue;
+
+    std::unique_ptr<std::thread> _decodeThread;
+    std::atomic<bool> _stopped{ false };
+    bool _skipToKeyframe{ false };
+    std::chrono::steady_clock::time_point _lastKeyframeRequest;
+    uint64_t _keyframeRequests{ 0 };
+    std::atomic<uint64_t> _framesQueued{ 0 };
+    uint64_t _framesDecoded{ 0 };
+    uint64_t _decodeErrors{ 0 };
+
+    // Decode thread only, frame threading returns frames a few packets after they went in.
+    std::deque<InFlightFrame> _inFlight;
+
+    LatencyHistogram _histograms[(int)Vp8ReceiveHistogram::Count];
+
+    void OnRtpPacket(const uint8_t* packet, int length, std::chrono::steady_clock::time_point receivedTime);
+    void OnFrame(AVPacket* pkt, std::chrono::steady_clock::time_point firstPacketTime);
+    void RequestKeyframe();
+    void Decode();
+    void OnDecodedFrame(AVFrame* frame);
+  };
+
+  /**
+  * Receives a VP8 stream on listenPort for durationSeconds and prints the
+  * receive and decode statistics.
+  */
+  void RunVp8Receiver(int listenPort, int decodeThreads, int durationSeconds);
+
+  /**
+  * Encodes a width x height realtime VP8 clip, packetizes it and then
+  * depacketizes and decodes it as fast as possible with frame and slice
+  * threading at a range of thread counts. Reports decoded frames per second
+  * and per core, the cores being the process CPU time over the wall time.
+  */
+  void RunVp8DecodeBenchmark(int width, int height, int fps, int frameCount);
+}
+
+#endif // SIPSORCERY_VP8RECEIVER_H
@@ -0,0 +1,382 @@
+#include "vp8rtp.h"
+
+#include <algorithm>
+
+#define VP8_FRAME_TAG_LENGTH 3
+#define VP8_KEYFRAME_HEADER_LENGTH 10     // Frame tag, start code and dimensions.
+#define VP8_PARTITION_SIZE_LENGTH 3
+
+namespace sipsorcery
+{
+  /**
+  * Boolean entropy decoder from RFC 6386 section 7.3. Only used to skip over
+  * the start of the frame header, reads past the end return zeros.
+  */
+  class Vp8BoolDecoder
+  {
+  public:
+    Vp8BoolDecoder(const uint8_t* data, size_t length) :
+      _input(data), _end(data + length)
+    {
+      _value = (ReadByte() << 8) | ReadByte();
+    }
+
+    int ReadBool(int probability)
+    {
+      uint32_t split = 1 + (((_range - 1) * probability) >> 8);
+      uint32_t bigSplit = split << 8;
+      int bit;
+
+      if (_value >= bigSplit) {
+        bit = 1;
+        _range -= split;
+        _value -= bigSplit;
+      }
+      else {
+        bit = 0;
+        _range = split;
+      }
+
+      while (_range < 128) {
+        _value <<= 1;
+        _range <<= 1;
+        if (++_bitCount == 8) {
+          _bitCount = 0;
+          _value |= ReadByte();
+        }
+      }
+
+      return bit;
+    }
+
+    uint32_t ReadLiteral(int bits)
+    {
+      uint32_t v = 0;
+      while (bits-- > 0) {
+        v = (v << 1) | ReadBool(128);
+      }
+      return v;
+    }
+
+    /**
+    * Reads an optional signed value, a flag followed by the magnitude and sign.
+    */
+    void SkipOptionalSigned(int bits)
+    {
+      if (ReadLiteral(1)) {
+        ReadLiteral(bits + 1);
+      }
+    }
+
+  private:
+    const uint8_t* _input;
+    const uint8_t* _end;
+    uint32_t _range{ 255 };
+    uint32_t _value{ 0 };
+    int _bitCount{ 0 };
+
+    uint32_t ReadByte()
+    {
+      return (_input < _end) ? *_input++ : 0;
+    }
+  };
+
+  bool ParseVp8Frame(const uint8_t* data, size_t length, Vp8FrameInfo& info)
+  {
+    if (length < VP8_FRAME_TAG_LENGTH) {
+      return false;
+    }
+
+    uint32_t tag = data[0] | (data[1] << 8) | (data[2] << 16);
+    info.KeyFrame = (tag & 0x01) == 0;
+    info.ShowFrame = ((tag >> 4) & 0x01) == 1;
+    size_t firstPartitionSize = (tag >> 5) & 0x7ffff;
+
+    size_t headerLength = VP8_FRAME_TAG_LENGTH;
+    if (info.KeyFrame) {
+      if (length < VP8_KEYFRAME_HEADER_LENGTH || data[3] != 0x9d || data[4] != 0x01 || data[5] != 0x2a) {
+        return false;
+      }
+      headerLength = VP8_KEYFRAME_HEADER_LENGTH;
+    }
+
+    if (headerLength + firstPartitionSize > length) {
+      return false;
+    }
+
+    // Frame header fields up to the partition count, RFC 6386 section 19.2.
+    Vp8BoolDecoder bd(data + headerLength, firstPartitionSize);
+
+    if (info.KeyFrame) {
+      bd.ReadLiteral(1);    // color_space
+      bd.ReadLiteral(1);    // clamping_type
+    }
+
+    if (bd.ReadLiteral(1)) {    // segmentation_enabled
+      bool updateMap = bd.ReadLiteral(1) == 1;
+      bool updateData = bd.ReadLiteral(1) == 1;
+
+      if (updateData) {
+        bd.ReadLiteral(1);    // segment_feature_mode
+        for (int i = 0; i < 4; i++) {
+          bd.SkipOptionalSigned(7);   // quantizer
+        }
+        for (int i = 0; i < 4; i++) {
+          bd.SkipOptionalSigned(6);   // loop filter
+        }
+      }
+
+      if (updateMap) {
+        for (int i = 0; i < 3; i++) {
+          if (bd.ReadLiteral(1)) {
+            bd.ReadLiteral(8);    // segment_prob
+          }
+        }
+      }
+    }
+
+    bd.ReadLiteral(1);    // filter_type
+    bd.ReadLiteral(6);    // loop_filter_level
+    bd.ReadLiteral(3);    // sharpness_level
+
+    if (bd.ReadLiteral(1)) {    // loop_filter_adj_enable
+      if (bd.ReadLiteral(1)) {    // mode_ref_lf_delta_update
+        for (int i = 0; i < 8; i++) {
+          bd.SkipOptionalSigned(6);   // ref_frame and mb_mode deltas
+        }
+      }
+    }
+
+    int tokenPartitions = 1 << bd.ReadLiteral(2);
+
+    // The token partition sizes follow the first partition, 3 bytes little
+    // endian for all but the last which takes the rest of the frame.
+    size_t sizesStart = headerLength + firstPartitionSize;
+    size_t posn = sizesStart + (tokenPartitions - 1) * VP8_PARTITION_SIZE_LENGTH;
+    if (posn > length) {
+      return false;
+    }
+
+    info.PartitionCount = tokenPartitions + 1;
+    info.PartitionStart[0] = 0;
+    info.PartitionLength[0] = posn;
+
+    for (int i = 0; i < tokenPartitions; i++) {
+      size_t partitionLength = length - posn;
+      if (i < tokenPartitions - 1) {
+        const uint8_t* sz = data + sizesStart + i * VP8_PARTITION_SIZE_LENGTH;
+        partitionLength = sz[0] | (sz[1] << 8) | (sz[2] << 16);
+        if (posn + partitionLength > length) {
+          return false;
+        }
+      }
+
+      info.PartitionStart[i + 1] = posn;
+      info.PartitionLength[i + 1] = partitionLength;
+      posn += partitionLength;
+    }
+
+    return true;
+  }
+
+  bool ParseVp8RtpDescriptor(const uint8_t* payload, size_t length, Vp8RtpDescriptor& desc)
+  {
+    if (length < 1) {
+      return false;
+    }
+
+    desc.NonReference = (payload[0] & 0x20) != 0;
+    desc.StartOfPartition = (payload[0] & 0x10) != 0;
+    desc.PartitionID = payload[0] & 0x07;
+    desc.PictureID = -1;
+    desc.TL0PicIdx = -1;
+    desc.TemporalLayer = -1;
+    desc.LayerSync = false;
+    desc.KeyIdx = -1;
+
+    size_t posn = 1;
+
+    if (payload[0] & 0x80) {
+      if (length < 2) {
+        return false;
+      }
+
+      uint8_t x = payload[posn++];
+
+      if (x & 0x80) {   // I
+        if (posn >= length) {
+          return false;
+        }
+        else if (payload[posn] & 0x80) {
+          if (posn + 2 > length) {
+            return false;
+          }
+          desc.PictureID = ((payload[posn] & 0x7f) << 8) | payload[posn + 1];
+          posn += 2;
+        }
+        else {
+          desc.PictureID = payload[posn++];
+        }
+      }
+
+      if (x & 0x40) {   // L
+        if (posn >= length) {
+          return false;
+        }
+        desc.TL0PicIdx = payload[posn++];
+      }
+
+      if (x & 0x30) {   // T or K
+        if (posn >= length) {
+          return false;
+        }
+        if (x & 0x20) {
+          desc.TemporalLayer = payload[posn] >> 6;
+          desc.LayerSync = (payload[posn] & 0x20) != 0;
+        }
+        if (x & 0x10) {
+          desc.KeyIdx = payload[posn] & 0x1f;
+        }
+        posn++;
+      }
+    }
+
+    desc.Length = posn;
+    return true;
+  }
+
+  Vp8RtpPayloader::Vp8RtpPayloader(uint32_t ssrc, uint8_t payloadType, int mtu, uint16_t initialSeqNum, uint16_t initialPictureID) :
+    _ssrc(ssrc), _payloadType(payloadType),
+    _maxPayload(std::max(1, mtu - RTP_HEADER_LENGTH - VP8_RTP_DESCRIPTOR_LENGTH)),
+    _seqNum(initialSeqNum),
+    _pictureID(initialPictureID & 0x7fff)
+  { }
+
+  /**
+  * Works out the payload of each packet. Consecutive partitions share a
+  * packet while they fit, a partition that doesn't fit in an empty packet is
+  * split into the fewest evenly sized pieces that do.
+  */
+  void Vp8RtpPayloader::BuildFragments(const Vp8FrameInfo& info)
+  {
+    _fragments.clear();
+
+    for (int i = 0; i < info.PartitionCount; i++) {
+      size_t start = info.PartitionStart[i];
+      size_t length = info.PartitionLength[i];
+
+      if (length == 0) {
+        continue;
+      }
+
+      if (!_fragments.empty() && _fragments.back().Length + length <= _maxPayload) {
+        // The partitions are contiguous so the packet payload stays one range.
+        _fragments.back().Length += length;
+        continue;
+      }
+
+      size_t pieces = (length + _maxPayload - 1) / _maxPayload;
+      size_t pieceLength = (length + pieces - 1) / pieces;
+
+      for (size_t offset = 0; offset < length; offset += pieceLength) {
+        _fragments.push_back(Fragment{ start + offset, std::min(pieceLength, length - offset), i, offset == 0 });
+      }
+    }
+  }
+
+  int Vp8RtpPayloader::Packetize(const uint8_t* data, size_t length, uint32_t timestamp, int temporalLayer,
+    std::vector<RtpPacketBuffers>& packets, bool layerSync, bool nonReference)
+  {
+    packets.clear();
+
+    Vp8FrameInfo info;
+    if (!ParseVp8Frame(data, length, info)) {
+      // Not something we can find the partitions in, send it as a single partition.
+      info.PartitionCount = 1;
+      info.PartitionStart[0] = 0;
+      info.PartitionLength[0] = length;
+    }
+
+    BuildFragments(info);
+
+    // Size the slab before taking pointers into it.
+    const size_t slotLength = RTP_HEADER_LENGTH + VP8_RTP_DESCRIPTOR_LENGTH;
+    if (_headerSlab.size() < _fragments.size() * slotLength) {
+      _headerSlab.resize(_fragments.size() * slotLength);
+    }
+
+    StartFrame(temporalLayer);
+
+    for (size_t i = 0; i < _fragments.size(); i++) {
+      const Fragment& fragment = _fragments[i];
+      uint8_t* hdr = _headerSlab.data() + i * slotLength;
+
+      WriteHeaders(hdr, i == _fragments.size() - 1, timestamp, fragment, temporalLayer, layerSync, nonReference);
+
+      RtpPacketBuffers packet;
+      packet.Count = 2;
+      packet.Buffers[0] = RtpIoVec{ hdr, slotLength };
+      packet.Buffers[1] = RtpIoVec{ data + fragment.Start, fragment.Length };
+      packets.push_back(packet);
+    }
+
+    return (int)packets.size();
+  }
+
+  int Vp8RtpPayloader::PacketizePartition(const uint8_t* data, size_t length, int partitionIndex, bool lastPartition,
+    uint32_t timestamp, int temporalLayer, std::vector<RtpPacketBuffers>& packets, bool layerSync, bool nonReference)
+  {
+    packets.clear();
+
+    if (partitionIndex == 0) {
+      StartFrame(temporalLayer);
+    }
+
+    size_t pieces = std::max<size_t>(1, (length + _maxPayload - 1) / _maxPayload);
+    size_t pieceLength = (length + pieces - 1) / pieces;
+
+    const size_t slotLength = RTP_HEADER_LENGTH + VP8_RTP_DESCRIPTOR_LENGTH;
+    if (_headerSlab.size() < pieces * slotLength) {
+      _headerSlab.resize(pieces * slotLength);
+    }
+
+    for (size_t i = 0; i < pieces; i++) {
+      size_t offset = i * pieceLength;
+      Fragment fragment{ offset, std::min(pieceLength, length - offset), partitionIndex, i == 0 };
+      uint8_t* hdr = _headerSlab.data() + i * slotLength;
+
+      WriteHeaders(hdr, lastPartition && i == pieces - 1, timestamp, fragment, temporalLayer, layerSync, nonReference);
+
+      RtpPacketBuffers packet;
+      packet.Count = 2;
+      packet.Buffers[0] = RtpIoVec{ hdr, slotLength };
+      packet.Buffers[1] = RtpIoVec{ data + fragment.Start, fragment.Length };
+      packets.push_back(packet);
+    }
+
+    return (int)packets.size();
+  }
+
+  void Vp8RtpPayloader::StartFrame(int temporalLayer)
+  {
+    _pictureID = (_pictureID + 1) & 0x7fff;
+    if (temporalLayer == 0) {
+      _tl0PicIdx++;
+    }
+  }
+
+  void Vp8RtpPayloader::WriteHeaders(uint8_t* hdr, bool marker, uint32_t timestamp, const Fragment& fragment,
+    int temporalLayer, bool layerSync, bool nonReference)
+  {
+    WriteRtpHeader(hdr, marker, _payloadType, _seqNum++, timestamp, _ssrc);
+
+    uint8_t* desc = hdr + RTP_HEADER_LENGTH;
+    desc[0] = 0x80 | (nonReference ? 0x20 : 0x00) | (fragment.PartitionStart ? 0x10 : 0x00) |
+      (std::min(fragment.PartitionIndex, 7) & 0x07);   // X, N, S, PID
+    desc[1] = 0xe0;   // I, L and T, the TL0PICIDX can only be sent along with the TID.
+    desc[2] = 0x80 | ((_pictureID >> 8) & 0x7f);    // M, 15 bit PictureID.
+    desc[3] = _pictureID & 0xff;
+    desc[4] = _tl0PicIdx;
+    desc[5] = ((temporalLayer & 0x03) << 6) | (layerSync ? 0x20 : 0x00);   // TID, Y
+  }
+}
@@ -0,0 +1,188 @@
+//-----------------------------------------------------------------------------
+// Filename: vp8rtp.h
+//
+// Description: RTP payloader for VP8 as specified in RFC 7741:
+// https://tools.ietf.org/html/rfc7741.
+//
+// Encoded frames are split at VP8 partition boundaries. Small partitions are
+// packed together and a partition that is bigger than the MTU is split into
+// evenly sized pieces. Each packet gets a header slab holding the RTP header
+// and the VP8 payload descriptor, the payload itself is left where the
+// encoder put it and referenced from the packet's buffer list.
+//
+//  VP8 payload descriptor as written, 6 bytes:
+//
+//       0 1 2 3 4 5 6 7
+//      +-+-+-+-+-+-+-+-+
+//      |X|R|N|S|R| PID | (REQUIRED)
+//      +-+-+-+-+-+-+-+-+
+//   X: |I|L|T|K| RSV   | (OPTIONAL)
+//      +-+-+-+-+-+-+-+-+
+//   I: |M| PictureID   | (OPTIONAL)
+//      +-+-+-+-+-+-+-+-+
+//      |   PictureID   |
+//      +-+-+-+-+-+-+-+-+
+//   L: |   TL0PICIDX   | (OPTIONAL)
+//      +-+-+-+-+-+-+-+-+
+//   T/K:|TID|Y| KEYIDX | (OPTIONAL)
+//      +-+-+-+-+-+-+-+-+
+//
+// With temporal layers the TID says which layer a frame is in and TL0PICIDX
+// counts layer 0 frames, a relay can drop the upper layers for a viewer by
+// looking at the descriptor alone and the receiver can still tell whether
+// it has missed a frame it needs. Frames in a layer that nothing references
+// have the N bit set, they can be dropped without affecting any other frame.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_VP8RTP_H
+#define SIPSORCERY_VP8RTP_H
+
+#include "rtpsender.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define VP8_RTP_DESCRIPTOR_LENGTH 6
+#define VP8_MAX_PARTITIONS 9          // The first partition plus up to 8 DCT token partitions.
+#define VP8_DEFAULT_PAYLOAD_TYPE 96
+
+namespace sipsorcery
+{
+  /**
+  * The layout of an encoded VP8 frame, from the uncompressed frame tag and
+  * the start of the first partition's header.
+  */
+  struct Vp8FrameInfo
+  {
+    bool KeyFrame;
+    bool ShowFrame;
+    int PartitionCount;
+    size_t PartitionStart[VP8_MAX_PARTITIONS];    // The first partition starts at 0 and includes the frame tag and size table.
+    size_t PartitionLength[VP8_MAX_PARTITIONS];
+  };
+
+  /**
+  * Works out where the partitions in an encoded VP8 frame are. The number of
+  * DCT partitions is coded in the first partition's header so it is read with
+  * a minimal boolean decoder, RFC 6386 sections 7 and 9.
+  * @@Returns true if the frame could be parsed.
+  */
+  bool ParseVp8Frame(const uint8_t* data, size_t length, Vp8FrameInfo& info);
+
+  /**
+  * The fields of a received VP8 payload descriptor. Optional fields that
+  * were not present are -1.
+  */
+  struct Vp8RtpDescriptor
+  {
+    bool NonReference;
+    bool StartOfPartition;
+    int PartitionID;
+    int PictureID;
+    int TL0PicIdx;
+    int TemporalLayer;
+    bool LayerSync;
+    int KeyIdx;
+    size_t Length;        // The length of the descriptor, the VP8 payload follows it.
+  };
+
+  /**
+  * Reads the payload descriptor from the start of a VP8 RTP payload.
+  * @param[in] payload: the RTP payload, after the RTP header.
+  * @param[in] length: the length of the payload.
+  * @param[out] desc: the descriptor fields.
+  * @@Returns false if the payload is too short for the descriptor it claims to have.
+  */
+  bool ParseVp8RtpDescriptor(const uint8_t* payload, size_t length, Vp8RtpDescriptor& desc);
+
+  class Vp8RtpPayloader
+  {
+  public:
+    /**
+    * @param[in] ssrc: the RTP synchronisation source.
+    * @param[in] payloadType: the dynamic RTP payload type negotiated for VP8.
+    * @param[in] mtu: the maximum size of an RTP packet, header included.
+    * @param[in] initialSeqNum: the first RTP sequence number, normally random.
+    * @param[in] initialPictureID: the first 15 bit PictureID, normally random.
+    */
+    Vp8RtpPayloader(uint32_t ssrc, uint8_t payloadType = VP8_DEFAULT_PAYLOAD_TYPE, int mtu = RTP_DEFAULT_MTU,
+      uint16_t initialSeqNum = 0, uint16_t initialPictureID = 0);
+
+    /**
+    * Splits an encoded frame into RTP packets. The packets reference the
+    * frame data and this payloader's header slab, both must stay unchanged
+    * until the packets are sent. The next call reuses the header slab.
+    * @param[in] data: the encoded VP8 frame.
+    * @param[in] length: the length of the encoded frame.
+    * @param[in] timestamp: the 90kHz RTP timestamp for the frame.
+    * @param[in] temporalLayer: the temporal layer of the frame, 0 if temporal
+    *  layers aren't in use.
+    * @param[out] packets: the packets for the frame, replaces any previous contents.
+    * @param[in] layerSync: true if the frame only references layer 0 frames.
+    * @param[in] nonReference: true if no other frame references this one.
+    * @@Returns the number of packets.
+    */
+    int Packetize(const uint8_t* data, size_t length, uint32_t timestamp, int temporalLayer,
+      std::vector<RtpPacketBuffers>& packets, bool layerSync = false, bool nonReference = false);
+
+    /**
+    * Packetizes one partition of a frame, for sending partitions as they are
+    * handed out rather than waiting for the whole frame. Partitions don't
+    * share packets, unlike Packetize, as the next one may not be available
+    * yet. The packets reference the partition data and this payloader's
+    * header slab, they must be sent before the next call.
+    * @param[in] data: the partition.
+    * @param[in] length: the length of the partition.
+    * @param[in] partitionIndex: the partition's index in the frame, 0 starts a new frame.
+    * @param[in] lastPartition: true for the frame's last partition, its last packet gets the marker.
+    * @param[in] timestamp: the 90kHz RTP timestamp for the frame.
+    * @param[in] temporalLayer: the temporal layer of the frame, 0 if temporal
+    *  layers aren't in use.
+    * @param[out] packets: the packets for the partition, replaces any previous contents.
+    * @param[in] layerSync: true if the frame only references layer 0 frames.
+    * @param[in] nonReference: true if no other frame references this one.
+    * @@Returns the number of packets.
+    */
+    int PacketizePartition(const uint8_t* data, size_t length, int partitionIndex, bool lastPartition, uint32_t timestamp,
+      int temporalLayer, std::vector<RtpPacketBuffers>& packets, bool layerSync = false, bool nonReference = false);
+
+    uint16_t GetSequenceNumber() const { return _seqNum; }
+    uint16_t GetPictureID() const { return _pictureID; }
+    uint8_t GetTL0PicIdx() const { return _tl0PicIdx; }
+
+  private:
+    struct Fragment
+    {
+      size_t Start;
+      size_t Length;
+      int PartitionIndex;
+      bool PartitionStart;
+    };
+
+    uint32_t _ssrc;
+    uint8_t _payloadType;
+    size_t _maxPayload;
+    uint16_t _seqNum;
+    uint16_t _pictureID;
+    uint8_t _tl0PicIdx{ 0 };
+    std::vector<uint8_t> _headerSlab;
+    std::vector<Fragment> _fragments;
+
+    void BuildFragments(const Vp8FrameInfo& info);
+    void StartFrame(int temporalLayer);
+    void WriteHeaders(uint8_t* hdr, bool marker, uint32_t timestamp, const Fragment& fragment, int temporalLayer, bool layerSync,
+      bool nonReference);
+  };
+}
+
+#endif // SIPSORCERY_VP8RTP_H
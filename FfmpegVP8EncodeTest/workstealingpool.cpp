@@ -0,0 +1,167 @@
+#include "workstealingpool.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace sipsorcery
+{
+  // Identifies which pool, if any, the current thread is a worker for.
+  static thread_local const WorkStealingPool* _currentPool = nullptr;
+  static thread_local int _currentWorkerIndex = -1;
+
+  WorkStealingPool::WorkStealingPool(int threadCount)
+  {
+    if (threadCount <= 0) {
+      threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+
+    for (int i = 0; i < threadCount; i++) {
+      _queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+
+    for (int i = 0; i < threadCount; i++) {
+      _threads.push_back(std::thread(&WorkStealingPool::WorkerLoop, this, i));
+    }
+  }
+
+  WorkStealingPool::~WorkStealingPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_idleMutex);
+      _stop = true;
+    }
+    _idleCondition.notify_all();
+
+    for (auto& thread : _threads) {
+      thread.join();
+    }
+  }
+
+  void WorkStealingPool::Submit(Task task)
+  {
+    Push(std::move(task), false);
+  }
+
+  void WorkStealingPool::SubmitFair(Task task)
+  {
+    Push(std::move(task), true);
+  }
+
+  void WorkStealingPool::Push(Task task, bool front)
+  {
+    int index = GetCurrentWorkerIndex();
+    if (index < 0) {
+      index = _nextQueue++ % _queues.size();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_queues[index]->Mutex);
+      if (front) {
+        _queues[index]->Tasks.push_front(std::move(task));
+      }
+      else {
+        _queues[index]->Tasks.push_back(std::move(task));
+      }
+    }
+
+    {
+      // Incrementing under the idle lock means a worker can't check the count
+      // and go to sleep between the increment and the notify.
+      std::lock_guard<std::mutex> lock(_idleMutex);
+      _pending++;
+    }
+    _idleCondition.notify_one();
+  }
+
+  void WorkStealingPool::WorkerLoop(int index)
+  {
+    _currentPool = this;
+    _currentWorkerIndex = index;
+
+    while (true) {
+      Task task;
+
+      if (TryPop(index, task) || TrySteal(index, task)) {
+        _pending--;
+
+        try {
+          task();
+        }
+        catch (std::exception& excp) {
+          std::cerr << "Exception in work stealing pool task. " << excp.what() << std::endl;
+        }
+
+        _executed++;
+      }
+      else if (_pending > 0) {
+        // Another worker has taken the task and not yet counted it, give it
+        // the core rather than spinning through the queues again.
+        std::this_thread::yield();
+      }
+      else {
+        std::unique_lock<std::mutex> lock(_idleMutex);
+        _idleCondition.wait(lock, [this] { return _stop || _pending > 0; });
+
+        if (_stop) {
+          break;
+        }
+      }
+    }
+  }
+
+  bool WorkStealingPool::TryPop(int index, Task& task)
+  {
+    auto& queue = *_queues[index];
+    std::lock_guard<std::mutex> lock(queue.Mutex);
+
+    if (queue.Tasks.empty()) {
+      return false;
+    }
+
+    task = std::move(queue.Tasks.back());
+    queue.Tasks.pop_back();
+    return true;
+  }
+
+  bool WorkStealingPool::TrySteal(int index, Task& task)
+  {
+    bool contended = false;
+
+    for (size_t i = 1; i < _queues.size(); i++) {
+      auto& victim = *_queues[(index + i) % _queues.size()];
+
+      // Don't wait on a queue another thread is using, move on to the next one.
+      std::unique_lock<std::mutex> lock(victim.Mutex, std::try_to_lock);
+      if (!lock.owns_lock()) {
+        contended = true;
+      }
+      else if (!victim.Tasks.empty()) {
+        task = std::move(victim.Tasks.front());
+        victim.Tasks.pop_front();
+        _steals++;
+        return true;
+      }
+    }
+
+    // The task may be in a queue that was locked, wait for the locks this time
+    // rather than going round again straight away.
+    for (size_t i = 1; contended && i < _queues.size(); i++) {
+      auto& victim = *_queues[(index + i) % _queues.size()];
+
+      std::lock_guard<std::mutex> lock(victim.Mutex);
+      if (!victim.Tasks.empty()) {
+        task = std::move(victim.Tasks.front());
+        victim.Tasks.pop_front();
+        _steals++;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  int WorkStealingPool::GetCurrentWorkerIndex() const
+  {
+    return (_currentPool == this) ? _currentWorkerIndex : -1;
+  }
+}
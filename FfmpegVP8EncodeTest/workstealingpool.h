@@ -0,0 +1,88 @@
+//-----------------------------------------------------------------------------
+// Filename: workstealingpool.h
+//
+// Description: Fixed size thread pool where each worker has its own task
+// queue. Workers take their own most recently queued task first and, when
+// their queue is empty, steal the oldest task from another worker. Tasks
+// submitted from outside the pool are spread round robin across the queues.
+//
+// Author(s):
+// Aaron Clauson (aaron@sipsorcery.com)
+//
+// History:
+// 17 Oct 2026  Aaron Clauson	  Created, Dublin, Ireland.
+//
+// License:
+// Creative Commons Zero v1.0 Universal, see included LICENSE file.
+//-----------------------------------------------------------------------------
+
+#ifndef SIPSORCERY_WORKSTEALINGPOOL_H
+#define SIPSORCERY_WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sipsorcery
+{
+  class WorkStealingPool
+  {
+  public:
+    typedef std::function<void()> Task;
+
+    /**
+    * @param[in] threadCount: the number of worker threads, 0 for one per core.
+    */
+    explicit WorkStealingPool(int threadCount = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /**
+    * Queues a task. Called from a worker the task goes on that worker's own
+    * queue, otherwise the queues are used in turn.
+    */
+    void Submit(Task task);
+
+    /**
+    * Queues a task behind everything already waiting on the worker. Used by
+    * tasks that reschedule themselves so they don't starve other work.
+    */
+    void SubmitFair(Task task);
+
+    int GetThreadCount() const { return (int)_threads.size(); }
+    uint64_t GetStealCount() const { return _steals.load(); }
+    uint64_t GetExecutedCount() const { return _executed.load(); }
+
+  private:
+    struct WorkerQueue
+    {
+      std::mutex Mutex;
+      std::deque<Task> Tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> _queues;
+    std::vector<std::thread> _threads;
+    std::mutex _idleMutex;
+    std::condition_variable _idleCondition;
+    std::atomic<bool> _stop{ false };
+    std::atomic<int64_t> _pending{ 0 };
+    std::atomic<uint32_t> _nextQueue{ 0 };
+    std::atomic<uint64_t> _steals{ 0 };
+    std::atomic<uint64_t> _executed{ 0 };
+
+    void Push(Task task, bool front);
+    void WorkerLoop(int index);
+    bool TryPop(int index, Task& task);
+    bool TrySteal(int index, Task& task);
+    int GetCurrentWorkerIndex() const;
+  };
+}
+
+#endif // SIPSORCERY_WORKSTEALINGPOOL_H
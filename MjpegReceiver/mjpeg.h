@@ -567,7 +567,7 @@ namespace sipsorcery
          * order, identical to the format used in a JFIF DQT
          * marker segment. */
         // bytestream2_put_buffer(&pbc, qtable + 64 * i, 64);
-        std::copy(qtable, qtable + 64, std::back_inserter(buf));
+        std::copy(qtable + 64 * i, qtable + 64 * (i + 1), std::back_inserter(buf));
       }
 
       /* DHT */
@@ -75,6 +75,16 @@ namespace sipsorcery
     _cb = cb;
   }
 
+  void RtpSocket::SetJpegFrameReadyCallback(JpegFrameReadyCallback cb)
+  {
+    _jpegCb = cb;
+  }
+
+  void RtpSocket::SetRtpPacketCallback(RtpPacketCallback cb)
+  {
+    _rtpCb = cb;
+  }
+
   void RtpSocket::Receive()
   {
     std::vector<uint8_t> recvBuffer(RECEIVE_BUFFER_SIZE);
@@ -84,6 +94,8 @@ namespace sipsorcery
     struct fd_set fds;
     std::vector<uint8_t> frame;
     int frameCounter = 0;
+    std::chrono::steady_clock::time_point frameStartTime;
+    uint8_t defaultQTables[128];
 
     while (!_closed)
     {
@@ -127,6 +139,10 @@ namespace sipsorcery
           int lastError = WSAGetLastError();
           std::cerr << "recvfrom failed with error " << lastError << "." << std::endl;
         }
+        else if (_rtpCb != nullptr && bytesRead > 1 && (recvBuffer[1] & 0x7f) != RTP_JPEG_PAYLOAD_TYPE)
+        {
+          _rtpCb(recvBuffer.data(), bytesRead, std::chrono::steady_clock::now());
+        }
         else if(bytesRead > RtpHeader::RTP_MINIMUM_HEADER_LENGTH)
         {
          /* rtp_hdr* rtpHeader = (rtp_hdr*)&RecvBuf;*/
@@ -134,13 +150,26 @@ namespace sipsorcery
           RtpHeader rtpHeader;
           int rtpHdrLen = rtpHeader.Deserialise(recvBuffer, 0);
           JpegRtpHeader jpegHeader;
-          int jpegHdrLen = jpegHeader.Deserialise(recvBuffer, RtpHeader::RTP_MINIMUM_HEADER_LENGTH);
+          int jpegHdrLen = 0;
+
+          try {
+            jpegHdrLen = jpegHeader.Deserialise(recvBuffer, RtpHeader::RTP_MINIMUM_HEADER_LENGTH);
+          }
+          catch (std::exception& excp) {
+            std::cerr << "Discarding RTP JPEG packet. " << excp.what() << std::endl;
+            frame.clear();
+            continue;
+          }
 
-          std::cout << "rtp version " << (int)rtpHeader.Version << ", marker " << (int)rtpHeader.MarkerBit << ", ssrc " << rtpHeader.SyncSource << 
-            ", timestamp " << rtpHeader.Timestamp << ", seqnum " << rtpHeader.SeqNum << ", payload length " << payloadLength << 
-            ", jpeg offset " << jpegHeader.Offset << ", Q " << (int)jpegHeader.Q << ", width " << jpegHeader.Width * 8 << 
-            ", height " << jpegHeader.Height * 8 << ", Q table length " << jpegHeader.Length << "." << std::endl;
-          std::cout << "Q Table: " << toHex(jpegHeader.QTable) << std::endl;
+          bool verbose = (_jpegCb == nullptr);
+
+          if (verbose) {
+            std::cout << "rtp version " << (int)rtpHeader.Version << ", marker " << (int)rtpHeader.MarkerBit << ", ssrc " << rtpHeader.SyncSource << 
+              ", timestamp " << rtpHeader.Timestamp << ", seqnum " << rtpHeader.SeqNum << ", payload length " << payloadLength << 
+              ", jpeg offset " << jpegHeader.Offset << ", Q " << (int)jpegHeader.Q << ", width " << jpegHeader.Width * 8 << 
+              ", height " << jpegHeader.Height * 8 << ", Q table length " << jpegHeader.Length << "." << std::endl;
+            std::cout << "Q Table: " << toHex(jpegHeader.QTable) << std::endl;
+          }
 
           //std::vector<uint8_t> buffer(&RecvBuf[0], &RecvBuf[iResult]);
           //buffer.insert(buffer.begin(), dataVec2.begin(), dataVec2.end());
@@ -149,19 +178,30 @@ namespace sipsorcery
 
           if (jpegHeader.Offset == 0) {
             frame.clear();
+            frameStartTime = std::chrono::steady_clock::now();
 
             // Add the JFIF header at the top of the frame.
             sipsorcery::Jfif jfif;
-            jfif.jpeg_create_header(frame, jpegHeader.Type, jpegHeader.Width, jpegHeader.Height, jpegHeader.QTable.data(), 1, 0);
+            const uint8_t* qtable = jpegHeader.QTable.data();
+            int qtableCount = (jpegHeader.QTable.size() >= 128) ? 2 : 1;
+            if (jpegHeader.QTable.empty()) {
+              // Q below 128 selects the RFC 2435 luma and chroma tables scaled by Q rather than sending them.
+              jfif.create_default_qtables(defaultQTables, jpegHeader.Q);
+              qtable = defaultQTables;
+              qtableCount = 2;
+            }
+            jfif.jpeg_create_header(frame, jpegHeader.Type, jpegHeader.Width, jpegHeader.Height, qtable, qtableCount, 0);
           }
 
           int hdrLen = rtpHdrLen + jpegHdrLen;
           int payloadLen = bytesRead - hdrLen;
           if (payloadLen > 0) {
             std::copy(recvBuffer.begin() + hdrLen, recvBuffer.begin() + bytesRead, std::back_inserter(frame));
-            std::cout << payloadLen << " bytes written to frame." << std::endl;
+            if (verbose) {
+              std::cout << payloadLen << " bytes written to frame." << std::endl;
+            }
           }
-          else {
+          else if (verbose) {
             std::cout << "No payload bytes in RTP packet." << std::endl;
           }
 
@@ -170,6 +210,13 @@ namespace sipsorcery
             // Need to write the jpeg end of data tag.
             sipsorcery::Jfif::jpeg_put_marker(frame, sipsorcery::Jfif::JpegMarker::EOI);
 
+            if (_jpegCb != nullptr) {
+              _jpegCb(frame, rtpHeader.Timestamp, frameStartTime);
+              frame.clear();
+              frameCounter++;
+              continue;
+            }
+
             // This is the last packet in the JPEG frame.
             std::cout << "frame ready total length " << frame.size() << "." << std::endl;
 
@@ -198,7 +245,7 @@ namespace sipsorcery
   {
     _closed = true;
 
-    if (_receiveThread != nullptr)
+    if (_receiveThread != nullptr && _receiveThread->joinable())
     {
       _receiveThread->join();
     }
@@ -19,6 +19,10 @@
 #include "mjpeg.h"
 #include "strutils.h"
 
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <iphlpapi.h>
@@ -33,15 +37,47 @@
 #include <vector>
 
 #define RECEIVE_TIMEOUT_MILLISECONDS 70
+#define RTP_JPEG_PAYLOAD_TYPE 26       // Static payload type from RFC 3551.
 
 namespace sipsorcery
 {
+  /**
+  * Called with each complete JPEG frame, JFIF header and EOI marker included.
+  * The callee can swap the contents out of the vector instead of copying it,
+  * the socket only needs the vector back empty.
+  * @param[in] jpeg: the reassembled JPEG frame.
+  * @param[in] timestamp: the RTP timestamp of the frame.
+  * @param[in] firstPacketTime: when the frame's first packet was received.
+  */
+  typedef std::function<void(std::vector<uint8_t>& jpeg, uint32_t timestamp,
+    std::chrono::steady_clock::time_point firstPacketTime)> JpegFrameReadyCallback;
+
+  /**
+  * Called with each received RTP packet that isn't JPEG, header included, so
+  * other payload formats can share the socket. The packet is only valid for
+  * the duration of the call.
+  */
+  typedef std::function<void(const uint8_t* packet, int length,
+    std::chrono::steady_clock::time_point receivedTime)> RtpPacketCallback;
+
   class RtpSocket
   {
   public:
     RtpSocket(int listenPort);
     ~RtpSocket();
     void SetBitmapReadyCallback(std::function<void(std::vector<uint8_t>&)> cb);
+
+    /**
+    * Hands complete frames to the callback instead of writing them to disk.
+    * The callback is called on the receive thread.
+    */
+    void SetJpegFrameReadyCallback(JpegFrameReadyCallback cb);
+
+    /**
+    * Hands packets with a payload type other than JPEG to the callback, on
+    * the receive thread. Without one they're parsed as JPEG.
+    */
+    void SetRtpPacketCallback(RtpPacketCallback cb);
     void Start();
     void Close();
 
@@ -53,6 +89,8 @@ namespace sipsorcery
     struct timeval _timeout;
     std::unique_ptr<std::thread> _receiveThread{ nullptr };
     std::function<void(std::vector<uint8_t>&)> _cb{ nullptr };
+    JpegFrameReadyCallback _jpegCb{ nullptr };
+    RtpPacketCallback _rtpCb{ nullptr };
 
     void Receive();
   };